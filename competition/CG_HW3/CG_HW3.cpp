@@ -1,12 +1,29 @@
 ﻿#include "camera.h"
+#include "deferred_renderer.h"
+#include "fbx_loader.h"
 #include "gui.h"
 #include "headers.h"
+#include "headless.h"
 #include "imagetexture.h"
+#include "instancing.h"
+#include "json_writer.h"
 #include "light.h"
+#include "lightmap.h"
+#include "memory_tracker.h"
+#include "path_tracer.h"
+#include "probe_grid.h"
+#include "profiler.h"
 #include "scene.h"
+#include "shader_variants.h"
 #include "shaderprog.h"
+#include "shadow.h"
+#include "shadow_atlas.h"
+#include "sky_ambient.h"
 #include "skybox.h"
+#include "software_rasterizer.h"
+#include "timing.h"
 #include "trianglemesh.h"
+#include "visibility_buffer.h"
 
 const std::string modelDirectory = "../TestModels_HW3/";
 const std::string skyboxDirectory = "../TestTextures_HW3/";
@@ -44,7 +61,24 @@ float zFar = 1000.0f;
 // Shader.
 FillColorShaderProg *fillColorShader = nullptr;
 PhongShadingDemoShaderProg *phongShadingShader = nullptr;
+// Specialized programs of phongShadingShader, picked per submesh.
+PhongVariants *phongVariants = nullptr;
+// Deferred path of the opaque pass: the G-buffer pass and the lighting
+// passes, both built from phong_shading_demo.fs.
+PhongShadingDemoShaderProg *gbufferShader = nullptr;
+DeferredLightShaderProg *deferredLightShader = nullptr;
+DeferredRenderer *deferredRenderer = nullptr;
+// Visibility-buffer path of the opaque pass: the visibility pass, the
+// material and scene depth passes, and the resolve built from
+// phong_shading_demo.fs.
+VisibilityShaderProg *visibilityShader = nullptr;
+VisibilityDepthShaderProg *visibilityDepthShader = nullptr;
+VisibilityResolveShaderProg *visibilityResolveShader = nullptr;
+VisibilityBuffer *visibilityBuffer = nullptr;
 SkyboxShaderProg *skyboxShader = nullptr;
+SkyboxCubeShaderProg *skyboxCubeShader = nullptr;
+ShadowDepthShaderProg *shadowDepthShader = nullptr;
+ShadowAtlasDepthShaderProg *atlasDepthShader = nullptr;
 bool isBlingPhong = true;
 // Light control.
 bool showDirLightArrow = true;
@@ -55,10 +89,70 @@ bool onDirLight = true;
 bool onAmbientLight = true;
 bool onDiffuseLight = true;
 bool onSpecularLight = true;
+bool onShadow = true;
+// Shadow.
+CascadedShadowMap *shadowMap = nullptr;
+const int shadowTextureUnit = 2;
+ShadowAtlas *shadowAtlas = nullptr;
+const int shadowAtlasTextureUnit = 3;
+// Lightmaps.
+const int lightmapTextureUnit = 4;
+bool useLightmaps = true;
+std::string lightmapScenePath;
+LightmapBakeSettings lightmapSettings;
+LightmapBakeStats lightmapStats;
+// Irradiance probes for the objects without a lightmap.
+const int probeTextureUnit = 5;
+ProbeGrid *probeGrid = nullptr;
+ProbeGridSettings probeSettings;
+bool useProbes = true;
+// Re-bake the probes an edit dirtied at the start of the next frame.
+bool autoRebakeProbes = true;
+// Instanced draws of the objects sharing a mesh.
+InstanceBatcher *instanceBatcher = nullptr;
+bool useInstancing = true;
+// Mesh of the copies spawned by the Instancing panel or --instances.
+TriangleMesh *instanceMesh = nullptr;
+int spawnedGrids = 0;
+// Node edited in the Scene Graph panel.
+int selectedNode = -1;
 // UI.
 const float lightMoveSpeed = 0.2f;
 // Skybox.
 Skybox *skybox = nullptr;
+// Directional ambient from the skybox; kept across skybox switches.
+SkyAmbient *skyAmbient = nullptr;
+// Camera path recording (F5), replayed by --headless --camera-path.
+const std::string cameraPathFile = "camera_path.txt";
+CameraPath recordedPath;
+bool isRecordingPath = false;
+double recordStartTime = 0.0;
+// Mouse picking (left click) through Scene::RayCast.
+RayHit pickedHit;
+glm::vec3 pickedPosition = glm::vec3(0.0f);
+double pickMs = 0.0;
+RayCastBenchmark rayBenchmark;
+
+// Progressive path tracing in the viewer, at half the window resolution.
+PathTracer *pathTracer = nullptr;
+bool pathTracerEnabled = false;
+GLuint pathTraceTexture = 0;
+std::vector<unsigned char> pathTracePixels;
+// Accumulation restarts when any of these change.
+glm::mat4x4 pathTraceView = glm::mat4x4(1.0f);
+glm::mat4x4 pathTraceRootTransform = glm::mat4x4(1.0f);
+bool pathTraceBlinnPhong = true;
+
+// GPU-resident mode: loaded meshes and textures drop their CPU copies, which
+// the CPU renderers and bakers read back from disk when they start.
+bool gpuResident = false;
+CpuReleaseStats cpuReleaseStats;
+// glfwGetTime of the last bake that read the CPU copies back, -1 if none
+// since they were freed. They are freed again once the CPU jobs have been
+// idle for a while, so a drag that re-bakes the probes every frame reads
+// them back only once.
+double lastCpuJobTime = -1.0;
+const double kCpuJobIdleSeconds = 2.0;
 
 Scene *scene = nullptr;
 
@@ -68,14 +162,72 @@ void ReleaseResources();
 void RenderSceneCB();
 void ReshapeCB(GLFWwindow, int, int);
 void ProcessKeysCB(GLFWwindow, int, int, int, int);
+void MouseButtonCB(GLFWwindow *, int, int, int);
 void SetupRenderState();
 void LoadObjects(const std::string &);
 void CreateCamera();
 void CreateSkybox(const std::string);
 void CreateShaderLib();
+void CreateShadowMap();
 void CreateScene();
+glm::mat4x4 ComputeRootTransform();
+
+// Deletes the programs CreateShaderLib made.
+void DeleteShaderLib() {
+  if (fillColorShader != nullptr) {
+    delete fillColorShader;
+    fillColorShader = nullptr;
+  }
+  if (phongVariants != nullptr) {
+    delete phongVariants;
+    phongVariants = nullptr;
+  }
+  if (phongShadingShader != nullptr) {
+    delete phongShadingShader;
+    phongShadingShader = nullptr;
+  }
+  if (gbufferShader != nullptr) {
+    delete gbufferShader;
+    gbufferShader = nullptr;
+  }
+  if (deferredLightShader != nullptr) {
+    delete deferredLightShader;
+    deferredLightShader = nullptr;
+  }
+  if (visibilityShader != nullptr) {
+    delete visibilityShader;
+    visibilityShader = nullptr;
+  }
+  if (visibilityDepthShader != nullptr) {
+    delete visibilityDepthShader;
+    visibilityDepthShader = nullptr;
+  }
+  if (visibilityResolveShader != nullptr) {
+    delete visibilityResolveShader;
+    visibilityResolveShader = nullptr;
+  }
+  if (skyboxShader != nullptr) {
+    delete skyboxShader;
+    skyboxShader = nullptr;
+  }
+  if (skyboxCubeShader != nullptr) {
+    delete skyboxCubeShader;
+    skyboxCubeShader = nullptr;
+  }
+  if (shadowDepthShader != nullptr) {
+    delete shadowDepthShader;
+    shadowDepthShader = nullptr;
+  }
+  if (atlasDepthShader != nullptr) {
+    delete atlasDepthShader;
+    atlasDepthShader = nullptr;
+  }
+}
 
 void ReleaseResources() {
+#if PROFILER_ENABLED
+  Profiler::Get().ReleaseGpuResources();
+#endif
   // Delete scene objects and lights.
   if (pointLight != nullptr) {
     delete pointLight;
@@ -94,18 +246,56 @@ void ReleaseResources() {
     delete camera;
     camera = nullptr;
   }
-  // Delete shaders.
-  if (fillColorShader != nullptr) {
-    delete fillColorShader;
-    fillColorShader = nullptr;
+  DeleteShaderLib();
+  // Delete shadow maps.
+  if (shadowMap != nullptr) {
+    delete shadowMap;
+    shadowMap = nullptr;
   }
-  if (phongShadingShader != nullptr) {
-    delete phongShadingShader;
-    phongShadingShader = nullptr;
+  if (shadowAtlas != nullptr) {
+    delete shadowAtlas;
+    shadowAtlas = nullptr;
   }
-  if (skyboxShader != nullptr) {
-    delete skyboxShader;
-    skyboxShader = nullptr;
+  // Delete the path tracer.
+  if (pathTracer != nullptr) {
+    delete pathTracer;
+    pathTracer = nullptr;
+  }
+  if (pathTraceTexture != 0) {
+    glDeleteTextures(1, &pathTraceTexture);
+    pathTraceTexture = 0;
+  }
+  // Delete the sky ambient.
+  if (skyAmbient != nullptr) {
+    delete skyAmbient;
+    skyAmbient = nullptr;
+  }
+  // Delete the instance buffer.
+  if (instanceBatcher != nullptr) {
+    delete instanceBatcher;
+    instanceBatcher = nullptr;
+  }
+  // Delete the G-buffer.
+  if (deferredRenderer != nullptr) {
+    delete deferredRenderer;
+    deferredRenderer = nullptr;
+  }
+  // Delete the visibility buffer and the merged geometry.
+  if (visibilityBuffer != nullptr) {
+    delete visibilityBuffer;
+    visibilityBuffer = nullptr;
+  }
+  // Delete the probe grid.
+  if (probeGrid != nullptr) {
+    delete probeGrid;
+    probeGrid = nullptr;
+  }
+  // Delete the lightmaps (their textures).
+  if (scene != nullptr) {
+    for (SceneObject &sceneObj : scene->objects) {
+      delete sceneObj.lightmap;
+      sceneObj.lightmap = nullptr;
+    }
   }
 }
 
@@ -113,6 +303,7 @@ static float curObjRotationY = 0.0f;
 static float curObjRotationX = 0.0f;
 
 static float skyboxRotation = 0.0f;
+static glm::mat4x4 lastRootTransform = glm::mat4x4(1.0f);
 // 新增輔助函數
 void UploadDirectionalLights(PhongShadingDemoShaderProg *shader,
                              const std::vector<DirectionalLight *> &dirLights) {
@@ -122,6 +313,8 @@ void UploadDirectionalLights(PhongShadingDemoShaderProg *shader,
                  glm::value_ptr(dirLights[i]->GetDirection()));
     glUniform3fv(shader->dirLightLocations[i].radiance, 1,
                  glm::value_ptr(dirLights[i]->GetIntensity()));
+    glUniform1i(shader->dirLightLocations[i].isStatic,
+                dirLights[i]->IsStatic());
   }
 }
 
@@ -142,6 +335,8 @@ void UploadPointLights(PhongShadingDemoShaderProg *shader,
                 pointLights[i]->GetQuadratic());
     glUniform1f(shader->pointLightLocations[i].decayStart,
                 pointLights[i]->GetDecayStart());
+    glUniform1i(shader->pointLightLocations[i].isStatic,
+                pointLights[i]->IsStatic());
   }
 }
 
@@ -167,6 +362,8 @@ void UploadSpotLights(PhongShadingDemoShaderProg *shader,
                 spotLights[i]->GetQuadratic());
     glUniform1f(shader->spotLightLocations[i].decayStart,
                 spotLights[i]->GetDecayStart());
+    glUniform1i(shader->spotLightLocations[i].isStatic,
+                spotLights[i]->IsStatic());
   }
 }
 
@@ -193,66 +390,309 @@ void UploadAreaLights(PhongShadingDemoShaderProg *shader,
                 areaLights[i]->GetQuadratic());
     glUniform1f(shader->areaLightLocations[i].decayStart,
                 areaLights[i]->GetDecayStart());
+    glUniform1i(shader->areaLightLocations[i].isStatic,
+                areaLights[i]->IsStatic());
   }
 }
 
-void RenderSceneCB() {
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  // Render a triangle mesh with Phong shading.
-  Camera *camera = scene->camera;
-
-  phongShadingShader->Bind();
-
+// Phong-shaded scene objects.
+// Uniforms and textures shared by the draws of a frame. Every program the
+// opaque pass binds needs them, the shader variants included.
+void SetupPhongFrame(PhongShadingDemoShaderProg *shader, Camera *camera,
+                     const glm::mat4x4 &rootTransform,
+                     const bool probesReady) {
   // 上傳環境光
-  glUniform3fv(phongShadingShader->GetLocAmbientLight(), 1,
+  glUniform3fv(shader->GetLocAmbientLight(), 1,
                glm::value_ptr(scene->ambientLight));
 
   // 上傳各類光源
-  UploadDirectionalLights(phongShadingShader, scene->dirLights);
-  UploadPointLights(phongShadingShader, scene->pointLights);
-  UploadSpotLights(phongShadingShader, scene->spotLights);
-  UploadAreaLights(phongShadingShader, scene->areaLights);
+  UploadDirectionalLights(shader, scene->dirLights);
+  UploadPointLights(shader, scene->pointLights);
+  UploadSpotLights(shader, scene->spotLights);
+  UploadAreaLights(shader, scene->areaLights);
 
-  glUniformMatrix4fv(phongShadingShader->GetLocV(), 1, GL_FALSE,
+  glUniformMatrix4fv(shader->GetLocV(), 1, GL_FALSE,
                      glm::value_ptr(camera->GetViewMatrix()));
+  // The lights follow the root transform, as in the shadow map and atlas,
+  // not the object being drawn.
+  glUniformMatrix4fv(shader->GetLocLightWorld(), 1, GL_FALSE,
+                     glm::value_ptr(rootTransform));
+  glUniformMatrix4fv(
+      shader->GetLocViewProj(), 1, GL_FALSE,
+      glm::value_ptr(camera->GetProjMatrix() * camera->GetViewMatrix()));
+  glUniform1i(shader->GetLocUseInstancing(), 0);
 
   // 設置燈光開關
-  glUniform1i(phongShadingShader->GetLocIsBlingPhong(), isBlingPhong);
-  glUniform1i(phongShadingShader->GetLocOnAmbientLight(), onAmbientLight);
-  glUniform1i(phongShadingShader->GetLocOnDiffuseLight(), onDiffuseLight);
-  glUniform1i(phongShadingShader->GetLocOnSpecularLight(), onSpecularLight);
-
-  for (auto sceneObj : scene->objects) {
-    // Update transform.
-    glm::mat4x4 S =
-        glm::scale(glm::mat4x4(1.0f), glm::vec3(scale, scale, scale));
-    glm::mat4x4 RY = glm::rotate(
-        glm::mat4x4(1.0f), glm::radians(curObjRotationY), glm::vec3(0, 1, 0));
-    glm::mat4x4 RX = glm::rotate(
-        glm::mat4x4(1.0f), glm::radians(curObjRotationX), glm::vec3(1, 0, 0));
-    sceneObj.worldMatrix = S * RY * RX;
-    glm::mat4x4 normalMatrix = glm::transpose(
-        glm::inverse(camera->GetViewMatrix() * sceneObj.worldMatrix));
-    glm::mat4x4 MVP = camera->GetProjMatrix() * camera->GetViewMatrix() *
-                      sceneObj.worldMatrix;
-    glUniformMatrix4fv(phongShadingShader->GetLocM(), 1, GL_FALSE,
-                       glm::value_ptr(sceneObj.worldMatrix));
-    glUniformMatrix4fv(phongShadingShader->GetLocNM(), 1, GL_FALSE,
-                       glm::value_ptr(normalMatrix));
-    glUniformMatrix4fv(phongShadingShader->GetLocV(), 1, GL_FALSE,
-                       glm::value_ptr(camera->GetViewMatrix()));
-    glUniformMatrix4fv(phongShadingShader->GetLocMVP(), 1, GL_FALSE,
-                       glm::value_ptr(MVP));
-    sceneObj.mesh->draw(phongShadingShader);
-  }
-
-  phongShadingShader->UnBind();
+  glUniform1i(shader->GetLocIsBlingPhong(), isBlingPhong);
+  glUniform1i(shader->GetLocOnAmbientLight(), onAmbientLight);
+  glUniform1i(shader->GetLocOnDiffuseLight(), onDiffuseLight);
+  glUniform1i(shader->GetLocOnSpecularLight(), onSpecularLight);
+
+  // 陰影（即使關閉也要綁定，避免 shadowMap sampler 與 mapKd 共用 texture unit）
+  glUniform1i(shader->GetLocOnShadow(), onShadow);
+  shadowMap->Bind(shader, shadowTextureUnit);
+  shadowAtlas->Bind(shader, shadowAtlasTextureUnit);
+  glUniform1i(shader->GetLocLightmap(), lightmapTextureUnit);
+
+  // The probes were baked without the root transform.
+  glUniform1i(shader->GetLocProbeSH(), probeTextureUnit);
+  if (probesReady) {
+    probeGrid->Bind(GL_TEXTURE0 + probeTextureUnit);
+    const glm::ivec3 res = probeGrid->GetResolution();
+    glUniform3i(shader->GetLocProbeGridRes(), res.x, res.y, res.z);
+    const glm::mat4x4 toBakeSpace = glm::inverse(rootTransform);
+    const glm::mat4x4 gridMatrix = probeGrid->GetGridMatrix() * toBakeSpace;
+    const glm::mat3x3 probeNormalMatrix =
+        glm::mat3x3(toBakeSpace) *
+        glm::mat3x3(glm::inverse(camera->GetViewMatrix()));
+    glUniformMatrix4fv(shader->GetLocProbeGridMatrix(), 1, GL_FALSE,
+                       glm::value_ptr(gridMatrix));
+    glUniformMatrix3fv(shader->GetLocProbeNormalMatrix(), 1, GL_FALSE,
+                       glm::value_ptr(probeNormalMatrix));
+  }
+}
+
+// Uniforms and lightmap of an object drawn on its own.
+void SetupPhongObject(PhongShadingDemoShaderProg *shader, const int index,
+                      const bool probesReady) {
+  const SceneObject &sceneObj = scene->objects[index];
+  // Static lights come from the lightmap, if the object has one; the
+  // others take their ambient light from the probes.
+  Lightmap *lightmap = useLightmaps ? sceneObj.lightmap : nullptr;
+  glUniform1i(shader->GetLocUseLightmap(), lightmap != nullptr);
+  glUniform1i(shader->GetLocUseProbes(), probesReady && lightmap == nullptr);
+  if (lightmap != nullptr) {
+    if (!lightmap->IsUploaded()) {
+      lightmap->Upload();
+    }
+    lightmap->Bind(GL_TEXTURE0 + lightmapTextureUnit);
+  }
+  // Transforms come ready from the store; the shader applies the camera.
+  glUniformMatrix4fv(shader->GetLocM(), 1, GL_FALSE,
+                     glm::value_ptr(scene->transforms.GetWorld(index)));
+  glUniformMatrix3fv(shader->GetLocNM(), 1, GL_FALSE,
+                     glm::value_ptr(scene->transforms.GetNormal(index)));
+}
+
+// The opaque draws with the shader variant of each submesh. A program gets
+// the frame uniforms the first time it is bound, and the uniforms of the
+// current object (or of the instanced draws) whenever it is bound.
+void RenderOpaqueVariants(Camera *camera, const glm::mat4x4 &rootTransform,
+                          const bool probesReady) {
+  PhongVariantKey frameKey;
+  frameKey.blinnPhong = isBlingPhong;
+  frameKey.ambientLight = onAmbientLight;
+  frameKey.diffuseLight = onDiffuseLight;
+  frameKey.specularLight = onSpecularLight;
+  frameKey.numDirLights =
+      std::min((int)scene->dirLights.size(), MAX_DIR_LIGHTS);
+  frameKey.numPointLights =
+      std::min((int)scene->pointLights.size(), MAX_POINT_LIGHTS);
+  frameKey.numSpotLights =
+      std::min((int)scene->spotLights.size(), MAX_SPOT_LIGHTS);
+  frameKey.numAreaLights =
+      std::min((int)scene->areaLights.size(), MAX_AREA_LIGHTS);
+  const glm::mat4x4 viewProj =
+      camera->GetProjMatrix() * camera->GetViewMatrix();
+
+  phongVariants->BeginFrame();
+  std::vector<PhongShadingDemoShaderProg *> prepared;
+  PhongShadingDemoShaderProg *bound = nullptr;
+  // Object of the draws, -1 for the instanced ones.
+  int object = -1;
+  auto select = [&](const SubMesh &subMesh) {
+    PhongShadingDemoShaderProg *shader =
+        phongVariants->Get(frameKey.WithMaterial(subMesh.material));
+    if (shader == bound) {
+      return shader;
+    }
+    bound = shader;
+    shader->Bind();
+    phongVariants->SetTimedProgram(shader);
+    if (std::find(prepared.begin(), prepared.end(), shader) ==
+        prepared.end()) {
+      prepared.push_back(shader);
+      SetupPhongFrame(shader, camera, rootTransform, probesReady);
+    }
+    if (object < 0) {
+      glUniform1i(shader->GetLocUseInstancing(), 1);
+      glUniformMatrix4fv(shader->GetLocViewProj(), 1, GL_FALSE,
+                         glm::value_ptr(viewProj));
+      glUniform1i(shader->GetLocUseLightmap(), 0);
+      glUniform1i(shader->GetLocUseProbes(), probesReady);
+    } else {
+      glUniform1i(shader->GetLocUseInstancing(), 0);
+      SetupPhongObject(shader, object, probesReady);
+    }
+    return shader;
+  };
+
+  if (useInstancing) {
+    instanceBatcher->Draw(select);
+  }
+  // The next select rebinds, leaving the instanced uniforms.
+  bound = nullptr;
+  for (int i = 0; i < (int)scene->objects.size(); ++i) {
+    if (useInstancing && instanceBatcher->IsBatched(i)) {
+      continue;
+    }
+    object = i;
+    if (bound != nullptr) {
+      SetupPhongObject(bound, i, probesReady);
+    }
+    scene->objects[i].mesh->draw(select);
+  }
+  phongVariants->EndFrame();
+  if (bound != nullptr) {
+    bound->UnBind();
+  }
+}
+
+// The opaque draws with a single program, the uber shader or the G-buffer
+// pass.
+void DrawPhongObjects(PhongShadingDemoShaderProg *shader, Camera *camera,
+                      const glm::mat4x4 &rootTransform,
+                      const bool probesReady) {
+  shader->Bind();
+  SetupPhongFrame(shader, camera, rootTransform, probesReady);
+
+  // Objects sharing a mesh are drawn together, except for those with a
+  // lightmap.
+  if (useInstancing) {
+    glUniform1i(shader->GetLocUseLightmap(), 0);
+    glUniform1i(shader->GetLocUseProbes(), probesReady);
+    instanceBatcher->Draw(shader,
+                          camera->GetProjMatrix() * camera->GetViewMatrix());
+  }
+
+  for (int i = 0; i < (int)scene->objects.size(); ++i) {
+    if (useInstancing && instanceBatcher->IsBatched(i)) {
+      continue;
+    }
+    SetupPhongObject(shader, i, probesReady);
+    scene->objects[i].mesh->draw(shader);
+  }
+
+  shader->UnBind();
+}
+
+// The objects fill the G-buffer, then the light loops run once per pixel.
+void RenderOpaqueDeferred(Camera *camera, const glm::mat4x4 &rootTransform,
+                          const bool probesReady) {
+  deferredRenderer->BeginGeometry();
+  DrawPhongObjects(gbufferShader, camera, rootTransform, probesReady);
+  deferredRenderer->EndGeometry();
+
+  deferredLightShader->Bind();
+  SetupPhongFrame(deferredLightShader, camera, rootTransform, probesReady);
+  deferredRenderer->Shade(deferredLightShader, scene, camera, rootTransform);
+  deferredLightShader->UnBind();
+}
+
+// The objects write their draw and triangle per pixel, then every pixel is
+// shaded once, in a pass per material.
+void RenderOpaqueVisibility(Camera *camera, const glm::mat4x4 &rootTransform,
+                            const bool probesReady) {
+  visibilityBuffer->DrawVisibility(visibilityShader, camera);
+
+  visibilityResolveShader->Bind();
+  SetupPhongFrame(visibilityResolveShader, camera, rootTransform,
+                  probesReady);
+  visibilityBuffer->Resolve(visibilityResolveShader, visibilityDepthShader,
+                            camera, probesReady, lightmapTextureUnit);
+  visibilityResolveShader->UnBind();
+}
+
+void RenderOpaquePass(Camera *camera, const glm::mat4x4 &rootTransform) {
+  PROFILE_GPU_SCOPE("Opaque Pass");
+  if (skyAmbient != nullptr) {
+    skyAmbient->Update(camera->GetViewMatrix(), skyboxRotation);
+  }
+  const bool probesReady = useProbes && probeGrid != nullptr;
+  if (probesReady && !probeGrid->IsUploaded()) {
+    probeGrid->Upload();
+  }
+  if (useInstancing) {
+    instanceBatcher->Update(scene, useLightmaps);
+  }
+  if (visibilityBuffer->IsEnabled() &&
+      visibilityBuffer->Update(scene, useLightmaps)) {
+    RenderOpaqueVisibility(camera, rootTransform, probesReady);
+    return;
+  }
+  if (deferredRenderer->IsEnabled()) {
+    RenderOpaqueDeferred(camera, rootTransform, probesReady);
+    return;
+  }
+  if (phongVariants->IsEnabled()) {
+    RenderOpaqueVariants(camera, rootTransform, probesReady);
+    return;
+  }
+  DrawPhongObjects(phongShadingShader, camera, rootTransform, probesReady);
+}
+
+void RenderSceneCB() {
+  PROFILE_GPU_SCOPE("RenderScene");
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // Render a triangle mesh with Phong shading.
+  Camera *camera = scene->camera;
+
+  glm::mat4x4 rootTransform = ComputeRootTransform();
+
+  // Node edits reach the objects here, once per frame, and only the moved
+  // objects get new matrices.
+  std::vector<int> movedObjects;
+  std::vector<glm::mat4x4> previousWorlds;
+  if (scene->graph.Update(scene->objects, &movedObjects, &previousWorlds) >
+      0) {
+    for (size_t k = 0; k < movedObjects.size(); k++) {
+      const int object = movedObjects[k];
+      scene->transforms.MarkDirty(object);
+      // The probes see the object leave its old place and arrive at the
+      // new one.
+      if (probeGrid != nullptr) {
+        SceneObject before = scene->objects[object];
+        before.worldMatrix = previousWorlds[k];
+        glm::vec3 boundsMin, boundsMax;
+        GetWorldBounds(before, boundsMin, boundsMax);
+        probeGrid->MarkDirty(boundsMin, boundsMax);
+        GetWorldBounds(scene->objects[object], boundsMin, boundsMax);
+        probeGrid->MarkDirty(boundsMin, boundsMax);
+      }
+    }
+    shadowMap->MarkStaticGeometryDirty();
+    shadowAtlas->MarkAllDirty();
+  }
+  scene->transforms.Update(scene->objects, rootTransform);
+  scene->textureStreamer.Update(scene, camera, screenHeight);
+  MemoryTracker::Get().EnforceBudgets();
+
+  // Render the shadow maps of the first directional light.
+  bool hasShadow = onShadow && !scene->dirLights.empty();
+  if (hasShadow) {
+    if (rootTransform != lastRootTransform) {
+      // Rotating or scaling the model moves all static geometry.
+      shadowMap->MarkStaticGeometryDirty();
+      lastRootTransform = rootTransform;
+    }
+    // Light directions live in model space, like the light positions.
+    glm::vec3 lightDir =
+        glm::mat3(rootTransform) * scene->dirLights[0]->GetDirection();
+    shadowMap->Update(camera, lightDir, scene->objects, scene->transforms,
+                      shadowDepthShader);
+  }
+  // Point and spot light shadows are only re-rendered when something changed.
+  if (onShadow) {
+    shadowAtlas->Update(camera, scene, rootTransform, atlasDepthShader);
+  }
+
+  RenderOpaquePass(camera, rootTransform);
 
   // Render skybox.
   if (skybox != nullptr) {
     skybox->SetRotation(skyboxRotation);
-    skybox->Render(camera, skyboxShader);
+    skybox->Render(camera, skyboxShader, skyboxCubeShader);
   }
 }
 
@@ -292,6 +732,24 @@ void ProcessKeysCB(GLFWwindow *window, int key, int scancode, int action,
       glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
       break;
 
+    // 錄製相機路徑
+    case GLFW_KEY_F5:
+      if (action != GLFW_PRESS) {
+        break;
+      }
+      if (!isRecordingPath) {
+        recordedPath.Clear();
+        recordStartTime = glfwGetTime();
+        isRecordingPath = true;
+        std::cerr << "Recording camera path..." << std::endl;
+      } else {
+        isRecordingPath = false;
+        if (recordedPath.Save(cameraPathFile)) {
+          std::cerr << "Camera path saved to " << cameraPathFile << std::endl;
+        }
+      }
+      break;
+
     // 相機控制
     case GLFW_KEY_W:
       scene->camera->moveForward(0.1f);
@@ -345,9 +803,565 @@ void ProcessKeysCB(GLFWwindow *window, int key, int scancode, int action,
   }
 }
 
+// Model transform shared by all objects.
+glm::mat4x4 ComputeRootTransform() {
+  glm::mat4x4 S = glm::scale(glm::mat4x4(1.0f), glm::vec3(scale, scale, scale));
+  glm::mat4x4 RY = glm::rotate(glm::mat4x4(1.0f), glm::radians(curObjRotationY),
+                               glm::vec3(0, 1, 0));
+  glm::mat4x4 RX = glm::rotate(glm::mat4x4(1.0f), glm::radians(curObjRotationX),
+                               glm::vec3(1, 0, 0));
+  return S * RY * RX;
+}
+
+void PickAtCursor(GLFWwindow *window) {
+  double cursorX, cursorY;
+  int windowWidth, windowHeight;
+  glfwGetCursorPos(window, &cursorX, &cursorY);
+  glfwGetWindowSize(window, &windowWidth, &windowHeight);
+  if (windowWidth <= 0 || windowHeight <= 0) {
+    return;
+  }
+  glm::vec2 ndc(2.0f * (float)cursorX / (float)windowWidth - 1.0f,
+                1.0f - 2.0f * (float)cursorY / (float)windowHeight);
+
+  auto start = std::chrono::steady_clock::now();
+  scene->UpdateBVH(ComputeRootTransform());
+  Ray ray = scene->camera->GenerateRay(ndc);
+  pickedHit = RayHit();
+  scene->RayCast(ray, pickedHit);
+  pickMs = MsSince(start);
+  pickedPosition = ray.origin + pickedHit.t * ray.direction;
+  if (pickedHit.IsValid()) {
+    std::cout << "Picked object " << pickedHit.object << " submesh "
+              << pickedHit.subMesh << " triangle " << pickedHit.triangle
+              << std::endl;
+  }
+}
+
+void MouseButtonCB(GLFWwindow *window, int button, int action, int mods) {
+  if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS &&
+      !ImGui::GetIO().WantCaptureMouse) {
+    PickAtCursor(window);
+  }
+}
+
+void DrawPickingPanel() {
+  ImGui::Begin("Ray Picking");
+  const BVHBuildStats &top = scene->GetBVH().GetStats();
+  ImGui::Text("Top level: %d objects, %d nodes, %.3f ms", top.numPrimitives,
+              top.numNodes, top.buildMs);
+  if (ImGui::BeginTable("bvh", 5)) {
+    ImGui::TableSetupColumn("Object");
+    ImGui::TableSetupColumn("Triangles");
+    ImGui::TableSetupColumn("Nodes");
+    ImGui::TableSetupColumn("Depth");
+    ImGui::TableSetupColumn("Build (ms)");
+    ImGui::TableHeadersRow();
+    for (size_t i = 0; i < scene->objects.size(); i++) {
+      // Mesh BVHs are built by the first pick.
+      if (i >= scene->bvhWorldMatrices.size()) {
+        break;
+      }
+      const BVHBuildStats &stats =
+          scene->objects[i].mesh->GetBVH()->GetStats();
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", (int)i);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", stats.numPrimitives);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", stats.numNodes);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", stats.maxDepth);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", stats.buildMs);
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::Separator();
+  if (pickedHit.IsValid()) {
+    const SubMesh &subMesh =
+        scene->objects[pickedHit.object].mesh->getSubMeshes()[pickedHit.subMesh];
+    ImGui::Text("Object %d, submesh %d (%s)", pickedHit.object,
+                pickedHit.subMesh,
+                subMesh.material ? subMesh.material->GetName().c_str() : "-");
+    ImGui::Text("Triangle %d, barycentric (%.3f, %.3f)", pickedHit.triangle,
+                pickedHit.barycentric.x, pickedHit.barycentric.y);
+    ImGui::Text("Position (%.3f, %.3f, %.3f)", pickedPosition.x,
+                pickedPosition.y, pickedPosition.z);
+  } else {
+    ImGui::Text("Left click to pick a triangle");
+  }
+  ImGui::Text("Last pick: %.3f ms", pickMs);
+
+  ImGui::Separator();
+  if (ImGui::Button("Benchmark primary rays")) {
+    scene->UpdateBVH(ComputeRootTransform());
+    rayBenchmark =
+        BenchmarkPrimaryRays(scene, scene->camera, screenWidth, screenHeight);
+  }
+  if (rayBenchmark.numRays > 0) {
+    ImGui::Text("%d rays, %d hits", rayBenchmark.numRays,
+                rayBenchmark.numHits);
+    ImGui::Text("Single: %.2f Mrays/s", rayBenchmark.singleRaysPerSec * 1e-6);
+    ImGui::Text("Packet: %.2f Mrays/s", rayBenchmark.packetRaysPerSec * 1e-6);
+  }
+  ImGui::End();
+}
+
+// Adds one path traced sample per pixel and uploads the average for the
+// "Path Tracer" panel.
+void UpdatePathTracer() {
+  if (!pathTracerEnabled) {
+    return;
+  }
+  PROFILE_SCOPE("Path Tracer");
+  const int width = glm::max(screenWidth / 2, 1);
+  const int height = glm::max(screenHeight / 2, 1);
+  if (pathTracer == nullptr || pathTracer->GetWidth() != width ||
+      pathTracer->GetHeight() != height) {
+    PathTracerSettings settings;
+    if (pathTracer != nullptr) {
+      settings = pathTracer->GetSettings();
+      delete pathTracer;
+    }
+    pathTracer = new PathTracer(width, height);
+    pathTracer->GetSettings() = settings;
+  }
+
+  const glm::mat4x4 rootTransform = ComputeRootTransform();
+  const glm::mat4x4 view = scene->camera->GetViewMatrix();
+  if (view != pathTraceView || rootTransform != pathTraceRootTransform ||
+      isBlingPhong != pathTraceBlinnPhong) {
+    pathTraceView = view;
+    pathTraceRootTransform = rootTransform;
+    pathTraceBlinnPhong = isBlingPhong;
+    pathTracer->GetSettings().blinnPhong = isBlingPhong;
+    pathTracer->Reset();
+  }
+  scene->UpdateBVH(rootTransform);
+  pathTracer->RenderPass(scene, scene->camera, rootTransform);
+  pathTracer->Resolve(pathTracePixels);
+
+  if (pathTraceTexture == 0) {
+    glGenTextures(1, &pathTraceTexture);
+    glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, pathTracePixels.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Reads the CPU copies back for a bake or the path tracer.
+void RestoreSceneCpuData() {
+  scene->RestoreCpuData();
+  lastCpuJobTime = glfwGetTime();
+}
+
+// The path tracer reads the CPU copies every frame.
+bool SceneCpuJobsIdle() {
+  return !pathTracerEnabled &&
+         glfwGetTime() - lastCpuJobTime >= kCpuJobIdleSeconds;
+}
+
+void DrawPathTracerPanel() {
+  ImGui::Begin("Path Tracer");
+  if (ImGui::Checkbox("Enable", &pathTracerEnabled) && pathTracerEnabled) {
+    RestoreSceneCpuData();
+  }
+  if (pathTracer == nullptr) {
+    ImGui::End();
+    return;
+  }
+  PathTracerSettings &settings = pathTracer->GetSettings();
+  bool changed = ImGui::SliderInt("Max bounces", &settings.maxBounces, 0, 8);
+  changed |= ImGui::Checkbox("Ambient sky", &settings.ambientSky);
+  if (changed) {
+    pathTracer->Reset();
+  }
+  if (ImGui::Button("Save image")) {
+    pathTracer->SaveImage("path_trace.png");
+  }
+
+  const PathTracerStats &stats = pathTracer->GetStats();
+  ImGui::Text("%dx%d, %d samples", pathTracer->GetWidth(),
+              pathTracer->GetHeight(), stats.samples);
+  ImGui::Text("Last pass: %.1f ms, %.2f Mrays/s", stats.lastPassMs,
+              stats.raysPerSec * 1e-6);
+  ImGui::Text("%d threads, %d tiles stolen", stats.threads,
+              stats.tilesStolen);
+  if (pathTraceTexture != 0) {
+    float displayWidth = ImGui::GetContentRegionAvail().x;
+    ImGui::Image((ImTextureID)(intptr_t)pathTraceTexture,
+                 ImVec2(displayWidth, displayWidth * pathTracer->GetHeight() /
+                                          pathTracer->GetWidth()));
+  }
+  ImGui::End();
+}
+
+// Bakes the lightmaps of the loaded scene and saves them next to it.
+bool BakeLightmaps() {
+  RestoreSceneCpuData();
+  LightmapBaker baker(lightmapSettings);
+  if (!baker.Bake(scene)) {
+    return false;
+  }
+  lightmapStats = baker.GetStats();
+  return SaveLightmaps(lightmapScenePath, scene);
+}
+
+void DrawLightmapPanel() {
+  ImGui::Begin("Lightmap");
+  ImGui::Checkbox("Use lightmaps", &useLightmaps);
+  ImGui::SliderInt("Atlas size", &lightmapSettings.atlasSize, 128, 2048);
+  ImGui::SliderInt("Bounce samples", &lightmapSettings.bounceSamples, 0, 256);
+  if (ImGui::Button("Bake")) {
+    // Meshes with GL buffers refresh them with the new layout.
+    BakeLightmaps();
+  }
+  ImGui::Text("%d objects, %d charts", lightmapStats.objects,
+              lightmapStats.charts);
+  ImGui::Text("Vertices: %d -> %d", lightmapStats.verticesBefore,
+              lightmapStats.verticesAfter);
+  ImGui::Text("Coverage: %.1f%%, %.1f texels/unit",
+              lightmapStats.coverage * 100.0, lightmapStats.texelsPerUnit);
+  ImGui::Text("Unwrap %.1f ms, bake %.1f ms (%d threads)",
+              lightmapStats.unwrapMs, lightmapStats.bakeMs,
+              lightmapStats.threads);
+  ImGui::End();
+}
+
+// Re-bakes the probes dirtied by edits since the last frame.
+void UpdateProbeGrid() {
+  if (probeGrid == nullptr || !autoRebakeProbes ||
+      probeGrid->GetNumDirty() == 0) {
+    return;
+  }
+  RestoreSceneCpuData();
+  probeGrid->BakeDirty(scene);
+}
+
+void DrawProbeGridPanel() {
+  ImGui::Begin("Light Probes");
+  ImGui::Checkbox("Use probes", &useProbes);
+  ImGui::SliderInt3("Resolution", glm::value_ptr(probeSettings.resolution), 1,
+                    32);
+  ImGui::SliderInt("Rays per probe", &probeSettings.raysPerProbe, 16, 2048);
+  if (ImGui::Button("Bake")) {
+    if (probeGrid == nullptr) {
+      probeGrid = new ProbeGrid(probeSettings);
+    }
+    probeGrid->GetSettings() = probeSettings;
+    RestoreSceneCpuData();
+    probeGrid->Bake(scene);
+  }
+  if (probeGrid == nullptr) {
+    ImGui::End();
+    return;
+  }
+  ImGui::Checkbox("Re-bake dirty probes", &autoRebakeProbes);
+  ImGui::SameLine();
+  // Light edits can reach every probe.
+  if (ImGui::Button("Mark all dirty")) {
+    probeGrid->MarkAllDirty();
+  }
+  const ProbeGridStats &stats = probeGrid->GetStats();
+  ImGui::Text("%d probes, %d dirty", stats.probes, probeGrid->GetNumDirty());
+  ImGui::Text("Last bake: %d probes (%d inside geometry)", stats.probesBaked,
+              stats.probesInvalid);
+  ImGui::Text("%.1f ms, %.2f Mrays/s, %d threads", stats.bakeMs,
+              stats.bakeMs > 0.0 ? stats.rays / (stats.bakeMs * 1e3) : 0.0,
+              stats.threads);
+  ImGui::End();
+}
+
+// Loads the unit cube the spawned instances share, on first use.
+bool LoadInstanceMesh() {
+  if (instanceMesh == nullptr) {
+    instanceMesh = new TriangleMesh();
+    if (!instanceMesh->LoadFromFile(defaultModelPath, true)) {
+      delete instanceMesh;
+      instanceMesh = nullptr;
+      return false;
+    }
+    instanceMesh->createBuffer();
+  }
+  return true;
+}
+
+// Baked and cached data over the box of new instances goes stale.
+void MarkInstancesDirty(const glm::vec3 &boundsMin,
+                        const glm::vec3 &boundsMax) {
+  if (probeGrid != nullptr) {
+    probeGrid->MarkDirty(boundsMin, boundsMax);
+  }
+  if (shadowMap != nullptr) {
+    shadowMap->MarkStaticGeometryDirty();
+  }
+  if (shadowAtlas != nullptr) {
+    shadowAtlas->MarkAllDirty();
+  }
+}
+
+// Spawns count copies of the test cube on a square grid, one layer above
+// the previous grid, each turned by the golden angle from its neighbour.
+void SpawnInstanceGrid(const int count) {
+  if (count <= 0 || !LoadInstanceMesh()) {
+    return;
+  }
+  const int side = (int)std::ceil(std::sqrt((float)count));
+  const float spacing = 0.75f;
+  const float halfSize = 0.5f * (float)(side - 1) * spacing;
+  const float y = (float)spawnedGrids * spacing;
+  std::vector<glm::mat4x4> worldMatrices(count);
+  for (int i = 0; i < count; ++i) {
+    glm::vec3 position((float)(i % side) * spacing - halfSize, y,
+                       (float)(i / side) * spacing - halfSize);
+    glm::mat4x4 world = glm::translate(glm::mat4x4(1.0f), position);
+    world = glm::rotate(world, glm::radians(137.5f * (float)i),
+                        glm::vec3(0.0f, 1.0f, 0.0f));
+    worldMatrices[i] = glm::scale(world, glm::vec3(0.25f));
+  }
+  scene->SpawnInstances(instanceMesh, worldMatrices);
+  spawnedGrids++;
+
+  MarkInstancesDirty(
+      glm::vec3(-halfSize - spacing, y - spacing, -halfSize - spacing),
+      glm::vec3(halfSize + spacing, y + spacing, halfSize + spacing));
+}
+
+// Spawns the cubes of the visibility benchmark.
+bool SpawnInstanceCubes(const std::vector<glm::mat4x4> &worldMatrices,
+                        const glm::vec3 &boundsMin,
+                        const glm::vec3 &boundsMax) {
+  if (!LoadInstanceMesh()) {
+    return false;
+  }
+  scene->SpawnInstances(instanceMesh, worldMatrices);
+  MarkInstancesDirty(boundsMin, boundsMax);
+  return true;
+}
+
+void RemoveSpawnedInstances() {
+  std::vector<SceneObject> &objects = scene->objects;
+  std::vector<int> newIndex(objects.size(), -1);
+  int kept = 0;
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (objects[i].mesh != instanceMesh) {
+      newIndex[i] = kept;
+      objects[kept++] = objects[i];
+    }
+  }
+  objects.resize(kept);
+  scene->graph.RemapObjects(newIndex);
+  scene->transforms.MarkAllDirty();
+  spawnedGrids = 0;
+  if (probeGrid != nullptr) {
+    probeGrid->MarkAllDirty();
+  }
+  if (shadowMap != nullptr) {
+    shadowMap->MarkStaticGeometryDirty();
+  }
+  if (shadowAtlas != nullptr) {
+    shadowAtlas->MarkAllDirty();
+  }
+}
+
+void DrawInstancingPanel() {
+  ImGui::Begin("Instancing");
+  ImGui::Checkbox("Instanced draws", &useInstancing);
+  if (ImGui::Button("Spawn 1k")) {
+    SpawnInstanceGrid(1000);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Spawn 100k")) {
+    SpawnInstanceGrid(100000);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Remove spawned")) {
+    RemoveSpawnedInstances();
+  }
+  const InstanceBatcherStats &stats = instanceBatcher->GetStats();
+  ImGui::Text("%d objects, %d instances in %d batches", stats.objects,
+              stats.instances, stats.batches);
+  ImGui::Text("Draw calls: %d", stats.drawCalls);
+  ImGui::Text("Last rebuild: group %.2f ms, stream %.2f ms (%.1f MB)",
+              stats.groupMs, stats.streamMs,
+              stats.streamedBytes / (1024.0 * 1024.0));
+  ImGui::Text("Rebuilds: %d", stats.rebuilds);
+  ImGui::End();
+}
+
+void DrawSceneNodeTree(const int index) {
+  const SceneNode &node = scene->graph.GetNode(index);
+  ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_OpenOnArrow;
+  if (node.children.empty()) {
+    flags |= ImGuiTreeNodeFlags_Leaf;
+  }
+  if (index == selectedNode) {
+    flags |= ImGuiTreeNodeFlags_Selected;
+  }
+  bool open = ImGui::TreeNodeEx((void *)(intptr_t)index, flags, "%s (%d)",
+                                node.name.c_str(), (int)node.objects.size());
+  if (ImGui::IsItemClicked()) {
+    selectedNode = index;
+  }
+  if (open) {
+    for (int child : node.children) {
+      DrawSceneNodeTree(child);
+    }
+    ImGui::TreePop();
+  }
+}
+
+void DrawSceneGraphPanel() {
+  ImGui::Begin("Scene Graph");
+  const SceneImportStats &stats = scene->graph.GetImportStats();
+  ImGui::Text("%d nodes, %d mesh references to %d meshes", stats.nodes,
+              stats.meshReferences, stats.uniqueMeshes);
+  const double mb = 1024.0 * 1024.0;
+  ImGui::Text("Shared %.2f MB, baked %.2f MB (%.1f%% saved)",
+              stats.sharedBytes / mb, stats.bakedBytes / mb,
+              stats.bakedBytes > 0
+                  ? 100.0 * (1.0 - (double)stats.sharedBytes /
+                                       (double)stats.bakedBytes)
+                  : 0.0);
+  ImGui::Text("Import %.1f ms", stats.loadMs);
+  if (selectedNode >= 0 && selectedNode < scene->graph.GetNumNodes()) {
+    glm::mat4x4 local = scene->graph.GetNode(selectedNode).localTransform;
+    glm::vec3 translation(local[3]);
+    if (ImGui::DragFloat3("Translation", glm::value_ptr(translation),
+                          0.01f)) {
+      local[3] = glm::vec4(translation, 1.0f);
+      scene->graph.SetLocalTransform(selectedNode, local);
+    }
+  }
+  if (ImGui::TreeNode("Nodes")) {
+    for (int i = 0; i < scene->graph.GetNumNodes(); i++) {
+      if (scene->graph.GetNode(i).parent < 0) {
+        DrawSceneNodeTree(i);
+      }
+    }
+    ImGui::TreePop();
+  }
+  ImGui::End();
+}
+
+void DrawTexturePanel() {
+  ImGui::Begin("Textures");
+  const char *modes[] = {"Off", "Cached", "Rebuild"};
+  int mode = (int)ImageTexture::GetCompression();
+  if (ImGui::Combo("Compression", &mode, modes, 3)) {
+    ImageTexture::SetCompression((TextureCompression)mode);
+  }
+  const char *mipModes[] = {"glGenerateMipmap", "Box", "Kaiser"};
+  int mipMode = (int)ImageTexture::GetMipGeneration();
+  if (ImGui::Combo("Mips", &mipMode, mipModes, 3)) {
+    ImageTexture::SetMipGeneration((MipGeneration)mipMode);
+  }
+  ImGui::TextDisabled("Applies to the next scene load");
+  const TextureLoadStats &stats = ImageTexture::GetLoadStats();
+  ImGui::Text("%d textures, %d compressed, %d from the cache", stats.textures,
+              stats.compressed, stats.cacheHits);
+  ImGui::Text("Load %.1f ms (encode %.1f ms)", stats.loadMs, stats.encodeMs);
+  ImGui::Text("Mips %.1f ms, %d cached chains", stats.mipMs,
+              stats.mipCacheHits);
+  ImGui::Text("VRAM %.2f MB", stats.gpuBytes / (1024.0 * 1024.0));
+  ImGui::End();
+}
+
+// Frees the CPU copies of the scene and logs the memory saved, if any.
+void ReleaseSceneCpuData() {
+  if (pathTracerEnabled) {
+    return;
+  }
+  lastCpuJobTime = -1.0;
+  const CpuReleaseStats stats = scene->ReleaseCpuData();
+  if (stats.meshes + stats.textures == 0) {
+    return;
+  }
+  cpuReleaseStats = stats;
+  std::cout << "GPU-resident: freed " << stats.meshes << " meshes ("
+            << stats.meshBytes / (1024.0 * 1024.0) << " MB) and "
+            << stats.textures << " textures ("
+            << stats.textureBytes / (1024.0 * 1024.0) << " MB) in "
+            << stats.ms << " ms" << std::endl;
+  if (stats.streamedTextures > 0) {
+    std::cout << "GPU-resident: " << stats.streamedTextures
+              << " streamed textures keep "
+              << stats.streamedBytes / (1024.0 * 1024.0)
+              << " MB of finer levels on the CPU" << std::endl;
+  }
+}
+
+// GPU-resident mode: frees the copies the bakes and the path tracer read
+// back once they are done with them.
+void ReleaseIdleSceneCpuData() {
+  if (gpuResident && lastCpuJobTime >= 0.0 && SceneCpuJobsIdle()) {
+    ReleaseSceneCpuData();
+  }
+}
+
+// What the subsystems can give back when a tag goes over its budget: CPU
+// copies (GPU-resident mode) and streamed texture levels.
+void AddMemoryBudgetCallbacks() {
+  MemoryTracker &tracker = MemoryTracker::Get();
+  auto releaseCpu = [](const long long cpuOver, const long long) {
+    // Copies in use by a CPU job go when it is idle.
+    if (cpuOver > 0 && SceneCpuJobsIdle()) {
+      ReleaseSceneCpuData();
+    }
+  };
+  tracker.AddBudgetCallback(MemoryTag::Mesh, releaseCpu);
+  tracker.AddBudgetCallback(MemoryTag::Texture, releaseCpu);
+  tracker.AddBudgetCallback(MemoryTag::Texture,
+                            [](const long long, const long long gpuOver) {
+                              if (gpuOver > 0) {
+                                scene->textureStreamer.Evict(gpuOver);
+                              }
+                            });
+}
+
+void DrawGpuResidentPanel() {
+  ImGui::Begin("GPU Resident");
+  ImGui::Checkbox("Free CPU copies after loading", &gpuResident);
+  if (ImGui::Button("Free now")) {
+    ReleaseSceneCpuData();
+  }
+  ImGui::SameLine();
+  // Picking and the CPU renderers restore on their own.
+  if (ImGui::Button("Restore")) {
+    scene->RestoreCpuData();
+  }
+  const CpuReleaseStats &stats = cpuReleaseStats;
+  ImGui::Text("Last: %d meshes, %.2f MB", stats.meshes,
+              stats.meshBytes / (1024.0 * 1024.0));
+  ImGui::Text("      %d textures, %.2f MB", stats.textures,
+              stats.textureBytes / (1024.0 * 1024.0));
+  ImGui::Text("Saved %.2f MB in %.1f ms",
+              (stats.meshBytes + stats.textureBytes) / (1024.0 * 1024.0),
+              stats.ms);
+  // Streaming uploads from these instead of reading the files again.
+  ImGui::Text("Kept: %d streamed textures, %.2f MB", stats.streamedTextures,
+              stats.streamedBytes / (1024.0 * 1024.0));
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip("Streamed textures keep the levels finer than their "
+                      "start level,\nlevel 0 included, in RAM.");
+  }
+  ImGui::End();
+}
+
 void SetupRenderState() {
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_MULTISAMPLE);
+  // Filter across cube map face edges (skybox).
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
   glm::vec4 clearColor = glm::vec4(0.44f, 0.57f, 0.75f, 1.00f);
   glClearColor((GLclampf)(clearColor.r), (GLclampf)(clearColor.g),
@@ -363,28 +1377,70 @@ void CreateScene() {
   scene = new Scene();
 }
 
-void LoadObjects(const std::string &modelPath) {
-  // -------------------------------------------------------
-  // Note: you can change the code below if you want to load
-  //       the model dynamically.
-  // -------------------------------------------------------
-
+// Adds a model to the scene. FBX files keep their node hierarchy in
+// scene->graph, with one object per mesh reference; other files become a
+// single object.
+bool ImportModel(const std::string &modelPath) {
+  if (Utils::getExtension(modelPath) == ".fbx") {
+    FbxSdkLoader loader;
+    return loader.loadFbxGraph(modelPath, scene);
+  }
   TriangleMesh *mesh = new TriangleMesh();
-  mesh->LoadFromFile(modelPath, false, scene);
+  if (!mesh->LoadFromFile(modelPath, false, scene)) {
+    delete mesh;
+    return false;
+  }
+  SceneObject sceneObj;
+  sceneObj.mesh = mesh;
+  scene->objects.push_back(sceneObj);
+  return true;
+}
+
+void LoadObjects(const std::string &modelPath) {
+  const size_t firstObject = scene->objects.size();
+  if (!ImportModel(modelPath)) {
+    return;
+  }
 
   if(scene->camera == nullptr) {
     scene->camera = camera;
   }
 
-  // scene->camera = camera;
-
-  mesh->createBuffer();
-  mesh->ShowInfo();
-  SceneObject sceneObj;
-
-  sceneObj.mesh = mesh;
+  // The lightmap layout changes the vertex streams, so apply it before the
+  // buffers are created.
+  lightmapScenePath = modelPath;
+  if (firstObject == 0) {
+    LoadLightmaps(modelPath, scene);
+  }
+  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+  std::set<TriangleMesh *> created;
+  for (size_t i = firstObject; i < scene->objects.size(); i++) {
+    const SceneObject &sceneObj = scene->objects[i];
+    // Meshes shared by several nodes get one set of buffers.
+    if (created.insert(sceneObj.mesh).second) {
+      sceneObj.mesh->createBuffer();
+      sceneObj.mesh->ShowInfo();
+    }
+    glm::vec3 objMin, objMax;
+    GetWorldBounds(sceneObj, objMin, objMax);
+    boundsMin = glm::min(boundsMin, objMin);
+    boundsMax = glm::max(boundsMax, objMax);
+  }
 
-  scene->objects.push_back(sceneObj);
+  // Probes near the new objects see different geometry now.
+  if (probeGrid != nullptr && scene->objects.size() > firstObject) {
+    probeGrid->MarkDirty(boundsMin, boundsMax);
+  }
+  if (shadowMap != nullptr) {
+    shadowMap->MarkStaticGeometryDirty();
+  }
+  if (shadowAtlas != nullptr) {
+    shadowAtlas->MarkAllDirty();
+  }
+  if (gpuResident) {
+    ReleaseSceneCpuData();
+  }
 }
 
 void CreateCamera() {
@@ -411,6 +1467,12 @@ void CreateSkybox(const std::string texFilePath) {
 
   const float radius = 50.0f;
   skybox = new Skybox(texFilePath, numSlices, numStacks, radius);
+
+  // Loads in the background; the old sky lights the scene until then.
+  if (skyAmbient == nullptr) {
+    skyAmbient = new SkyAmbient();
+  }
+  skyAmbient->Load(texFilePath);
 }
 
 void CreateShaderLib() {
@@ -428,32 +1490,319 @@ void CreateShaderLib() {
   if (!phongShadingShader->LoadFromFiles("shaders/phong_shading_demo.vs",
                                          "shaders/phong_shading_demo.fs"))
     exit(1);
+  // Compiled as the draws ask for them.
+  phongVariants =
+      new PhongVariants(phongShadingShader, "shaders/phong_shading_demo.vs",
+                        "shaders/phong_shading_demo.fs");
+
+  gbufferShader = new PhongShadingDemoShaderProg();
+  gbufferShader->SetDefines("#define GBUFFER_PASS 1\n");
+  if (!gbufferShader->LoadFromFiles("shaders/phong_shading_demo.vs",
+                                    "shaders/phong_shading_demo.fs"))
+    exit(1);
+
+  deferredLightShader = new DeferredLightShaderProg();
+  deferredLightShader->SetDefines("#define DEFERRED_LIGHTING 1\n");
+  if (!deferredLightShader->LoadFromFiles("shaders/deferred_light.vs",
+                                          "shaders/phong_shading_demo.fs"))
+    exit(1);
+
+  visibilityShader = new VisibilityShaderProg();
+  if (!visibilityShader->LoadFromFiles("shaders/visibility.vs",
+                                       "shaders/visibility.fs"))
+    exit(1);
+
+  visibilityDepthShader = new VisibilityDepthShaderProg();
+  if (!visibilityDepthShader->LoadFromFiles("shaders/visibility_fullscreen.vs",
+                                            "shaders/visibility_depth.fs"))
+    exit(1);
+
+  visibilityResolveShader = new VisibilityResolveShaderProg();
+  visibilityResolveShader->SetDefines("#define VISIBILITY_RESOLVE 1\n");
+  if (!visibilityResolveShader->LoadFromFiles(
+          "shaders/visibility_fullscreen.vs", "shaders/phong_shading_demo.fs"))
+    exit(1);
 
   skyboxShader = new SkyboxShaderProg();
   if (!skyboxShader->LoadFromFiles("shaders/skybox.vs", "shaders/skybox.fs"))
     exit(1);
+
+  skyboxCubeShader = new SkyboxCubeShaderProg();
+  if (!skyboxCubeShader->LoadFromFiles("shaders/skybox_cube.vs",
+                                       "shaders/skybox_cube.fs"))
+    exit(1);
+
+  shadowDepthShader = new ShadowDepthShaderProg();
+  if (!shadowDepthShader->LoadFromFiles("shaders/shadow_depth.vs",
+                                        "shaders/shadow_depth.fs"))
+    exit(1);
+
+  atlasDepthShader = new ShadowAtlasDepthShaderProg();
+  if (!atlasDepthShader->LoadFromFiles("shaders/shadow_atlas_depth.vs",
+                                       "shaders/shadow_atlas_depth.fs"))
+    exit(1);
+}
+
+void CreateShadowMap() {
+  if (shadowMap != nullptr) {
+    delete shadowMap;
+    shadowMap = nullptr;
+  }
+  if (shadowAtlas != nullptr) {
+    delete shadowAtlas;
+    shadowAtlas = nullptr;
+  }
+
+  shadowMap = new CascadedShadowMap();
+  // Do not spend shadow resolution beyond the part of the scene we look at.
+  shadowMap->SetMaxShadowDistance(glm::min(zFar, 50.0f));
+
+  shadowAtlas = new ShadowAtlas();
+}
+
+// Orbit around the bounding box of the loaded objects.
+CameraPath CreateDefaultCameraPath() {
+  glm::vec3 bmin(std::numeric_limits<float>::max());
+  glm::vec3 bmax(-std::numeric_limits<float>::max());
+  for (const auto &sceneObj : scene->objects) {
+    glm::vec3 objMin, objMax;
+    GetWorldBounds(sceneObj, objMin, objMax);
+    bmin = glm::min(bmin, objMin * scale);
+    bmax = glm::max(bmax, objMax * scale);
+  }
+  if (scene->objects.empty()) {
+    bmin = glm::vec3(-1.0f);
+    bmax = glm::vec3(1.0f);
+  }
+  glm::vec3 center = 0.5f * (bmin + bmax);
+  float radius = glm::max(glm::length(bmax - bmin), 0.1f);
+  return CameraPath::Orbit(center, radius, 0.3f * radius);
+}
+
+// The options' camera path, or an orbit around the scene. False if the
+// file cannot be read.
+bool LoadCameraPath(const HeadlessOptions &options, CameraPath &path) {
+  if (options.cameraPathFile.empty()) {
+    path = CreateDefaultCameraPath();
+    return true;
+  }
+  return path.Load(options.cameraPathFile);
+}
+
+// Replays a camera path offscreen and writes the frame times as JSON.
+int RunHeadless(const HeadlessOptions &options,
+                const std::string &contextApi) {
+  CameraPath path;
+  if (!LoadCameraPath(options, path)) {
+    return 1;
+  }
+
+  Camera *camera = scene->camera;
+  camera->UpdateProjection(camera->GetFovy(),
+                           (float)options.width / (float)options.height,
+                           camera->GetNearPlane(), camera->GetFarPlane());
+
+  HeadlessBenchmark benchmark(options);
+  // Draws and GPU time per program, as of the last frames.
+  bool ok = benchmark.Run(camera, cameraUp, path, RenderSceneCB, contextApi,
+                          [](JsonWriter &json) {
+                            json.Key("phongVariants");
+                            phongVariants->WriteJson(json);
+                            json.Key("deferredShading");
+                            deferredRenderer->WriteJson(json);
+                            json.Key("visibilityBuffer");
+                            visibilityBuffer->WriteJson(json);
+                          });
+  return ok ? 0 : 1;
+}
+
+// Renders the camera path into a new framebuffer of the given size and
+// returns the mean GPU time per frame, or -1 without timer queries. With
+// samplesPerPixel, it also gets the fragments of the last frame that passed
+// the depth test, per pixel: the overdraw of a forward frame.
+double MeasureGpuFrames(const HeadlessOptions &options,
+                        const CameraPath &path, const int width,
+                        const int height, double *samplesPerPixel = nullptr) {
+  GLint timerBits = 0;
+  glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &timerBits);
+  if (timerBits == 0) {
+    return -1.0;
+  }
+  GLuint fbo, colorBuffer, depthBuffer;
+  glGenFramebuffers(1, &fbo);
+  glGenRenderbuffers(1, &colorBuffer);
+  glGenRenderbuffers(1, &depthBuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, colorBuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, depthBuffer);
+
+  Camera *camera = scene->camera;
+  camera->UpdateProjection(camera->GetFovy(), (float)width / (float)height,
+                           camera->GetNearPlane(), camera->GetFarPlane());
+  // Texture streaming by the size of this target.
+  screenHeight = height;
+  std::vector<GLuint> queries(options.frames * 2, 0);
+  glGenQueries((GLsizei)queries.size(), queries.data());
+  GLuint samplesQuery = 0;
+  glGenQueries(1, &samplesQuery);
+  const float duration = path.GetDuration();
+  for (int i = 0; i < options.warmupFrames + options.frames; ++i) {
+    const int measured = i - options.warmupFrames;
+    const bool countSamples =
+        samplesPerPixel != nullptr && measured == options.frames - 1;
+    const float t =
+        measured <= 0 || options.frames == 1
+            ? 0.0f
+            : duration * (float)measured / (float)(options.frames - 1);
+    glm::vec3 position, target;
+    path.Sample(t, position, target);
+    camera->UpdateView(position, target, cameraUp);
+    if (measured >= 0) {
+      glQueryCounter(queries[measured * 2], GL_TIMESTAMP);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+    if (countSamples) {
+      glBeginQuery(GL_SAMPLES_PASSED, samplesQuery);
+    }
+    RenderSceneCB();
+    if (countSamples) {
+      glEndQuery(GL_SAMPLES_PASSED);
+    }
+    if (measured >= 0) {
+      glQueryCounter(queries[measured * 2 + 1], GL_TIMESTAMP);
+    }
+  }
+  if (samplesPerPixel != nullptr) {
+    GLuint64 samples = 0;
+    glGetQueryObjectui64v(samplesQuery, GL_QUERY_RESULT, &samples);
+    *samplesPerPixel = (double)samples / ((double)width * height);
+  }
+  glDeleteQueries(1, &samplesQuery);
+  double totalMs = 0.0;
+  for (int i = 0; i < options.frames; ++i) {
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+    totalMs += (double)(end - begin) / 1.0e6;
+  }
+  glDeleteQueries((GLsizei)queries.size(), queries.data());
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(1, &colorBuffer);
+  glDeleteRenderbuffers(1, &depthBuffer);
+  return totalMs / options.frames;
+}
+
+// Loads the scene for the CPU-only modes, without a GL context.
+bool LoadSceneWithoutGL(const HeadlessOptions &options) {
+  screenWidth = options.width;
+  screenHeight = options.height;
+  CreateScene();
+  CreateCamera();
+
+  if (!ImportModel(options.scenePath)) {
+    return false;
+  }
+  if (scene->camera == nullptr) {
+    scene->camera = camera;
+  }
+
+  Camera *camera = scene->camera;
+  camera->UpdateProjection(camera->GetFovy(),
+                           (float)options.width / (float)options.height,
+                           camera->GetNearPlane(), camera->GetFarPlane());
+  return true;
+}
+
+// Runs the mode of the options that only uses the CPU (see RunsWithoutGL);
+// the work and the report live with each subsystem.
+int RunWithoutGL(const HeadlessOptions &options) {
+  if (options.jobs.encodeTextures) {
+    return ImageTexture::RunHeadlessEncode(
+        options, [&]() { return LoadSceneWithoutGL(options); });
+  }
+  if (!LoadSceneWithoutGL(options)) {
+    return 1;
+  }
+  const glm::mat4x4 rootTransform = ComputeRootTransform();
+  if (!options.jobs.softwareImagePath.empty()) {
+    SoftwareRenderSettings settings;
+    settings.blinnPhong = isBlingPhong;
+    settings.onAmbientLight = onAmbientLight;
+    settings.onDiffuseLight = onDiffuseLight;
+    settings.onSpecularLight = onSpecularLight;
+    return SoftwareRasterizer::RunHeadless(options, scene, rootTransform,
+                                           settings);
+  }
+  if (options.jobs.rayBenchmark) {
+    return RunRayBenchmark(options, scene, rootTransform);
+  }
+  if (!options.jobs.pathTraceImagePath.empty()) {
+    PathTracerSettings settings;
+    settings.blinnPhong = isBlingPhong;
+    return PathTracer::RunHeadless(options, scene, rootTransform, settings);
+  }
+  if (options.jobs.bakeLightmap) {
+    return LightmapBaker::RunHeadless(options, scene, lightmapSettings);
+  }
+  return ProbeGrid::RunHeadless(options, scene, probeSettings);
 }
 
 int main(int argc, char **argv) {
+  PROFILE_THREAD_NAME("Main");
+  HeadlessOptions options;
+  if (!ParseCommandLine(argc, argv, options)) {
+    return 1;
+  }
+  if (options.scenePath.empty()) {
+    options.scenePath = fbxRoomModelPath;
+  }
+
   std::ofstream outFile("output.txt");
   if (!outFile) {
     std::cerr << "無法開啟檔案進行輸出。" << std::endl;
     return 1;
   }
   std::cout.rdbuf(outFile.rdbuf());
+  ImageTexture::SetCompression(options.resources.textureCompression);
+  ImageTexture::SetMipGeneration(options.resources.mipGeneration);
+  ImageTexture::SetStreaming(options.resources.streamTextures);
+  ShaderProg::SetBinaryCache(options.resources.shaderCache);
+  if (RunsWithoutGL(options)) {
+    return RunWithoutGL(options);
+  }
+  if (options.enabled) {
+    // No display server needed.
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    screenWidth = options.width;
+    screenHeight = options.height;
+  }
   if (!glfwInit()) {
     std::cerr << "GLFW initialization failed!" << std::endl;
     return 1;
   }
 
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_SAMPLES, 8);
-
-  GLFWwindow *window = glfwCreateWindow(screenWidth, screenHeight,
-                                        "Texture Mapping", NULL, NULL);
+  GLFWwindow *window = nullptr;
+  std::string contextApi = "native";
+  if (options.enabled) {
+    window = CreateOffscreenWindow(screenWidth, screenHeight, contextApi);
+  } else {
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_SAMPLES, 8);
+
+    window = glfwCreateWindow(screenWidth, screenHeight, "Texture Mapping",
+                              NULL, NULL);
+  }
 
   if (!window) {
     std::cerr << "GLFW window creation failed!" << std::endl;
@@ -465,7 +1814,14 @@ int main(int argc, char **argv) {
 
   // Initialize GLEW.
   // Must be done after glfw is initialized!
+  glewExperimental = GL_TRUE;
   GLenum res = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  // A GLX build of GLEW still loads the GL entry points under EGL/OSMesa.
+  if (options.enabled && res == GLEW_ERROR_NO_GLX_DISPLAY) {
+    res = GLEW_OK;
+  }
+#endif
   if (res != GLEW_OK) {
     std::cerr << "GLEW initialization error: " << glewGetErrorString(res)
               << std::endl;
@@ -474,24 +1830,135 @@ int main(int argc, char **argv) {
 
   std::cout << "OpenGL version: " << glGetString(GL_VERSION) << std::endl;
 
+  if (options.jobs.shaderBenchmark) {
+    int status = ShaderProg::RunHeadlessBenchmark(
+        options, contextApi, CreateShaderLib, DeleteShaderLib);
+    ReleaseResources();
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return status;
+  }
+  if (options.jobs.textureBenchmark) {
+    int status = ImageTexture::RunHeadlessBenchmark(
+        options, contextApi, [&]() {
+          CreateScene();
+          return ImportModel(options.scenePath);
+        });
+    ReleaseResources();
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return status;
+  }
+
   // Initialization.
   CreateScene();
+  AddMemoryBudgetCallbacks();
+  if (options.resources.textureBudgetMb > 0) {
+    scene->textureStreamer.GetSettings().budgetBytes =
+        (long long)options.resources.textureBudgetMb * 1024 * 1024;
+  }
   SetupRenderState();
   CreateCamera();
-  LoadObjects(fbxRoomModelPath);
+  gpuResident = options.resources.gpuResident;
+  LoadObjects(options.scenePath);
   CreateSkybox("textures/photostudio_02_2k.png");
   CreateShaderLib();
+  const ShaderLoadStats &shaderStats = ShaderProg::GetLoadStats();
+  std::cout << "Shaders: " << shaderStats.programs << " programs ("
+            << shaderStats.binaryHits << " from binaries) in "
+            << shaderStats.totalMs << " ms" << std::endl;
+  phongVariants->SetEnabled(!options.render.noShaderVariants);
+  CreateShadowMap();
+  instanceBatcher = new InstanceBatcher();
+  useInstancing = !options.render.noInstancing;
+  deferredRenderer = new DeferredRenderer();
+  deferredRenderer->SetEnabled(options.render.deferred);
+  visibilityBuffer = new VisibilityBuffer();
+  visibilityBuffer->SetEnabled(options.render.visibility);
+  if (options.render.instances > 0) {
+    SpawnInstanceGrid(options.render.instances);
+    // The shadow passes still draw object by object.
+    onShadow = false;
+  }
+
+  if (options.enabled) {
+    const GpuFrameTimer measure = [&](const CameraPath &path, const int width,
+                                      const int height,
+                                      double *samplesPerPixel) {
+      return MeasureGpuFrames(options, path, width, height, samplesPerPixel);
+    };
+    int status;
+    if (options.jobs.visibilityBenchmark) {
+      // The shadow passes still draw object by object.
+      onShadow = false;
+      status = visibilityBuffer->RunHeadlessBenchmark(
+          options, contextApi, scene, ComputeRootTransform(),
+          deferredRenderer, shadowAtlas, measure, SpawnInstanceCubes,
+          RemoveSpawnedInstances);
+    } else if (options.jobs.deferredBenchmark) {
+      CameraPath path;
+      status = LoadCameraPath(options, path)
+                   ? deferredRenderer->RunHeadlessBenchmark(
+                         options, contextApi, path, scene, shadowAtlas,
+                         measure)
+                   : 1;
+    } else {
+      status = RunHeadless(options, contextApi);
+    }
+    if (!options.memoryJsonPath.empty()) {
+      MemoryTracker::Get().WriteJson(options.memoryJsonPath);
+    }
+    ReleaseResources();
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return status;
+  }
+
+  if (!options.memoryJsonPath.empty()) {
+    MemoryTracker::Get().WriteJson(options.memoryJsonPath);
+  }
 
   // Register callback functions.
   glfwSetFramebufferSizeCallback(window, ReshapeCB);
   glfwSetKeyCallback(window, ProcessKeysCB);
+  glfwSetMouseButtonCallback(window, MouseButtonCB);
 
   // Initialize ImGui.
   gui = new GUI(window);
   GUIState guiState = GUIState(
       isBlingPhong, showDirLightArrow, onPointLight, onSpotLight, onDirLight,
-      onAmbientLight, onDiffuseLight, onSpecularLight, dirLightArrowScale,
-      curObjRotationX, curObjRotationY, skyboxRotation);
+      onAmbientLight, onDiffuseLight, onSpecularLight, onShadow,
+      dirLightArrowScale, curObjRotationX, curObjRotationY, skyboxRotation);
+  gui->AddPanel([]() { shadowMap->DrawDebugPanel(); });
+  gui->AddPanel([]() { shadowAtlas->DrawDebugPanel(); });
+  gui->AddPanel(DrawPickingPanel);
+  gui->AddPanel(DrawPathTracerPanel);
+  gui->AddPanel(DrawLightmapPanel);
+  gui->AddPanel(DrawProbeGridPanel);
+  gui->AddPanel(DrawInstancingPanel);
+  gui->AddPanel(DrawSceneGraphPanel);
+  gui->AddPanel(DrawTexturePanel);
+  gui->AddPanel(DrawGpuResidentPanel);
+  gui->AddPanel([]() { MemoryTracker::Get().DrawPanel(); });
+  gui->AddPanel([]() { phongVariants->DrawDebugPanel(); });
+  gui->AddPanel([]() { deferredRenderer->DrawDebugPanel(); });
+  gui->AddPanel([]() { visibilityBuffer->DrawDebugPanel(); });
+  gui->AddPanel([]() { scene->textureStreamer.DrawDebugPanel(); });
+  gui->AddPanel([]() { scene->transforms.DrawDebugPanel(); });
+  gui->AddPanel([]() {
+    if (skybox != nullptr) {
+      skybox->DrawDebugPanel();
+    }
+  });
+  gui->AddPanel([]() {
+    if (skyAmbient != nullptr) {
+      skyAmbient->DrawDebugPanel();
+    }
+  });
+#if PROFILER_ENABLED
+  gui->AddPanel(
+      []() { Profiler::Get().DrawPanel(gui->GetSettingsAnchor()); });
+#endif
 
   std::vector<std::string> objFileDirectory =
       Utils::getFilesInDirectory(modelDirectory, ".obj");
@@ -502,11 +1969,23 @@ int main(int argc, char **argv) {
   // Enter main event loop.
   while (!glfwWindowShouldClose(window)) {
     RenderSceneCB();
+    UpdatePathTracer();
+    UpdateProbeGrid();
+    ReleaseIdleSceneCpuData();
+    if (isRecordingPath) {
+      recordedPath.AddKey((float)(glfwGetTime() - recordStartTime),
+                          scene->camera->GetCameraPos(),
+                          scene->camera->GetTarget());
+    }
     // Render ImGui.
-    gui->render(dirLight, LoadObjects, CreateSkybox, objFileDirectory,
-                skyboxFileDirectory, guiState);
+    {
+      PROFILE_GPU_SCOPE("GUI");
+      gui->render(dirLight, LoadObjects, CreateSkybox, objFileDirectory,
+                  skyboxFileDirectory, guiState);
+    }
     glfwSwapBuffers(window);
     glfwPollEvents();
+    PROFILE_FRAME();
   }
 
   // Release resources.
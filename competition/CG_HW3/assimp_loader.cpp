@@ -1,6 +1,11 @@
 #include "assimp_loader.h"
 
-AssimpLoader::AssimpLoader(TriangleMesh *mesh) { this->mesh = mesh; }
+#include <chrono>
+
+#include "timing.h"
+
+AssimpLoader::AssimpLoader(TriangleMesh *mesh)
+    : mesh(mesh), sceneData(nullptr) {}
 
 AssimpLoader::~AssimpLoader() {}
 inline float divideAndTruncate(float value)
@@ -37,8 +42,40 @@ glm::mat4 aiMatrix4x4ToGlm(const aiMatrix4x4 &from)
 
 bool AssimpLoader::loadFbx(const std::string &filePath, Scene *scene) 
 {
-    Assimp::Importer importer;
+    if (!importScene(filePath, scene))
+    {
+        return false;
+    }
+
+    processNode(sceneData->mRootNode, sceneData, glm::mat4(1.0f));
+
+    return true;
+}
+
+bool AssimpLoader::loadFbxGraph(const std::string &filePath, Scene *scene)
+{
+    const auto start = std::chrono::steady_clock::now();
+    if (!importScene(filePath, scene))
+    {
+        return false;
+    }
+
+    // aiScene already lists each mesh once; nodes refer to them by index.
+    SceneImportStats stats;
+    std::vector<TriangleMesh *> meshes(sceneData->mNumMeshes, nullptr);
+    processGraphNode(sceneData->mRootNode, -1, scene, meshes, stats);
+    stats.sharedBytes += (long long)stats.nodes * sizeof(SceneNode) +
+                         (long long)stats.meshReferences *
+                             (sizeof(SceneObject) + sizeof(glm::mat4x4));
+    stats.loadMs = MsSince(start);
+    scene->graph.SetImportStats(stats);
+    scene->graph.Update(scene->objects);
+    return true;
+}
 
+bool AssimpLoader::importScene(const std::string &filePath, Scene *scene)
+{
+    // The member importer owns sceneData until the next import.
     const aiScene *aiscene = importer.ReadFile(
         filePath, aiProcess_Triangulate | aiProcess_FlipUVs |
                       aiProcess_GenNormals | aiProcess_GenUVCoords |
@@ -49,6 +86,7 @@ bool AssimpLoader::loadFbx(const std::string &filePath, Scene *scene)
         std::cout << "Error: " << importer.GetErrorString() << std::endl;
         return false;
     }
+    sceneData = aiscene;
 
     aiCamera *aiCamera = nullptr;
 
@@ -210,8 +248,6 @@ bool AssimpLoader::loadFbx(const std::string &filePath, Scene *scene)
         }
     }
 
-    processNode(aiscene->mRootNode, aiscene, glm::mat4(1.0f));
-
     return true;
 }
 
@@ -245,6 +281,46 @@ void AssimpLoader::processNode(aiNode *node, const aiScene *aiscene,
     }
 }
 
+void AssimpLoader::processGraphNode(aiNode *node, const int parent,
+                                    Scene *scene,
+                                    std::vector<TriangleMesh *> &meshes,
+                                    SceneImportStats &stats)
+{
+    const int index = scene->graph.AddNode(
+        node->mName.C_Str(), parent,
+        aiMatrix4x4ToGlm(node->mTransformation));
+    stats.nodes++;
+
+    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    {
+        // Load each referenced mesh once, untransformed.
+        TriangleMesh *&shared = meshes[node->mMeshes[i]];
+        if (shared == nullptr)
+        {
+            shared = new TriangleMesh();
+            mesh = shared;
+            processMesh(sceneData->mMeshes[node->mMeshes[i]], sceneData,
+                        glm::mat4(1.0f));
+            shared->computeBounds();
+            stats.uniqueMeshes++;
+            stats.sharedBytes += (long long)shared->GetGeometryBytes();
+        }
+        stats.meshReferences++;
+        stats.bakedBytes += (long long)shared->GetGeometryBytes();
+
+        SceneObject sceneObj;
+        sceneObj.mesh = shared;
+        scene->objects.push_back(sceneObj);
+        scene->graph.AttachObject(index, (int)scene->objects.size() - 1,
+                                  glm::mat4(1.0f));
+    }
+
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+    {
+        processGraphNode(node->mChildren[i], index, scene, meshes, stats);
+    }
+}
+
 void AssimpLoader::processMesh(aiMesh *mesh, const aiScene *aiscene,
                                const glm::mat4 &transform)
 {
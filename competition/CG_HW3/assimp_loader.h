@@ -13,16 +13,23 @@
 class AssimpLoader : public FbxModelLoader
 {
 public:
-    AssimpLoader(TriangleMesh *mesh);
+    // mesh receives the baked import; loadFbxGraph creates its own meshes.
+    AssimpLoader(TriangleMesh *mesh = nullptr);
     ~AssimpLoader();
     bool loadFbx(const std::string &filePath, Scene *scene) override;
+    bool loadFbxGraph(const std::string &filePath, Scene *scene) override;
 
 private:
     TriangleMesh *mesh;
     Assimp::Importer importer;
     const aiScene *sceneData;
 
+    // Reads the file into sceneData, with its camera and lights.
+    bool importScene(const std::string &filePath, Scene *scene);
     void processNode(aiNode *node, const aiScene *scene, const glm::mat4 &parentTransform);
+    void processGraphNode(aiNode *node, const int parent, Scene *scene,
+                          std::vector<TriangleMesh *> &meshes,
+                          SceneImportStats &stats);
     void processMesh(aiMesh *ai_mesh, const aiScene *scene, const glm::mat4 &transform);
     void processMaterial(aiMaterial *ai_material, PhongMaterial *phongMaterial);
     void processTexture(aiMaterial *ai_material, PhongMaterial *phongMaterial, const std::string &textureType);
@@ -0,0 +1,783 @@
+#include "block_compression.h"
+
+#include <cstring>
+
+#include "file_cache.h"
+#include "mip_generator.h"
+#include "thread_pool.h"
+
+static uint32_t MakeFourCC(const char a, const char b, const char c,
+                           const char d) {
+  return (uint32_t)(unsigned char)a | ((uint32_t)(unsigned char)b << 8) |
+         ((uint32_t)(unsigned char)c << 16) |
+         ((uint32_t)(unsigned char)d << 24);
+}
+
+// DDS file layout, after the "DDS " magic.
+struct DdsPixelFormat {
+  uint32_t size;
+  uint32_t flags;
+  uint32_t fourCC;
+  uint32_t rgbBitCount;
+  uint32_t rMask, gMask, bMask, aMask;
+};
+
+struct DdsHeader {
+  uint32_t size;
+  uint32_t flags;
+  uint32_t height;
+  uint32_t width;
+  uint32_t pitchOrLinearSize;
+  uint32_t depth;
+  uint32_t mipMapCount;
+  uint32_t reserved1[11];
+  DdsPixelFormat pixelFormat;
+  uint32_t caps;
+  uint32_t caps2;
+  uint32_t caps3;
+  uint32_t caps4;
+  uint32_t reserved2;
+};
+
+struct DdsHeaderDX10 {
+  uint32_t dxgiFormat;
+  uint32_t resourceDimension;
+  uint32_t miscFlag;
+  uint32_t arraySize;
+  uint32_t miscFlags2;
+};
+
+static const uint32_t kDdsFlagsCaps = 0x1;
+static const uint32_t kDdsFlagsHeight = 0x2;
+static const uint32_t kDdsFlagsWidth = 0x4;
+static const uint32_t kDdsFlagsPixelFormat = 0x1000;
+static const uint32_t kDdsFlagsMipMapCount = 0x20000;
+static const uint32_t kDdsFlagsLinearSize = 0x80000;
+static const uint32_t kDdsPixelFourCC = 0x4;
+static const uint32_t kDdsCapsComplex = 0x8;
+static const uint32_t kDdsCapsTexture = 0x1000;
+static const uint32_t kDdsCapsMipMap = 0x400000;
+static const uint32_t kDdsCaps2Cubemap = 0x200;
+static const uint32_t kDxgiBC7 = 98;
+static const uint32_t kDdsDimensionTexture2D = 3;
+
+// Marks the cache files written by SaveDDS; the source hash follows it.
+static const uint32_t kCacheMarker = MakeFourCC('B', 'C', 'E', 'N');
+
+static const unsigned char kKtx2Identifier[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+struct Ktx2Header {
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  // Two 64-bit fields, split so the struct has no padding.
+  uint32_t sgdByteOffset[2];
+  uint32_t sgdByteLength[2];
+};
+
+struct Ktx2Level {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+static int BlockBytes(const BlockFormat format) {
+  return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+size_t CompressedTexture::GetByteSize() const {
+  size_t bytes = 0;
+  for (const auto &level : levels) {
+    bytes += level.size();
+  }
+  return bytes;
+}
+
+// 5:6:5 color from 0-255 floats, and back with the low bits replicated
+// like the hardware does.
+static uint16_t PackRGB565(const glm::vec3 &c) {
+  int r = (int)std::lround(glm::clamp(c.r, 0.0f, 255.0f) * 31.0f / 255.0f);
+  int g = (int)std::lround(glm::clamp(c.g, 0.0f, 255.0f) * 63.0f / 255.0f);
+  int b = (int)std::lround(glm::clamp(c.b, 0.0f, 255.0f) * 31.0f / 255.0f);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static glm::vec3 UnpackRGB565(const uint16_t v) {
+  int r = (v >> 11) & 31;
+  int g = (v >> 5) & 63;
+  int b = v & 31;
+  return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4),
+                   (b << 3) | (b >> 2));
+}
+
+// Colors of a 4-color BC1 block in index order.
+static void BC1Palette(const uint16_t c0, const uint16_t c1,
+                       glm::vec3 palette[4]) {
+  palette[0] = UnpackRGB565(c0);
+  palette[1] = UnpackRGB565(c1);
+  palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+  palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+}
+
+// Endpoints at the ends of the principal axis of the block's colors, pulled
+// in by 1/16 of the range, then the closest palette entry per texel. Always
+// the 4-color mode, which is also the only mode of the BC3 color block.
+static void EncodeBC1Block(const glm::vec3 texels[16], unsigned char *out) {
+  glm::vec3 mean(0.0f);
+  glm::vec3 boxMin(255.0f), boxMax(0.0f);
+  for (int i = 0; i < 16; ++i) {
+    mean += texels[i];
+    boxMin = glm::min(boxMin, texels[i]);
+    boxMax = glm::max(boxMax, texels[i]);
+  }
+  mean /= 16.0f;
+  glm::mat3x3 covariance(0.0f);
+  for (int i = 0; i < 16; ++i) {
+    glm::vec3 d = texels[i] - mean;
+    covariance += glm::outerProduct(d, d);
+  }
+  glm::vec3 axis = boxMax - boxMin;
+  for (int iteration = 0; iteration < 4; ++iteration) {
+    glm::vec3 next = covariance * axis;
+    float length = glm::length(next);
+    if (length < 1e-6f) {
+      break;
+    }
+    axis = next / length;
+  }
+  float tMin = 0.0f, tMax = 0.0f;
+  if (glm::dot(axis, axis) > 1e-12f) {
+    axis = glm::normalize(axis);
+    tMin = tMax = glm::dot(texels[0] - mean, axis);
+    for (int i = 1; i < 16; ++i) {
+      float t = glm::dot(texels[i] - mean, axis);
+      tMin = glm::min(tMin, t);
+      tMax = glm::max(tMax, t);
+    }
+  }
+  const float inset = (tMax - tMin) / 16.0f;
+  uint16_t c0 = PackRGB565(mean + axis * (tMax - inset));
+  uint16_t c1 = PackRGB565(mean + axis * (tMin + inset));
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+
+  uint32_t indices = 0;
+  if (c0 != c1) {
+    glm::vec3 palette[4];
+    BC1Palette(c0, c1, palette);
+    for (int i = 0; i < 16; ++i) {
+      int best = 0;
+      float bestError = FLT_MAX;
+      for (int p = 0; p < 4; ++p) {
+        glm::vec3 d = texels[i] - palette[p];
+        float error = glm::dot(d, d);
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= (uint32_t)best << (2 * i);
+    }
+  }
+  out[0] = (unsigned char)(c0 & 0xFF);
+  out[1] = (unsigned char)(c0 >> 8);
+  out[2] = (unsigned char)(c1 & 0xFF);
+  out[3] = (unsigned char)(c1 >> 8);
+  for (int i = 0; i < 4; ++i) {
+    out[4 + i] = (unsigned char)(indices >> (8 * i));
+  }
+}
+
+// Values of an 8-value BC4 block (a0 > a1) in index order.
+static void BC4Palette(const int a0, const int a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1) {
+    for (int i = 2; i < 8; ++i) {
+      palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+    }
+  } else {
+    for (int i = 2; i < 6; ++i) {
+      palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+static void EncodeBC4Block(const unsigned char values[16],
+                           unsigned char *out) {
+  int a0 = values[0], a1 = values[0];
+  for (int i = 1; i < 16; ++i) {
+    a0 = std::max(a0, (int)values[i]);
+    a1 = std::min(a1, (int)values[i]);
+  }
+  uint64_t indices = 0;
+  if (a0 != a1) {
+    int palette[8];
+    BC4Palette(a0, a1, palette);
+    for (int i = 0; i < 16; ++i) {
+      int best = 0;
+      int bestError = 256;
+      for (int p = 0; p < 8; ++p) {
+        int error = std::abs((int)values[i] - palette[p]);
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= (uint64_t)best << (3 * i);
+    }
+  }
+  out[0] = (unsigned char)a0;
+  out[1] = (unsigned char)a1;
+  for (int i = 0; i < 6; ++i) {
+    out[2 + i] = (unsigned char)(indices >> (8 * i));
+  }
+}
+
+static void DecodeBC1Block(const unsigned char *block, const bool fourColor,
+                           unsigned char rgb[16][3]) {
+  const uint16_t c0 = (uint16_t)(block[0] | (block[1] << 8));
+  const uint16_t c1 = (uint16_t)(block[2] | (block[3] << 8));
+  glm::vec3 palette[4];
+  BC1Palette(c0, c1, palette);
+  if (!fourColor && c0 <= c1) {
+    palette[2] = 0.5f * (palette[0] + palette[1]);
+    palette[3] = glm::vec3(0.0f);
+  }
+  for (int i = 0; i < 16; ++i) {
+    const int index = (block[4 + i / 4] >> (2 * (i % 4))) & 3;
+    for (int c = 0; c < 3; ++c) {
+      rgb[i][c] = (unsigned char)std::lround(palette[index][c]);
+    }
+  }
+}
+
+static void DecodeBC4Block(const unsigned char *block,
+                           unsigned char values[16]) {
+  int palette[8];
+  BC4Palette(block[0], block[1], palette);
+  uint64_t indices = 0;
+  for (int i = 0; i < 6; ++i) {
+    indices |= (uint64_t)block[2 + i] << (8 * i);
+  }
+  for (int i = 0; i < 16; ++i) {
+    values[i] = (unsigned char)palette[(indices >> (3 * i)) & 7];
+  }
+}
+
+// Reverse the first rows rows of a block. A BC1 block has one index byte
+// per row, a BC4 block 12 index bits per row.
+static void FlipBC1Rows(unsigned char *block, const int rows) {
+  std::reverse(block + 4, block + 4 + rows);
+}
+
+static void FlipBC4Rows(unsigned char *block, const int rows) {
+  uint64_t indices = 0;
+  for (int i = 0; i < 6; ++i) {
+    indices |= (uint64_t)block[2 + i] << (8 * i);
+  }
+  uint64_t flipped = indices;
+  for (int r = 0; r < rows; ++r) {
+    const uint64_t row = (indices >> (12 * (rows - 1 - r))) & 0xFFF;
+    flipped &= ~((uint64_t)0xFFF << (12 * r));
+    flipped |= row << (12 * r);
+  }
+  for (int i = 0; i < 6; ++i) {
+    block[2 + i] = (unsigned char)(flipped >> (8 * i));
+  }
+}
+
+namespace BlockCompression {
+
+const char *FormatName(const BlockFormat format) {
+  switch (format) {
+    case BlockFormat::BC1:
+      return "BC1";
+    case BlockFormat::BC3:
+      return "BC3";
+    case BlockFormat::BC5:
+      return "BC5";
+    case BlockFormat::BC7:
+      return "BC7";
+  }
+  return "?";
+}
+
+size_t LevelBytes(const BlockFormat format, const int width,
+                  const int height) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+}
+
+// Copies the mip levels that follow a header. Returns false if the file is
+// too short.
+static bool ReadLevels(const std::vector<char> &data, size_t offset,
+                       const int numLevels, CompressedTexture &texture) {
+  int width = texture.width;
+  int height = texture.height;
+  texture.levels.resize(numLevels);
+  for (int level = 0; level < numLevels; ++level) {
+    const size_t bytes = LevelBytes(texture.format, width, height);
+    if (offset + bytes > data.size()) {
+      return false;
+    }
+    texture.levels[level].assign(data.begin() + offset,
+                                 data.begin() + offset + bytes);
+    offset += bytes;
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
+  return true;
+}
+
+bool LoadDDS(const std::string &filePath, CompressedTexture &texture,
+             uint64_t *sourceHash) {
+  std::vector<char> data;
+  if (!FileCache::ReadFile(filePath, data)) {
+    std::cerr << "[ERROR] Failed to read DDS file: " << filePath << std::endl;
+    return false;
+  }
+  DdsHeader header;
+  if (data.size() < 4 + sizeof(header) ||
+      std::memcmp(data.data(), "DDS ", 4) != 0) {
+    std::cerr << "[ERROR] Not a DDS file: " << filePath << std::endl;
+    return false;
+  }
+  std::memcpy(&header, data.data() + 4, sizeof(header));
+  size_t offset = 4 + sizeof(header);
+
+  bool known = (header.pixelFormat.flags & kDdsPixelFourCC) != 0;
+  const uint32_t fourCC = header.pixelFormat.fourCC;
+  texture.srgb = false;
+  if (fourCC == MakeFourCC('D', 'X', 'T', '1')) {
+    texture.format = BlockFormat::BC1;
+  } else if (fourCC == MakeFourCC('D', 'X', 'T', '5') ||
+             fourCC == MakeFourCC('D', 'X', 'T', '4')) {
+    texture.format = BlockFormat::BC3;
+  } else if (fourCC == MakeFourCC('A', 'T', 'I', '2') ||
+             fourCC == MakeFourCC('B', 'C', '5', 'U')) {
+    texture.format = BlockFormat::BC5;
+  } else if (fourCC == MakeFourCC('D', 'X', '1', '0')) {
+    DdsHeaderDX10 dx10;
+    if (data.size() < offset + sizeof(dx10)) {
+      known = false;
+    } else {
+      std::memcpy(&dx10, data.data() + offset, sizeof(dx10));
+      offset += sizeof(dx10);
+      known = known && dx10.arraySize <= 1 &&
+              dx10.resourceDimension == kDdsDimensionTexture2D;
+      switch (dx10.dxgiFormat) {
+        case 71:  // BC1_UNORM
+        case 72:  // BC1_UNORM_SRGB
+          texture.format = BlockFormat::BC1;
+          break;
+        case 77:  // BC3_UNORM
+        case 78:  // BC3_UNORM_SRGB
+          texture.format = BlockFormat::BC3;
+          break;
+        case 83:  // BC5_UNORM
+          texture.format = BlockFormat::BC5;
+          break;
+        case 98:  // BC7_UNORM
+        case 99:  // BC7_UNORM_SRGB
+          texture.format = BlockFormat::BC7;
+          break;
+        default:
+          known = false;
+          break;
+      }
+      texture.srgb = dx10.dxgiFormat == 72 || dx10.dxgiFormat == 78 ||
+                     dx10.dxgiFormat == 99;
+    }
+  } else {
+    known = false;
+  }
+  if (!known || (header.caps2 & kDdsCaps2Cubemap) != 0) {
+    std::cerr << "[ERROR] Unsupported DDS format (BC1/BC3/BC5/BC7 2D "
+                 "textures only): "
+              << filePath << std::endl;
+    return false;
+  }
+
+  texture.width = (int)header.width;
+  texture.height = (int)header.height;
+  const int numLevels =
+      (header.flags & kDdsFlagsMipMapCount) != 0 && header.mipMapCount > 0
+          ? (int)header.mipMapCount
+          : 1;
+  if (texture.width <= 0 || texture.height <= 0 ||
+      !ReadLevels(data, offset, numLevels, texture)) {
+    std::cerr << "[ERROR] Truncated DDS file: " << filePath << std::endl;
+    return false;
+  }
+  if (sourceHash != nullptr) {
+    *sourceHash = header.reserved1[0] == kCacheMarker
+                      ? (uint64_t)header.reserved1[1] |
+                            ((uint64_t)header.reserved1[2] << 32)
+                      : 0;
+  }
+  return true;
+}
+
+bool LoadKTX2(const std::string &filePath, CompressedTexture &texture) {
+  std::vector<char> data;
+  if (!FileCache::ReadFile(filePath, data)) {
+    std::cerr << "[ERROR] Failed to read KTX2 file: " << filePath
+              << std::endl;
+    return false;
+  }
+  Ktx2Header header;
+  if (data.size() < sizeof(kKtx2Identifier) + sizeof(header) ||
+      std::memcmp(data.data(), kKtx2Identifier, sizeof(kKtx2Identifier)) !=
+          0) {
+    std::cerr << "[ERROR] Not a KTX2 file: " << filePath << std::endl;
+    return false;
+  }
+  std::memcpy(&header, data.data() + sizeof(kKtx2Identifier), sizeof(header));
+
+  bool known = true;
+  texture.srgb = false;
+  switch (header.vkFormat) {
+    case 131:  // BC1_RGB_UNORM_BLOCK
+    case 133:  // BC1_RGBA_UNORM_BLOCK
+      texture.format = BlockFormat::BC1;
+      break;
+    case 132:  // BC1_RGB_SRGB_BLOCK
+    case 134:  // BC1_RGBA_SRGB_BLOCK
+      texture.format = BlockFormat::BC1;
+      texture.srgb = true;
+      break;
+    case 137:  // BC3_UNORM_BLOCK
+      texture.format = BlockFormat::BC3;
+      break;
+    case 138:  // BC3_SRGB_BLOCK
+      texture.format = BlockFormat::BC3;
+      texture.srgb = true;
+      break;
+    case 141:  // BC5_UNORM_BLOCK
+      texture.format = BlockFormat::BC5;
+      break;
+    case 145:  // BC7_UNORM_BLOCK
+      texture.format = BlockFormat::BC7;
+      break;
+    case 146:  // BC7_SRGB_BLOCK
+      texture.format = BlockFormat::BC7;
+      texture.srgb = true;
+      break;
+    default:
+      known = false;
+      break;
+  }
+  if (!known || header.supercompressionScheme != 0 ||
+      header.pixelDepth > 1 || header.layerCount > 1 ||
+      header.faceCount != 1) {
+    std::cerr << "[ERROR] Unsupported KTX2 format (BC1/BC3/BC5/BC7 2D "
+                 "textures without supercompression only): "
+              << filePath << std::endl;
+    return false;
+  }
+
+  texture.width = (int)header.pixelWidth;
+  texture.height = (int)header.pixelHeight;
+  const int numLevels = std::max(1, (int)header.levelCount);
+  const size_t indexOffset = sizeof(kKtx2Identifier) + sizeof(header);
+  bool ok = texture.width > 0 && texture.height > 0 &&
+            indexOffset + numLevels * sizeof(Ktx2Level) <= data.size();
+  texture.levels.resize(numLevels);
+  int width = texture.width;
+  int height = texture.height;
+  for (int level = 0; ok && level < numLevels; ++level) {
+    Ktx2Level entry;
+    std::memcpy(&entry, data.data() + indexOffset + level * sizeof(entry),
+                sizeof(entry));
+    const size_t bytes = LevelBytes(texture.format, width, height);
+    ok = entry.byteLength >= bytes &&
+         entry.byteOffset + bytes <= (uint64_t)data.size();
+    if (ok) {
+      texture.levels[level].assign(data.begin() + entry.byteOffset,
+                                   data.begin() + entry.byteOffset + bytes);
+    }
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
+  if (!ok) {
+    std::cerr << "[ERROR] Truncated KTX2 file: " << filePath << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SaveDDS(const std::string &filePath, const CompressedTexture &texture,
+             const uint64_t sourceHash) {
+  DdsHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.size = sizeof(header);
+  header.flags = kDdsFlagsCaps | kDdsFlagsHeight | kDdsFlagsWidth |
+                 kDdsFlagsPixelFormat | kDdsFlagsMipMapCount |
+                 kDdsFlagsLinearSize;
+  header.height = (uint32_t)texture.height;
+  header.width = (uint32_t)texture.width;
+  header.pitchOrLinearSize =
+      texture.levels.empty() ? 0 : (uint32_t)texture.levels[0].size();
+  header.mipMapCount = (uint32_t)texture.levels.size();
+  header.reserved1[0] = kCacheMarker;
+  header.reserved1[1] = (uint32_t)(sourceHash & 0xFFFFFFFFu);
+  header.reserved1[2] = (uint32_t)(sourceHash >> 32);
+  header.pixelFormat.size = sizeof(DdsPixelFormat);
+  header.pixelFormat.flags = kDdsPixelFourCC;
+  header.caps = kDdsCapsTexture |
+                (texture.levels.size() > 1 ? kDdsCapsComplex | kDdsCapsMipMap
+                                           : 0);
+  const bool dx10 = texture.format == BlockFormat::BC7 || texture.srgb;
+  switch (texture.format) {
+    case BlockFormat::BC1:
+      header.pixelFormat.fourCC = MakeFourCC('D', 'X', 'T', '1');
+      break;
+    case BlockFormat::BC3:
+      header.pixelFormat.fourCC = MakeFourCC('D', 'X', 'T', '5');
+      break;
+    case BlockFormat::BC5:
+      header.pixelFormat.fourCC = MakeFourCC('A', 'T', 'I', '2');
+      break;
+    case BlockFormat::BC7:
+      break;
+  }
+  DdsHeaderDX10 headerDX10;
+  std::memset(&headerDX10, 0, sizeof(headerDX10));
+  if (dx10) {
+    static const uint32_t kDxgiFormats[4][2] = {
+        {71, 72}, {77, 78}, {83, 83}, {kDxgiBC7, kDxgiBC7 + 1}};
+    header.pixelFormat.fourCC = MakeFourCC('D', 'X', '1', '0');
+    headerDX10.dxgiFormat =
+        kDxgiFormats[(int)texture.format][texture.srgb ? 1 : 0];
+    headerDX10.resourceDimension = kDdsDimensionTexture2D;
+    headerDX10.arraySize = 1;
+  }
+
+  std::vector<char> data(4 + sizeof(header) +
+                         (dx10 ? sizeof(headerDX10) : 0));
+  std::memcpy(data.data(), "DDS ", 4);
+  std::memcpy(data.data() + 4, &header, sizeof(header));
+  if (dx10) {
+    std::memcpy(data.data() + 4 + sizeof(header), &headerDX10,
+                sizeof(headerDX10));
+  }
+  for (const auto &level : texture.levels) {
+    data.insert(data.end(), level.begin(), level.end());
+  }
+  return FileCache::WriteFile(filePath, data.data(), data.size());
+}
+
+CompressedTexture Encode(const cv::Mat &image, const BlockFormat format) {
+  CompressedTexture texture;
+  texture.format = format;
+  texture.width = image.cols;
+  texture.height = image.rows;
+  if (format == BlockFormat::BC7 || image.empty()) {
+    std::cerr << "[ERROR] Cannot encode to " << FormatName(format)
+              << std::endl;
+    return texture;
+  }
+
+  // BC5 usually holds normals or other data, not colors.
+  std::vector<cv::Mat> mips;
+  MipGenerator::Generate(image, MipFilter::Box, format != BlockFormat::BC5,
+                         mips);
+
+  const int channels = image.channels();
+  const int blockBytes = BlockBytes(format);
+  texture.levels.resize(mips.size());
+  for (size_t level = 0; level < mips.size(); ++level) {
+    const cv::Mat &mip = mips[level];
+    const int blocksX = (mip.cols + 3) / 4;
+    const int blocksY = (mip.rows + 3) / 4;
+    std::vector<unsigned char> &out = texture.levels[level];
+    out.resize(LevelBytes(format, mip.cols, mip.rows));
+    ThreadPool::Get().ParallelFor(
+        blocksY, 4, [&](const int begin, const int end) {
+          glm::vec3 rgb[16];
+          unsigned char red[16], green[16], alpha[16];
+          for (int by = begin; by < end; ++by) {
+            for (int bx = 0; bx < blocksX; ++bx) {
+              // Edge texels are repeated into partial blocks.
+              for (int i = 0; i < 16; ++i) {
+                const int x = std::min(bx * 4 + i % 4, mip.cols - 1);
+                const int y = std::min(by * 4 + i / 4, mip.rows - 1);
+                const unsigned char *p = mip.ptr<unsigned char>(y) +
+                                         x * channels;
+                red[i] = channels >= 3 ? p[2] : p[0];
+                green[i] = channels >= 3 ? p[1] : p[0];
+                rgb[i] = glm::vec3(red[i], green[i], p[0]);
+                alpha[i] = channels == 4 ? p[3] : 255;
+              }
+              unsigned char *block =
+                  out.data() + ((size_t)by * blocksX + bx) * blockBytes;
+              switch (format) {
+                case BlockFormat::BC1:
+                  EncodeBC1Block(rgb, block);
+                  break;
+                case BlockFormat::BC3:
+                  EncodeBC4Block(alpha, block);
+                  EncodeBC1Block(rgb, block + 8);
+                  break;
+                case BlockFormat::BC5:
+                  EncodeBC4Block(red, block);
+                  EncodeBC4Block(green, block + 8);
+                  break;
+                case BlockFormat::BC7:
+                  break;
+              }
+            }
+          }
+        });
+  }
+  return texture;
+}
+
+bool DecodeTopLevel(const CompressedTexture &texture, cv::Mat &image) {
+  if (texture.format == BlockFormat::BC7 || texture.levels.empty()) {
+    return false;
+  }
+  const bool hasAlpha = texture.format == BlockFormat::BC3;
+  const int channels = hasAlpha ? 4 : 3;
+  image.create(texture.height, texture.width, hasAlpha ? CV_8UC4 : CV_8UC3);
+  const int blocksX = (texture.width + 3) / 4;
+  const int blocksY = (texture.height + 3) / 4;
+  const int blockBytes = BlockBytes(texture.format);
+  const unsigned char *data = texture.levels[0].data();
+  ThreadPool::Get().ParallelFor(
+      blocksY, 16, [&](const int begin, const int end) {
+        unsigned char rgb[16][3];
+        unsigned char alpha[16], green[16];
+        for (int by = begin; by < end; ++by) {
+          for (int bx = 0; bx < blocksX; ++bx) {
+            const unsigned char *block =
+                data + ((size_t)by * blocksX + bx) * blockBytes;
+            switch (texture.format) {
+              case BlockFormat::BC1:
+                DecodeBC1Block(block, false, rgb);
+                break;
+              case BlockFormat::BC3:
+                DecodeBC4Block(block, alpha);
+                DecodeBC1Block(block + 8, true, rgb);
+                break;
+              case BlockFormat::BC5:
+                DecodeBC4Block(block, alpha);
+                DecodeBC4Block(block + 8, green);
+                for (int i = 0; i < 16; ++i) {
+                  rgb[i][0] = alpha[i];
+                  rgb[i][1] = green[i];
+                  rgb[i][2] = 0;
+                }
+                break;
+              case BlockFormat::BC7:
+                break;
+            }
+            for (int i = 0; i < 16; ++i) {
+              const int x = bx * 4 + i % 4;
+              const int y = by * 4 + i / 4;
+              if (x >= texture.width || y >= texture.height) {
+                continue;
+              }
+              unsigned char *p = image.ptr<unsigned char>(y) + x * channels;
+              p[0] = rgb[i][2];
+              p[1] = rgb[i][1];
+              p[2] = rgb[i][0];
+              if (hasAlpha) {
+                p[3] = alpha[i];
+              }
+            }
+          }
+        }
+      });
+  return true;
+}
+
+bool FlipVertically(CompressedTexture &texture) {
+  if (texture.format == BlockFormat::BC7) {
+    return false;
+  }
+  const int blockBytes = BlockBytes(texture.format);
+  int width = texture.width;
+  int height = texture.height;
+  for (auto &level : texture.levels) {
+    const int blocksX = (width + 3) / 4;
+    const int blocksY = (height + 3) / 4;
+    const size_t rowBytes = (size_t)blocksX * blockBytes;
+    for (int by = 0; by < blocksY / 2; ++by) {
+      std::swap_ranges(level.begin() + by * rowBytes,
+                       level.begin() + (by + 1) * rowBytes,
+                       level.begin() + (blocksY - 1 - by) * rowBytes);
+    }
+    // Levels shorter than a block keep their rows at the block's top. Other
+    // heights that are not a multiple of 4 end up shifted by the padding.
+    const int rows = std::min(height, 4);
+    for (size_t offset = 0; offset < level.size(); offset += blockBytes) {
+      unsigned char *block = level.data() + offset;
+      switch (texture.format) {
+        case BlockFormat::BC1:
+          FlipBC1Rows(block, rows);
+          break;
+        case BlockFormat::BC3:
+          FlipBC4Rows(block, rows);
+          FlipBC1Rows(block + 8, rows);
+          break;
+        case BlockFormat::BC5:
+          FlipBC4Rows(block, rows);
+          FlipBC4Rows(block + 8, rows);
+          break;
+        case BlockFormat::BC7:
+          break;
+      }
+    }
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
+  return true;
+}
+
+bool IsSupported(const BlockFormat format) {
+  switch (format) {
+    case BlockFormat::BC1:
+    case BlockFormat::BC3:
+      return GLEW_EXT_texture_compression_s3tc;
+    case BlockFormat::BC5:
+      // RGTC is core since GL 3.0.
+      return true;
+    case BlockFormat::BC7:
+      return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+  }
+  return false;
+}
+
+GLenum GetGLFormat(const BlockFormat format, const bool srgb) {
+  switch (format) {
+    case BlockFormat::BC1:
+      return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+                  : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    case BlockFormat::BC3:
+      return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+                  : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BlockFormat::BC5:
+      return GL_COMPRESSED_RG_RGTC2;
+    case BlockFormat::BC7:
+      return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+                  : GL_COMPRESSED_RGBA_BPTC_UNORM;
+  }
+  return GL_NONE;
+}
+
+}  // namespace BlockCompression
@@ -0,0 +1,60 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include "headers.h"
+
+// GPU block formats, all made of 4x4 texel blocks.
+enum class BlockFormat {
+  BC1,  // RGB, 8 bytes per block.
+  BC3,  // RGBA, BC1 color plus BC4 alpha, 16 bytes.
+  BC5,  // RG, two BC4 channels, 16 bytes.
+  BC7,  // RGBA, 16 bytes. Loaded from files only.
+};
+
+// A block-compressed mip chain, largest level first. Rows are in file order
+// (top row first) unless FlipVertically was applied.
+struct CompressedTexture {
+  BlockFormat format = BlockFormat::BC1;
+  bool srgb = false;
+  int width = 0;
+  int height = 0;
+  std::vector<std::vector<unsigned char>> levels;
+
+  size_t GetByteSize() const;
+};
+
+// Loading, saving and encoding of BC textures. DDS (legacy FourCC and DX10
+// headers) and KTX2 (without supercompression) are read directly; DDS is
+// also the format of the encoder's cache files.
+namespace BlockCompression {
+
+const char *FormatName(const BlockFormat format);
+size_t LevelBytes(const BlockFormat format, const int width, const int height);
+
+bool LoadDDS(const std::string &filePath, CompressedTexture &texture,
+             uint64_t *sourceHash = nullptr);
+bool LoadKTX2(const std::string &filePath, CompressedTexture &texture);
+// sourceHash is kept in the reserved header words, so a cache file can be
+// checked against its source (see LoadDDS).
+bool SaveDDS(const std::string &filePath, const CompressedTexture &texture,
+             const uint64_t sourceHash);
+
+// Encodes an 8-bit BGR or BGRA image (OpenCV layout, top row first) and its
+// mips (box-filtered in linear space) to BC1, BC3 or BC5, block rows spread
+// over the thread pool.
+CompressedTexture Encode(const cv::Mat &image, const BlockFormat format);
+// Decodes the largest level to BGR (BC1, BC5) or BGRA (BC3), keeping the
+// row order. BC7 is not supported.
+bool DecodeTopLevel(const CompressedTexture &texture, cv::Mat &image);
+// Turns file order into the bottom-up order GL expects by moving whole
+// block rows and the rows inside every block. BC7 blocks cannot be flipped
+// this way; returns false for them.
+bool FlipVertically(CompressedTexture &texture);
+
+// A current GL context is required for these two.
+bool IsSupported(const BlockFormat format);
+GLenum GetGLFormat(const BlockFormat format, const bool srgb);
+
+}  // namespace BlockCompression
+
+#endif
@@ -0,0 +1,767 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "profiler.h"
+#include "scene_obj.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+namespace {
+
+// Bins per axis; small nodes use one bin per primitive.
+const int kNumBins = 16;
+// Leaves never hold more primitives than this unless they cannot be split.
+const int kMaxLeafSize = 8;
+// Cost of visiting a node relative to testing one primitive.
+const float kTraversalCost = 1.0f;
+// Ranges at least this large are binned on all threads...
+const int kParallelBinSize = 64 * 1024;
+// ...and their two subtrees are built concurrently.
+const int kParallelSubtreeSize = 8 * 1024;
+// Deeper nodes become leaves, so the traversal stack cannot overflow.
+const int kStackSize = 64;
+
+struct Box {
+  Box()
+      : min(std::numeric_limits<float>::infinity()),
+        max(-std::numeric_limits<float>::infinity()) {}
+  // Spelled out per component: glm::min is not always inlined, and this is
+  // the innermost loop of the build.
+  void Grow(const glm::vec3 &p) { Grow(p, p); }
+  void Grow(const Box &b) { Grow(b.min, b.max); }
+  void Grow(const glm::vec3 &lo, const glm::vec3 &hi) {
+    min.x = lo.x < min.x ? lo.x : min.x;
+    min.y = lo.y < min.y ? lo.y : min.y;
+    min.z = lo.z < min.z ? lo.z : min.z;
+    max.x = hi.x > max.x ? hi.x : max.x;
+    max.y = hi.y > max.y ? hi.y : max.y;
+    max.z = hi.z > max.z ? hi.z : max.z;
+  }
+  float HalfArea() const {
+    glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+  }
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+struct Bin {
+  Bin() : count(0) {}
+  Box bounds;
+  int count;
+};
+
+// Primitives are partitioned by value rather than through an index array,
+// so every pass over a node reads memory in order.
+struct BuildPrim {
+  glm::vec3 min;
+  unsigned int index;
+  glm::vec3 max;
+  float pad;
+  glm::vec3 Centroid() const { return 0.5f * (min + max); }
+};
+
+struct BuildContext {
+  std::vector<BuildPrim> prims;
+};
+
+// Bounds of the primitives [begin, end) and of their centroids.
+void ComputeRangeBounds(const BuildContext &ctx, const int begin,
+                        const int end, Box &bounds, Box &centroidBounds) {
+  auto accumulate = [&ctx](const int b, const int e, Box &box, Box &cbox) {
+    for (int i = b; i < e; i++) {
+      const BuildPrim &prim = ctx.prims[i];
+      box.Grow(prim.min, prim.max);
+      cbox.Grow(prim.Centroid());
+    }
+  };
+  const int count = end - begin;
+  if (count < kParallelBinSize) {
+    accumulate(begin, end, bounds, centroidBounds);
+    return;
+  }
+  const int grain = kParallelBinSize / 4;
+  const int numChunks = (count + grain - 1) / grain;
+  std::vector<Box> boxes(numChunks), cboxes(numChunks);
+  ThreadPool::Get().ParallelFor(count, grain, [&](const int b, const int e) {
+    accumulate(begin + b, begin + e, boxes[b / grain], cboxes[b / grain]);
+  });
+  for (int i = 0; i < numChunks; i++) {
+    bounds.Grow(boxes[i]);
+    centroidBounds.Grow(cboxes[i]);
+  }
+}
+
+int BinIndex(const float c, const float cmin, const float scale,
+             const int numBins) {
+  int bin = (int)((c - cmin) * scale);
+  return std::min(std::max(bin, 0), numBins - 1);
+}
+
+// Counts and bounds of the primitives in each bin along each axis.
+void BinRange(const BuildContext &ctx, const int begin, const int end,
+              const Box &centroidBounds, const int numBins,
+              Bin bins[3][kNumBins]) {
+  glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+  glm::vec3 scale;
+  for (int axis = 0; axis < 3; axis++) {
+    scale[axis] = extent[axis] > 0.0f ? numBins / extent[axis] : 0.0f;
+  }
+  auto binPrims = [&](const int b, const int e, Bin local[3][kNumBins]) {
+    for (int i = b; i < e; i++) {
+      const BuildPrim &prim = ctx.prims[i];
+      const glm::vec3 c = prim.Centroid();
+      for (int axis = 0; axis < 3; axis++) {
+        Bin &bin =
+            local[axis][BinIndex(c[axis], centroidBounds.min[axis], scale[axis],
+                                 numBins)];
+        bin.count++;
+        bin.bounds.Grow(prim.min, prim.max);
+      }
+    }
+  };
+  const int count = end - begin;
+  if (count < kParallelBinSize) {
+    binPrims(begin, end, bins);
+    return;
+  }
+  struct ChunkBins {
+    Bin bins[3][kNumBins];
+  };
+  const int grain = kParallelBinSize / 4;
+  std::vector<ChunkBins> chunks((count + grain - 1) / grain);
+  ThreadPool::Get().ParallelFor(count, grain, [&](const int b, const int e) {
+    binPrims(begin + b, begin + e, chunks[b / grain].bins);
+  });
+  for (const ChunkBins &chunk : chunks) {
+    for (int axis = 0; axis < 3; axis++) {
+      for (int i = 0; i < numBins; i++) {
+        bins[axis][i].count += chunk.bins[axis][i].count;
+        bins[axis][i].bounds.Grow(chunk.bins[axis][i].bounds);
+      }
+    }
+  }
+}
+
+void SetNodeBounds(BVHNode &node, const Box &bounds) {
+  for (int axis = 0; axis < 3; axis++) {
+    node.boundsMin[axis] = bounds.min[axis];
+    node.boundsMax[axis] = bounds.max[axis];
+  }
+}
+
+// Appends the subtree over prims[begin, end) to nodes, depth first.
+void BuildNode(BuildContext &ctx, const int begin, const int end,
+               const int depth, std::vector<BVHNode> &nodes) {
+  const int nodeIndex = (int)nodes.size();
+  nodes.push_back(BVHNode());
+  Box bounds, centroidBounds;
+  ComputeRangeBounds(ctx, begin, end, bounds, centroidBounds);
+  SetNodeBounds(nodes[nodeIndex], bounds);
+
+  const int count = end - begin;
+  auto makeLeaf = [&]() {
+    nodes[nodeIndex].offset = (uint32_t)begin;
+    nodes[nodeIndex].count = (uint16_t)count;
+    nodes[nodeIndex].axis = 0;
+  };
+  if (count <= 2 || (depth >= kStackSize && count <= 0xffff)) {
+    makeLeaf();
+    return;
+  }
+
+  // Find the cheapest bin boundary on any axis.
+  int bestAxis = -1;
+  int bestSplit = 0;
+  float bestCost = std::numeric_limits<float>::infinity();
+  const int numBins = std::min(count, kNumBins);
+  Bin bins[3][kNumBins];
+  BinRange(ctx, begin, end, centroidBounds, numBins, bins);
+  const float invArea = 1.0f / std::max(bounds.HalfArea(), 1e-30f);
+  for (int axis = 0; axis < 3; axis++) {
+    if (centroidBounds.max[axis] <= centroidBounds.min[axis]) {
+      continue;
+    }
+    // rightCost[i]: cost of bins [i + 1, numBins).
+    float rightCost[kNumBins];
+    Box right;
+    int rightCount = 0;
+    for (int i = numBins - 1; i > 0; i--) {
+      right.Grow(bins[axis][i].bounds);
+      rightCount += bins[axis][i].count;
+      rightCost[i - 1] = right.HalfArea() * rightCount;
+    }
+    Box left;
+    int leftCount = 0;
+    for (int i = 0; i < numBins - 1; i++) {
+      left.Grow(bins[axis][i].bounds);
+      leftCount += bins[axis][i].count;
+      if (leftCount == 0 || leftCount == count) {
+        continue;
+      }
+      float cost = kTraversalCost +
+                   (left.HalfArea() * leftCount + rightCost[i]) * invArea;
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = i;
+      }
+    }
+  }
+
+  int mid;
+  if (bestAxis < 0) {
+    // All centroids coincide.
+    if (count <= kMaxLeafSize) {
+      makeLeaf();
+      return;
+    }
+    bestAxis = 0;
+    mid = begin + count / 2;
+  } else {
+    if (bestCost >= (float)count && count <= kMaxLeafSize) {
+      makeLeaf();
+      return;
+    }
+    const float cmin = centroidBounds.min[bestAxis];
+    const float scale =
+        numBins / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+    mid = (int)(std::partition(ctx.prims.begin() + begin,
+                               ctx.prims.begin() + end,
+                               [&](const BuildPrim &prim) {
+                                 return BinIndex(prim.Centroid()[bestAxis],
+                                                 cmin, scale,
+                                                 numBins) <= bestSplit;
+                               }) -
+                ctx.prims.begin());
+  }
+  nodes[nodeIndex].count = 0;
+  nodes[nodeIndex].axis = (uint8_t)bestAxis;
+
+  if (count < kParallelSubtreeSize) {
+    BuildNode(ctx, begin, mid, depth + 1, nodes);
+    nodes[nodeIndex].offset = (uint32_t)nodes.size();
+    BuildNode(ctx, mid, end, depth + 1, nodes);
+    return;
+  }
+
+  // Build both subtrees into their own arrays, then move them in place.
+  std::vector<BVHNode> subtrees[2];
+  const int ranges[3] = {begin, mid, end};
+  ThreadPool::Get().ParallelFor(2, 1, [&](const int b, const int e) {
+    for (int i = b; i < e; i++) {
+      BuildNode(ctx, ranges[i], ranges[i + 1], depth + 1, subtrees[i]);
+    }
+  });
+  for (int i = 0; i < 2; i++) {
+    const uint32_t base = (uint32_t)nodes.size();
+    if (i == 1) {
+      nodes[nodeIndex].offset = base;
+    }
+    for (BVHNode node : subtrees[i]) {
+      if (!node.IsLeaf()) {
+        node.offset += base;
+      }
+      nodes.push_back(node);
+    }
+  }
+}
+
+// Ray/box slab test against the segment [0, tMax].
+inline bool IntersectBox(const BVHNode &node, const glm::vec3 &origin,
+                         const glm::vec3 &invDir, const float tMax) {
+  float tNear = 0.0f;
+  float tFar = tMax;
+  for (int axis = 0; axis < 3; axis++) {
+    float t0 = (node.boundsMin[axis] - origin[axis]) * invDir[axis];
+    float t1 = (node.boundsMax[axis] - origin[axis]) * invDir[axis];
+    if (t0 > t1) std::swap(t0, t1);
+    tNear = t0 > tNear ? t0 : tNear;
+    tFar = t1 < tFar ? t1 : tFar;
+  }
+  return tNear <= tFar;
+}
+
+// Visits the leaves a ray reaches, near child first. leaf(first, count)
+// may shrink tMax; returning true stops the traversal.
+template <typename LeafFunc>
+bool Traverse(const std::vector<BVHNode> &nodes, const glm::vec3 &origin,
+              const glm::vec3 &direction, const float &tMax,
+              const LeafFunc &leaf) {
+  if (nodes.empty()) {
+    return false;
+  }
+  const glm::vec3 invDir = 1.0f / direction;
+  const bool dirIsNeg[3] = {invDir.x < 0.0f, invDir.y < 0.0f, invDir.z < 0.0f};
+  int stack[kStackSize];
+  int stackSize = 0;
+  int current = 0;
+  while (true) {
+    const BVHNode &node = nodes[current];
+    if (IntersectBox(node, origin, invDir, tMax)) {
+      if (node.IsLeaf()) {
+        if (leaf((int)node.offset, (int)node.count)) {
+          return true;
+        }
+      } else if (dirIsNeg[node.axis]) {
+        stack[stackSize++] = current + 1;
+        current = (int)node.offset;
+        continue;
+      } else {
+        stack[stackSize++] = (int)node.offset;
+        current = current + 1;
+        continue;
+      }
+    }
+    if (stackSize == 0) {
+      return false;
+    }
+    current = stack[--stackSize];
+  }
+}
+
+// Packet rays in SIMD registers.
+struct PacketRays {
+  float8 ox, oy, oz;
+  float8 dx, dy, dz;
+  float8 invDx, invDy, invDz;
+  float8 tMax;
+  // Sign of the direction most rays have, per axis.
+  bool dirIsNeg[3];
+};
+
+PacketRays LoadPacket(const RayPacket8 &packet) {
+  PacketRays rays;
+  rays.ox = float8::Load(packet.ox);
+  rays.oy = float8::Load(packet.oy);
+  rays.oz = float8::Load(packet.oz);
+  rays.dx = float8::Load(packet.dx);
+  rays.dy = float8::Load(packet.dy);
+  rays.dz = float8::Load(packet.dz);
+  const float8 one = float8::Broadcast(1.0f);
+  rays.invDx = one / rays.dx;
+  rays.invDy = one / rays.dy;
+  rays.invDz = one / rays.dz;
+  rays.tMax = float8::Load(packet.tMax);
+  const float8 zero = float8::Broadcast(0.0f);
+  const float8 dirs[3] = {rays.dx, rays.dy, rays.dz};
+  for (int axis = 0; axis < 3; axis++) {
+    int negative = MoveMask(dirs[axis] < zero);
+    int bits = 0;
+    for (int i = 0; i < 8; i++) bits += (negative >> i) & 1;
+    rays.dirIsNeg[axis] = bits > 4;
+  }
+  return rays;
+}
+
+// Bit mask of the active lanes whose segment [0, tMax] overlaps the node.
+inline int IntersectBox8(const BVHNode &node, const PacketRays &rays) {
+  const float8 zero = float8::Broadcast(0.0f);
+  const float8 t0x = (float8::Broadcast(node.boundsMin[0]) - rays.ox) * rays.invDx;
+  const float8 t1x = (float8::Broadcast(node.boundsMax[0]) - rays.ox) * rays.invDx;
+  const float8 t0y = (float8::Broadcast(node.boundsMin[1]) - rays.oy) * rays.invDy;
+  const float8 t1y = (float8::Broadcast(node.boundsMax[1]) - rays.oy) * rays.invDy;
+  const float8 t0z = (float8::Broadcast(node.boundsMin[2]) - rays.oz) * rays.invDz;
+  const float8 t1z = (float8::Broadcast(node.boundsMax[2]) - rays.oz) * rays.invDz;
+  float8 tNear = Max(Max(Min(t0x, t1x), Min(t0y, t1y)),
+                     Max(Min(t0z, t1z), zero));
+  float8 tFar = Min(Min(Max(t0x, t1x), Max(t0y, t1y)),
+                    Min(Max(t0z, t1z), rays.tMax));
+  return MoveMask((tNear <= tFar) & (rays.tMax > zero));
+}
+
+template <typename LeafFunc>
+void TraversePacket(const std::vector<BVHNode> &nodes, PacketRays &rays,
+                    const LeafFunc &leaf) {
+  if (nodes.empty()) {
+    return;
+  }
+  int stack[kStackSize];
+  int stackSize = 0;
+  int current = 0;
+  while (true) {
+    const BVHNode &node = nodes[current];
+    if (IntersectBox8(node, rays) != 0) {
+      if (node.IsLeaf()) {
+        leaf((int)node.offset, (int)node.count, rays);
+      } else if (rays.dirIsNeg[node.axis]) {
+        stack[stackSize++] = current + 1;
+        current = (int)node.offset;
+        continue;
+      } else {
+        stack[stackSize++] = (int)node.offset;
+        current = current + 1;
+        continue;
+      }
+    }
+    if (stackSize == 0) {
+      return;
+    }
+    current = stack[--stackSize];
+  }
+}
+
+using BuildClock = std::chrono::steady_clock;
+
+}  // namespace
+
+void RayPacket8::Set(const int lane, const Ray &ray) {
+  ox[lane] = ray.origin.x;
+  oy[lane] = ray.origin.y;
+  oz[lane] = ray.origin.z;
+  dx[lane] = ray.direction.x;
+  dy[lane] = ray.direction.y;
+  dz[lane] = ray.direction.z;
+  tMax[lane] = ray.tMax;
+}
+
+PacketHit8::PacketHit8() {
+  for (int i = 0; i < 8; i++) {
+    object[i] = subMesh[i] = triangle[i] = -1;
+    t[i] = u[i] = v[i] = 0.0f;
+  }
+}
+
+void BuildBVH(const std::vector<glm::vec3> &primMin,
+              const std::vector<glm::vec3> &primMax,
+              std::vector<BVHNode> &nodes, std::vector<unsigned int> &order,
+              BVHBuildStats &stats) {
+  PROFILE_SCOPE("Build BVH");
+  const BuildClock::time_point start = BuildClock::now();
+  const int count = (int)primMin.size();
+  nodes.clear();
+  order.resize(count);
+  BuildContext ctx;
+  ctx.prims.resize(count);
+  ThreadPool::Get().ParallelFor(count, 16 * 1024, [&](const int b,
+                                                      const int e) {
+    for (int i = b; i < e; i++) {
+      ctx.prims[i].min = primMin[i];
+      ctx.prims[i].max = primMax[i];
+      ctx.prims[i].index = (unsigned int)i;
+    }
+  });
+  if (count > 0) {
+    BuildNode(ctx, 0, count, 1, nodes);
+  }
+  for (int i = 0; i < count; i++) {
+    order[i] = ctx.prims[i].index;
+  }
+
+  stats = BVHBuildStats();
+  stats.buildMs = MsSince(start);
+  stats.numNodes = (int)nodes.size();
+  stats.numPrimitives = count;
+  stats.memoryBytes = nodes.size() * sizeof(BVHNode);
+  // Leaf count and depth.
+  std::vector<std::pair<int, int>> stack;
+  if (!nodes.empty()) {
+    stack.push_back(std::make_pair(0, 1));
+  }
+  while (!stack.empty()) {
+    std::pair<int, int> entry = stack.back();
+    stack.pop_back();
+    const BVHNode &node = nodes[entry.first];
+    stats.maxDepth = std::max(stats.maxDepth, entry.second);
+    if (node.IsLeaf()) {
+      stats.numLeaves++;
+    } else {
+      stack.push_back(std::make_pair(entry.first + 1, entry.second + 1));
+      stack.push_back(std::make_pair((int)node.offset, entry.second + 1));
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+// MeshBVH Public Methods.
+// ---------------------------------------------------------------------------
+
+void MeshBVH::Build(TriangleMesh *mesh) {
+  const BuildClock::time_point start = BuildClock::now();
+  const std::vector<VertexPTN> &vertices = mesh->GetVertices();
+  std::vector<Triangle> source;
+  source.reserve(mesh->GetNumTriangles());
+  for (size_t s = 0; s < mesh->getSubMeshes().size(); s++) {
+    const std::vector<unsigned int> &indices =
+        mesh->getSubMeshes()[s].vertexIndices;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      Triangle tri;
+      tri.p0 = vertices[indices[i]].position;
+      tri.e1 = vertices[indices[i + 1]].position - tri.p0;
+      tri.e2 = vertices[indices[i + 2]].position - tri.p0;
+      tri.subMesh = (int)s;
+      tri.index = (int)(i / 3);
+      source.push_back(tri);
+    }
+  }
+
+  const int count = (int)source.size();
+  std::vector<glm::vec3> primMin(count), primMax(count);
+  ThreadPool::Get().ParallelFor(count, 16 * 1024, [&](const int b,
+                                                      const int e) {
+    for (int i = b; i < e; i++) {
+      const Triangle &tri = source[i];
+      glm::vec3 p1 = tri.p0 + tri.e1;
+      glm::vec3 p2 = tri.p0 + tri.e2;
+      primMin[i] = glm::min(tri.p0, glm::min(p1, p2));
+      primMax[i] = glm::max(tri.p0, glm::max(p1, p2));
+    }
+  });
+
+  std::vector<unsigned int> order;
+  BuildBVH(primMin, primMax, nodes, order, stats);
+  triangles.resize(count);
+  for (int i = 0; i < count; i++) {
+    triangles[i] = source[order[i]];
+  }
+  stats.memoryBytes += triangles.size() * sizeof(Triangle);
+  stats.buildMs = MsSince(start);
+}
+
+bool MeshBVH::Intersect(Ray &ray, RayHit &hit) const {
+  bool found = false;
+  const glm::vec3 &origin = ray.origin;
+  const glm::vec3 &dir = ray.direction;
+  Traverse(nodes, origin, dir, ray.tMax, [&](const int first, const int count) {
+    for (int i = first; i < first + count; i++) {
+      // Moller-Trumbore; both sides count.
+      const Triangle &tri = triangles[i];
+      glm::vec3 pvec = glm::cross(dir, tri.e2);
+      float det = glm::dot(tri.e1, pvec);
+      if (det == 0.0f) continue;
+      float invDet = 1.0f / det;
+      glm::vec3 tvec = origin - tri.p0;
+      float u = glm::dot(tvec, pvec) * invDet;
+      if (u < 0.0f || u > 1.0f) continue;
+      glm::vec3 qvec = glm::cross(tvec, tri.e1);
+      float v = glm::dot(dir, qvec) * invDet;
+      if (v < 0.0f || u + v > 1.0f) continue;
+      float t = glm::dot(tri.e2, qvec) * invDet;
+      if (t <= 0.0f || t >= ray.tMax) continue;
+      ray.tMax = t;
+      hit.subMesh = tri.subMesh;
+      hit.triangle = tri.index;
+      hit.t = t;
+      hit.barycentric = glm::vec2(u, v);
+      found = true;
+    }
+    return false;
+  });
+  return found;
+}
+
+bool MeshBVH::Occluded(const Ray &ray) const {
+  const glm::vec3 &origin = ray.origin;
+  const glm::vec3 &dir = ray.direction;
+  return Traverse(nodes, origin, dir, ray.tMax,
+                  [&](const int first, const int count) {
+                    for (int i = first; i < first + count; i++) {
+                      const Triangle &tri = triangles[i];
+                      glm::vec3 pvec = glm::cross(dir, tri.e2);
+                      float det = glm::dot(tri.e1, pvec);
+                      if (det == 0.0f) continue;
+                      float invDet = 1.0f / det;
+                      glm::vec3 tvec = origin - tri.p0;
+                      float u = glm::dot(tvec, pvec) * invDet;
+                      if (u < 0.0f || u > 1.0f) continue;
+                      glm::vec3 qvec = glm::cross(tvec, tri.e1);
+                      float v = glm::dot(dir, qvec) * invDet;
+                      if (v < 0.0f || u + v > 1.0f) continue;
+                      float t = glm::dot(tri.e2, qvec) * invDet;
+                      if (t > 0.0f && t < ray.tMax) return true;
+                    }
+                    return false;
+                  });
+}
+
+void MeshBVH::IntersectPacket(RayPacket8 &packet, PacketHit8 &hit) const {
+  PacketRays rays = LoadPacket(packet);
+  const float8 zero = float8::Broadcast(0.0f);
+  const float8 one = float8::Broadcast(1.0f);
+  TraversePacket(nodes, rays, [&](const int first, const int count,
+                                  PacketRays &r) {
+    for (int i = first; i < first + count; i++) {
+      // Moller-Trumbore for 8 rays against one triangle. A zero determinant
+      // gives non-finite u, v, t, which fail the tests below.
+      const Triangle &tri = triangles[i];
+      const float8 e1x = float8::Broadcast(tri.e1.x);
+      const float8 e1y = float8::Broadcast(tri.e1.y);
+      const float8 e1z = float8::Broadcast(tri.e1.z);
+      const float8 e2x = float8::Broadcast(tri.e2.x);
+      const float8 e2y = float8::Broadcast(tri.e2.y);
+      const float8 e2z = float8::Broadcast(tri.e2.z);
+      const float8 px = r.dy * e2z - r.dz * e2y;
+      const float8 py = r.dz * e2x - r.dx * e2z;
+      const float8 pz = r.dx * e2y - r.dy * e2x;
+      const float8 det = e1x * px + e1y * py + e1z * pz;
+      const float8 invDet = one / det;
+      const float8 tx = r.ox - float8::Broadcast(tri.p0.x);
+      const float8 ty = r.oy - float8::Broadcast(tri.p0.y);
+      const float8 tz = r.oz - float8::Broadcast(tri.p0.z);
+      const float8 u = (tx * px + ty * py + tz * pz) * invDet;
+      const float8 qx = ty * e1z - tz * e1y;
+      const float8 qy = tz * e1x - tx * e1z;
+      const float8 qz = tx * e1y - ty * e1x;
+      const float8 v = (r.dx * qx + r.dy * qy + r.dz * qz) * invDet;
+      const float8 t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+      const float8 mask = (u >= zero) & (v >= zero) & (u + v <= one) &
+                          (t > zero) & (t < r.tMax);
+      const int bits = MoveMask(mask);
+      if (bits == 0) continue;
+      r.tMax = Select(mask, t, r.tMax);
+      float ts[8], us[8], vs[8];
+      t.Store(ts);
+      u.Store(us);
+      v.Store(vs);
+      for (int lane = 0; lane < 8; lane++) {
+        if (bits & (1 << lane)) {
+          hit.subMesh[lane] = tri.subMesh;
+          hit.triangle[lane] = tri.index;
+          hit.t[lane] = ts[lane];
+          hit.u[lane] = us[lane];
+          hit.v[lane] = vs[lane];
+        }
+      }
+    }
+  });
+  rays.tMax.Store(packet.tMax);
+}
+
+glm::vec3 MeshBVH::GetBoundsMin() const {
+  if (nodes.empty()) {
+    return glm::vec3(0.0f);
+  }
+  return glm::vec3(nodes[0].boundsMin[0], nodes[0].boundsMin[1],
+                   nodes[0].boundsMin[2]);
+}
+
+glm::vec3 MeshBVH::GetBoundsMax() const {
+  if (nodes.empty()) {
+    return glm::vec3(0.0f);
+  }
+  return glm::vec3(nodes[0].boundsMax[0], nodes[0].boundsMax[1],
+                   nodes[0].boundsMax[2]);
+}
+
+// ---------------------------------------------------------------------------
+// SceneBVH Public Methods.
+// ---------------------------------------------------------------------------
+
+void SceneBVH::Build(const std::vector<SceneObject> &objects,
+                     const glm::mat4x4 &rootTransform) {
+  BuildClock::time_point start = BuildClock::now();
+  for (const SceneObject &sceneObj : objects) {
+    sceneObj.mesh->GetBVH();
+  }
+  meshBuildMs = MsSince(start);
+
+  // World bounds of each object from the corners of its mesh bounds.
+  std::vector<glm::vec3> primMin, primMax;
+  std::vector<Instance> source;
+  std::vector<int> sourceObject;
+  for (size_t o = 0; o < objects.size(); o++) {
+    const MeshBVH *bvh = objects[o].mesh->GetBVH();
+    if (bvh->IsEmpty()) {
+      continue;
+    }
+    glm::mat4x4 world = rootTransform * objects[o].worldMatrix;
+    glm::vec3 lo = bvh->GetBoundsMin();
+    glm::vec3 hi = bvh->GetBoundsMax();
+    glm::vec3 worldMin(std::numeric_limits<float>::infinity());
+    glm::vec3 worldMax(-std::numeric_limits<float>::infinity());
+    for (int corner = 0; corner < 8; corner++) {
+      glm::vec3 p((corner & 1) ? hi.x : lo.x, (corner & 2) ? hi.y : lo.y,
+                  (corner & 4) ? hi.z : lo.z);
+      glm::vec3 w = glm::vec3(world * glm::vec4(p, 1.0f));
+      worldMin = glm::min(worldMin, w);
+      worldMax = glm::max(worldMax, w);
+    }
+    primMin.push_back(worldMin);
+    primMax.push_back(worldMax);
+    source.push_back({bvh, glm::inverse(world)});
+    sourceObject.push_back((int)o);
+  }
+
+  std::vector<unsigned int> order;
+  BuildBVH(primMin, primMax, nodes, order, stats);
+  instances.resize(order.size());
+  objectIndex.resize(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    instances[i] = source[order[i]];
+    objectIndex[i] = sourceObject[order[i]];
+  }
+}
+
+bool SceneBVH::Intersect(Ray &ray, RayHit &hit) const {
+  bool found = false;
+  Traverse(nodes, ray.origin, ray.direction, ray.tMax,
+           [&](const int first, const int count) {
+             for (int i = first; i < first + count; i++) {
+               // An affine transform keeps t, so tMax carries over.
+               const Instance &instance = instances[i];
+               Ray local(glm::vec3(instance.worldToObject *
+                                   glm::vec4(ray.origin, 1.0f)),
+                         glm::vec3(instance.worldToObject *
+                                   glm::vec4(ray.direction, 0.0f)),
+                         ray.tMax);
+               if (instance.bvh->Intersect(local, hit)) {
+                 ray.tMax = local.tMax;
+                 hit.object = objectIndex[i];
+                 found = true;
+               }
+             }
+             return false;
+           });
+  return found;
+}
+
+bool SceneBVH::Occluded(const Ray &ray) const {
+  return Traverse(nodes, ray.origin, ray.direction, ray.tMax,
+                  [&](const int first, const int count) {
+                    for (int i = first; i < first + count; i++) {
+                      const Instance &instance = instances[i];
+                      Ray local(glm::vec3(instance.worldToObject *
+                                          glm::vec4(ray.origin, 1.0f)),
+                                glm::vec3(instance.worldToObject *
+                                          glm::vec4(ray.direction, 0.0f)),
+                                ray.tMax);
+                      if (instance.bvh->Occluded(local)) return true;
+                    }
+                    return false;
+                  });
+}
+
+void SceneBVH::IntersectPacket(RayPacket8 &packet, PacketHit8 &hit) const {
+  PacketRays rays = LoadPacket(packet);
+  TraversePacket(nodes, rays, [&](const int first, const int count,
+                                  PacketRays &r) {
+    r.tMax.Store(packet.tMax);
+    for (int i = first; i < first + count; i++) {
+      const Instance &instance = instances[i];
+      RayPacket8 local;
+      for (int lane = 0; lane < 8; lane++) {
+        glm::vec4 o = instance.worldToObject *
+                      glm::vec4(packet.ox[lane], packet.oy[lane],
+                                packet.oz[lane], 1.0f);
+        glm::vec4 d = instance.worldToObject *
+                      glm::vec4(packet.dx[lane], packet.dy[lane],
+                                packet.dz[lane], 0.0f);
+        local.Set(lane, Ray(glm::vec3(o), glm::vec3(d), packet.tMax[lane]));
+      }
+      instance.bvh->IntersectPacket(local, hit);
+      for (int lane = 0; lane < 8; lane++) {
+        if (local.tMax[lane] < packet.tMax[lane]) {
+          packet.tMax[lane] = local.tMax[lane];
+          hit.object[lane] = objectIndex[i];
+        }
+      }
+    }
+    r.tMax = float8::Load(packet.tMax);
+  });
+  rays.tMax.Store(packet.tMax);
+}
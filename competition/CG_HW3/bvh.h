@@ -0,0 +1,162 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "headers.h"
+
+class TriangleMesh;
+struct SceneObject;
+
+// A ray segment [0, tMax] along origin + t * direction. The direction does
+// not need to be normalized.
+struct Ray {
+  Ray() : tMax(std::numeric_limits<float>::infinity()) {}
+  Ray(const glm::vec3 &o, const glm::vec3 &d,
+      const float t = std::numeric_limits<float>::infinity())
+      : origin(o), direction(d), tMax(t) {}
+  glm::vec3 origin;
+  glm::vec3 direction;
+  float tMax;
+};
+
+// Closest hit of a ray. The hit point is
+// (1 - u - v) * p0 + u * p1 + v * p2 of the submesh triangle.
+struct RayHit {
+  RayHit() : object(-1), subMesh(-1), triangle(-1), t(0.0f) {}
+  bool IsValid() const { return object >= 0 || triangle >= 0; }
+  // Index into Scene::objects (-1 for a mesh-level query).
+  int object;
+  int subMesh;
+  // Triangle within the submesh (its indices start at 3 * triangle).
+  int triangle;
+  float t;
+  glm::vec2 barycentric;
+};
+
+// 8 rays traced together. Lanes with tMax <= 0 are inactive.
+struct RayPacket8 {
+  float ox[8], oy[8], oz[8];
+  float dx[8], dy[8], dz[8];
+  float tMax[8];
+  void Set(const int lane, const Ray &ray);
+};
+
+struct PacketHit8 {
+  PacketHit8();
+  int object[8];
+  int subMesh[8];
+  int triangle[8];
+  float t[8];
+  float u[8];
+  float v[8];
+};
+
+// 32 bytes; two nodes per cache line. The first child of an inner node is
+// the next node, so only the second one is stored.
+struct BVHNode {
+  float boundsMin[3];
+  // Leaf: first primitive. Inner node: second child.
+  uint32_t offset;
+  float boundsMax[3];
+  // 0 for inner nodes.
+  uint16_t count;
+  // Split axis of inner nodes, to visit the nearer child first.
+  uint8_t axis;
+  uint8_t pad;
+
+  bool IsLeaf() const { return count > 0; }
+};
+
+struct BVHBuildStats {
+  double buildMs = 0.0;
+  int numNodes = 0;
+  int numLeaves = 0;
+  int maxDepth = 0;
+  int numPrimitives = 0;
+  size_t memoryBytes = 0;
+};
+
+// Builds a BVH over boxes with binned SAH. Nodes are stored depth first;
+// order receives the primitive index of each leaf slot. Large nodes are
+// binned and split on all pool threads.
+void BuildBVH(const std::vector<glm::vec3> &primMin,
+              const std::vector<glm::vec3> &primMax,
+              std::vector<BVHNode> &nodes, std::vector<unsigned int> &order,
+              BVHBuildStats &stats);
+
+// MeshBVH Declarations.
+// Triangles of all submeshes of a TriangleMesh, in object space.
+class MeshBVH {
+ public:
+  // MeshBVH Public Methods.
+  void Build(TriangleMesh *mesh);
+
+  // Updates hit (and ray.tMax) when a closer triangle is found. hit.object
+  // is left untouched.
+  bool Intersect(Ray &ray, RayHit &hit) const;
+  // Any hit in (0, ray.tMax).
+  bool Occluded(const Ray &ray) const;
+  // Closest hits of all active lanes; shrinks packet.tMax like Intersect.
+  void IntersectPacket(RayPacket8 &packet, PacketHit8 &hit) const;
+
+  bool IsEmpty() const { return nodes.empty(); }
+  // Object-space bounds of the whole mesh.
+  glm::vec3 GetBoundsMin() const;
+  glm::vec3 GetBoundsMax() const;
+  const BVHBuildStats &GetStats() const { return stats; }
+
+ private:
+  // Vertex 0 and the two edges from it, as the intersection test wants.
+  struct Triangle {
+    glm::vec3 p0;
+    glm::vec3 e1;
+    glm::vec3 e2;
+    int subMesh;
+    int index;
+  };
+
+  // MeshBVH Private Data.
+  std::vector<BVHNode> nodes;
+  // In leaf order.
+  std::vector<Triangle> triangles;
+  BVHBuildStats stats;
+};
+
+// SceneBVH Declarations.
+// Top-level BVH over scene objects. Each leaf refers to the MeshBVH of an
+// object, which is queried in object space.
+class SceneBVH {
+ public:
+  // SceneBVH Public Methods.
+  // Builds missing mesh BVHs, then the top level. rootTransform is applied
+  // to all objects, like in RenderSceneCB.
+  void Build(const std::vector<SceneObject> &objects,
+             const glm::mat4x4 &rootTransform);
+
+  bool Intersect(Ray &ray, RayHit &hit) const;
+  bool Occluded(const Ray &ray) const;
+  void IntersectPacket(RayPacket8 &packet, PacketHit8 &hit) const;
+
+  const BVHBuildStats &GetStats() const { return stats; }
+  // Time spent building mesh BVHs during the last Build.
+  double GetMeshBuildMs() const { return meshBuildMs; }
+
+ private:
+  struct Instance {
+    const MeshBVH *bvh;
+    glm::mat4x4 worldToObject;
+  };
+
+  // SceneBVH Private Data.
+  std::vector<BVHNode> nodes;
+  // In leaf order; Instance i of leaf slot i is object objectIndex[i].
+  std::vector<Instance> instances;
+  std::vector<int> objectIndex;
+  BVHBuildStats stats;
+  double meshBuildMs = 0.0;
+};
+
+#endif
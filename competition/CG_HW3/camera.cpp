@@ -43,11 +43,22 @@ void Camera::UpdateView(const glm::vec3 newPos, const glm::vec3 newTarget, const
 void Camera::UpdateProjection(const float fovyInDegree, const float aspectRatio, const float zNear, const float zFar)
 {
 	fovy = fovyInDegree;
+	this->aspectRatio = aspectRatio;
 	nearPlane = zNear;
 	farPlane = zFar;
 	projMatrix = glm::perspective(glm::radians(fovyInDegree), aspectRatio, nearPlane, farPlane);
 }
 
+Ray Camera::GenerateRay(const glm::vec2 ndc) const
+{
+	glm::mat4x4 invViewProj = glm::inverse(projMatrix * viewMatrix);
+	glm::vec4 nearPoint = invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 farPoint = invViewProj * glm::vec4(ndc, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 end = glm::vec3(farPoint) / farPoint.w;
+	return Ray(origin, end - origin, 1.0f);
+}
+
 void Camera::moveUp(const float delta)
 {
 	position += delta * glm::normalize(glm::cross(glm::normalize(target - position), up));
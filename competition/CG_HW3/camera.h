@@ -1,6 +1,7 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "bvh.h"
 #include "headers.h"
 
 // Camera Declarations.
@@ -23,8 +24,17 @@ public:
 	void rotate(const float yaw, const float pitch);
 
 	glm::vec3 GetCameraPos() const { return position; }
+	glm::vec3 GetTarget() const { return target; }
 	glm::mat4x4 GetViewMatrix() const { return viewMatrix; }
 	glm::mat4x4 GetProjMatrix() const { return projMatrix; }
+	float GetFovy() const { return fovy; }
+	float GetAspectRatio() const { return aspectRatio; }
+	float GetNearPlane() const { return nearPlane; }
+	float GetFarPlane() const { return farPlane; }
+
+	// Ray from the near plane through a point given in normalized device
+	// coordinates (x right, y up, both in [-1, 1]), ending at the far plane.
+	Ray GenerateRay(const glm::vec2 ndc) const;
 
 	void UpdateView(const glm::vec3 newPos, const glm::vec3 newTarget, const glm::vec3 up);
 	void UpdateProjection(const float fovyInDegree, const float aspectRatio, const float zNear, const float zFar);
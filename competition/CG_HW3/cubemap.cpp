@@ -0,0 +1,212 @@
+#include "cubemap.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "file_cache.h"
+#include "memory_tracker.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include "timing.h"
+
+// Bump when the conversion or the file layout changes.
+static const uint32_t kCacheVersion = 1;
+static const char kCacheMagic[4] = {'C', 'U', 'B', 'E'};
+
+struct CubeCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t faceSize;
+  uint32_t channels;
+};
+
+CubeMapTexture::CubeMapTexture(const std::string &equirectPath,
+                               const int faceSize)
+    : texFilePath(equirectPath) {
+  PROFILE_SCOPE("CubeMap Load");
+  textureObj = 0;
+  this->faceSize = faceSize;
+  stats = CubeMapLoadStats();
+  auto totalStart = std::chrono::steady_clock::now();
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t key;
+  if (!FileCache::HashFile(equirectPath, key)) {
+    std::cerr << "[ERROR] Failed to load image texture: " << equirectPath
+              << std::endl;
+    return;
+  }
+  const uint32_t params[2] = {kCacheVersion, (uint32_t)faceSize};
+  key = FileCache::Hash(params, sizeof(params), key);
+  std::string cachePath = FileCache::GetCachePath(equirectPath, key, ".cube");
+  stats.hashMs = MsSince(start);
+
+  std::vector<unsigned char> faces;
+  start = std::chrono::steady_clock::now();
+  stats.cacheHit = ReadCache(cachePath, faces);
+  stats.cacheMs = MsSince(start);
+
+  if (!stats.cacheHit) {
+    start = std::chrono::steady_clock::now();
+    cv::Mat equirect = cv::imread(equirectPath);
+    stats.decodeMs = MsSince(start);
+    if (equirect.rows == 0 || equirect.cols == 0) {
+      std::cerr << "[ERROR] Failed to load image texture: " << equirectPath
+                << std::endl;
+      return;
+    }
+    if (this->faceSize <= 0) {
+      this->faceSize = std::max(equirect.cols / 4, 1);
+    }
+
+    start = std::chrono::steady_clock::now();
+    ConvertEquirect(equirect, this->faceSize, faces);
+    stats.convertMs = MsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    WriteCache(cachePath, faces);
+    stats.cacheMs += MsSince(start);
+  }
+
+  start = std::chrono::steady_clock::now();
+  Upload(faces);
+  stats.uploadMs = MsSince(start);
+  stats.totalMs = MsSince(totalStart);
+}
+
+CubeMapTexture::~CubeMapTexture() {
+  MemoryTracker::Get().Remove(this);
+  glDeleteTextures(1, &textureObj);
+}
+
+void CubeMapTexture::Bind(GLenum textureUnit) {
+  glActiveTexture(textureUnit);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, textureObj);
+}
+
+void CubeMapTexture::ConvertEquirect(const cv::Mat &equirect,
+                                     const int faceSize,
+                                     std::vector<unsigned char> &faces) {
+  PROFILE_SCOPE("ConvertEquirect");
+  const int width = equirect.cols;
+  const int height = equirect.rows;
+  const size_t faceBytes = (size_t)faceSize * faceSize * 3;
+  faces.resize(faceBytes * 6);
+
+  // One task per face row.
+  ThreadPool::Get().ParallelFor(
+      6 * faceSize, 16, [&](const int rowBegin, const int rowEnd) {
+        for (int row = rowBegin; row < rowEnd; ++row) {
+          const int face = row / faceSize;
+          const int y = row % faceSize;
+          unsigned char *dst = &faces[face * faceBytes + (size_t)y * faceSize * 3];
+          const float b = 2.0f * ((float)y + 0.5f) / (float)faceSize - 1.0f;
+          for (int x = 0; x < faceSize; ++x) {
+            const float a = 2.0f * ((float)x + 0.5f) / (float)faceSize - 1.0f;
+            // Direction of texel (a, b) as defined by the GL cube map rules.
+            glm::vec3 dir;
+            switch (face) {
+              case 0: dir = glm::vec3(1.0f, -b, -a); break;
+              case 1: dir = glm::vec3(-1.0f, -b, a); break;
+              case 2: dir = glm::vec3(a, 1.0f, b); break;
+              case 3: dir = glm::vec3(a, -1.0f, -b); break;
+              case 4: dir = glm::vec3(a, -b, 1.0f); break;
+              default: dir = glm::vec3(-a, -b, -1.0f); break;
+            }
+            dir = glm::normalize(dir);
+
+            // Same mapping as the sphere skybox: u follows atan2(z, x), the
+            // top image row is straight up.
+            float phi = std::atan2(dir.z, dir.x);
+            if (phi < 0.0f) {
+              phi += 2.0f * glm::pi<float>();
+            }
+            float theta = std::asin(glm::clamp(dir.y, -1.0f, 1.0f));
+            float u = phi / (2.0f * glm::pi<float>()) * (float)width - 0.5f;
+            float v = (0.5f - theta / glm::pi<float>()) * (float)height - 0.5f;
+
+            // Bilinear filter, wrapping horizontally.
+            int x0 = (int)std::floor(u);
+            int y0 = (int)std::floor(v);
+            float fx = u - (float)x0;
+            float fy = v - (float)y0;
+            int x1 = (x0 + 1) % width;
+            x0 = (x0 % width + width) % width;
+            int y1 = glm::clamp(y0 + 1, 0, height - 1);
+            y0 = glm::clamp(y0, 0, height - 1);
+            const unsigned char *p00 = equirect.ptr<unsigned char>(y0) + x0 * 3;
+            const unsigned char *p10 = equirect.ptr<unsigned char>(y0) + x1 * 3;
+            const unsigned char *p01 = equirect.ptr<unsigned char>(y1) + x0 * 3;
+            const unsigned char *p11 = equirect.ptr<unsigned char>(y1) + x1 * 3;
+            for (int c = 0; c < 3; ++c) {
+              float top = p00[c] + (p10[c] - p00[c]) * fx;
+              float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+              dst[x * 3 + c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+            }
+          }
+        }
+      });
+}
+
+bool CubeMapTexture::ReadCache(const std::string &cachePath,
+                               std::vector<unsigned char> &faces) {
+  std::vector<char> data;
+  if (!FileCache::ReadFile(cachePath, data) ||
+      data.size() < sizeof(CubeCacheHeader)) {
+    return false;
+  }
+  CubeCacheHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  size_t faceBytes = (size_t)header.faceSize * header.faceSize * 3;
+  if (std::memcmp(header.magic, kCacheMagic, 4) != 0 ||
+      header.version != kCacheVersion || header.channels != 3 ||
+      data.size() != sizeof(header) + faceBytes * 6) {
+    return false;
+  }
+  faceSize = (int)header.faceSize;
+  faces.assign(data.begin() + sizeof(header), data.end());
+  return true;
+}
+
+void CubeMapTexture::WriteCache(const std::string &cachePath,
+                                const std::vector<unsigned char> &faces) {
+  CubeCacheHeader header;
+  std::memcpy(header.magic, kCacheMagic, 4);
+  header.version = kCacheVersion;
+  header.faceSize = (uint32_t)faceSize;
+  header.channels = 3;
+  std::vector<char> data(sizeof(header) + faces.size());
+  std::memcpy(data.data(), &header, sizeof(header));
+  std::memcpy(data.data() + sizeof(header), faces.data(), faces.size());
+  FileCache::WriteFile(cachePath, data.data(), data.size());
+}
+
+void CubeMapTexture::Upload(const std::vector<unsigned char> &faces) {
+  const size_t faceBytes = (size_t)faceSize * faceSize * 3;
+
+  glGenTextures(1, &textureObj);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, textureObj);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int face = 0; face < 6; ++face) {
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, faceSize,
+                 faceSize, 0, GL_BGR, GL_UNSIGNED_BYTE,
+                 &faces[face * faceBytes]);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+  // The faces are not kept on the CPU. RGB counts 4 bytes per texel, and
+  // the mips add a third.
+  const long long gpuBytes = 6LL * faceSize * faceSize * 4 * 4 / 3;
+  MemoryTracker::Get().Update(this, MemoryTag::Skybox, texFilePath, 0,
+                              gpuBytes);
+}
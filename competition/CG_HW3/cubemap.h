@@ -0,0 +1,56 @@
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+#include "headers.h"
+
+// Startup cost of a CubeMapTexture, split by stage.
+struct CubeMapLoadStats {
+  double hashMs;
+  double decodeMs;   // PNG/JPG decode (cache miss only).
+  double convertMs;  // Equirect to cube conversion (cache miss only).
+  double cacheMs;    // Reading or writing the cache file.
+  double uploadMs;   // Texture upload and mipmap generation.
+  double totalMs;
+  bool cacheHit;
+};
+
+// CubeMapTexture Declarations.
+// Cube map converted from an equirectangular panorama on the CPU. The
+// conversion runs on the thread pool and its result is cached on disk, keyed
+// by the hash of the panorama file, so later runs skip the image decode too.
+class CubeMapTexture {
+ public:
+  // CubeMapTexture Public Methods.
+  // faceSize == 0 picks a quarter of the panorama width.
+  CubeMapTexture(const std::string &equirectPath, const int faceSize = 0);
+  ~CubeMapTexture();
+
+  bool IsValid() const { return textureObj != 0; }
+  void Bind(GLenum textureUnit);
+
+  int GetFaceSize() const { return faceSize; }
+  std::string GetPath() const { return texFilePath; }
+  const CubeMapLoadStats &GetLoadStats() const { return stats; }
+
+  // Resamples a 3-channel panorama into six faces stored one after another,
+  // in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order and in glTexImage2D row
+  // order.
+  static void ConvertEquirect(const cv::Mat &equirect, const int faceSize,
+                              std::vector<unsigned char> &faces);
+
+ private:
+  // CubeMapTexture Private Methods.
+  bool ReadCache(const std::string &cachePath,
+                 std::vector<unsigned char> &faces);
+  void WriteCache(const std::string &cachePath,
+                  const std::vector<unsigned char> &faces);
+  void Upload(const std::vector<unsigned char> &faces);
+
+  // CubeMapTexture Private Data.
+  std::string texFilePath;
+  GLuint textureObj;
+  int faceSize;
+  CubeMapLoadStats stats;
+};
+
+#endif
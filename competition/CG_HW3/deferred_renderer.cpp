@@ -0,0 +1,348 @@
+#include "deferred_renderer.h"
+
+#include "camera.h"
+#include "json_writer.h"
+#include "scene.h"
+#include "shaderprog.h"
+#include "shadow_atlas.h"
+
+// Distance from a light at which its brightest channel falls below 1/256,
+// the step of an 8-bit target; infinite without falloff.
+static float LightReach(const Light *light) {
+  const glm::vec3 intensity = light->GetIntensity();
+  const float peak = glm::max(intensity.x, glm::max(intensity.y, intensity.z));
+  const float c = light->GetConstant();
+  const float l = light->GetLinear();
+  const float q = light->GetQuadratic();
+  // Solve peak / (c + l d + q d^2) = 1 / 256 for d.
+  const float k = c - 256.0f * peak;
+  if (k >= 0.0f) {
+    return light->GetDecayStart();
+  }
+  float d;
+  if (q > 0.0f) {
+    d = (-l + std::sqrt(l * l - 4.0f * q * k)) / (2.0f * q);
+  } else if (l > 0.0f) {
+    d = -k / l;
+  } else {
+    return std::numeric_limits<float>::infinity();
+  }
+  return light->GetDecayStart() + d;
+}
+
+DeferredRenderer::DeferredRenderer() {}
+
+DeferredRenderer::~DeferredRenderer() { Release(); }
+
+void DeferredRenderer::Release() {
+  if (fboId != 0) {
+    glDeleteFramebuffers(1, &fboId);
+    glDeleteTextures(kNumTargets, targets);
+    glDeleteTextures(1, &depthTexture);
+    fboId = 0;
+  }
+  stats.width = 0;
+  stats.height = 0;
+  stats.gbufferBytes = 0;
+}
+
+void DeferredRenderer::Resize(const int width, const int height) {
+  Release();
+  // Internal format, format and type of each target.
+  const GLenum formats[kNumTargets][3] = {
+      {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+      {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+      {GL_RG16, GL_RG, GL_UNSIGNED_SHORT},
+      {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+  };
+  glGenTextures(kNumTargets, targets);
+  glGenTextures(1, &depthTexture);
+  glGenFramebuffers(1, &fboId);
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+  GLenum drawBuffers[kNumTargets];
+  for (int t = 0; t < kNumTargets; ++t) {
+    glBindTexture(GL_TEXTURE_2D, targets[t]);
+    glTexImage2D(GL_TEXTURE_2D, 0, formats[t][0], width, height, 0,
+                 formats[t][1], formats[t][2], nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + t,
+                           GL_TEXTURE_2D, targets[t], 0);
+    drawBuffers[t] = GL_COLOR_ATTACHMENT0 + t;
+  }
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0,
+               GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         depthTexture, 0);
+  glDrawBuffers(kNumTargets, drawBuffers);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "[ERROR] G-buffer framebuffer is incomplete" << std::endl;
+  }
+
+  stats.width = width;
+  stats.height = height;
+  // Three RGBA8 targets, RG16 and 24-bit depth padded to 32.
+  stats.gbufferBytes = (long long)width * height * (3 * 4 + 4 + 4);
+}
+
+void DeferredRenderer::BeginGeometry() {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFbo);
+  if (fboId == 0 || viewport[2] != stats.width ||
+      viewport[3] != stats.height) {
+    Resize(viewport[2], viewport[3]);
+  }
+  geometryTimer.Begin();
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+  // The color of empty pixels is never read; their depth stays 1.
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DeferredRenderer::EndGeometry() {
+  geometryTimer.End();
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFbo);
+}
+
+bool DeferredRenderer::GetScissor(const glm::vec3 &center, const float radius,
+                                  const glm::mat4x4 &proj, const float zNear,
+                                  glm::ivec4 &rect) const {
+  // The camera looks down -z.
+  if (center.z - radius > -zNear) {
+    return false;
+  }
+  if (center.z + radius > -zNear || std::isinf(radius)) {
+    rect = glm::ivec4(0, 0, stats.width, stats.height);
+    return true;
+  }
+  // Screen bounds of the sphere's box, all in front of the camera.
+  glm::vec2 lo(std::numeric_limits<float>::max());
+  glm::vec2 hi(-std::numeric_limits<float>::max());
+  for (int corner = 0; corner < 8; ++corner) {
+    const glm::vec3 offset((corner & 1) ? radius : -radius,
+                           (corner & 2) ? radius : -radius,
+                           (corner & 4) ? radius : -radius);
+    const glm::vec4 clip = proj * glm::vec4(center + offset, 1.0f);
+    const glm::vec2 ndc = glm::vec2(clip) / clip.w;
+    lo = glm::min(lo, ndc);
+    hi = glm::max(hi, ndc);
+  }
+  if (hi.x < -1.0f || hi.y < -1.0f || lo.x > 1.0f || lo.y > 1.0f) {
+    return false;
+  }
+  const glm::vec2 size((float)stats.width, (float)stats.height);
+  lo = glm::clamp(lo, -1.0f, 1.0f) * 0.5f + 0.5f;
+  hi = glm::clamp(hi, -1.0f, 1.0f) * 0.5f + 0.5f;
+  const glm::ivec2 x0 = glm::ivec2(glm::floor(lo * size));
+  const glm::ivec2 x1 = glm::ivec2(glm::ceil(hi * size));
+  rect = glm::ivec4(x0, x1 - x0);
+  return rect.z > 0 && rect.w > 0;
+}
+
+void DeferredRenderer::Shade(DeferredLightShaderProg *shader,
+                             const Scene *scene, const Camera *camera,
+                             const glm::mat4x4 &rootTransform) {
+  lightingTimer.Begin();
+  for (int t = 0; t < kNumTargets; ++t) {
+    glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit + t);
+    glBindTexture(GL_TEXTURE_2D, targets[t]);
+  }
+  glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit + kNumTargets);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(shader->GetLocGAlbedo(), kFirstTextureUnit + Albedo);
+  glUniform1i(shader->GetLocGSpecular(), kFirstTextureUnit + Specular);
+  glUniform1i(shader->GetLocGNormal(), kFirstTextureUnit + Normal);
+  glUniform1i(shader->GetLocGIndirect(), kFirstTextureUnit + Indirect);
+  glUniform1i(shader->GetLocGDepth(), kFirstTextureUnit + kNumTargets);
+
+  const glm::mat4x4 view = camera->GetViewMatrix();
+  const glm::mat4x4 proj = camera->GetProjMatrix();
+  glUniformMatrix4fv(shader->GetLocInvProj(), 1, GL_FALSE,
+                     glm::value_ptr(glm::inverse(proj)));
+  glUniformMatrix4fv(shader->GetLocInvView(), 1, GL_FALSE,
+                     glm::value_ptr(glm::inverse(view)));
+  glUniformMatrix4fv(shader->GetLocLightWorld(), 1, GL_FALSE,
+                     glm::value_ptr(rootTransform));
+
+  // Indirect, directional and area light of every pixel. Depth is written
+  // for the skybox, so the test has to pass.
+  glUniform1i(shader->GetLocAddIndirect(), 1);
+  glUniform1i(shader->locNumPointLights, 0);
+  glUniform1i(shader->locNumSpotLights, 0);
+  glUniform1i(shader->GetLocFirstPointLight(), 0);
+  glUniform1i(shader->GetLocFirstSpotLight(), 0);
+  glDepthFunc(GL_ALWAYS);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glDepthFunc(GL_LESS);
+  stats.lightPasses = 1;
+  stats.culledLights = 0;
+  long long pixels = (long long)stats.width * stats.height;
+
+  // One additive pass per point or spot light, over its screen rect.
+  glUniform1i(shader->GetLocAddIndirect(), 0);
+  glUniform1i(shader->locNumDirLights, 0);
+  glUniform1i(shader->locNumAreaLights, 0);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE);
+  glDisable(GL_DEPTH_TEST);
+  glDepthMask(GL_FALSE);
+  glEnable(GL_SCISSOR_TEST);
+  // Lights are placed like the shadow atlas places them.
+  const glm::mat3x3 rootLinear(rootTransform);
+  const float rootScale = glm::max(
+      glm::length(rootLinear[0]),
+      glm::max(glm::length(rootLinear[1]), glm::length(rootLinear[2])));
+  auto drawLight = [&](const Light *light, const glm::vec3 &position,
+                       const GLint locFirst, const GLint locNum,
+                       const int index) {
+    const glm::vec3 center =
+        glm::vec3(view * rootTransform * glm::vec4(position, 1.0f));
+    glm::ivec4 rect;
+    if (!GetScissor(center, LightReach(light) * rootScale, proj,
+                    camera->GetNearPlane(), rect)) {
+      stats.culledLights++;
+      return;
+    }
+    glScissor(rect.x, rect.y, rect.z, rect.w);
+    glUniform1i(locFirst, index);
+    glUniform1i(locNum, index + 1);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    stats.lightPasses++;
+    pixels += (long long)rect.z * rect.w;
+  };
+  const int numPointLights =
+      std::min((int)scene->pointLights.size(), MAX_POINT_LIGHTS);
+  for (int i = 0; i < numPointLights; ++i) {
+    const PointLight *light = scene->pointLights[i];
+    drawLight(light, light->GetPosition(), shader->GetLocFirstPointLight(),
+              shader->locNumPointLights, i);
+  }
+  glUniform1i(shader->locNumPointLights, 0);
+  const int numSpotLights =
+      std::min((int)scene->spotLights.size(), MAX_SPOT_LIGHTS);
+  for (int i = 0; i < numSpotLights; ++i) {
+    const SpotLight *light = scene->spotLights[i];
+    drawLight(light, light->GetPosition(), shader->GetLocFirstSpotLight(),
+              shader->locNumSpotLights, i);
+  }
+  glDisable(GL_SCISSOR_TEST);
+  glDepthMask(GL_TRUE);
+  glEnable(GL_DEPTH_TEST);
+  glDisable(GL_BLEND);
+  lightingTimer.End();
+
+  stats.lightCoverage =
+      stats.width > 0 ? (float)((double)pixels / stats.width / stats.height)
+                      : 0.0f;
+  stats.geometryGpuMs = geometryTimer.GetElapsedMs();
+  stats.lightingGpuMs = lightingTimer.GetElapsedMs();
+}
+
+void DeferredRenderer::WriteJson(JsonWriter &json) const {
+  json.BeginObject();
+  json.Field("enabled", enabled);
+  json.Field("width", stats.width);
+  json.Field("height", stats.height);
+  json.Field("gbufferBytes", stats.gbufferBytes);
+  json.Field("lightPasses", stats.lightPasses);
+  json.Field("culledLights", stats.culledLights);
+  json.Field("lightCoverage", stats.lightCoverage);
+  json.Field("geometryGpuMs", stats.geometryGpuMs);
+  json.Field("lightingGpuMs", stats.lightingGpuMs);
+  json.EndObject();
+}
+
+void DeferredRenderer::DrawDebugPanel() {
+  ImGui::Begin("Deferred Shading");
+  ImGui::Checkbox("Deferred opaque pass", &enabled);
+  ImGui::TextDisabled("One sample per pixel: no MSAA on opaque objects");
+  if (enabled && stats.width > 0) {
+    ImGui::Text("G-buffer %dx%d, %.2f MB", stats.width, stats.height,
+                stats.gbufferBytes / (1024.0 * 1024.0));
+    ImGui::Text("%d light passes, %d lights culled", stats.lightPasses,
+                stats.culledLights);
+    ImGui::Text("Shaded %.2f times per pixel", stats.lightCoverage);
+    ImGui::Text("GPU: geometry %.3f ms, lighting %.3f ms",
+                stats.geometryGpuMs, stats.lightingGpuMs);
+  }
+  ImGui::End();
+}
+
+// One light setup of the deferred benchmark.
+struct DeferredBenchmarkLights {
+  int pointLights;
+  int spotLights;
+};
+
+int DeferredRenderer::RunHeadlessBenchmark(const HeadlessOptions &options,
+                                           const std::string &contextApi,
+                                           const CameraPath &path,
+                                           Scene *scene,
+                                           ShadowAtlas *shadowAtlas,
+                                           const GpuFrameTimer &measure) {
+  const glm::ivec2 sizes[] = {{640, 360}, {1280, 720}, {1920, 1080}};
+  const DeferredBenchmarkLights lightSetups[] = {
+      {0, 0}, {1, 1}, {2, 2}, {4, 4}, {MAX_POINT_LIGHTS, MAX_SPOT_LIGHTS}};
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  const std::vector<PointLight *> scenePointLights = scene->pointLights;
+  const std::vector<SpotLight *> sceneSpotLights = scene->spotLights;
+
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("contextApi", contextApi);
+  json.Field("renderer",
+             std::string((const char *)glGetString(GL_RENDERER)));
+  json.Field("frames", options.frames);
+  json.Field("warmupFrames", options.warmupFrames);
+  json.Field("directionalLights", (int)scene->dirLights.size());
+  json.Field("areaLights", (int)scene->areaLights.size());
+  json.Key("runs");
+  json.BeginArray();
+  for (const DeferredBenchmarkLights &setup : lightSetups) {
+    scene->pointLights.clear();
+    scene->spotLights.clear();
+    SetBenchmarkLights(scene, setup.pointLights, setup.spotLights);
+    // New lights may reuse the addresses of deleted ones.
+    shadowAtlas->MarkAllDirty();
+    for (const glm::ivec2 &size : sizes) {
+      SetEnabled(false);
+      const double forwardMs = measure(path, size.x, size.y, nullptr);
+      SetEnabled(true);
+      const double deferredMs = measure(path, size.x, size.y, nullptr);
+      json.BeginObject();
+      json.Field("width", size.x);
+      json.Field("height", size.y);
+      json.Field("pointLights", setup.pointLights);
+      json.Field("spotLights", setup.spotLights);
+      json.Field("forwardGpuMs", forwardMs);
+      json.Field("deferredGpuMs", deferredMs);
+      json.Field("gbufferBytes", stats.gbufferBytes);
+      json.Field("lightPasses", stats.lightPasses);
+      json.Field("lightCoverage", stats.lightCoverage);
+      json.EndObject();
+    }
+    DeleteBenchmarkLights(scene);
+  }
+  json.EndArray();
+  json.EndObject();
+  file << std::endl;
+
+  scene->pointLights = scenePointLights;
+  scene->spotLights = sceneSpotLights;
+  shadowAtlas->MarkAllDirty();
+  SetEnabled(options.render.deferred);
+  return 0;
+}
@@ -0,0 +1,105 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include "gpu_timer.h"
+#include "headers.h"
+#include "headless.h"
+
+class Camera;
+class DeferredLightShaderProg;
+class JsonWriter;
+class ShadowAtlas;
+struct Scene;
+
+struct DeferredStats {
+  int width = 0;
+  int height = 0;
+  long long gbufferBytes = 0;
+  // The fullscreen pass of the directional and area lights, plus one pass
+  // per point or spot light that reaches the screen.
+  int lightPasses = 0;
+  // Point and spot lights whose reach is off screen.
+  int culledLights = 0;
+  // Pixels shaded by all passes per screen pixel.
+  float lightCoverage = 0.0f;
+  double geometryGpuMs = 0.0;
+  double lightingGpuMs = 0.0;
+};
+
+// DeferredRenderer Declarations.
+// Deferred path of the opaque pass. The geometry pass draws the objects
+// with phong_shading_demo.fs built with GBUFFER_PASS, which writes a
+// compact G-buffer instead of lighting every overdrawn fragment:
+//   albedo   RGBA8  effective Kd, a: has a lightmap
+//   specular RGBA8  effective Ks, a: Ns on a log scale
+//   normal   RG16   octahedral camera-space normal
+//   indirect RGBA8  ambient (constant, sky or probes) and lightmap light
+//   depth    DEPTH24
+// The lighting passes then run the light loops of the same shader once per
+// pixel: a fullscreen pass for the indirect light and the directional and
+// area lights, then one additive pass per point or spot light, scissored
+// to the screen rect of the sphere where its light is above 1/256.
+//
+// The G-buffer has one sample per pixel, so the opaque pass loses MSAA.
+class DeferredRenderer {
+ public:
+  // DeferredRenderer Public Methods.
+  DeferredRenderer();
+  ~DeferredRenderer();
+
+  // Binds the G-buffer, sized to the current viewport, and clears it. Draw
+  // the opaque objects with the GBUFFER_PASS program, then EndGeometry.
+  void BeginGeometry();
+  // Rebinds the framebuffer BeginGeometry found bound.
+  void EndGeometry();
+  // Lights the G-buffer into the bound framebuffer and writes its depth.
+  // shader is bound with the uniforms of the forward shader uploaded (the
+  // lights, switches and shadows); the lights are placed with
+  // rootTransform.
+  void Shade(DeferredLightShaderProg *shader, const Scene *scene,
+             const Camera *camera, const glm::mat4x4 &rootTransform);
+
+  // Off, the opaque pass stays forward.
+  void SetEnabled(const bool on) { enabled = on; }
+  bool IsEnabled() const { return enabled; }
+  const DeferredStats &GetStats() const { return stats; }
+  void WriteJson(JsonWriter &json) const;
+  void DrawDebugPanel();
+
+  // Renders path forward and deferred with measure at every resolution
+  // and light setup and writes the mean GPU time of each, with the
+  // G-buffer stats of the last deferred frame. The scene's own point and
+  // spot lights are swapped out for the run.
+  int RunHeadlessBenchmark(const HeadlessOptions &options,
+                           const std::string &contextApi,
+                           const CameraPath &path, Scene *scene,
+                           ShadowAtlas *shadowAtlas,
+                           const GpuFrameTimer &measure);
+
+ private:
+  // DeferredRenderer Private Methods.
+  void Resize(const int width, const int height);
+  void Release();
+  // Pixel rect (x, y, w, h) of a sphere in camera space; false if it is
+  // off screen.
+  bool GetScissor(const glm::vec3 &center, const float radius,
+                  const glm::mat4x4 &proj, const float zNear,
+                  glm::ivec4 &rect) const;
+
+  // DeferredRenderer Private Data.
+  enum Target { Albedo, Specular, Normal, Indirect, kNumTargets };
+  // Texture units of the targets, then the depth; after the forward
+  // shader's units.
+  static const int kFirstTextureUnit = 6;
+
+  bool enabled = false;
+  GLuint fboId = 0;
+  GLuint targets[kNumTargets] = {};
+  GLuint depthTexture = 0;
+  GLint prevFbo = 0;
+  GpuTimer geometryTimer;
+  GpuTimer lightingTimer;
+  DeferredStats stats;
+};
+
+#endif
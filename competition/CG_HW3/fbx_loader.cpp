@@ -1,5 +1,9 @@
 ﻿#include "fbx_loader.h"
 
+#include <chrono>
+
+#include "timing.h"
+
 // 構造函式
 FbxSdkLoader::FbxSdkLoader(TriangleMesh *mesh)
     : mesh(mesh),
@@ -62,6 +66,55 @@ void FbxSdkLoader::polygonSubdivision(std::vector<VertexPTN> &vertices,
 
 // 載入 FBX 檔案
 bool FbxSdkLoader::loadFbx(const std::string &filePath, Scene *scene)
+{
+  if (!importScene(filePath, scene))
+  {
+    return false;
+  }
+
+  // 處理場景根節點
+  FbxNode *rootNode = fbxScene->GetRootNode();
+  if (rootNode)
+  {
+    FbxAMatrix identity;
+    identity.SetIdentity();
+    processNode(rootNode, identity, scene);
+  }
+
+  return true;
+}
+
+bool FbxSdkLoader::loadFbxGraph(const std::string &filePath, Scene *scene)
+{
+  const auto start = std::chrono::steady_clock::now();
+  if (!importScene(filePath, scene))
+  {
+    return false;
+  }
+
+  SceneImportStats stats;
+  std::unordered_map<FbxMesh *, TriangleMesh *> meshes;
+  FbxNode *rootNode = fbxScene->GetRootNode();
+  if (rootNode)
+  {
+    processGraphNode(rootNode, -1, scene, meshes, stats);
+  }
+  stats.sharedBytes += (long long)stats.nodes * sizeof(SceneNode) +
+                       (long long)stats.meshReferences *
+                           (sizeof(SceneObject) + sizeof(glm::mat4x4));
+  stats.loadMs = MsSince(start);
+  scene->graph.SetImportStats(stats);
+  scene->graph.Update(scene->objects);
+
+  std::cout << "Scene graph: " << stats.nodes << " nodes, "
+            << stats.meshReferences << " mesh references to "
+            << stats.uniqueMeshes << " meshes, "
+            << stats.sharedBytes / 1024 << " KB instead of "
+            << stats.bakedBytes / 1024 << " KB baked" << std::endl;
+  return true;
+}
+
+bool FbxSdkLoader::importScene(const std::string &filePath, Scene *scene)
 {
   // 初始化導入器
   if (!importer->Initialize(filePath.c_str(), -1,
@@ -95,17 +148,34 @@ bool FbxSdkLoader::loadFbx(const std::string &filePath, Scene *scene)
   scene->ambientLight = glm::vec3(static_cast<float>(ambientColor.mRed),
                                   static_cast<float>(ambientColor.mGreen),
                                   static_cast<float>(ambientColor.mBlue));
+  return true;
+}
 
-  // 處理場景根節點
-  FbxNode *rootNode = fbxScene->GetRootNode();
-  if (rootNode)
+// Pivot offset of a node's geometry; the children do not inherit it.
+FbxAMatrix FbxSdkLoader::getGeometryTransform(FbxNode *node)
+{
+  FbxVector4 geoTranslation = node->GetGeometricTranslation(FbxNode::eSourcePivot);
+  FbxVector4 geoRotation = node->GetGeometricRotation(FbxNode::eSourcePivot);
+  FbxVector4 geoScaling = node->GetGeometricScaling(FbxNode::eSourcePivot);
+
+  FbxAMatrix geometryTransform;
+  geometryTransform.SetT(geoTranslation);
+  geometryTransform.SetR(geoRotation);
+  geometryTransform.SetS(geoScaling);
+  return geometryTransform;
+}
+
+glm::mat4 FbxSdkLoader::convertFbxMatrixToGlm(const FbxAMatrix &fbxMat)
+{
+  glm::mat4 glmMat;
+  for (int column = 0; column < 4; column++)
   {
-    FbxAMatrix identity;
-    identity.SetIdentity();
-    processNode(rootNode, identity, scene);
+    for (int row = 0; row < 4; row++)
+    {
+      glmMat[column][row] = static_cast<float>(fbxMat.Get(column, row));
+    }
   }
-
-  return true;
+  return glmMat;
 }
 
 // 處理節點
@@ -132,16 +202,7 @@ void FbxSdkLoader::processNode(FbxNode *node, const FbxAMatrix &parentTransform,
       FbxMesh *fbxMesh = node->GetMesh();
 
       // get geometry transform
-      FbxVector4 geoTranslation = node->GetGeometricTranslation(FbxNode::eSourcePivot);
-      FbxVector4 geoRotation = node->GetGeometricRotation(FbxNode::eSourcePivot);
-      FbxVector4 geoScaling = node->GetGeometricScaling(FbxNode::eSourcePivot);
-
-      FbxAMatrix geometryTransform;
-      geometryTransform.SetT(geoTranslation);
-      geometryTransform.SetR(geoRotation);
-      geometryTransform.SetS(geoScaling);
-
-      globalTransform = globalTransform * geometryTransform;
+      globalTransform = globalTransform * getGeometryTransform(node);
 
       processMesh(fbxMesh, globalTransform, scene);
     }
@@ -154,6 +215,52 @@ void FbxSdkLoader::processNode(FbxNode *node, const FbxAMatrix &parentTransform,
   }
 }
 
+void FbxSdkLoader::processGraphNode(
+    FbxNode *node, const int parent, Scene *scene,
+    std::unordered_map<FbxMesh *, TriangleMesh *> &meshes,
+    SceneImportStats &stats)
+{
+  const int index = scene->graph.AddNode(
+      node->GetName(), parent,
+      convertFbxMatrixToGlm(node->EvaluateLocalTransform()));
+  stats.nodes++;
+
+  processLights(node, scene);
+  processCamera(node, scene);
+
+  if (node->GetNodeAttribute() &&
+      node->GetNodeAttribute()->GetAttributeType() == FbxNodeAttribute::eMesh)
+  {
+    // Instanced nodes point at the same FbxMesh; load it once, untransformed.
+    FbxMesh *fbxMesh = node->GetMesh();
+    TriangleMesh *&shared = meshes[fbxMesh];
+    if (shared == nullptr)
+    {
+      shared = new TriangleMesh();
+      mesh = shared;
+      FbxAMatrix identity;
+      identity.SetIdentity();
+      processMesh(fbxMesh, identity, scene);
+      shared->computeBounds();
+      stats.uniqueMeshes++;
+      stats.sharedBytes += (long long)shared->GetGeometryBytes();
+    }
+    stats.meshReferences++;
+    stats.bakedBytes += (long long)shared->GetGeometryBytes();
+
+    SceneObject sceneObj;
+    sceneObj.mesh = shared;
+    scene->objects.push_back(sceneObj);
+    const glm::mat4 offset = convertFbxMatrixToGlm(getGeometryTransform(node));
+    scene->graph.AttachObject(index, (int)scene->objects.size() - 1, offset);
+  }
+
+  for (int i = 0; i < node->GetChildCount(); i++)
+  {
+    processGraphNode(node->GetChild(i), index, scene, meshes, stats);
+  }
+}
+
 // 處理網格
 void FbxSdkLoader::processMesh(FbxMesh *fbxMesh, const FbxAMatrix &transform,
                                Scene *scene)
@@ -354,9 +461,10 @@ void FbxSdkLoader::processTexture(FbxProperty &prop, PhongMaterial *phongMateria
     // tell if the texture is .dds
     std::string extension = texturePath.substr(texturePath.find_last_of(".") + 1);
 
-    if (extension == "dds")
+    // DDS files are loaded as they are; fall back to a .png next to them
+    // if the referenced file is missing.
+    if (extension == "dds" && !std::filesystem::exists(texturePath))
     {
-      // transform .dds to .png
       texturePath = texturePath.substr(0, texturePath.find_last_of(".")) + ".png";
     }
 
@@ -10,9 +10,11 @@
 class FbxSdkLoader : public FbxModelLoader
 {
 public:
-  FbxSdkLoader(TriangleMesh *);
+  // mesh receives the baked import; loadFbxGraph creates its own meshes.
+  FbxSdkLoader(TriangleMesh *mesh = nullptr);
   ~FbxSdkLoader();
   bool loadFbx(const std::string &filePath, Scene *scene) override;
+  bool loadFbxGraph(const std::string &filePath, Scene *scene) override;
 
 private:
   TriangleMesh *mesh;
@@ -25,8 +27,15 @@ private:
   void polygonSubdivision(std::vector<VertexPTN> &vertices, TriangleMesh *mesh,
                           SubMesh &subMesh);
 
+  // Imports the file into fbxScene in the viewer's axes and units.
+  bool importScene(const std::string &filePath, Scene *scene);
+
   void processNode(FbxNode *node, const FbxAMatrix &parentTransform,
                    Scene *scene);
+  void processGraphNode(FbxNode *node, const int parent, Scene *scene,
+                        std::unordered_map<FbxMesh *, TriangleMesh *> &meshes,
+                        SceneImportStats &stats);
+  FbxAMatrix getGeometryTransform(FbxNode *node);
   void processMesh(FbxMesh *fbxMesh, const FbxAMatrix &transform, Scene *scene);
   void processMaterial(FbxSurfaceMaterial *fbxMaterial,
                        PhongMaterial *phongMaterial);
@@ -6,8 +6,13 @@
 class FbxModelLoader
 {
 public:
-    FbxModelLoader();
-    ~FbxModelLoader();
+    FbxModelLoader() {}
+    virtual ~FbxModelLoader() {}
 
+    // Bakes every node's transform into the vertices of one TriangleMesh.
     virtual bool loadFbx(const std::string &filePath, Scene *scene) = 0;
+    // Adds the node hierarchy to scene->graph instead, with one TriangleMesh
+    // per distinct mesh, shared by all nodes that reference it, and one
+    // scene object per reference.
+    virtual bool loadFbxGraph(const std::string &filePath, Scene *scene) = 0;
 };
\ No newline at end of file
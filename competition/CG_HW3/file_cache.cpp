@@ -0,0 +1,77 @@
+#include "file_cache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace FileCache {
+
+static const char *kCacheDirectory = "cache";
+
+uint64_t Hash(const void *data, const size_t size, const uint64_t seed) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool HashFile(const std::string &filePath, uint64_t &hash) {
+  std::vector<char> data;
+  if (!ReadFile(filePath, data)) {
+    return false;
+  }
+  hash = Hash(data.data(), data.size());
+  return true;
+}
+
+std::string GetCachePath(const std::string &sourcePath, const uint64_t key,
+                         const std::string &extension) {
+  std::ostringstream name;
+  name << std::filesystem::path(sourcePath).stem().string() << "_" << std::hex
+       << key << extension;
+  return (std::filesystem::path(kCacheDirectory) / name.str()).string();
+}
+
+bool ReadFile(const std::string &filePath, std::vector<char> &data) {
+  std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  std::streamsize size = file.tellg();
+  file.seekg(0, std::ios::beg);
+  data.resize((size_t)size);
+  return (bool)file.read(data.data(), size);
+}
+
+bool WriteFile(const std::string &filePath, const void *data,
+               const size_t size) {
+  std::error_code error;
+  std::filesystem::path path(filePath);
+  if (path.has_parent_path()) {
+    std::filesystem::create_directories(path.parent_path(), error);
+  }
+
+  std::string tmpPath = filePath + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file || !file.write((const char *)data, (std::streamsize)size)) {
+      std::cerr << "[ERROR] Failed to write cache file: " << filePath
+                << std::endl;
+      return false;
+    }
+  }
+  std::filesystem::rename(tmpPath, filePath, error);
+  if (error) {
+    std::cerr << "[ERROR] Failed to write cache file: " << filePath
+              << std::endl;
+    std::filesystem::remove(tmpPath, error);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace FileCache
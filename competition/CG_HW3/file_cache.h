@@ -0,0 +1,33 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Helpers for caching derived data (converted textures, bakes, ...) on disk.
+// Cache files are keyed by a hash of the source data, so editing a source
+// file invalidates its cache entries automatically.
+namespace FileCache {
+
+const uint64_t kFnvOffsetBasis = 1469598103934665603ULL;
+
+// 64-bit FNV-1a. Pass a previous result as seed to hash several buffers.
+uint64_t Hash(const void *data, const size_t size,
+              const uint64_t seed = kFnvOffsetBasis);
+
+// Hash of the whole file; returns false if it cannot be read.
+bool HashFile(const std::string &filePath, uint64_t &hash);
+
+// Path of a cache entry: <cache dir>/<source stem>_<key in hex><extension>.
+std::string GetCachePath(const std::string &sourcePath, const uint64_t key,
+                         const std::string &extension);
+
+bool ReadFile(const std::string &filePath, std::vector<char> &data);
+// Writes through a temporary file, so a crash never leaves half an entry.
+bool WriteFile(const std::string &filePath, const void *data,
+               const size_t size);
+
+}  // namespace FileCache
+
+#endif
@@ -0,0 +1,55 @@
+#include "gpu_timer.h"
+
+GpuTimer::GpuTimer() {
+  current = 0;
+  elapsedMs = 0.0;
+  glGenQueries(kNumSlots, beginQueries);
+  glGenQueries(kNumSlots, endQueries);
+  for (int i = 0; i < kNumSlots; ++i) {
+    pending[i] = false;
+  }
+}
+
+GpuTimer::~GpuTimer() {
+  glDeleteQueries(kNumSlots, beginQueries);
+  glDeleteQueries(kNumSlots, endQueries);
+}
+
+void GpuTimer::Begin() {
+  // The slot we are about to reuse was issued kNumSlots frames ago, so its
+  // result is almost always ready by now.
+  if (pending[current]) {
+    Resolve(current);
+  }
+  glQueryCounter(beginQueries[current], GL_TIMESTAMP);
+}
+
+void GpuTimer::End() {
+  glQueryCounter(endQueries[current], GL_TIMESTAMP);
+  pending[current] = true;
+  current = (current + 1) % kNumSlots;
+
+  // Opportunistically pick up results that are already available, oldest
+  // first, so the reported value never jumps back in time.
+  for (int k = 0; k < kNumSlots; ++k) {
+    int slot = (current + k) % kNumSlots;
+    if (!pending[slot]) {
+      continue;
+    }
+    GLint available = 0;
+    glGetQueryObjectiv(endQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      break;
+    }
+    Resolve(slot);
+  }
+}
+
+void GpuTimer::Resolve(int slot) {
+  GLuint64 beginNs = 0;
+  GLuint64 endNs = 0;
+  glGetQueryObjectui64v(beginQueries[slot], GL_QUERY_RESULT, &beginNs);
+  glGetQueryObjectui64v(endQueries[slot], GL_QUERY_RESULT, &endNs);
+  elapsedMs = (double)(endNs - beginNs) / 1.0e6;
+  pending[slot] = false;
+}
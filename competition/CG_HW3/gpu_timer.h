@@ -0,0 +1,35 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include "headers.h"
+
+// GpuTimer Declarations.
+// Measures GPU time between Begin() and End() with GL_TIMESTAMP queries.
+// Results are read back a few frames later so the CPU never waits on the GPU.
+// Timestamp queries (unlike GL_TIME_ELAPSED) may be nested freely.
+class GpuTimer {
+ public:
+  // GpuTimer Public Methods.
+  GpuTimer();
+  ~GpuTimer();
+
+  void Begin();
+  void End();
+
+  // Latest resolved time in milliseconds (0 until the first result arrives).
+  double GetElapsedMs() const { return elapsedMs; }
+
+ private:
+  // GpuTimer Private Methods.
+  void Resolve(int slot);
+
+  // GpuTimer Private Data.
+  static const int kNumSlots = 4;
+  GLuint beginQueries[kNumSlots];
+  GLuint endQueries[kNumSlots];
+  bool pending[kNumSlots];
+  int current;
+  double elapsedMs;
+};
+
+#endif
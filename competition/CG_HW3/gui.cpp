@@ -151,8 +151,15 @@ void GUI::render(DirectionalLight* dirLight,
     ImGui::Checkbox("Enable Ambient Light", &guiState.onAmbientLight);
     ImGui::Checkbox("Enable Diffuse Light", &guiState.onDiffuseLight);
     ImGui::Checkbox("Enable Specular Light", &guiState.onSpecularLight);
+    ImGui::Checkbox("Enable Shadows", &guiState.onShadow);
+    settingsAnchor = ImVec2(ImGui::GetWindowPos().x + ImGui::GetWindowWidth() + 8.0f,
+        ImGui::GetWindowPos().y);
     ImGui::End();
 
+    for (auto& panel : panels) {
+        panel();
+    }
+
     // 渲染 ImGui
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
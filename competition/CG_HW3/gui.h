@@ -14,6 +14,7 @@ struct GUIState {
     bool& onAmbientLight;
     bool& onDiffuseLight;
     bool& onSpecularLight;
+    bool& onShadow;
     float& dirLightArrowScale;
 
     float& curObjRotationX;
@@ -22,7 +23,7 @@ struct GUIState {
 
     GUIState(bool& isBlingPhong, bool& showDirLightArrow, bool& onPointLight,
         bool& onSpotLight, bool& onDirLight, bool& onAmbientLight,
-        bool& onDiffuseLight, bool& onSpecularLight,
+        bool& onDiffuseLight, bool& onSpecularLight, bool& onShadow,
         float& dirLightArrowScale, float& curObjRotationX, float& curObjRotationY,
         float& skyboxRotation)
         : isBlingPhong(isBlingPhong),
@@ -33,6 +34,7 @@ struct GUIState {
         onAmbientLight(onAmbientLight),
         onDiffuseLight(onDiffuseLight),
         onSpecularLight(onSpecularLight),
+        onShadow(onShadow),
         dirLightArrowScale(dirLightArrowScale),
         curObjRotationX(curObjRotationX),
         curObjRotationY(curObjRotationY),
@@ -49,7 +51,16 @@ public:
         std::vector<std::string> objFilePaths,
         std::vector<std::string> skyboxFilePath, GUIState& guiState);
 
+    // Extra windows (debug panels etc.) drawn every frame after the built-in
+    // ones.
+    void AddPanel(std::function<void()> panel) { panels.push_back(panel); }
+
+    // Just right of the "Settings" window, for panels that open next to it.
+    ImVec2 GetSettingsAnchor() const { return settingsAnchor; }
+
 private:
+    std::vector<std::function<void()>> panels;
+    ImVec2 settingsAnchor;
 };
 
 #endif  // GUI_H
\ No newline at end of file
@@ -1,4 +1,4 @@
-#ifndef HEADERS_H
+﻿#ifndef HEADERS_H
 #define HEADERS_H
 
 // OpenGL and FreeGlut headers.
@@ -16,8 +16,10 @@
 // C++ STL headers.
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <set>
 #include <sstream>
 #include <string>
 #include <algorithm>
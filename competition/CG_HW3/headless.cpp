@@ -0,0 +1,588 @@
+#include "headless.h"
+
+#include <chrono>
+
+#include "json_writer.h"
+#include "light.h"
+#include "profiler.h"
+#include "scene.h"
+#include "timing.h"
+
+static void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  --headless          Run the benchmark without a window\n"
+            << "  --scene PATH        Model to load\n"
+            << "  --camera-path PATH  Camera path to replay (default: orbit)\n"
+            << "  --frames N          Measured frames (default 300)\n"
+            << "  --warmup N          Frames before measuring (default 30)\n"
+            << "  --size WxH          Framebuffer size (default 1280x720)\n"
+            << "  --output PATH       JSON report (default benchmark.json)\n"
+            << "  --trace PATH        Chrome trace of the run (profiler builds)\n"
+            << "  --memory-json PATH  Write the memory breakdown per resource\n"
+            << "\n"
+            << "Jobs, run instead of the viewer; stats go to --output:\n"
+            << "  --software PATH     Render one frame on the CPU to a PNG\n"
+            << "  --ray-bench         Build the BVH and trace primary rays\n"
+            << "  --path-trace PATH   Path trace the scene to a PNG or EXR\n"
+            << "  --spp N             Path trace samples per pixel (default 64)\n"
+            << "  --bake-lightmap     Bake the static lights into lightmaps\n"
+            << "  --bake-probes       Bake the irradiance probe grid\n"
+            << "  --encode-textures   Encode the sidecars of the scene\n"
+            << "  --deferred-bench    Compare forward and deferred GPU times\n"
+            << "                      per light count and resolution\n"
+            << "  --visibility-bench  Compare forward, deferred and\n"
+            << "                      visibility buffer GPU times per\n"
+            << "                      overdraw\n"
+            << "  --texture-bench     Compare texture VRAM and load times per\n"
+            << "                      mode, offscreen\n"
+            << "  --shader-bench      Compare shader startup from source and\n"
+            << "                      from a cold and a warm binary cache,\n"
+            << "                      offscreen\n"
+            << "\n"
+            << "Rendering:\n"
+            << "  --instances N       Spawn N copies of the test cube, shadows\n"
+            << "                      off (instancing stress test)\n"
+            << "  --no-instancing     Draw every object with its own calls\n"
+            << "  --no-shader-variants\n"
+            << "                      Draw with the uber phong shader only\n"
+            << "  --deferred          Deferred shading of the opaque pass\n"
+            << "  --visibility        Visibility buffer for the opaque pass\n"
+            << "\n"
+            << "Resources:\n"
+            << "  --texture-compression off|cached|rebuild\n"
+            << "                      Upload textures as BC1/BC3 from .dds\n"
+            << "                      sidecars (default off)\n"
+            << "  --mips driver|box|kaiser\n"
+            << "                      Mip filter of uncompressed textures\n"
+            << "                      (default box)\n"
+            << "  --stream-textures   Stream texture mips by screen size\n"
+            << "  --texture-budget MB VRAM budget of the streamed textures\n"
+            << "  --gpu-resident      Free the CPU copies of uploaded meshes\n"
+            << "                      and textures; streamed textures keep\n"
+            << "                      their finer levels, level 0\n"
+            << "                      included\n"
+            << "  --shader-cache off|on|rebuild\n"
+            << "                      Reuse program binaries across runs\n"
+            << "                      (default on)"
+            << std::endl;
+}
+
+bool ParseCommandLine(int argc, char **argv, HeadlessOptions &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--headless") {
+      options.enabled = true;
+    } else if (arg == "--scene" && hasValue) {
+      options.scenePath = argv[++i];
+    } else if (arg == "--camera-path" && hasValue) {
+      options.cameraPathFile = argv[++i];
+    } else if (arg == "--frames" && hasValue) {
+      options.frames = std::atoi(argv[++i]);
+    } else if (arg == "--warmup" && hasValue) {
+      options.warmupFrames = std::atoi(argv[++i]);
+    } else if (arg == "--size" && hasValue) {
+      if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) !=
+          2) {
+        PrintUsage(argv[0]);
+        return false;
+      }
+    } else if (arg == "--output" && hasValue) {
+      options.outputPath = argv[++i];
+    } else if (arg == "--trace" && hasValue) {
+      options.tracePath = argv[++i];
+    } else if (arg == "--software" && hasValue) {
+      options.jobs.softwareImagePath = argv[++i];
+    } else if (arg == "--ray-bench") {
+      options.jobs.rayBenchmark = true;
+    } else if (arg == "--path-trace" && hasValue) {
+      options.jobs.pathTraceImagePath = argv[++i];
+    } else if (arg == "--spp" && hasValue) {
+      options.jobs.pathTraceSamples = std::atoi(argv[++i]);
+    } else if (arg == "--bake-lightmap") {
+      options.jobs.bakeLightmap = true;
+    } else if (arg == "--bake-probes") {
+      options.jobs.bakeProbes = true;
+    } else if (arg == "--instances" && hasValue) {
+      options.render.instances = std::atoi(argv[++i]);
+    } else if (arg == "--no-instancing") {
+      options.render.noInstancing = true;
+    } else if (arg == "--no-shader-variants") {
+      options.render.noShaderVariants = true;
+    } else if (arg == "--deferred") {
+      options.render.deferred = true;
+    } else if (arg == "--deferred-bench") {
+      options.enabled = true;
+      options.jobs.deferredBenchmark = true;
+    } else if (arg == "--visibility") {
+      options.render.visibility = true;
+    } else if (arg == "--visibility-bench") {
+      options.enabled = true;
+      options.jobs.visibilityBenchmark = true;
+    } else if (arg == "--texture-compression" && hasValue) {
+      const std::string mode = argv[++i];
+      if (mode == "off") {
+        options.resources.textureCompression = TextureCompression::Off;
+      } else if (mode == "cached") {
+        options.resources.textureCompression = TextureCompression::Cached;
+      } else if (mode == "rebuild") {
+        options.resources.textureCompression = TextureCompression::Rebuild;
+      } else {
+        PrintUsage(argv[0]);
+        return false;
+      }
+    } else if (arg == "--mips" && hasValue) {
+      const std::string mode = argv[++i];
+      if (mode == "driver") {
+        options.resources.mipGeneration = MipGeneration::Driver;
+      } else if (mode == "box") {
+        options.resources.mipGeneration = MipGeneration::Box;
+      } else if (mode == "kaiser") {
+        options.resources.mipGeneration = MipGeneration::Kaiser;
+      } else {
+        PrintUsage(argv[0]);
+        return false;
+      }
+    } else if (arg == "--stream-textures") {
+      options.resources.streamTextures = true;
+    } else if (arg == "--texture-budget" && hasValue) {
+      options.resources.textureBudgetMb = std::atoi(argv[++i]);
+    } else if (arg == "--gpu-resident") {
+      options.resources.gpuResident = true;
+    } else if (arg == "--memory-json" && hasValue) {
+      options.memoryJsonPath = argv[++i];
+    } else if (arg == "--shader-cache" && hasValue) {
+      const std::string mode = argv[++i];
+      if (mode == "off") {
+        options.resources.shaderCache = ProgramBinaryCache::Off;
+      } else if (mode == "on") {
+        options.resources.shaderCache = ProgramBinaryCache::On;
+      } else if (mode == "rebuild") {
+        options.resources.shaderCache = ProgramBinaryCache::Rebuild;
+      } else {
+        PrintUsage(argv[0]);
+        return false;
+      }
+    } else if (arg == "--shader-bench") {
+      options.enabled = true;
+      options.jobs.shaderBenchmark = true;
+    } else if (arg == "--encode-textures") {
+      options.jobs.encodeTextures = true;
+    } else if (arg == "--texture-bench") {
+      // Needs a GL context for the uploads.
+      options.enabled = true;
+      options.jobs.textureBenchmark = true;
+    } else {
+      std::cerr << "[ERROR] Unknown argument: " << arg << std::endl;
+      PrintUsage(argv[0]);
+      return false;
+    }
+  }
+  if (options.frames <= 0 || options.warmupFrames < 0 || options.width <= 0 ||
+      options.height <= 0 || options.jobs.pathTraceSamples <= 0 ||
+      options.render.instances < 0 || options.resources.textureBudgetMb < 0) {
+    PrintUsage(argv[0]);
+    return false;
+  }
+  return true;
+}
+
+bool RunsWithoutGL(const HeadlessOptions &options) {
+  const HeadlessOptions::Jobs &jobs = options.jobs;
+  return jobs.encodeTextures || !jobs.softwareImagePath.empty() ||
+         jobs.rayBenchmark || !jobs.pathTraceImagePath.empty() ||
+         jobs.bakeLightmap || jobs.bakeProbes;
+}
+
+bool OpenReport(const HeadlessOptions &options, std::ofstream &file) {
+  file.open(options.outputPath);
+  if (!file) {
+    std::cerr << "[ERROR] Failed to write report: " << options.outputPath
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+GLFWwindow *CreateOffscreenWindow(const int width, const int height,
+                                  std::string &contextApi) {
+  const int apis[2] = {GLFW_EGL_CONTEXT_API, GLFW_OSMESA_CONTEXT_API};
+  const char *names[2] = {"EGL", "OSMesa"};
+  for (int i = 0; i < 2; ++i) {
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, apis[i]);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    GLFWwindow *window =
+        glfwCreateWindow(width, height, "Headless", NULL, NULL);
+    if (window != nullptr) {
+      contextApi = names[i];
+      return window;
+    }
+    std::cerr << "[WARNING] " << names[i] << " context creation failed"
+              << std::endl;
+  }
+  return nullptr;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+bool CameraPath::Load(const std::string &filePath) {
+  std::ifstream file(filePath);
+  if (!file) {
+    std::cerr << "[ERROR] Failed to open camera path: " << filePath
+              << std::endl;
+    return false;
+  }
+  keys.clear();
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream iss(line);
+    CameraKey key;
+    if (iss >> key.time >> key.position.x >> key.position.y >>
+        key.position.z >> key.target.x >> key.target.y >> key.target.z) {
+      keys.push_back(key);
+    }
+  }
+  if (keys.empty()) {
+    std::cerr << "[ERROR] Camera path has no keys: " << filePath << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool CameraPath::Save(const std::string &filePath) const {
+  std::ofstream file(filePath);
+  if (!file) {
+    std::cerr << "[ERROR] Failed to write camera path: " << filePath
+              << std::endl;
+    return false;
+  }
+  file << "# time px py pz tx ty tz\n";
+  for (const auto &key : keys) {
+    file << key.time << " " << key.position.x << " " << key.position.y << " "
+         << key.position.z << " " << key.target.x << " " << key.target.y
+         << " " << key.target.z << "\n";
+  }
+  return true;
+}
+
+void CameraPath::AddKey(const float time, const glm::vec3 &position,
+                        const glm::vec3 &target) {
+  CameraKey key;
+  key.time = time;
+  key.position = position;
+  key.target = target;
+  keys.push_back(key);
+}
+
+void CameraPath::Sample(const float time, glm::vec3 &position,
+                        glm::vec3 &target) const {
+  if (keys.empty()) {
+    return;
+  }
+  if (time <= keys.front().time) {
+    position = keys.front().position;
+    target = keys.front().target;
+    return;
+  }
+  for (size_t i = 1; i < keys.size(); ++i) {
+    if (time <= keys[i].time) {
+      const CameraKey &a = keys[i - 1];
+      const CameraKey &b = keys[i];
+      float span = b.time - a.time;
+      float t = span > 0.0f ? (time - a.time) / span : 1.0f;
+      position = glm::mix(a.position, b.position, t);
+      target = glm::mix(a.target, b.target, t);
+      return;
+    }
+  }
+  position = keys.back().position;
+  target = keys.back().target;
+}
+
+CameraPath CameraPath::Orbit(const glm::vec3 &center, const float radius,
+                             const float height, const int numKeys) {
+  CameraPath path;
+  for (int i = 0; i <= numKeys; ++i) {
+    float t = (float)i / (float)numKeys;
+    float angle = t * 2.0f * glm::pi<float>();
+    glm::vec3 position =
+        center + glm::vec3(radius * std::cos(angle), height,
+                           radius * std::sin(angle));
+    path.AddKey(t, position, center);
+  }
+  return path;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+void SetBenchmarkLights(Scene *scene, const int pointLights,
+                        const int spotLights) {
+  glm::vec3 bmin, bmax;
+  scene->GetBounds(bmin, bmax);
+  const glm::vec3 center = 0.5f * (bmin + bmax);
+  const glm::vec3 extent = glm::max(bmax - bmin, glm::vec3(0.1f));
+  const float reach = 0.5f * glm::length(extent);
+  const int count = pointLights + spotLights;
+  for (int i = 0; i < count; ++i) {
+    const float angle = 2.0f * glm::pi<float>() * (float)i / (float)count;
+    const glm::vec3 position =
+        center + glm::vec3(0.35f * extent.x * std::cos(angle),
+                           0.25f * extent.y,
+                           0.35f * extent.z * std::sin(angle));
+    // Hues around the color wheel, so overlapping lights stay visible.
+    const glm::vec3 color =
+        glm::vec3(0.5f) + 0.5f * glm::vec3(std::cos(angle),
+                                           std::cos(angle + 2.094f),
+                                           std::cos(angle + 4.189f));
+    Light *light;
+    if (i < pointLights) {
+      PointLight *pointLight = new PointLight(position, color);
+      scene->pointLights.push_back(pointLight);
+      light = pointLight;
+    } else {
+      SpotLight *spotLight =
+          new SpotLight(position, color, center - position, 30.0f, 45.0f);
+      scene->spotLights.push_back(spotLight);
+      light = spotLight;
+    }
+    // Below 1/256 at the reach.
+    light->SetConstant(1.0f);
+    light->SetLinear(0.0f);
+    light->SetQuadratic(255.0f / (reach * reach));
+    light->SetDecayStart(0.0f);
+    light->SetStatic(false);
+  }
+}
+
+void DeleteBenchmarkLights(Scene *scene) {
+  for (PointLight *light : scene->pointLights) {
+    delete light;
+  }
+  for (SpotLight *light : scene->spotLights) {
+    delete light;
+  }
+  scene->pointLights.clear();
+  scene->spotLights.clear();
+}
+
+// ------------------------------------------------------------------------------------------------
+
+// Percentile by linear interpolation between the closest ranks.
+static double Percentile(const std::vector<double> &sorted, const double p) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  double rank = p / 100.0 * (double)(sorted.size() - 1);
+  size_t lo = (size_t)rank;
+  size_t hi = std::min(lo + 1, sorted.size() - 1);
+  double t = rank - (double)lo;
+  return sorted[lo] + (sorted[hi] - sorted[lo]) * t;
+}
+
+static void WriteSummary(JsonWriter &json, const std::string &name,
+                         std::vector<double> values) {
+  json.Key(name);
+  if (values.empty()) {
+    json.Null();
+    return;
+  }
+  std::sort(values.begin(), values.end());
+  double sum = 0.0;
+  for (double v : values) {
+    sum += v;
+  }
+  json.BeginObject();
+  json.Field("mean", sum / (double)values.size());
+  json.Field("min", values.front());
+  json.Field("p50", Percentile(values, 50.0));
+  json.Field("p90", Percentile(values, 90.0));
+  json.Field("p95", Percentile(values, 95.0));
+  json.Field("p99", Percentile(values, 99.0));
+  json.Field("max", values.back());
+  json.EndObject();
+}
+
+HeadlessBenchmark::HeadlessBenchmark(const HeadlessOptions &options)
+    : options(options) {}
+
+bool HeadlessBenchmark::Run(Camera *camera, const glm::vec3 &up,
+                            const CameraPath &path,
+                            const std::function<void()> &renderFrame,
+                            const std::string &contextApi,
+                            const std::function<void(JsonWriter &)>
+                                &writeStats) {
+  const int width = options.width;
+  const int height = options.height;
+
+  // Render into our own framebuffer; the null platform window has none we
+  // can rely on.
+  GLuint fbo, colorBuffer, depthBuffer;
+  glGenFramebuffers(1, &fbo);
+  glGenRenderbuffers(1, &colorBuffer);
+  glGenRenderbuffers(1, &depthBuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, colorBuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, depthBuffer);
+  bool complete =
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  if (!complete) {
+    std::cerr << "[ERROR] Offscreen framebuffer is incomplete" << std::endl;
+  }
+
+  // Timestamp queries around every measured frame, read back at the end so
+  // the CPU never waits on the GPU inside the loop.
+  GLint timerBits = 0;
+  glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &timerBits);
+  const bool hasGpuTimer = timerBits > 0;
+  std::vector<GLuint> queries(options.frames * 2, 0);
+  if (hasGpuTimer) {
+    glGenQueries((GLsizei)queries.size(), queries.data());
+  }
+
+  std::vector<double> cpuMs(options.frames, 0.0);
+  std::vector<double> frameMs(options.frames, 0.0);
+  const int totalFrames = options.warmupFrames + options.frames;
+  const float duration = path.GetDuration();
+  auto lastStart = std::chrono::steady_clock::now();
+  auto runStart = lastStart;
+
+  for (int i = 0; complete && i < totalFrames; ++i) {
+    // Warm-up frames replay the start of the path.
+    int measured = i - options.warmupFrames;
+    float t = measured <= 0 || options.frames == 1
+                  ? 0.0f
+                  : duration * (float)measured / (float)(options.frames - 1);
+    glm::vec3 position, target;
+    path.Sample(t, position, target);
+    camera->UpdateView(position, target, up);
+
+    auto start = std::chrono::steady_clock::now();
+    if (measured == 0) {
+      runStart = start;
+    }
+    if (measured >= 0 && hasGpuTimer) {
+      glQueryCounter(queries[measured * 2], GL_TIMESTAMP);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+    renderFrame();
+    if (measured >= 0 && hasGpuTimer) {
+      glQueryCounter(queries[measured * 2 + 1], GL_TIMESTAMP);
+    }
+    auto end = std::chrono::steady_clock::now();
+    PROFILE_FRAME();
+
+    if (measured >= 0) {
+      cpuMs[measured] = MsBetween(start, end);
+      if (measured > 0) {
+        frameMs[measured - 1] = MsBetween(lastStart, start);
+      }
+    }
+    lastStart = start;
+  }
+  glFinish();
+  auto runEnd = std::chrono::steady_clock::now();
+  if (complete && options.frames > 0) {
+    frameMs[options.frames - 1] = MsBetween(lastStart, runEnd);
+  }
+
+  std::vector<double> gpuMs;
+  if (complete && hasGpuTimer) {
+    gpuMs.resize(options.frames);
+    for (int i = 0; i < options.frames; ++i) {
+      GLuint64 begin = 0, end = 0;
+      glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+      gpuMs[i] = (double)(end - begin) / 1.0e6;
+    }
+    glDeleteQueries((GLsizei)queries.size(), queries.data());
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(1, &colorBuffer);
+  glDeleteRenderbuffers(1, &depthBuffer);
+  if (!complete) {
+    return false;
+  }
+
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return false;
+  }
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("cameraPath", options.cameraPathFile.empty()
+                               ? std::string("orbit")
+                               : options.cameraPathFile);
+  json.Field("width", width);
+  json.Field("height", height);
+  json.Field("frames", options.frames);
+  json.Field("warmupFrames", options.warmupFrames);
+  json.Field("contextApi", contextApi);
+  json.Field("instances", options.render.instances);
+  json.Field("instancing", !options.render.noInstancing);
+  json.Field("shaderVariants", !options.render.noShaderVariants);
+  json.Field("deferred", options.render.deferred);
+  json.Field("visibility", options.render.visibility);
+  json.Field("renderer", std::string((const char *)glGetString(GL_RENDERER)));
+  json.Field("glVersion", std::string((const char *)glGetString(GL_VERSION)));
+  json.Field("totalMs", MsBetween(runStart, runEnd));
+
+  json.Key("summary");
+  json.BeginObject();
+  // cpuMs: time to submit a frame; frameMs: time between frame starts.
+  WriteSummary(json, "cpuMs", cpuMs);
+  WriteSummary(json, "frameMs", frameMs);
+  WriteSummary(json, "gpuMs", gpuMs);
+  json.EndObject();
+
+  json.Key("perFrame");
+  json.BeginArray();
+  for (int i = 0; i < options.frames; ++i) {
+    json.BeginObject();
+    json.Field("frame", i);
+    json.Field("cpuMs", cpuMs[i]);
+    json.Field("frameMs", frameMs[i]);
+    json.Key("gpuMs");
+    if (gpuMs.empty()) {
+      json.Null();
+    } else {
+      json.Value(gpuMs[i]);
+    }
+    json.EndObject();
+  }
+  json.EndArray();
+  if (writeStats) {
+    writeStats(json);
+  }
+  json.EndObject();
+
+  std::cerr << "Benchmark written to " << options.outputPath << std::endl;
+
+  if (!options.tracePath.empty()) {
+#if PROFILER_ENABLED
+    Profiler::Get().EndFrame();
+    Profiler::Get().ExportChromeTrace(options.tracePath);
+#else
+    std::cerr << "[WARNING] --trace needs a build with ENABLE_PROFILER"
+              << std::endl;
+#endif
+  }
+  return true;
+}
@@ -0,0 +1,188 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "camera.h"
+#include "headers.h"
+#include "program_binary_cache.h"
+#include "texture_options.h"
+
+class JsonWriter;
+struct Scene;
+
+// Command line options of the viewer.
+struct HeadlessOptions {
+  // Render offscreen instead of opening a window: the frame benchmark, or
+  // one of the GL jobs below.
+  bool enabled = false;
+  // Model to load instead of the default scene.
+  std::string scenePath;
+  // Camera path to replay; an orbit around the scene when empty.
+  std::string cameraPathFile;
+  // Report of the benchmark or of the job that ran.
+  std::string outputPath = "benchmark.json";
+  int frames = 300;
+  // Frames rendered before measuring (shader compiles, shadow caches, ...).
+  int warmupFrames = 30;
+  int width = 1280;
+  int height = 720;
+  // Chrome trace of the measured frames (profiler builds only).
+  std::string tracePath;
+  // Write the memory breakdown (see MemoryTracker) here after loading, or
+  // after the headless run.
+  std::string memoryJsonPath;
+
+  // One-off jobs that run instead of the viewer or the frame benchmark.
+  // Each writes its stats to outputPath.
+  struct Jobs {
+    // Without a GL context (see RunsWithoutGL).
+    // Render one frame with the software rasterizer to this PNG.
+    std::string softwareImagePath;
+    // Trace primary rays through the BVH.
+    bool rayBenchmark = false;
+    // Path trace the scene to this PNG or EXR.
+    std::string pathTraceImagePath;
+    int pathTraceSamples = 64;
+    // Bake the lightmaps of the scene into its sidecar file.
+    bool bakeLightmap = false;
+    // Bake the probe grid and a partial re-bake.
+    bool bakeProbes = false;
+    // Encode the BC sidecars of every texture of the scene.
+    bool encodeTextures = false;
+
+    // Offscreen, with a GL context.
+    // Render the camera path forward and deferred at several light counts
+    // and resolutions, comparing the GPU times.
+    bool deferredBenchmark = false;
+    // Render stacks of 1 to 16 layers of cubes forward, deferred and from a
+    // visibility buffer, comparing the GPU times per overdraw.
+    bool visibilityBenchmark = false;
+    // Load the scene's textures uncompressed, freshly encoded and from the
+    // sidecars, comparing VRAM and load times.
+    bool textureBenchmark = false;
+    // Load the shader library from source, with a cold and with a warm
+    // program binary cache, comparing the times.
+    bool shaderBenchmark = false;
+  } jobs;
+
+  // How the viewer and the frame benchmark draw.
+  struct Render {
+    // Stress test: spawn this many copies of the test cube (shadows off).
+    int instances = 0;
+    // Draw every object with its own calls, for comparison.
+    bool noInstancing = false;
+    // Draw everything with the uber phong shader, no specialized variants.
+    bool noShaderVariants = false;
+    // Shade the opaque pass from a G-buffer (see DeferredRenderer).
+    bool deferred = false;
+    // Resolve the opaque pass from a visibility buffer (see
+    // VisibilityBuffer).
+    bool visibility = false;
+  } render;
+
+  // How textures, meshes and shaders are loaded and kept.
+  struct Resources {
+    // How PNG/JPG textures are loaded.
+    TextureCompression textureCompression = TextureCompression::Off;
+    MipGeneration mipGeneration = MipGeneration::Box;
+    // Load textures with only their small mips resident and stream the
+    // rest.
+    bool streamTextures = false;
+    // VRAM budget of the streamed textures; 0 keeps the default.
+    int textureBudgetMb = 0;
+    // Drop the CPU copies of meshes and textures once they are uploaded.
+    bool gpuResident = false;
+    ProgramBinaryCache shaderCache = ProgramBinaryCache::On;
+  } resources;
+};
+
+// Returns false (after printing the usage) on invalid arguments.
+bool ParseCommandLine(int argc, char **argv, HeadlessOptions &options);
+
+// Whether the options ask for one of the modes that only use the CPU and
+// run without a window or GL context.
+bool RunsWithoutGL(const HeadlessOptions &options);
+
+// Opens options.outputPath for a mode's JSON report; prints the error and
+// returns false if it cannot be created. The JsonWriter writes into file.
+bool OpenReport(const HeadlessOptions &options, std::ofstream &file);
+
+// Creates a hidden window on GLFW's null platform with an offscreen context,
+// trying EGL first and OSMesa second, so it runs without a display server
+// (e.g. on Mesa llvmpipe). glfwInit() must have been called with
+// GLFW_PLATFORM set to GLFW_PLATFORM_NULL. contextApi receives the name of
+// the API that worked.
+GLFWwindow *CreateOffscreenWindow(const int width, const int height,
+                                  std::string &contextApi);
+
+// One recorded camera pose.
+struct CameraKey {
+  float time;
+  glm::vec3 position;
+  glm::vec3 target;
+};
+
+// CameraPath Declarations.
+// Camera poses over time, stored as text lines "time px py pz tx ty tz".
+class CameraPath {
+ public:
+  // CameraPath Public Methods.
+  bool Load(const std::string &filePath);
+  bool Save(const std::string &filePath) const;
+
+  void AddKey(const float time, const glm::vec3 &position,
+              const glm::vec3 &target);
+  void Clear() { keys.clear(); }
+  bool IsEmpty() const { return keys.empty(); }
+  float GetDuration() const { return keys.empty() ? 0.0f : keys.back().time; }
+
+  // Linear interpolation between the keys around time.
+  void Sample(const float time, glm::vec3 &position, glm::vec3 &target) const;
+
+  // A full circle around center, looking at it.
+  static CameraPath Orbit(const glm::vec3 &center, const float radius,
+                          const float height, const int numKeys = 64);
+
+ private:
+  // CameraPath Private Data.
+  std::vector<CameraKey> keys;
+};
+
+// Renders a camera path into a framebuffer of width x height and returns
+// the mean GPU time per frame, or -1 without timer queries. With
+// samplesPerPixel, it also gets the fragments of the last frame that passed
+// the depth test, per pixel: the overdraw of a forward frame.
+typedef std::function<double(const CameraPath &path, const int width,
+                             const int height, double *samplesPerPixel)>
+    GpuFrameTimer;
+
+// Adds a ring of dynamic point and spot lights over the scene bounds, each
+// reaching about half way across, for the renderer benchmarks. Move the
+// scene's own point and spot lights aside first.
+void SetBenchmarkLights(Scene *scene, const int pointLights,
+                        const int spotLights);
+// Deletes the lights SetBenchmarkLights made.
+void DeleteBenchmarkLights(Scene *scene);
+
+// HeadlessBenchmark Declarations.
+// Renders a camera path for a fixed number of frames into an offscreen
+// framebuffer and writes per-frame CPU and GPU times plus percentile
+// summaries as JSON.
+class HeadlessBenchmark {
+ public:
+  // HeadlessBenchmark Public Methods.
+  explicit HeadlessBenchmark(const HeadlessOptions &options);
+
+  // renderFrame draws one frame with the current camera. writeStats, if
+  // set, adds its own fields to the report after the run. Returns false if
+  // the framebuffer or the output file could not be created.
+  bool Run(Camera *camera, const glm::vec3 &up, const CameraPath &path,
+           const std::function<void()> &renderFrame,
+           const std::string &contextApi,
+           const std::function<void(JsonWriter &)> &writeStats = nullptr);
+
+ private:
+  // HeadlessBenchmark Private Data.
+  HeadlessOptions options;
+};
+
+#endif
@@ -1,45 +1,135 @@
 #include "imagetexture.h"
 
+#include <chrono>
+
+#include "file_cache.h"
+#include "headless.h"
+#include "json_writer.h"
+#include "mip_generator.h"
+#include "thread_pool.h"
+#include "timing.h"
+
+// Bump when the encoder output changes, to invalidate the sidecars.
+static const uint32_t kEncoderVersion = 2;
+
+TextureCompression ImageTexture::compression = TextureCompression::Off;
+TextureLoadStats ImageTexture::loadStats;
+MipGeneration ImageTexture::mipGeneration = MipGeneration::Box;
+bool ImageTexture::readMipCache = true;
+bool ImageTexture::streaming = false;
+
+// Streamed textures start with the levels up to this size resident.
+static const int kStreamingStartSize = 64;
+
+// Lower-case extension with the dot.
+static std::string GetExtension(const std::string &filePath) {
+  std::string extension = std::filesystem::path(filePath).extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 ::tolower);
+  return extension;
+}
+
 ImageTexture::ImageTexture(const std::string filePath) : texFilePath(filePath) {
   imageWidth = 0;
   imageHeight = 0;
   numChannels = 0;
   textureObj = 0;
+  formatName = "none";
+  gpuBytes = 0;
+  loadMs = 0.0;
+  glInternalFormat = 0;
+  glDataFormat = 0;
+  numLevels = 0;
+  residentLevel = 0;
+  startLevel = 0;
+  streamable = false;
+  compressedUpload = false;
+  chainMips = mipGeneration;
+  cpuReleased = false;
+  memoryTag = MemoryTag::Texture;
 
+  auto start = std::chrono::steady_clock::now();
+  const std::string extension = GetExtension(filePath);
+  bool ok;
+  if (extension == ".dds" || extension == ".ktx2") {
+    ok = LoadCompressedFile(extension == ".dds");
+  } else if (compression != TextureCompression::Off) {
+    ok = LoadWithCache();
+  } else {
+    ok = ReadImage(texImage);
+    if (ok) {
+      // Flip texture in vertical direction.
+      // OpenCV has smaller y coordinate on top; while OpenGL has larger.
+      cv::flip(texImage, texImage, 0);
+      UploadImage();
+    }
+  }
+  loadMs = MsSince(start);
+  if (ok) {
+    loadStats.textures++;
+    loadStats.loadMs += loadMs;
+    loadStats.gpuBytes += gpuBytes;
+  }
+  ReportMemory();
+}
+
+bool ImageTexture::ReadImage(cv::Mat &image) const {
   // Try to load texture image.
-  texImage = cv::imread(texFilePath);
-  if (texImage.rows == 0 || texImage.cols == 0) {
-    std::cerr << "[ERROR] Failed to load image texture: " << filePath
+  image = cv::imread(texFilePath);
+  if (image.rows == 0 || image.cols == 0) {
+    std::cerr << "[ERROR] Failed to load image texture: " << texFilePath
               << std::endl;
-    return;
+    return false;
   }
+  return true;
+}
+
+void ImageTexture::UploadImage() {
   imageWidth = texImage.cols;
   imageHeight = texImage.rows;
   numChannels = texImage.channels();
 
-  // Flip texture in vertical direction.
-  // OpenCV has smaller y coordinate on top; while OpenGL has larger.
-  cv::flip(texImage, texImage, 0);
+  // The software renderer loads scenes without a GL context.
+  if (glfwGetCurrentContext() == nullptr) {
+    return;
+  }
 
-  glGenTextures(1, &textureObj);
-  glBindTexture(GL_TEXTURE_2D, textureObj);
   switch (numChannels) {
     case 1:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, imageWidth, imageHeight, 0, GL_RED,
-                   GL_UNSIGNED_BYTE, texImage.ptr());
+      glInternalFormat = GL_RED;
+      glDataFormat = GL_RED;
+      formatName = "R8";
       break;
     case 3:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_BGR,
-                   GL_UNSIGNED_BYTE, texImage.ptr());
+      glInternalFormat = GL_RGB;
+      glDataFormat = GL_BGR;
+      formatName = "RGB8";
       break;
     case 4:
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, imageWidth, imageHeight, 0,
-                   GL_BGRA, GL_UNSIGNED_BYTE, texImage.ptr());
+      glInternalFormat = GL_RGBA;
+      glDataFormat = GL_BGRA;
+      formatName = "RGBA8";
       break;
     default:
       std::cerr << "[ERROR] Unsupport texture format" << std::endl;
-      break;
+      return;
   }
+  numLevels = 1;
+  while (std::max(imageWidth, imageHeight) >> numLevels > 0) {
+    numLevels++;
+  }
+  // Drivers pad RGB8 to 4 bytes per texel.
+  const int texelBytes = numChannels == 1 ? 1 : 4;
+  levelBytes.resize(numLevels);
+  for (int level = 0; level < numLevels; ++level) {
+    levelBytes[level] = (long long)std::max(1, imageWidth >> level) *
+                        std::max(1, imageHeight >> level) * texelBytes;
+  }
+
+  glGenTextures(1, &textureObj);
+  glBindTexture(GL_TEXTURE_2D, textureObj);
+  // Rows of the smaller mips are not 4-byte aligned.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -48,25 +138,474 @@ ImageTexture::ImageTexture(const std::string filePath) : texFilePath(filePath) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-  glGenerateMipmap(GL_TEXTURE_2D);
+  auto start = std::chrono::steady_clock::now();
+  chainMips = mipGeneration;
+  if (chainMips == MipGeneration::Driver) {
+    // Without a CPU chain there is nothing to stream from.
+    glTexImage2D(GL_TEXTURE_2D, 0, glInternalFormat, imageWidth, imageHeight,
+                 0, glDataFormat, GL_UNSIGNED_BYTE, texImage.ptr());
+    glGenerateMipmap(GL_TEXTURE_2D);
+  } else {
+    BuildMips(mipChain);
+    if (streaming) {
+      StartStreaming();
+    }
+    for (int level = residentLevel; level < numLevels; ++level) {
+      UploadLevel(level);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, residentLevel);
+    if (!streamable) {
+      // Level 0 stays in texImage.
+      mipChain.clear();
+    }
+  }
+  loadStats.mipMs += MsSince(start);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  UpdateGpuBytes();
+}
+
+void ImageTexture::StartStreaming() {
+  startLevel = 0;
+  while (startLevel + 1 < numLevels &&
+         std::max(imageWidth, imageHeight) >> startLevel >
+             kStreamingStartSize) {
+    startLevel++;
+  }
+  residentLevel = startLevel;
+  streamable = true;
+}
+
+void ImageTexture::UploadLevel(const int level) {
+  const int w = std::max(1, imageWidth >> level);
+  const int h = std::max(1, imageHeight >> level);
+  if (!compressedChain.levels.empty()) {
+    const std::vector<unsigned char> &data = compressedChain.levels[level];
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, glInternalFormat, w, h, 0,
+                           (GLsizei)data.size(), data.data());
+  } else {
+    glTexImage2D(GL_TEXTURE_2D, level, glInternalFormat, w, h, 0,
+                 glDataFormat, GL_UNSIGNED_BYTE, mipChain[level].ptr());
+  }
+}
+
+void ImageTexture::UpdateGpuBytes() {
+  gpuBytes = 0;
+  for (int level = residentLevel; level < numLevels; ++level) {
+    gpuBytes += levelBytes[level];
+  }
+}
+
+void ImageTexture::SetResidentLevel(int level) {
+  level = glm::clamp(level, 0, startLevel);
+  if (!streamable || level == residentLevel) {
+    return;
+  }
+  glBindTexture(GL_TEXTURE_2D, textureObj);
+  if (level < residentLevel) {
+    // The levels before startLevel stay on the CPU even in GPU-resident
+    // mode, so this never waits for the file.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int l = residentLevel - 1; l >= level; --l) {
+      UploadLevel(l);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+  } else {
+    // Stop sampling the levels before releasing them: a 0x0 image frees a
+    // level's storage.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    for (int l = residentLevel; l < level; ++l) {
+      glTexImage2D(GL_TEXTURE_2D, l, glInternalFormat, 0, 0, 0,
+                   compressedUpload ? GL_RGBA : glDataFormat,
+                   GL_UNSIGNED_BYTE, nullptr);
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  residentLevel = level;
+  UpdateGpuBytes();
+  ReportMemory();
+}
+
+void ImageTexture::BuildMips(std::vector<cv::Mat> &mips) {
+  const MipFilter filter = chainMips == MipGeneration::Kaiser
+                               ? MipFilter::Kaiser
+                               : MipFilter::Box;
+  std::string cachePath;
+  uint64_t key;
+  if (FileCache::HashFile(texFilePath, key)) {
+    const uint32_t params[2] = {(uint32_t)filter, (uint32_t)numChannels};
+    key = FileCache::Hash(params, sizeof(params), key);
+    cachePath = FileCache::GetCachePath(texFilePath, key, ".mips");
+    if (readMipCache &&
+        MipGenerator::ReadCache(cachePath, imageWidth, imageHeight,
+                                numChannels, mips)) {
+      loadStats.mipCacheHits++;
+      return;
+    }
+  }
+  // Single-channel maps hold data rather than colors.
+  MipGenerator::Generate(texImage, filter, numChannels >= 3, mips);
+  if (!cachePath.empty() && !MipGenerator::WriteCache(cachePath, mips)) {
+    std::cerr << "[WARNING] Failed to write " << cachePath << std::endl;
+  }
+}
+
+bool ImageTexture::LoadCompressedFile(const bool isDDS) {
+  CompressedTexture compressed;
+  bool ok = isDDS ? BlockCompression::LoadDDS(texFilePath, compressed)
+                  : BlockCompression::LoadKTX2(texFilePath, compressed);
+  return ok && UseCompressed(compressed);
+}
+
+bool ImageTexture::LoadWithCache() {
+  uint64_t key;
+  if (!FileCache::HashFile(texFilePath, key)) {
+    std::cerr << "[ERROR] Failed to load image texture: " << texFilePath
+              << std::endl;
+    return false;
+  }
+  key = FileCache::Hash(&kEncoderVersion, sizeof(kEncoderVersion), key);
+  const std::string cachePath = texFilePath + ".dds";
+
+  CompressedTexture compressed;
+  uint64_t cachedKey = 0;
+  if (compression == TextureCompression::Cached &&
+      std::filesystem::exists(cachePath) &&
+      BlockCompression::LoadDDS(cachePath, compressed, &cachedKey) &&
+      cachedKey == key) {
+    loadStats.cacheHits++;
+    return UseCompressed(compressed);
+  }
+
+  cv::Mat source;
+  if (!ReadImage(source)) {
+    return false;
+  }
+  auto start = std::chrono::steady_clock::now();
+  compressed = BlockCompression::Encode(
+      source, source.channels() == 4 ? BlockFormat::BC3 : BlockFormat::BC1);
+  loadStats.encodeMs += MsSince(start);
+  if (!BlockCompression::SaveDDS(cachePath, compressed, key)) {
+    std::cerr << "[WARNING] Failed to write " << cachePath << std::endl;
+  }
+  // The CPU renderers get the source pixels rather than the decoded blocks.
+  cv::flip(source, texImage, 0);
+  return UseCompressed(compressed);
+}
+
+bool ImageTexture::UseCompressed(CompressedTexture &compressed) {
+  imageWidth = compressed.width;
+  imageHeight = compressed.height;
+  if (!BlockCompression::FlipVertically(compressed)) {
+    std::cerr << "[WARNING] BC7 rows cannot be flipped; " << texFilePath
+              << " is used top row first" << std::endl;
+  }
+  if (texImage.empty()) {
+    BlockCompression::DecodeTopLevel(compressed, texImage);
+  }
+  numChannels = texImage.empty() ? 4 : texImage.channels();
+  loadStats.compressed++;
+
+  // The software renderer loads scenes without a GL context.
+  if (glfwGetCurrentContext() == nullptr) {
+    return true;
+  }
+  if (!BlockCompression::IsSupported(compressed.format)) {
+    if (texImage.empty()) {
+      std::cerr << "[ERROR] " << BlockCompression::FormatName(compressed.format)
+                << " textures are not supported by the driver: "
+                << texFilePath << std::endl;
+      return false;
+    }
+    std::cerr << "[WARNING] " << BlockCompression::FormatName(compressed.format)
+              << " textures are not supported by the driver; uploading "
+              << texFilePath << " uncompressed" << std::endl;
+    UploadImage();
+    return true;
+  }
 
+  glInternalFormat =
+      BlockCompression::GetGLFormat(compressed.format, compressed.srgb);
+  numLevels = (int)compressed.levels.size();
+  levelBytes.clear();
+  for (const std::vector<unsigned char> &level : compressed.levels) {
+    levelBytes.push_back((long long)level.size());
+  }
+  compressedChain = std::move(compressed);
+  compressedUpload = true;
+  if (streaming) {
+    StartStreaming();
+  }
+  glGenTextures(1, &textureObj);
+  glBindTexture(GL_TEXTURE_2D, textureObj);
+  for (int level = residentLevel; level < numLevels; ++level) {
+    UploadLevel(level);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, residentLevel);
+  // Files may stop before 1x1.
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
   glBindTexture(GL_TEXTURE_2D, 0);
+
+  formatName = BlockCompression::FormatName(compressedChain.format);
+  UpdateGpuBytes();
+  if (!streamable) {
+    compressedChain.levels.clear();
+  }
+  return true;
 }
 
 ImageTexture::~ImageTexture() {
-  glDeleteTextures(1, &textureObj);
+  MemoryTracker::Get().Remove(this);
+  if (textureObj != 0) {
+    glDeleteTextures(1, &textureObj);
+  }
   texImage.release();
 }
 
+glm::vec3 ImageTexture::Sample(const glm::vec2 &uv) const {
+  if (texImage.empty()) {
+    return glm::vec3(0.0f);
+  }
+  const int w = texImage.cols;
+  const int h = texImage.rows;
+  const int channels = texImage.channels();
+  // The image is stored bottom row first, so v maps to rows directly.
+  float x = uv.x * (float)w - 0.5f;
+  float y = uv.y * (float)h - 0.5f;
+  float fx0 = std::floor(x);
+  float fy0 = std::floor(y);
+  float tx = x - fx0;
+  float ty = y - fy0;
+  int x0 = ((int)fx0 % w + w) % w;
+  int y0 = ((int)fy0 % h + h) % h;
+  int x1 = (x0 + 1) % w;
+  int y1 = (y0 + 1) % h;
+
+  auto texel = [&](const int px, const int py) {
+    const unsigned char *p = texImage.ptr<unsigned char>(py) + px * channels;
+    if (channels == 1) {
+      return glm::vec3(p[0], 0.0f, 0.0f) / 255.0f;
+    }
+    // OpenCV stores BGR(A).
+    return glm::vec3(p[2], p[1], p[0]) / 255.0f;
+  };
+  glm::vec3 top = glm::mix(texel(x0, y0), texel(x1, y0), tx);
+  glm::vec3 bottom = glm::mix(texel(x0, y1), texel(x1, y1), tx);
+  return glm::mix(top, bottom, ty);
+}
+
 void ImageTexture::Bind(GLenum textureUnit) {
   glActiveTexture(textureUnit);
   glBindTexture(GL_TEXTURE_2D, textureObj);
 }
 
+size_t ImageTexture::GetCpuBytes() const {
+  size_t bytes = texImage.total() * texImage.elemSize();
+  // mipChain[0] shares texImage's pixels, unless texImage was released.
+  for (size_t level = texImage.empty() ? 0 : 1; level < mipChain.size();
+       ++level) {
+    bytes += mipChain[level].total() * mipChain[level].elemSize();
+  }
+  for (const std::vector<unsigned char> &level : compressedChain.levels) {
+    bytes += level.size();
+  }
+  return bytes;
+}
+
+size_t ImageTexture::ReleaseCpuData() {
+  if (cpuReleased || textureObj == 0) {
+    return 0;
+  }
+  const size_t bytes = GetCpuBytes();
+  texImage.release();
+  if (streamable) {
+    // Keep what SetResidentLevel may upload, level 0 included; the rest
+    // never leaves VRAM.
+    if (mipChain.size() > (size_t)startLevel) {
+      mipChain.resize(startLevel);
+    }
+    if (compressedChain.levels.size() > (size_t)startLevel) {
+      compressedChain.levels.resize(startLevel);
+    }
+  } else {
+    std::vector<cv::Mat>().swap(mipChain);
+    std::vector<std::vector<unsigned char>>().swap(compressedChain.levels);
+  }
+  cpuReleased = true;
+  ReportMemory();
+  return bytes - GetCpuBytes();
+}
+
+bool ImageTexture::RestoreCpuData() {
+  if (!cpuReleased) {
+    return true;
+  }
+  const std::string extension = GetExtension(texFilePath);
+  bool ok;
+  if (extension == ".dds" || extension == ".ktx2") {
+    CompressedTexture compressed;
+    ok = extension == ".dds"
+             ? BlockCompression::LoadDDS(texFilePath, compressed)
+             : BlockCompression::LoadKTX2(texFilePath, compressed);
+    if (ok) {
+      BlockCompression::FlipVertically(compressed);
+      BlockCompression::DecodeTopLevel(compressed, texImage);
+      if (streamable && compressedUpload) {
+        compressedChain = std::move(compressed);
+      }
+    }
+  } else {
+    ok = ReadImage(texImage);
+    if (ok) {
+      cv::flip(texImage, texImage, 0);
+      if (streamable && compressedUpload) {
+        // The sidecar the texture was uploaded from.
+        ok = BlockCompression::LoadDDS(texFilePath + ".dds", compressedChain);
+        BlockCompression::FlipVertically(compressedChain);
+      }
+    }
+  }
+  if (ok && streamable && !compressedUpload) {
+    BuildMips(mipChain);
+  }
+  if (ok && streamable && compressedUpload &&
+      (int)compressedChain.levels.size() != numLevels) {
+    ok = false;
+  }
+  if (!ok) {
+    std::cerr << "[ERROR] Failed to restore the CPU copy of " << texFilePath
+              << std::endl;
+    texImage.release();
+    mipChain.clear();
+    compressedChain.levels.clear();
+    return false;
+  }
+  cpuReleased = false;
+  ReportMemory();
+  return true;
+}
+
+void ImageTexture::SetMemoryTag(const MemoryTag tag) {
+  memoryTag = tag;
+  ReportMemory();
+}
+
+void ImageTexture::ReportMemory() {
+  MemoryTracker::Get().Update(this, memoryTag, texFilePath,
+                              (long long)GetCpuBytes(), gpuBytes);
+}
+
 void ImageTexture::Preview() {
+  if (!RestoreCpuData()) {
+    return;
+  }
   std::string windowText = "[DEBUG] TexturePreview: " + texFilePath;
   cv::Mat previewImg = cv::Mat(texImage.rows, texImage.cols, texImage.type());
   cv::cvtColor(texImage, previewImg, cv::COLOR_BGR2RGB);
   cv::imshow(windowText, previewImg);
   cv::waitKey(0);
 }
+
+int ImageTexture::RunHeadlessEncode(const HeadlessOptions &options,
+                                    const std::function<bool()> &loadScene) {
+  SetCompression(
+      options.resources.textureCompression == TextureCompression::Rebuild
+          ? TextureCompression::Rebuild
+          : TextureCompression::Cached);
+  ResetLoadStats();
+  if (!loadScene()) {
+    return 1;
+  }
+  const TextureLoadStats &stats = GetLoadStats();
+
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("threads", ThreadPool::Get().GetConcurrency());
+  json.Field("textures", stats.textures);
+  json.Field("compressed", stats.compressed);
+  json.Field("cacheHits", stats.cacheHits);
+  json.Field("encodeMs", stats.encodeMs);
+  json.Field("loadMs", stats.loadMs);
+  json.Field("gpuBytes", stats.gpuBytes);
+  json.EndObject();
+  file << std::endl;
+  return 0;
+}
+
+// One configuration of the texture benchmark.
+struct TextureBenchmarkRun {
+  const char *name;
+  TextureCompression compression;
+  MipGeneration mips;
+  bool readMipCache;
+};
+
+int ImageTexture::RunHeadlessBenchmark(
+    const HeadlessOptions &options, const std::string &contextApi,
+    const std::function<bool()> &loadScene) {
+  const TextureBenchmarkRun runs[] = {
+      {"rgb8-driver", TextureCompression::Off, MipGeneration::Driver, true},
+      {"rgb8-box", TextureCompression::Off, MipGeneration::Box, false},
+      {"rgb8-box-cached", TextureCompression::Off, MipGeneration::Box, true},
+      {"rgb8-kaiser", TextureCompression::Off, MipGeneration::Kaiser, false},
+      {"bc-rebuild", TextureCompression::Rebuild, MipGeneration::Box, true},
+      {"bc-cached", TextureCompression::Cached, MipGeneration::Box, true},
+  };
+
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("contextApi", contextApi);
+  json.Field("renderer",
+             std::string((const char *)glGetString(GL_RENDERER)));
+  json.Field("bc7", BlockCompression::IsSupported(BlockFormat::BC7));
+  json.Field("threads", ThreadPool::Get().GetConcurrency());
+  json.Key("runs");
+  json.BeginArray();
+  for (const TextureBenchmarkRun &run : runs) {
+    SetCompression(run.compression);
+    SetMipGeneration(run.mips);
+    SetReadMipCache(run.readMipCache);
+    ResetLoadStats();
+    auto start = std::chrono::steady_clock::now();
+    if (!loadScene()) {
+      return 1;
+    }
+    // Wait for the uploads before reading the clock.
+    glFinish();
+    const double importMs = MsSince(start);
+    const TextureLoadStats &stats = GetLoadStats();
+    json.BeginObject();
+    json.Field("mode", run.name);
+    json.Field("importMs", importMs);
+    json.Field("textures", stats.textures);
+    json.Field("compressed", stats.compressed);
+    json.Field("cacheHits", stats.cacheHits);
+    json.Field("loadMs", stats.loadMs);
+    json.Field("encodeMs", stats.encodeMs);
+    json.Field("mipMs", stats.mipMs);
+    json.Field("mipCacheHits", stats.mipCacheHits);
+    json.Field("gpuBytes", stats.gpuBytes);
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+  file << std::endl;
+  return 0;
+}
@@ -1,7 +1,26 @@
 #ifndef IMAGE_TEXTURE_H
 #define IMAGE_TEXTURE_H
 
+#include "block_compression.h"
 #include "headers.h"
+#include "memory_tracker.h"
+#include "texture_options.h"
+
+struct HeadlessOptions;
+
+// Totals over the textures loaded since the last ResetLoadStats.
+struct TextureLoadStats {
+	int textures = 0;
+	int compressed = 0;
+	int cacheHits = 0;
+	double loadMs = 0.0;
+	double encodeMs = 0.0;
+	// Mip generation, cache reads and uploads, or glGenerateMipmap calls.
+	double mipMs = 0.0;
+	int mipCacheHits = 0;
+	// Estimated VRAM with mips; uncompressed RGB counts 4 bytes per texel.
+	long long gpuBytes = 0;
+};
 
 // Texture Declarations.
 class ImageTexture
@@ -14,8 +33,95 @@ public:
 	void Bind(GLenum textureUnit);
 	void Preview();
 	std::string GetPath() const { return texFilePath; }
+	int GetWidth() const { return imageWidth; }
+	int GetHeight() const { return imageHeight; }
+	// Decoded image (BGR, bottom row first) for the CPU renderers.
+	const cv::Mat& GetImage() const { return texImage; }
+	// Bilinear RGB lookup with repeat wrapping, like the GL sampler without
+	// mipmaps. Single-channel images return (value, 0, 0) like GL_RED.
+	glm::vec3 Sample(const glm::vec2& uv) const;
+
+	const char* GetFormatName() const { return formatName; }
+	// Residency of streamed textures. Level 0 is the full resolution; the
+	// levels from GetResidentLevel() down to 1x1 are in VRAM.
+	bool IsStreamable() const { return streamable; }
+	int GetNumLevels() const { return numLevels; }
+	int GetResidentLevel() const { return residentLevel; }
+	// The level streamed textures start at and never drop below.
+	int GetStartLevel() const { return startLevel; }
+	long long GetLevelBytes(const int level) const { return levelBytes[level]; }
+	// Uploads the missing finer levels or frees the ones before level, from
+	// the CPU copy of the chain. level is clamped to [0, GetStartLevel()].
+	void SetResidentLevel(int level);
+	long long GetGpuBytes() const { return gpuBytes; }
+	double GetLoadMs() const { return loadMs; }
+	// GPU-resident mode: drops the decoded image of an uploaded texture,
+	// returning the bytes freed. Streamed textures keep the levels of their
+	// chain that can still be streamed in, so streaming never reads files;
+	// that includes the full-resolution level 0, so they only free the
+	// levels from GetStartLevel() on, which stay in VRAM.
+	// RestoreCpuData reads everything again from the source file (and its
+	// .dds sidecar), e.g. before Sample or GetImage; Preview restores on
+	// its own.
+	size_t GetCpuBytes() const;
+	size_t ReleaseCpuData();
+	bool RestoreCpuData();
+	bool HasCpuData() const { return !cpuReleased; }
+	// Category the texture is reported under (see MemoryTracker).
+	void SetMemoryTag(const MemoryTag tag);
+
+	// Applies to textures created afterwards.
+	static void SetCompression(const TextureCompression mode)
+	{
+		compression = mode;
+	}
+	static TextureCompression GetCompression() { return compression; }
+	static void SetMipGeneration(const MipGeneration mode)
+	{
+		mipGeneration = mode;
+	}
+	static MipGeneration GetMipGeneration() { return mipGeneration; }
+	// Textures loaded while streaming is on keep their mip chain on the CPU
+	// and start with only the levels up to 64x64 resident. Driver mips
+	// cannot be streamed.
+	static void SetStreaming(const bool enabled) { streaming = enabled; }
+	static bool IsStreaming() { return streaming; }
+	// Cached chains are still written when reads are off (cold benchmarks).
+	static void SetReadMipCache(const bool read) { readMipCache = read; }
+	static const TextureLoadStats& GetLoadStats() { return loadStats; }
+	static void ResetLoadStats() { loadStats = TextureLoadStats(); }
+
+	// Encodes the BC sidecars of the textures loadScene loads, keeping
+	// up-to-date ones unless a rebuild was asked for, and writes the totals
+	// to the report.
+	static int RunHeadlessEncode(const HeadlessOptions& options,
+		const std::function<bool()>& loadScene);
+	// Calls loadScene once per texture mode (uncompressed with driver, box
+	// and Kaiser mips, cold and cached, then encoding every BC sidecar and
+	// reading them back) and writes the texture load times and VRAM of
+	// each to the report. Needs the GL context.
+	static int RunHeadlessBenchmark(const HeadlessOptions& options,
+		const std::string& contextApi,
+		const std::function<bool()>& loadScene);
 
 private:
+	// Texture Private Methods.
+	bool ReadImage(cv::Mat& image) const;
+	void UploadImage();
+	// Level 0 (texImage) and its mips, from the cache when possible.
+	void BuildMips(std::vector<cv::Mat>& mips);
+	// Picks the start level and makes the texture streamable.
+	void StartStreaming();
+	// glTexImage2D of one level from mipChain or compressedChain; the
+	// texture must be bound.
+	void UploadLevel(const int level);
+	void UpdateGpuBytes();
+	bool LoadCompressedFile(const bool isDDS);
+	bool LoadWithCache();
+	// Flips, uploads and keeps a decoded CPU copy unless texImage is set.
+	bool UseCompressed(CompressedTexture& texture);
+	void ReportMemory();
+
 	// Texture Private Data.
 	std::string texFilePath;
 	GLuint textureObj;
@@ -23,6 +129,31 @@ private:
 	int imageHeight;
 	int numChannels;
 	cv::Mat texImage;
+	const char* formatName;
+	long long gpuBytes;
+	double loadMs;
+
+	// Upload formats, and the chain kept for streaming (one of the two).
+	GLenum glInternalFormat;
+	GLenum glDataFormat;
+	std::vector<cv::Mat> mipChain;
+	CompressedTexture compressedChain;
+	std::vector<long long> levelBytes;
+	int numLevels;
+	int residentLevel;
+	int startLevel;
+	bool streamable;
+	// Whether the GL texture holds blocks, and the mips it was built with.
+	bool compressedUpload;
+	MipGeneration chainMips;
+	bool cpuReleased;
+	MemoryTag memoryTag;
+
+	static TextureCompression compression;
+	static TextureLoadStats loadStats;
+	static MipGeneration mipGeneration;
+	static bool readMipCache;
+	static bool streaming;
 };
 
 #endif
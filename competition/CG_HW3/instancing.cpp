@@ -0,0 +1,165 @@
+#include "instancing.h"
+
+#include <chrono>
+#include <unordered_map>
+
+#include "profiler.h"
+#include "thread_pool.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+InstanceBatcher::InstanceBatcher()
+    : instanceVboId(0),
+      dirty(true),
+      lastNumObjects(0),
+      lastTransformVersion(0),
+      lastUseLightmaps(false) {}
+
+InstanceBatcher::~InstanceBatcher() {
+  if (instanceVboId != 0) {
+    glDeleteBuffers(1, &instanceVboId);
+  }
+}
+
+void InstanceBatcher::Update(const Scene *scene, const bool useLightmaps) {
+  const std::vector<SceneObject> &objects = scene->objects;
+  const TransformStore &transforms = scene->transforms;
+  const bool regroup = dirty || objects.size() != lastNumObjects ||
+                       useLightmaps != lastUseLightmaps;
+  if (!regroup && transforms.GetVersion() == lastTransformVersion) {
+    return;
+  }
+  PROFILE_SCOPE("Instance Batching");
+  const int numObjects = (int)objects.size();
+  if (regroup) {
+    Regroup(objects, useLightmaps);
+  }
+  dirty = false;
+  lastNumObjects = objects.size();
+  lastTransformVersion = transforms.GetVersion();
+  lastUseLightmaps = useLightmaps;
+
+  // The matrices are ready in the transform store, so this is only a copy.
+  auto start = std::chrono::steady_clock::now();
+  instances.resize(stats.instances);
+  ThreadPool::Get().ParallelFor(
+      numObjects, 4096, [&](const int begin, const int end) {
+        for (int i = begin; i < end; ++i) {
+          if (slots[i] < 0) {
+            continue;
+          }
+          InstanceData &instance = instances[slots[i]];
+          instance.world = transforms.GetWorld(i);
+          instance.normal = transforms.GetNormal(i);
+        }
+      });
+
+  // Orphan the old storage so the driver does not wait for draws still
+  // reading it.
+  const size_t bytes = instances.size() * sizeof(InstanceData);
+  if (instanceVboId == 0) {
+    glGenBuffers(1, &instanceVboId);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVboId);
+  glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_DYNAMIC_DRAW);
+  if (bytes > 0) {
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  stats.streamMs = MsSince(start);
+  stats.streamedBytes = (long long)bytes;
+  stats.rebuilds++;
+}
+
+void InstanceBatcher::Regroup(const std::vector<SceneObject> &objects,
+                              const bool useLightmaps) {
+  // Group by mesh, in the order the meshes first appear.
+  auto start = std::chrono::steady_clock::now();
+  const int numObjects = (int)objects.size();
+  std::unordered_map<const TriangleMesh *, int> batchOfMesh;
+  batches.clear();
+  batched.assign(numObjects, 0);
+  slots.assign(numObjects, -1);
+  for (int i = 0; i < numObjects; ++i) {
+    const SceneObject &obj = objects[i];
+    if (obj.mesh == nullptr || (useLightmaps && obj.lightmap != nullptr)) {
+      continue;
+    }
+    auto it = batchOfMesh.find(obj.mesh);
+    if (it == batchOfMesh.end()) {
+      it = batchOfMesh.emplace(obj.mesh, (int)batches.size()).first;
+      batches.push_back({obj.mesh, 0, 0});
+    }
+    // Slot within the batch for now, made absolute below.
+    slots[i] = batches[it->second].count++;
+    batched[i] = 1;
+  }
+  int numInstances = 0;
+  for (Batch &batch : batches) {
+    batch.first = numInstances;
+    numInstances += batch.count;
+  }
+  for (int i = 0; i < numObjects; ++i) {
+    if (batched[i]) {
+      slots[i] += batches[batchOfMesh[objects[i].mesh]].first;
+    }
+  }
+  stats.groupMs = MsSince(start);
+  stats.objects = numObjects;
+  stats.batches = (int)batches.size();
+  stats.instances = numInstances;
+}
+
+void InstanceBatcher::BindInstanceAttributes(const size_t byteOffset) {
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVboId);
+  // A mat4 takes four attribute slots and a mat3 three, one per column.
+  for (int column = 0; column < 4; ++column) {
+    const GLuint location = 4 + column;
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(
+        location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+        (void *)(byteOffset + offsetof(InstanceData, world) +
+                 column * sizeof(glm::vec4)));
+    glVertexAttribDivisor(location, 1);
+  }
+  for (int column = 0; column < 3; ++column) {
+    const GLuint location = 8 + column;
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(
+        location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+        (void *)(byteOffset + offsetof(InstanceData, normal) +
+                 column * sizeof(glm::vec3)));
+    glVertexAttribDivisor(location, 1);
+  }
+}
+
+void InstanceBatcher::Draw(PhongShadingDemoShaderProg *shader,
+                           const glm::mat4x4 &viewProj) {
+  if (batches.empty()) {
+    stats.drawCalls = 0;
+    return;
+  }
+  glUniform1i(shader->GetLocUseInstancing(), 1);
+  glUniformMatrix4fv(shader->GetLocViewProj(), 1, GL_FALSE,
+                     glm::value_ptr(viewProj));
+  Draw([shader](const SubMesh &) { return shader; });
+  glUniform1i(shader->GetLocUseInstancing(), 0);
+}
+
+void InstanceBatcher::Draw(const TriangleMesh::ShaderSelector &select) {
+  PROFILE_GPU_SCOPE("Instanced Draws");
+  stats.drawCalls = 0;
+  if (batches.empty()) {
+    return;
+  }
+  for (const Batch &batch : batches) {
+    BindInstanceAttributes(batch.first * sizeof(InstanceData));
+    batch.mesh->drawInstanced(select, batch.count);
+    stats.drawCalls += batch.mesh->GetNumSubMeshes();
+  }
+  for (GLuint location = 4; location <= 10; ++location) {
+    glVertexAttribDivisor(location, 0);
+    glDisableVertexAttribArray(location);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,96 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include "headers.h"
+#include "scene.h"
+#include "shaderprog.h"
+#include "trianglemesh.h"
+
+// Per-instance vertex data, attributes 4-7 (world) and 8-10 (normal) of
+// phong_shading_demo.vs.
+struct InstanceData {
+  glm::mat4x4 world;
+  // Normal matrix in world space.
+  glm::mat3x3 normal;
+};
+
+struct InstanceBatcherStats {
+  int objects = 0;
+  int batches = 0;
+  int instances = 0;
+  // glDrawElementsInstanced calls of the last Draw.
+  int drawCalls = 0;
+  // Cost of the last Update that had to do any work.
+  double groupMs = 0.0;
+  double streamMs = 0.0;
+  long long streamedBytes = 0;
+  int rebuilds = 0;
+};
+
+// InstanceBatcher Declarations.
+// Draws the scene objects that share a TriangleMesh with one
+// glDrawElementsInstanced call per submesh. The world and normal matrices of
+// all batched objects live in one instance buffer, batch after batch; they
+// are copied from the scene's TransformStore and streamed into a freshly
+// orphaned buffer only when the store changed, objects were added or
+// removed or MarkDirty was called, so a static scene costs nothing on the
+// CPU.
+//
+// Objects with a lightmap in use need their own texture and stay on the
+// per-object path (see IsBatched).
+class InstanceBatcher {
+ public:
+  // InstanceBatcher Public Methods.
+  InstanceBatcher();
+  ~InstanceBatcher();
+
+  // Regroups the objects and re-streams the matrices if anything changed.
+  // scene->transforms must be up to date.
+  void Update(const Scene *scene, const bool useLightmaps);
+  // Forces a regroup, e.g. after swapping the mesh of an object.
+  void MarkDirty() { dirty = true; }
+  // Whether Draw covers the object with this index.
+  bool IsBatched(const int object) const {
+    return object < (int)batched.size() && batched[object] != 0;
+  }
+
+  // Draws every batch. The shader must be bound with the per-frame
+  // uniforms, useLightmap and useProbes set.
+  void Draw(PhongShadingDemoShaderProg *shader, const glm::mat4x4 &viewProj);
+  // Draws every batch with a program per submesh. select sets all of the
+  // above, useInstancing and viewProj included, on the programs it binds.
+  void Draw(const TriangleMesh::ShaderSelector &select);
+
+  const InstanceBatcherStats &GetStats() const { return stats; }
+
+ private:
+  // Objects of one mesh, instances [first, first + count) of the buffer.
+  struct Batch {
+    TriangleMesh *mesh;
+    int first;
+    int count;
+  };
+
+  // InstanceBatcher Private Methods.
+  void Regroup(const std::vector<SceneObject> &objects,
+               const bool useLightmaps);
+  void BindInstanceAttributes(const size_t byteOffset);
+
+  // InstanceBatcher Private Data.
+  std::vector<Batch> batches;
+  std::vector<unsigned char> batched;
+  // Instance slot of every object, -1 if not batched.
+  std::vector<int> slots;
+  std::vector<InstanceData> instances;
+  GLuint instanceVboId;
+
+  // Inputs of the last Update.
+  bool dirty;
+  size_t lastNumObjects;
+  unsigned long long lastTransformVersion;
+  bool lastUseLightmaps;
+
+  InstanceBatcherStats stats;
+};
+
+#endif
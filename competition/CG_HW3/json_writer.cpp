@@ -0,0 +1,135 @@
+#include "json_writer.h"
+
+#include <cmath>
+#include <cstdio>
+
+JsonWriter::JsonWriter(std::ostream &out) : out(out) { afterKey = false; }
+
+void JsonWriter::NewLine() {
+  out << "\n" << std::string(hasItems.size() * 2, ' ');
+}
+
+void JsonWriter::BeforeValue() {
+  if (afterKey) {
+    afterKey = false;
+    return;
+  }
+  if (!hasItems.empty()) {
+    if (hasItems.back()) {
+      out << ",";
+    }
+    hasItems.back() = true;
+    NewLine();
+  }
+}
+
+void JsonWriter::BeginObject() {
+  BeforeValue();
+  out << "{";
+  hasItems.push_back(false);
+}
+
+void JsonWriter::EndObject() {
+  bool hadItems = hasItems.back();
+  hasItems.pop_back();
+  if (hadItems) {
+    NewLine();
+  }
+  out << "}";
+  if (hasItems.empty()) {
+    out << "\n";
+  }
+}
+
+void JsonWriter::BeginArray() {
+  BeforeValue();
+  out << "[";
+  hasItems.push_back(false);
+}
+
+void JsonWriter::EndArray() {
+  bool hadItems = hasItems.back();
+  hasItems.pop_back();
+  if (hadItems) {
+    NewLine();
+  }
+  out << "]";
+}
+
+void JsonWriter::Key(const std::string &key) {
+  BeforeValue();
+  WriteString(key);
+  out << ": ";
+  afterKey = true;
+}
+
+void JsonWriter::Value(const double value) {
+  BeforeValue();
+  if (!std::isfinite(value)) {
+    out << "null";
+    return;
+  }
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+  out << buffer;
+}
+
+void JsonWriter::Value(const int value) {
+  BeforeValue();
+  out << value;
+}
+
+void JsonWriter::Value(const long long value) {
+  BeforeValue();
+  out << value;
+}
+
+void JsonWriter::Value(const bool value) {
+  BeforeValue();
+  out << (value ? "true" : "false");
+}
+
+void JsonWriter::Value(const std::string &value) {
+  BeforeValue();
+  WriteString(value);
+}
+
+void JsonWriter::Value(const char *value) { Value(std::string(value)); }
+
+void JsonWriter::Null() {
+  BeforeValue();
+  out << "null";
+}
+
+void JsonWriter::WriteString(const std::string &value) {
+  out << '"';
+  for (unsigned char c : value) {
+    switch (c) {
+      case '"':
+        out << "\\\"";
+        break;
+      case '\\':
+        out << "\\\\";
+        break;
+      case '\n':
+        out << "\\n";
+        break;
+      case '\r':
+        out << "\\r";
+        break;
+      case '\t':
+        out << "\\t";
+        break;
+      default:
+        if (c < 0x20) {
+          char buffer[8];
+          std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+          out << buffer;
+        } else {
+          out << c;
+        }
+        break;
+    }
+  }
+  out << '"';
+}
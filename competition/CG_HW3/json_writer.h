@@ -0,0 +1,52 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// JsonWriter Declarations.
+// Minimal streaming JSON writer for benchmark and profiler reports.
+// Non-finite numbers are written as null.
+class JsonWriter {
+ public:
+  // JsonWriter Public Methods.
+  explicit JsonWriter(std::ostream &out);
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+
+  // Name of the next value inside an object.
+  void Key(const std::string &key);
+
+  void Value(const double value);
+  void Value(const int value);
+  void Value(const long long value);
+  void Value(const bool value);
+  void Value(const std::string &value);
+  void Value(const char *value);
+  void Null();
+
+  // Key followed by a value.
+  template <typename T>
+  void Field(const std::string &key, const T &value) {
+    Key(key);
+    Value(value);
+  }
+
+ private:
+  // JsonWriter Private Methods.
+  void BeforeValue();
+  void NewLine();
+  void WriteString(const std::string &value);
+
+  // JsonWriter Private Data.
+  std::ostream &out;
+  // One entry per open object/array: whether it already has an item.
+  std::vector<bool> hasItems;
+  bool afterKey;
+};
+
+#endif
@@ -11,10 +11,15 @@ class Light {
       : intensity(glm::vec3(1.0f)),
         constant(1.0f),
         linear(0.09f),
-        quadratic(0.032f) {}
+        quadratic(0.032f),
+        isStatic(true) {}
 
   Light(const glm::vec3& I)
-      : intensity(I), constant(1.0f), linear(0.09f), quadratic(0.032f) {}
+      : intensity(I),
+        constant(1.0f),
+        linear(0.09f),
+        quadratic(0.032f),
+        isStatic(true) {}
 
   // Getter 方法
   glm::vec3 GetIntensity() const { return intensity; }
@@ -22,6 +27,17 @@ class Light {
   float GetLinear() const { return linear; }
   float GetQuadratic() const { return quadratic; }
   float GetDecayStart() const { return decayStart; }
+  // Falloff the shader applies beyond decayStart.
+  float GetAttenuation(const float distance) const {
+    if (distance <= decayStart) {
+      return 1.0f;
+    }
+    float d = distance - decayStart;
+    return 1.0f / (constant + linear * d + quadratic * d * d);
+  }
+  // Static lights are baked into lightmaps; the shader skips them for
+  // objects that have one.
+  bool IsStatic() const { return isStatic; }
 
   // Setter 方法
   void SetIntensity(const glm::vec3& I) { intensity = I; }
@@ -29,6 +45,7 @@ class Light {
   void SetLinear(float l) { linear = l; }
   void SetQuadratic(float q) { quadratic = q; }
   void SetDecayStart(float decayStart) { this->decayStart = decayStart; }
+  void SetStatic(bool isStatic) { this->isStatic = isStatic; }
 
  protected:
   glm::vec3 intensity;
@@ -36,6 +53,7 @@ class Light {
   float constant;
   float linear;
   float quadratic;
+  bool isStatic;
 };
 
 // PointLight 類別
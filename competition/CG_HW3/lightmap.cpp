@@ -0,0 +1,725 @@
+#include "lightmap.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <set>
+
+#include "file_cache.h"
+#include "headless.h"
+#include "json_writer.h"
+#include "material.h"
+#include "profiler.h"
+#include "sampling.h"
+#include "thread_pool.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+namespace {
+
+using BakeClock = std::chrono::steady_clock;
+
+// Bump when the bake or the file layout changes.
+const uint32_t kLightmapVersion = 1;
+const char kLightmapMagic[4] = {'L', 'M', 'A', 'P'};
+
+struct LightmapFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t sceneHash;
+  uint32_t numObjects;
+  uint32_t pad;
+};
+
+// Followed by the source vertex indices, the UVs, the index list of every
+// submesh (count first) and the RGB float texels.
+struct LightmapObjectHeader {
+  uint32_t numVertices;
+  uint32_t numSubMeshes;
+  uint32_t width;
+  uint32_t height;
+};
+
+// A chart of the lightmap atlas.
+struct Chart {
+  std::vector<int> triangles;
+  glm::vec2 boundsMin;
+  glm::vec2 boundsMax;
+  // Placement in texels, including the padding.
+  int x, y, width, height;
+};
+
+float Cross2(const glm::vec2 &a, const glm::vec2 &b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+}  // namespace
+
+Lightmap::Lightmap(const int width, const int height)
+    : width(width), height(height), textureObj(0) {
+  texels.assign((size_t)width * height, glm::vec3(0.0f));
+}
+
+Lightmap::~Lightmap() {
+  if (textureObj != 0) {
+    glDeleteTextures(1, &textureObj);
+  }
+}
+
+void Lightmap::Upload() {
+  if (textureObj == 0) {
+    glGenTextures(1, &textureObj);
+  }
+  glBindTexture(GL_TEXTURE_2D, textureObj);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB,
+               GL_FLOAT, texels.data());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Lightmap::Bind(GLenum textureUnit) {
+  glActiveTexture(textureUnit);
+  glBindTexture(GL_TEXTURE_2D, textureObj);
+}
+
+LightmapBaker::LightmapBaker(const LightmapBakeSettings &settings)
+    : settings(settings) {}
+
+bool LightmapBaker::Bake(Scene *scene) {
+  PROFILE_SCOPE("Lightmap Bake");
+  stats = LightmapBakeStats();
+  stats.threads = ThreadPool::Get().GetConcurrency();
+
+  BakeClock::time_point start = BakeClock::now();
+  std::set<TriangleMesh *> unwrapped;
+  for (SceneObject &sceneObj : scene->objects) {
+    // Objects sharing a mesh share its layout, but not the lightmap.
+    if (unwrapped.count(sceneObj.mesh) != 0) {
+      continue;
+    }
+    stats.verticesBefore += sceneObj.mesh->GetNumVertices();
+    if (!Unwrap(sceneObj.mesh)) {
+      return false;
+    }
+    stats.verticesAfter += sceneObj.mesh->GetNumVertices();
+    unwrapped.insert(sceneObj.mesh);
+  }
+  stats.unwrapMs = MsSince(start);
+
+  start = BakeClock::now();
+  // Lighting is baked in model space; see the class comment.
+  scene->UpdateBVH(glm::mat4x4(1.0f));
+  lights.Prepare(scene);
+  long long rays = 0;
+  for (size_t o = 0; o < scene->objects.size(); o++) {
+    Lightmap *lightmap = new Lightmap(settings.atlasSize, settings.atlasSize);
+    BakeObject(scene, (int)o, lightmap, rays);
+    delete scene->objects[o].lightmap;
+    scene->objects[o].lightmap = lightmap;
+    stats.objects++;
+  }
+  stats.rays = rays;
+  stats.bakeMs = MsSince(start);
+  long long atlasTexels =
+      (long long)stats.objects * settings.atlasSize * settings.atlasSize;
+  stats.coverage =
+      atlasTexels > 0 ? (double)stats.texelsCovered / atlasTexels : 0.0;
+  return true;
+}
+
+bool LightmapBaker::Unwrap(TriangleMesh *mesh) {
+  const std::vector<VertexPTN> &vertices = mesh->GetVertices();
+  std::vector<SubMesh> &subMeshes = mesh->getSubMeshes();
+
+  // All triangles of all submeshes, in submesh order.
+  std::vector<unsigned int> corners;
+  for (const SubMesh &subMesh : subMeshes) {
+    corners.insert(corners.end(), subMesh.vertexIndices.begin(),
+                   subMesh.vertexIndices.end());
+  }
+  const int numTriangles = (int)corners.size() / 3;
+  std::vector<glm::vec3> normals(numTriangles);
+  std::vector<float> areas(numTriangles);
+  double totalArea = 0.0;
+  for (int t = 0; t < numTriangles; t++) {
+    const glm::vec3 &p0 = vertices[corners[3 * t]].position;
+    const glm::vec3 &p1 = vertices[corners[3 * t + 1]].position;
+    const glm::vec3 &p2 = vertices[corners[3 * t + 2]].position;
+    glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+    float length = glm::length(n);
+    areas[t] = 0.5f * length;
+    normals[t] = length > 0.0f ? n / length : glm::vec3(0.0f);
+    totalArea += areas[t];
+  }
+  if (numTriangles == 0 || totalArea <= 0.0) {
+    std::cerr << "[ERROR] Lightmap: mesh has no surface to unwrap"
+              << std::endl;
+    return false;
+  }
+
+  // Weld vertices by position, since the mesh splits them by normal and UV.
+  std::vector<unsigned int> sorted(vertices.size());
+  for (size_t i = 0; i < sorted.size(); i++) sorted[i] = (unsigned int)i;
+  auto lessPosition = [&](const unsigned int a, const unsigned int b) {
+    const glm::vec3 &pa = vertices[a].position;
+    const glm::vec3 &pb = vertices[b].position;
+    if (pa.x != pb.x) return pa.x < pb.x;
+    if (pa.y != pb.y) return pa.y < pb.y;
+    if (pa.z != pb.z) return pa.z < pb.z;
+    return a < b;
+  };
+  std::sort(sorted.begin(), sorted.end(), lessPosition);
+  std::vector<unsigned int> welded(vertices.size());
+  unsigned int weldedId = 0;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    if (i > 0 && vertices[sorted[i]].position !=
+                     vertices[sorted[i - 1]].position) {
+      weldedId++;
+    }
+    welded[sorted[i]] = weldedId;
+  }
+
+  // Triangles sharing a welded edge are neighbours.
+  std::vector<std::pair<uint64_t, int>> edges;
+  edges.reserve(corners.size());
+  for (int t = 0; t < numTriangles; t++) {
+    for (int k = 0; k < 3; k++) {
+      uint64_t a = welded[corners[3 * t + k]];
+      uint64_t b = welded[corners[3 * t + (k + 1) % 3]];
+      if (a == b) continue;
+      edges.push_back({std::min(a, b) << 32 | std::max(a, b), t});
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  std::vector<int> neighbourCount(numTriangles + 1, 0);
+  std::vector<std::pair<int, int>> neighbourPairs;
+  for (size_t i = 0; i < edges.size();) {
+    size_t j = i;
+    while (j < edges.size() && edges[j].first == edges[i].first) j++;
+    for (size_t a = i; a < j; a++) {
+      for (size_t b = a + 1; b < j; b++) {
+        neighbourPairs.push_back({edges[a].second, edges[b].second});
+        neighbourPairs.push_back({edges[b].second, edges[a].second});
+      }
+    }
+    i = j;
+  }
+  std::vector<int> neighbourStart(numTriangles + 1, 0);
+  for (const auto &pair : neighbourPairs) neighbourStart[pair.first + 1]++;
+  for (int t = 0; t < numTriangles; t++) {
+    neighbourStart[t + 1] += neighbourStart[t];
+  }
+  std::vector<int> neighbours(neighbourPairs.size());
+  {
+    std::vector<int> fill(neighbourStart.begin(), neighbourStart.end() - 1);
+    for (const auto &pair : neighbourPairs) {
+      neighbours[fill[pair.first]++] = pair.second;
+    }
+  }
+
+  // Grow charts from the largest triangles first.
+  std::vector<int> seeds(numTriangles);
+  for (int t = 0; t < numTriangles; t++) seeds[t] = t;
+  std::sort(seeds.begin(), seeds.end(), [&](const int a, const int b) {
+    return areas[a] != areas[b] ? areas[a] > areas[b] : a < b;
+  });
+  const float cosLimit = std::cos(glm::radians(settings.chartAngleDegrees));
+  std::vector<int> chartOf(numTriangles, -1);
+  std::vector<Chart> charts;
+  std::vector<int> queue;
+  for (const int seed : seeds) {
+    if (chartOf[seed] >= 0) continue;
+    const int chartIndex = (int)charts.size();
+    charts.push_back(Chart());
+    Chart &chart = charts.back();
+    const glm::vec3 seedNormal = normals[seed];
+    chartOf[seed] = chartIndex;
+    queue.assign(1, seed);
+    for (size_t q = 0; q < queue.size(); q++) {
+      const int t = queue[q];
+      chart.triangles.push_back(t);
+      for (int i = neighbourStart[t]; i < neighbourStart[t + 1]; i++) {
+        const int n = neighbours[i];
+        // Degenerate triangles join any chart next to them.
+        if (chartOf[n] < 0 && (areas[n] == 0.0f ||
+                               glm::dot(normals[n], seedNormal) >= cosLimit)) {
+          chartOf[n] = chartIndex;
+          queue.push_back(n);
+        }
+      }
+    }
+  }
+
+  // Project every chart onto its plane, oriented along the longest edge of
+  // its largest triangle and turned so it is wider than tall.
+  std::vector<glm::vec2> corner2D(corners.size());
+  for (Chart &chart : charts) {
+    glm::vec3 axisW(0.0f);
+    for (const int t : chart.triangles) axisW += areas[t] * normals[t];
+    float length = glm::length(axisW);
+    axisW = length > 0.0f ? axisW / length : glm::vec3(0.0f, 0.0f, 1.0f);
+    const int largest = chart.triangles[0];
+    glm::vec3 axisU(0.0f);
+    float longest = 0.0f;
+    for (int k = 0; k < 3; k++) {
+      glm::vec3 edge = vertices[corners[3 * largest + (k + 1) % 3]].position -
+                       vertices[corners[3 * largest + k]].position;
+      edge -= glm::dot(edge, axisW) * axisW;
+      if (glm::length(edge) > longest) {
+        longest = glm::length(edge);
+        axisU = edge / longest;
+      }
+    }
+    glm::vec3 axisV;
+    if (longest <= 0.0f) {
+      BuildBasis(axisW, axisU, axisV);
+    } else {
+      axisV = glm::cross(axisW, axisU);
+    }
+
+    chart.boundsMin = glm::vec2(std::numeric_limits<float>::max());
+    chart.boundsMax = glm::vec2(-std::numeric_limits<float>::max());
+    for (const int t : chart.triangles) {
+      for (int k = 0; k < 3; k++) {
+        const glm::vec3 &p = vertices[corners[3 * t + k]].position;
+        glm::vec2 c(glm::dot(p, axisU), glm::dot(p, axisV));
+        corner2D[3 * t + k] = c;
+        chart.boundsMin = glm::min(chart.boundsMin, c);
+        chart.boundsMax = glm::max(chart.boundsMax, c);
+      }
+    }
+    glm::vec2 extent = chart.boundsMax - chart.boundsMin;
+    if (extent.y > extent.x) {
+      for (const int t : chart.triangles) {
+        for (int k = 0; k < 3; k++) {
+          glm::vec2 &c = corner2D[3 * t + k];
+          c = glm::vec2(c.y, c.x);
+        }
+      }
+      chart.boundsMin = glm::vec2(chart.boundsMin.y, chart.boundsMin.x);
+      chart.boundsMax = glm::vec2(chart.boundsMax.y, chart.boundsMax.x);
+    }
+  }
+
+  // Shelf-pack the charts, shrinking the texel density until they fit.
+  const int atlasSize = settings.atlasSize;
+  const int padding = settings.padding;
+  std::vector<int> order(charts.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+  float density = (float)std::sqrt(0.5 * atlasSize * atlasSize / totalArea);
+  bool packed = false;
+  for (int attempt = 0; attempt < 40 && !packed; attempt++) {
+    for (Chart &chart : charts) {
+      glm::vec2 extent = (chart.boundsMax - chart.boundsMin) * density;
+      chart.width = std::max((int)std::ceil(extent.x), 1) + 2 * padding;
+      chart.height = std::max((int)std::ceil(extent.y), 1) + 2 * padding;
+    }
+    std::sort(order.begin(), order.end(), [&](const int a, const int b) {
+      if (charts[a].height != charts[b].height) {
+        return charts[a].height > charts[b].height;
+      }
+      return a < b;
+    });
+    int x = 0, y = 0, shelfHeight = 0;
+    packed = true;
+    for (const int c : order) {
+      Chart &chart = charts[c];
+      if (x + chart.width > atlasSize) {
+        x = 0;
+        y += shelfHeight;
+        shelfHeight = 0;
+      }
+      if (chart.width > atlasSize || y + chart.height > atlasSize) {
+        packed = false;
+        break;
+      }
+      chart.x = x;
+      chart.y = y;
+      x += chart.width;
+      shelfHeight = std::max(shelfHeight, chart.height);
+    }
+    if (!packed) {
+      density *= 0.9f;
+    }
+  }
+  if (!packed) {
+    std::cerr << "[ERROR] Lightmap: " << charts.size()
+              << " charts do not fit a " << atlasSize << "x" << atlasSize
+              << " atlas" << std::endl;
+    return false;
+  }
+
+  // Split vertices per chart and assign their atlas UVs.
+  std::unordered_map<uint64_t, unsigned int> splitIndex;
+  std::vector<unsigned int> sourceVertices;
+  std::vector<glm::vec2> uvs;
+  std::vector<std::vector<unsigned int>> subMeshIndices(subMeshes.size());
+  int triangle = 0;
+  for (size_t s = 0; s < subMeshes.size(); s++) {
+    const int subMeshTriangles = (int)subMeshes[s].vertexIndices.size() / 3;
+    subMeshIndices[s].resize(subMeshTriangles * 3);
+    for (int i = 0; i < subMeshTriangles; i++, triangle++) {
+      const Chart &chart = charts[chartOf[triangle]];
+      for (int k = 0; k < 3; k++) {
+        const unsigned int source = corners[3 * triangle + k];
+        uint64_t key = (uint64_t)source << 32 | (uint32_t)chartOf[triangle];
+        auto found = splitIndex.find(key);
+        unsigned int index;
+        if (found == splitIndex.end()) {
+          index = (unsigned int)sourceVertices.size();
+          splitIndex[key] = index;
+          sourceVertices.push_back(source);
+          glm::vec2 texel =
+              glm::vec2(chart.x + padding, chart.y + padding) +
+              (corner2D[3 * triangle + k] - chart.boundsMin) * density;
+          uvs.push_back(texel / (float)atlasSize);
+        } else {
+          index = found->second;
+        }
+        subMeshIndices[s][3 * i + k] = index;
+      }
+    }
+  }
+  mesh->SetLightmapLayout(sourceVertices, uvs, subMeshIndices);
+  stats.charts += (int)charts.size();
+  stats.texelsPerUnit = density;
+  return true;
+}
+
+std::vector<unsigned char> LightmapBaker::RasterizeTexels(
+    const TriangleMesh *mesh, std::vector<Texel> &texels) const {
+  const int size = settings.atlasSize;
+  const std::vector<VertexPTN> &vertices = mesh->GetVertices();
+  const std::vector<glm::vec2> &uvs = mesh->GetLightmapUVs();
+  std::vector<unsigned char> covered((size_t)size * size, 0);
+  texels.assign((size_t)size * size, Texel());
+
+  // Charts never overlap, so this only resolves texels on shared edges.
+  for (const SubMesh &subMesh :
+       const_cast<TriangleMesh *>(mesh)->getSubMeshes()) {
+    const std::vector<unsigned int> &indices = subMesh.vertexIndices;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+      const VertexPTN *v[3];
+      glm::vec2 c[3];
+      for (int k = 0; k < 3; k++) {
+        v[k] = &vertices[indices[t + k]];
+        c[k] = uvs[indices[t + k]] * (float)size;
+      }
+      glm::vec3 geometricNormal =
+          glm::cross(v[1]->position - v[0]->position,
+                     v[2]->position - v[0]->position);
+      float normalLength = glm::length(geometricNormal);
+      if (normalLength > 0.0f) geometricNormal /= normalLength;
+      const float area = Cross2(c[1] - c[0], c[2] - c[0]);
+
+      auto writeTexel = [&](const int x, const int y, float b1, float b2) {
+        float b0 = 1.0f - b1 - b2;
+        Texel &texel = texels[(size_t)y * size + x];
+        texel.position =
+            b0 * v[0]->position + b1 * v[1]->position + b2 * v[2]->position;
+        glm::vec3 n = b0 * v[0]->normal + b1 * v[1]->normal + b2 * v[2]->normal;
+        float length = glm::length(n);
+        texel.normal = length > 0.0f ? n / length : geometricNormal;
+        texel.geometricNormal = geometricNormal;
+        covered[(size_t)y * size + x] = 1;
+      };
+
+      if (area != 0.0f) {
+        glm::vec2 lo = glm::min(c[0], glm::min(c[1], c[2]));
+        glm::vec2 hi = glm::max(c[0], glm::max(c[1], c[2]));
+        int x0 = std::max((int)std::floor(lo.x), 0);
+        int y0 = std::max((int)std::floor(lo.y), 0);
+        int x1 = std::min((int)std::ceil(hi.x), size - 1);
+        int y1 = std::min((int)std::ceil(hi.y), size - 1);
+        for (int y = y0; y <= y1; y++) {
+          for (int x = x0; x <= x1; x++) {
+            glm::vec2 p((float)x + 0.5f, (float)y + 0.5f);
+            float b1 = Cross2(p - c[0], c[2] - c[0]) / -area;
+            float b2 = Cross2(c[1] - c[0], p - c[0]) / area;
+            if (b1 >= 0.0f && b2 >= 0.0f && b1 + b2 <= 1.0f) {
+              writeTexel(x, y, b1, b2);
+            }
+          }
+        }
+      }
+      // Triangles too small to cover a texel center still get the texel
+      // under their centroid.
+      glm::vec2 centroid = (c[0] + c[1] + c[2]) / 3.0f;
+      int cx = glm::clamp((int)centroid.x, 0, size - 1);
+      int cy = glm::clamp((int)centroid.y, 0, size - 1);
+      if (!covered[(size_t)cy * size + cx]) {
+        writeTexel(cx, cy, 1.0f / 3.0f, 1.0f / 3.0f);
+      }
+    }
+  }
+  return covered;
+}
+
+void LightmapBaker::BakeObject(const Scene *scene, const int object,
+                               Lightmap *lightmap, long long &rays) {
+  PROFILE_SCOPE("Lightmap Object");
+  const int size = settings.atlasSize;
+  std::vector<Texel> texels;
+  std::vector<unsigned char> covered =
+      RasterizeTexels(scene->objects[object].mesh, texels);
+  for (const unsigned char c : covered) stats.texelsCovered += c;
+
+  const glm::mat4x4 &m = scene->bvhWorldMatrices[object];
+  const glm::mat3x3 &nm = scene->bvhNormalMatrices[object];
+  std::vector<glm::vec3> &out = lightmap->GetTexels();
+  std::atomic<long long> totalRays(0);
+  ThreadPool::Get().ParallelFor(size, 4, [&](const int begin, const int end) {
+    long long localRays = 0;
+    for (int y = begin; y < end; y++) {
+      for (int x = 0; x < size; x++) {
+        const size_t i = (size_t)y * size + x;
+        if (!covered[i]) continue;
+        const Texel &texel = texels[i];
+        glm::vec3 p = glm::vec3(m * glm::vec4(texel.position, 1.0f));
+        glm::vec3 n = glm::normalize(nm * texel.normal);
+        glm::vec3 ng = glm::normalize(nm * texel.geometricNormal);
+        if (glm::dot(ng, n) < 0.0f) ng = -ng;
+        glm::vec3 light =
+            lights.DirectLight(scene, object, p, n, ng, localRays);
+
+        // One diffuse bounce of the static direct light.
+        uint32_t rng = PcgHash((uint32_t)i ^ PcgHash((uint32_t)object));
+        glm::vec3 bounce(0.0f);
+        for (int s = 0; s < settings.bounceSamples; s++) {
+          glm::vec3 wi =
+              SamplePowerCosine(n, 1.0f, NextRandom(rng), NextRandom(rng));
+          if (glm::dot(wi, ng) <= 0.0f) continue;
+          Ray ray(OffsetRayOrigin(p, ng, wi), wi);
+          RayHit hit;
+          localRays++;
+          if (!scene->RayCast(ray, hit)) continue;
+          SurfacePoint sp = scene->GetSurfacePoint(ray, hit);
+          glm::vec3 albedo = PhongMaterial::Sample(sp.material, sp.uv).Kd;
+          if (albedo == glm::vec3(0.0f)) continue;
+          bounce += albedo * lights.DirectLight(scene, hit.object,
+                                                sp.position, sp.normal,
+                                                sp.geometricNormal, localRays);
+        }
+        if (settings.bounceSamples > 0) {
+          light += bounce / (float)settings.bounceSamples;
+        }
+        out[i] = light;
+      }
+    }
+    totalRays += localRays;
+  });
+  rays += totalRays.load();
+  Dilate(out, covered, size, size, settings.padding);
+}
+
+void LightmapBaker::Dilate(std::vector<glm::vec3> &texels,
+                           std::vector<unsigned char> &covered,
+                           const int width, const int height,
+                           const int iterations) {
+  for (int iteration = 0; iteration < iterations; iteration++) {
+    std::vector<unsigned char> next = covered;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        const size_t i = (size_t)y * width + x;
+        if (covered[i]) continue;
+        glm::vec3 sum(0.0f);
+        int count = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+          for (int dx = -1; dx <= 1; dx++) {
+            int nx = x + dx, ny = y + dy;
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+            const size_t n = (size_t)ny * width + nx;
+            if (covered[n]) {
+              sum += texels[n];
+              count++;
+            }
+          }
+        }
+        if (count > 0) {
+          texels[i] = sum / (float)count;
+          next[i] = 1;
+        }
+      }
+    }
+    covered.swap(next);
+  }
+}
+
+std::string GetLightmapPath(const std::string &scenePath) {
+  return scenePath + ".lightmap";
+}
+
+bool SaveLightmaps(const std::string &scenePath, const Scene *scene) {
+  LightmapFileHeader header;
+  std::memcpy(header.magic, kLightmapMagic, 4);
+  header.version = kLightmapVersion;
+  if (!FileCache::HashFile(scenePath, header.sceneHash)) {
+    std::cerr << "[ERROR] Failed to read " << scenePath << std::endl;
+    return false;
+  }
+  header.numObjects = (uint32_t)scene->objects.size();
+  header.pad = 0;
+
+  std::vector<char> data;
+  auto append = [&](const void *p, const size_t size) {
+    data.insert(data.end(), (const char *)p, (const char *)p + size);
+  };
+  append(&header, sizeof(header));
+  for (const SceneObject &sceneObj : scene->objects) {
+    TriangleMesh *mesh = sceneObj.mesh;
+    LightmapObjectHeader objectHeader;
+    const bool baked = sceneObj.lightmap != nullptr && mesh->HasLightmapUVs();
+    objectHeader.numVertices =
+        baked ? (uint32_t)mesh->GetLightmapSourceVertices().size() : 0;
+    objectHeader.numSubMeshes = baked ? (uint32_t)mesh->GetNumSubMeshes() : 0;
+    objectHeader.width = baked ? sceneObj.lightmap->GetWidth() : 0;
+    objectHeader.height = baked ? sceneObj.lightmap->GetHeight() : 0;
+    append(&objectHeader, sizeof(objectHeader));
+    if (!baked) continue;
+    append(mesh->GetLightmapSourceVertices().data(),
+           objectHeader.numVertices * sizeof(uint32_t));
+    append(mesh->GetLightmapUVs().data(),
+           objectHeader.numVertices * sizeof(glm::vec2));
+    for (const SubMesh &subMesh : mesh->getSubMeshes()) {
+      uint32_t count = (uint32_t)subMesh.vertexIndices.size();
+      append(&count, sizeof(count));
+      append(subMesh.vertexIndices.data(), count * sizeof(uint32_t));
+    }
+    append(sceneObj.lightmap->GetTexels().data(),
+           sceneObj.lightmap->GetTexels().size() * sizeof(glm::vec3));
+  }
+  return FileCache::WriteFile(GetLightmapPath(scenePath), data.data(),
+                              data.size());
+}
+
+bool LoadLightmaps(const std::string &scenePath, Scene *scene) {
+  std::vector<char> data;
+  if (!FileCache::ReadFile(GetLightmapPath(scenePath), data)) {
+    return false;
+  }
+  size_t offset = 0;
+  auto read = [&](void *p, const size_t size) {
+    if (offset + size > data.size()) return false;
+    std::memcpy(p, data.data() + offset, size);
+    offset += size;
+    return true;
+  };
+
+  LightmapFileHeader header;
+  uint64_t sceneHash;
+  if (!read(&header, sizeof(header)) ||
+      std::memcmp(header.magic, kLightmapMagic, 4) != 0 ||
+      header.version != kLightmapVersion ||
+      !FileCache::HashFile(scenePath, sceneHash) ||
+      header.sceneHash != sceneHash ||
+      header.numObjects != scene->objects.size()) {
+    std::cerr << "[ERROR] Lightmap file is stale: "
+              << GetLightmapPath(scenePath) << std::endl;
+    return false;
+  }
+
+  // Parse and check everything before touching the meshes.
+  struct ObjectData {
+    LightmapObjectHeader header;
+    std::vector<unsigned int> sources;
+    std::vector<glm::vec2> uvs;
+    std::vector<std::vector<unsigned int>> indices;
+    Lightmap *lightmap;
+  };
+  std::vector<ObjectData> objects(header.numObjects);
+  bool valid = true;
+  for (size_t o = 0; o < objects.size() && valid; o++) {
+    ObjectData &object = objects[o];
+    object.lightmap = nullptr;
+    TriangleMesh *mesh = scene->objects[o].mesh;
+    if (!read(&object.header, sizeof(object.header))) {
+      valid = false;
+      break;
+    }
+    if (object.header.numVertices == 0) continue;
+    const uint32_t numVertices = object.header.numVertices;
+    object.sources.resize(numVertices);
+    object.uvs.resize(numVertices);
+    valid = object.header.numSubMeshes == (uint32_t)mesh->GetNumSubMeshes() &&
+            read(object.sources.data(), numVertices * sizeof(uint32_t)) &&
+            read(object.uvs.data(), numVertices * sizeof(glm::vec2));
+    for (unsigned int source : object.sources) {
+      valid = valid && source < (unsigned int)mesh->GetNumVertices();
+    }
+    object.indices.resize(object.header.numSubMeshes);
+    for (uint32_t s = 0; s < object.header.numSubMeshes && valid; s++) {
+      uint32_t count = 0;
+      valid = read(&count, sizeof(count)) &&
+              count == mesh->getSubMeshes()[s].vertexIndices.size();
+      if (!valid) break;
+      object.indices[s].resize(count);
+      valid = read(object.indices[s].data(), count * sizeof(uint32_t));
+      for (unsigned int index : object.indices[s]) {
+        valid = valid && index < numVertices;
+      }
+    }
+    if (!valid) break;
+    object.lightmap = new Lightmap((int)object.header.width,
+                                   (int)object.header.height);
+    valid = read(object.lightmap->GetTexels().data(),
+                 object.lightmap->GetTexels().size() * sizeof(glm::vec3));
+  }
+  if (!valid || offset != data.size()) {
+    std::cerr << "[ERROR] Lightmap file does not match the scene: "
+              << GetLightmapPath(scenePath) << std::endl;
+    for (ObjectData &object : objects) delete object.lightmap;
+    return false;
+  }
+
+  std::set<TriangleMesh *> applied;
+  for (size_t o = 0; o < objects.size(); o++) {
+    ObjectData &object = objects[o];
+    if (object.lightmap == nullptr) continue;
+    TriangleMesh *mesh = scene->objects[o].mesh;
+    // Objects sharing a mesh store the same layout.
+    if (applied.insert(mesh).second) {
+      mesh->SetLightmapLayout(object.sources, object.uvs, object.indices);
+    }
+    delete scene->objects[o].lightmap;
+    scene->objects[o].lightmap = object.lightmap;
+  }
+  return true;
+}
+
+int LightmapBaker::RunHeadless(const HeadlessOptions &options, Scene *scene,
+                               const LightmapBakeSettings &settings) {
+  LightmapBaker baker(settings);
+  if (!baker.Bake(scene) || !SaveLightmaps(options.scenePath, scene)) {
+    return 1;
+  }
+
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  const LightmapBakeStats &stats = baker.GetStats();
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("lightmap", GetLightmapPath(options.scenePath));
+  json.Field("atlasSize", settings.atlasSize);
+  json.Field("bounceSamples", settings.bounceSamples);
+  json.Field("threads", stats.threads);
+  json.Field("objects", stats.objects);
+  json.Field("charts", stats.charts);
+  json.Field("verticesBefore", stats.verticesBefore);
+  json.Field("verticesAfter", stats.verticesAfter);
+  json.Field("texelsCovered", stats.texelsCovered);
+  json.Field("coverage", stats.coverage);
+  json.Field("rays", stats.rays);
+  json.Field("unwrapMs", stats.unwrapMs);
+  json.Field("bakeMs", stats.bakeMs);
+  json.EndObject();
+  file << std::endl;
+  return 0;
+}
@@ -0,0 +1,132 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <cstdint>
+
+#include "headers.h"
+#include "scene.h"
+#include "static_lights.h"
+
+class TriangleMesh;
+struct HeadlessOptions;
+
+// Lightmap Declarations.
+// Diffuse light of the static lights arriving at each texel of an object's
+// second UV set, without the surface albedo. The shader multiplies it by
+// the diffuse color.
+class Lightmap {
+ public:
+  // Lightmap Public Methods.
+  Lightmap(const int width, const int height);
+  ~Lightmap();
+
+  // Creates or refreshes the GL texture (RGB16F, bilinear).
+  void Upload();
+  void Bind(GLenum textureUnit);
+  bool IsUploaded() const { return textureObj != 0; }
+
+  int GetWidth() const { return width; }
+  int GetHeight() const { return height; }
+  // Row v, column u; the first row is at v = 0.
+  std::vector<glm::vec3> &GetTexels() { return texels; }
+  const std::vector<glm::vec3> &GetTexels() const { return texels; }
+
+ private:
+  // Lightmap Private Data.
+  int width;
+  int height;
+  std::vector<glm::vec3> texels;
+  GLuint textureObj;
+};
+
+struct LightmapBakeSettings {
+  int atlasSize = 512;
+  // Texels kept free around every chart, so bilinear filtering and mips
+  // never blend neighbouring charts.
+  int padding = 2;
+  // Neighbouring triangles join a chart while their normal stays within
+  // this angle of the chart's first triangle.
+  float chartAngleDegrees = 35.0f;
+  // Cosine-distributed rays per texel for the indirect bounce.
+  int bounceSamples = 32;
+};
+
+struct LightmapBakeStats {
+  int objects = 0;
+  int charts = 0;
+  int verticesBefore = 0;
+  int verticesAfter = 0;
+  // Texels covered by triangles, and their share of all atlas texels.
+  long long texelsCovered = 0;
+  double coverage = 0.0;
+  // Atlas texels per object-space unit (of the last object).
+  float texelsPerUnit = 0.0f;
+  long long rays = 0;
+  double unwrapMs = 0.0;
+  double bakeMs = 0.0;
+  int threads = 0;
+};
+
+// LightmapBaker Declarations.
+// Offline lightmap baker. Every object's mesh gets a second UV set: the
+// triangles are grouped into charts of connected, roughly coplanar faces,
+// each chart is projected onto its plane, and the charts are shelf-packed
+// into one atlas per object. Vertices on chart borders are split.
+//
+// Each covered texel then gets the direct light of all static lights (see
+// StaticLights), plus one diffuse bounce of that direct light, traced on
+// all pool threads against the scene BVH. The viewer's model rotation and
+// scale are not baked in; lighting is computed with scale 1.
+class LightmapBaker {
+ public:
+  // LightmapBaker Public Methods.
+  explicit LightmapBaker(const LightmapBakeSettings &settings);
+
+  // Unwraps all meshes (replacing their vertex streams) and bakes one
+  // lightmap per object into SceneObject::lightmap. Builds the BVH.
+  bool Bake(Scene *scene);
+
+  const LightmapBakeStats &GetStats() const { return stats; }
+
+  // Bakes the lightmaps of the scene into its sidecar file and writes the
+  // bake stats to the report.
+  static int RunHeadless(const HeadlessOptions &options, Scene *scene,
+                         const LightmapBakeSettings &settings);
+
+ private:
+  // Surface of one atlas texel, in object space.
+  struct Texel {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 geometricNormal;
+  };
+
+  // LightmapBaker Private Methods.
+  bool Unwrap(TriangleMesh *mesh);
+  // Fills texels with the surface of the covering triangle; returns the
+  // coverage mask.
+  std::vector<unsigned char> RasterizeTexels(const TriangleMesh *mesh,
+                                            std::vector<Texel> &texels) const;
+  void BakeObject(const Scene *scene, const int object, Lightmap *lightmap,
+                  long long &rays);
+  // Grows covered texels into the empty ones next to them.
+  static void Dilate(std::vector<glm::vec3> &texels,
+                     std::vector<unsigned char> &covered, const int width,
+                     const int height, const int iterations);
+
+  // LightmapBaker Private Data.
+  LightmapBakeSettings settings;
+  LightmapBakeStats stats;
+  StaticLights lights;
+};
+
+// Sidecar file next to a scene that keeps the lightmap UV layout and
+// texels of every object. It stores the hash of the scene file, and
+// loading fails if the scene or its meshes changed since the bake.
+std::string GetLightmapPath(const std::string &scenePath);
+bool SaveLightmaps(const std::string &scenePath, const Scene *scene);
+// Applies the stored layout to the freshly loaded meshes and creates the
+// lightmaps (without uploading them).
+bool LoadLightmaps(const std::string &scenePath, Scene *scene);
+
+#endif
@@ -22,6 +22,15 @@ class Material {
 
 // ------------------------------------------------------------------------------------------------
 
+// Material inputs at one surface point, as TriangleMesh::draw feeds them to
+// phong_shading_demo.fs. Used by the CPU renderers.
+struct SurfaceSample {
+  glm::vec3 Ka;
+  glm::vec3 Kd;
+  glm::vec3 Ks;
+  float Ns;
+};
+
 // PhongMaterial Declarations.
 class PhongMaterial : public Material {
  public:
@@ -60,6 +69,33 @@ class PhongMaterial : public Material {
   ImageTexture* GetMapKd() const { return mapKd; }
   ImageTexture* GetMapKs() const { return mapKs; }
 
+  // With mapKd the texture replaces Kd. Without mapKs, the shader's mapKs
+  // sampler reads texture unit 0, i.e. mapKd (or black), scaled by Ks.
+  // A null material draws in grey.
+  static SurfaceSample Sample(const PhongMaterial* material,
+                              const glm::vec2& uv) {
+    SurfaceSample s;
+    s.Ka = glm::vec3(0.0f);
+    s.Kd = glm::vec3(0.8f);
+    s.Ks = glm::vec3(0.0f);
+    s.Ns = 1.0f;
+    if (material == nullptr) {
+      return s;
+    }
+    s.Ka = material->Ka;
+    s.Ns = material->Ns;
+    glm::vec3 texColor =
+        material->mapKd ? material->mapKd->Sample(uv) : glm::vec3(0.0f);
+    s.Kd = material->mapKd ? texColor : material->Kd;
+    if (material->mapKs) {
+      s.Ks = material->mapKs->Sample(uv);
+    } else {
+      s.Ks = material->Ks == glm::vec3(0.0f) ? texColor
+                                             : material->Ks * texColor;
+    }
+    return s;
+  }
+
  private:
   // PhongMaterial Private Data.
   glm::vec3 Ka;
@@ -0,0 +1,283 @@
+#include "memory_tracker.h"
+
+#include "json_writer.h"
+
+MemoryTracker &MemoryTracker::Get() {
+  static MemoryTracker tracker;
+  return tracker;
+}
+
+const char *MemoryTracker::TagName(const MemoryTag tag) {
+  switch (tag) {
+    case MemoryTag::Mesh:
+      return "mesh";
+    case MemoryTag::Texture:
+      return "texture";
+    case MemoryTag::Skybox:
+      return "skybox";
+    case MemoryTag::Shader:
+      return "shader";
+    default:
+      return "unknown";
+  }
+}
+
+void MemoryTracker::Update(const void *owner, const MemoryTag tag,
+                           const std::string &name, const long long cpuBytes,
+                           const long long gpuBytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = entries.find(owner);
+  if (it == entries.end()) {
+    it = entries.emplace(owner, Entry{tag, name, 0, 0}).first;
+    usage[(int)tag].resources++;
+  } else if (it->second.tag != tag) {
+    // Retagged, e.g. the skybox panorama.
+    MemoryUsage &old = usage[(int)it->second.tag];
+    old.cpuBytes -= it->second.cpuBytes;
+    old.gpuBytes -= it->second.gpuBytes;
+    old.resources--;
+    usage[(int)tag].resources++;
+    it->second = Entry{tag, name, 0, 0};
+  }
+  Entry &entry = it->second;
+  usage[(int)tag].cpuBytes += cpuBytes - entry.cpuBytes;
+  usage[(int)tag].gpuBytes += gpuBytes - entry.gpuBytes;
+  entry.name = name;
+  entry.cpuBytes = cpuBytes;
+  entry.gpuBytes = gpuBytes;
+}
+
+void MemoryTracker::Remove(const void *owner) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = entries.find(owner);
+  if (it == entries.end()) {
+    return;
+  }
+  MemoryUsage &tagUsage = usage[(int)it->second.tag];
+  tagUsage.cpuBytes -= it->second.cpuBytes;
+  tagUsage.gpuBytes -= it->second.gpuBytes;
+  tagUsage.resources--;
+  entries.erase(it);
+}
+
+MemoryUsage MemoryTracker::GetUsage(const MemoryTag tag) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return usage[(int)tag];
+}
+
+MemoryUsage MemoryTracker::GetTotal() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  MemoryUsage total;
+  for (int t = 0; t < kNumTags; ++t) {
+    total.cpuBytes += usage[t].cpuBytes;
+    total.gpuBytes += usage[t].gpuBytes;
+    total.resources += usage[t].resources;
+  }
+  return total;
+}
+
+void MemoryTracker::SetBudget(const MemoryTag tag,
+                              const MemoryBudget &budget) {
+  std::lock_guard<std::mutex> lock(mutex);
+  budgets[(int)tag] = budget;
+}
+
+MemoryBudget MemoryTracker::GetBudget(const MemoryTag tag) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return budgets[(int)tag];
+}
+
+int MemoryTracker::AddBudgetCallback(const MemoryTag tag,
+                                     const BudgetCallback &callback) {
+  std::lock_guard<std::mutex> lock(mutex);
+  callbacks.push_back(Callback{nextCallbackId, tag, callback});
+  return nextCallbackId++;
+}
+
+void MemoryTracker::RemoveBudgetCallback(const int id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  callbacks.erase(std::remove_if(callbacks.begin(), callbacks.end(),
+                                 [id](const Callback &c) {
+                                   return c.id == id;
+                                 }),
+                  callbacks.end());
+}
+
+void MemoryTracker::GetOverBudget(const MemoryTag tag, long long &cpuOver,
+                                  long long &gpuOver) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  const MemoryBudget &budget = budgets[(int)tag];
+  const MemoryUsage &tagUsage = usage[(int)tag];
+  cpuOver = budget.cpuBytes > 0
+                ? std::max(0LL, tagUsage.cpuBytes - budget.cpuBytes)
+                : 0;
+  gpuOver = budget.gpuBytes > 0
+                ? std::max(0LL, tagUsage.gpuBytes - budget.gpuBytes)
+                : 0;
+}
+
+void MemoryTracker::EnforceBudgets() {
+  // Callbacks report their frees through Update, so they run unlocked.
+  std::vector<Callback> pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending = callbacks;
+  }
+  for (int t = 0; t < kNumTags; ++t) {
+    const MemoryTag tag = (MemoryTag)t;
+    long long cpuOver, gpuOver;
+    GetOverBudget(tag, cpuOver, gpuOver);
+    for (const Callback &c : pending) {
+      if (cpuOver == 0 && gpuOver == 0) {
+        break;
+      }
+      if (c.tag != tag) {
+        continue;
+      }
+      c.callback(cpuOver, gpuOver);
+      callbackCalls[t]++;
+      GetOverBudget(tag, cpuOver, gpuOver);
+    }
+    overBudget[t] = cpuOver > 0 || gpuOver > 0;
+  }
+}
+
+void MemoryTracker::WriteJson(JsonWriter &json) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  MemoryUsage total;
+  for (int t = 0; t < kNumTags; ++t) {
+    total.cpuBytes += usage[t].cpuBytes;
+    total.gpuBytes += usage[t].gpuBytes;
+    total.resources += usage[t].resources;
+  }
+  json.BeginObject();
+  json.Field("cpuBytes", total.cpuBytes);
+  json.Field("gpuBytes", total.gpuBytes);
+  json.Field("resources", total.resources);
+  json.Key("tags");
+  json.BeginArray();
+  for (int t = 0; t < kNumTags; ++t) {
+    json.BeginObject();
+    json.Field("tag", TagName((MemoryTag)t));
+    json.Field("resources", usage[t].resources);
+    json.Field("cpuBytes", usage[t].cpuBytes);
+    json.Field("gpuBytes", usage[t].gpuBytes);
+    json.Field("cpuBudget", budgets[t].cpuBytes);
+    json.Field("gpuBudget", budgets[t].gpuBytes);
+    json.Field("overBudget", overBudget[t]);
+    json.EndObject();
+  }
+  json.EndArray();
+
+  std::vector<const Entry *> sorted;
+  for (const auto &pair : entries) {
+    sorted.push_back(&pair.second);
+  }
+  std::sort(sorted.begin(), sorted.end(), [](const Entry *a, const Entry *b) {
+    return a->cpuBytes + a->gpuBytes > b->cpuBytes + b->gpuBytes;
+  });
+  json.Key("resources");
+  json.BeginArray();
+  for (const Entry *entry : sorted) {
+    json.BeginObject();
+    json.Field("tag", TagName(entry->tag));
+    json.Field("name", entry->name);
+    json.Field("cpuBytes", entry->cpuBytes);
+    json.Field("gpuBytes", entry->gpuBytes);
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+}
+
+bool MemoryTracker::WriteJson(const std::string &filePath) const {
+  std::ofstream file(filePath);
+  if (!file) {
+    std::cerr << "[ERROR] Failed to write " << filePath << std::endl;
+    return false;
+  }
+  JsonWriter json(file);
+  WriteJson(json);
+  file << std::endl;
+  return true;
+}
+
+void MemoryTracker::DrawPanel() {
+  ImGui::Begin("Memory");
+  const double mb = 1024.0 * 1024.0;
+  const MemoryUsage total = GetTotal();
+  ImGui::Text("%d resources: CPU %.2f MB, GPU %.2f MB (estimated)",
+              total.resources, total.cpuBytes / mb, total.gpuBytes / mb);
+  if (ImGui::BeginTable("memory", 6)) {
+    ImGui::TableSetupColumn("Tag");
+    ImGui::TableSetupColumn("Count");
+    ImGui::TableSetupColumn("CPU (MB)");
+    ImGui::TableSetupColumn("GPU (MB)");
+    ImGui::TableSetupColumn("CPU budget");
+    ImGui::TableSetupColumn("GPU budget");
+    ImGui::TableHeadersRow();
+    for (int t = 0; t < kNumTags; ++t) {
+      const MemoryTag tag = (MemoryTag)t;
+      const MemoryUsage tagUsage = GetUsage(tag);
+      MemoryBudget budget = GetBudget(tag);
+      ImGui::PushID(t);
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      if (overBudget[t]) {
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s",
+                           TagName(tag));
+      } else {
+        ImGui::Text("%s", TagName(tag));
+      }
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", tagUsage.resources);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", tagUsage.cpuBytes / mb);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", tagUsage.gpuBytes / mb);
+      // Budgets in MB, 0 for none.
+      int cpuMb = (int)(budget.cpuBytes / (long long)mb);
+      int gpuMb = (int)(budget.gpuBytes / (long long)mb);
+      bool changed = false;
+      ImGui::TableNextColumn();
+      ImGui::SetNextItemWidth(-1.0f);
+      changed |= ImGui::InputInt("##cpu", &cpuMb, 0);
+      ImGui::TableNextColumn();
+      ImGui::SetNextItemWidth(-1.0f);
+      changed |= ImGui::InputInt("##gpu", &gpuMb, 0);
+      if (changed) {
+        budget.cpuBytes = (long long)std::max(cpuMb, 0) * (long long)mb;
+        budget.gpuBytes = (long long)std::max(gpuMb, 0) * (long long)mb;
+        SetBudget(tag, budget);
+      }
+      ImGui::PopID();
+    }
+    ImGui::EndTable();
+  }
+  ImGui::TextDisabled("Budgets in MB, 0 for none; red tags are over");
+
+  if (ImGui::Button("Dump JSON")) {
+    WriteJson("memory.json");
+  }
+
+  if (ImGui::CollapsingHeader("Largest resources")) {
+    std::vector<Entry> sorted;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const auto &pair : entries) {
+        sorted.push_back(pair.second);
+      }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Entry &a, const Entry &b) {
+      return a.cpuBytes + a.gpuBytes > b.cpuBytes + b.gpuBytes;
+    });
+    const size_t shown = std::min(sorted.size(), (size_t)20);
+    for (size_t i = 0; i < shown; ++i) {
+      const Entry &entry = sorted[i];
+      ImGui::Text("%-8s %7.2f / %7.2f MB  %s", TagName(entry.tag),
+                  entry.cpuBytes / mb, entry.gpuBytes / mb,
+                  entry.name.c_str());
+    }
+  }
+  ImGui::End();
+}
@@ -0,0 +1,107 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <functional>
+#include <mutex>
+
+#include "headers.h"
+
+class JsonWriter;
+
+// What a tracked resource is.
+enum class MemoryTag {
+  Mesh,
+  Texture,
+  Skybox,
+  Shader,
+  Count,
+};
+
+// Totals of one tag, or of all of them.
+struct MemoryUsage {
+  long long cpuBytes = 0;
+  // Estimated from sizes and formats; drivers add padding and alignment.
+  long long gpuBytes = 0;
+  int resources = 0;
+};
+
+// Limits of one tag; 0 means unlimited.
+struct MemoryBudget {
+  long long cpuBytes = 0;
+  long long gpuBytes = 0;
+};
+
+// MemoryTracker Declarations.
+// CPU and estimated GPU bytes of the loaded resources, by tag. Resources
+// report their current sizes whenever they change and remove themselves
+// when deleted. Subsystems that can give memory back register budget
+// callbacks, which EnforceBudgets calls while their tag is over budget.
+class MemoryTracker {
+ public:
+  // Gets how many bytes the tag is over its CPU and GPU budgets (0 when
+  // within) and frees what it can, reporting the new sizes as usual.
+  typedef std::function<void(const long long cpuOver,
+                             const long long gpuOver)>
+      BudgetCallback;
+
+  // MemoryTracker Public Methods.
+  static MemoryTracker &Get();
+  static const char *TagName(const MemoryTag tag);
+
+  // Replaces what owner reported before. name labels it in the dump.
+  void Update(const void *owner, const MemoryTag tag, const std::string &name,
+              const long long cpuBytes, const long long gpuBytes);
+  void Remove(const void *owner);
+
+  MemoryUsage GetUsage(const MemoryTag tag) const;
+  MemoryUsage GetTotal() const;
+
+  void SetBudget(const MemoryTag tag, const MemoryBudget &budget);
+  MemoryBudget GetBudget(const MemoryTag tag) const;
+  // Returns an id for RemoveBudgetCallback.
+  int AddBudgetCallback(const MemoryTag tag, const BudgetCallback &callback);
+  void RemoveBudgetCallback(const int id);
+  // Calls the callbacks of the tags over budget, in the order they were
+  // added, until the tag fits. Call once per frame on the GL thread.
+  void EnforceBudgets();
+
+  // Per-tag totals, budgets and every resource, largest first.
+  void WriteJson(JsonWriter &json) const;
+  bool WriteJson(const std::string &filePath) const;
+  void DrawPanel();
+
+ private:
+  // MemoryTracker Private Methods.
+  MemoryTracker() = default;
+  // Bytes over budget, 0 when within.
+  void GetOverBudget(const MemoryTag tag, long long &cpuOver,
+                     long long &gpuOver) const;
+
+  // MemoryTracker Private Data.
+  static const int kNumTags = (int)MemoryTag::Count;
+
+  struct Entry {
+    MemoryTag tag;
+    std::string name;
+    long long cpuBytes;
+    long long gpuBytes;
+  };
+  struct Callback {
+    int id;
+    MemoryTag tag;
+    BudgetCallback callback;
+  };
+
+  mutable std::mutex mutex;
+  std::unordered_map<const void *, Entry> entries;
+  MemoryUsage usage[kNumTags];
+  MemoryBudget budgets[kNumTags];
+  std::vector<Callback> callbacks;
+  int nextCallbackId = 0;
+  // Callback calls since the start, and whether the tag was still over
+  // budget after the last EnforceBudgets.
+  long long callbackCalls[kNumTags] = {};
+  bool overBudget[kNumTags] = {};
+};
+
+#endif
@@ -0,0 +1,318 @@
+#include "mip_generator.h"
+
+#include <cstring>
+
+#include "file_cache.h"
+#include "profiler.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+// Bump when the filters or the file layout change.
+static const uint32_t kCacheVersion = 1;
+static const char kCacheMagic[4] = {'M', 'I', 'P', 'S'};
+
+struct MipCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  uint32_t numLevels;
+};
+
+// Kaiser taps cover source texels 2x - 3 .. 2x + 4 of destination texel x.
+static const int kKaiserTaps = 8;
+static const int kKaiserOffset = 3;
+// Padding of the scratch rows, enough for the last float8 of the taps.
+static const int kRowPadding = 24;
+
+// Decode table and the encode thresholds of the sRGB transfer function.
+struct SrgbTables {
+  float toLinear[256];
+  // Linear value halfway between the codes b and b + 1.
+  float bounds[255];
+
+  SrgbTables() {
+    for (int i = 0; i < 256; ++i) {
+      toLinear[i] = Decode(i / 255.0f);
+    }
+    for (int i = 0; i < 255; ++i) {
+      bounds[i] = Decode((i + 0.5f) / 255.0f);
+    }
+  }
+
+  static float Decode(const float c) {
+    return c <= 0.04045f ? c / 12.92f
+                         : std::pow((c + 0.055f) / 1.055f, 2.4f);
+  }
+};
+
+static const SrgbTables &GetSrgbTables() {
+  static const SrgbTables tables;
+  return tables;
+}
+
+static unsigned char EncodeLinear(const float value) {
+  return (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+// The code whose interval contains value, by binary search.
+static unsigned char EncodeSrgb(const float value, const float *bounds) {
+  int low = 0;
+  int high = 255;
+  while (low < high) {
+    const int mid = (low + high) / 2;
+    if (value > bounds[mid]) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return (unsigned char)low;
+}
+
+static int Wrap(const int i, const int size) {
+  const int m = i % size;
+  return m < 0 ? m + size : m;
+}
+
+// Kaiser-windowed sinc for a 2:1 reduction, normalized to sum 1.
+static void ComputeKaiserWeights(float weights[kKaiserTaps]) {
+  const double alpha = 4.0;
+  const double halfWidth = 2.0;
+  // Zeroth-order modified Bessel function, by its power series.
+  auto besselI0 = [](const double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 20; ++k) {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum += term;
+    }
+    return sum;
+  };
+  double total = 0.0;
+  double w[kKaiserTaps];
+  for (int k = 0; k < kKaiserTaps; ++k) {
+    // Distance from the destination center, in destination texels.
+    const double t = (k - kKaiserOffset - 0.5) / 2.0;
+    const double sinc =
+        std::sin(glm::pi<double>() * t) / (glm::pi<double>() * t);
+    const double r = t / halfWidth;
+    w[k] = sinc * besselI0(alpha * std::sqrt(std::max(0.0, 1.0 - r * r))) /
+           besselI0(alpha);
+    total += w[k];
+  }
+  for (int k = 0; k < kKaiserTaps; ++k) {
+    weights[k] = (float)(w[k] / total);
+  }
+}
+
+// One channel of a level in linear space.
+typedef std::vector<float> Plane;
+
+// Filters the planes of a width x height level down to dstWidth x
+// dstHeight.
+static void Downsample(const std::vector<Plane> &src, const int width,
+                       const int height, const MipFilter filter,
+                       std::vector<Plane> &dst, const int dstWidth,
+                       const int dstHeight) {
+  float kaiser[kKaiserTaps];
+  ComputeKaiserWeights(kaiser);
+  const int numTaps = filter == MipFilter::Kaiser ? kKaiserTaps : 2;
+  const int tapOffset = filter == MipFilter::Kaiser ? kKaiserOffset : 0;
+  const float boxWeights[2] = {0.5f, 0.5f};
+  const float *weights = filter == MipFilter::Kaiser ? kaiser : boxWeights;
+
+  const int channels = (int)src.size();
+  dst.assign(channels, Plane((size_t)dstWidth * dstHeight));
+  ThreadPool::Get().ParallelFor(
+      dstHeight, 8, [&](const int begin, const int end) {
+        // column[tapOffset + x] holds the vertically filtered source column
+        // x, wrapped around on both sides.
+        std::vector<float> column(width + kRowPadding);
+        std::vector<float> row(width + kRowPadding);
+        for (int y = begin; y < end; ++y) {
+          const float *rows[kKaiserTaps];
+          for (int c = 0; c < channels; ++c) {
+            for (int k = 0; k < numTaps; ++k) {
+              rows[k] = src[c].data() +
+                        (size_t)Wrap(2 * y + k - tapOffset, height) * width;
+            }
+            // Vertical pass over contiguous rows.
+            float *out = column.data() + tapOffset;
+            int x = 0;
+            for (; x + 8 <= width; x += 8) {
+              float8 sum = float8::Broadcast(weights[0]) *
+                           float8::Load(rows[0] + x);
+              for (int k = 1; k < numTaps; ++k) {
+                sum = MulAdd(float8::Broadcast(weights[k]),
+                             float8::Load(rows[k] + x), sum);
+              }
+              sum.Store(out + x);
+            }
+            for (; x < width; ++x) {
+              float sum = 0.0f;
+              for (int k = 0; k < numTaps; ++k) {
+                sum += weights[k] * rows[k][x];
+              }
+              out[x] = sum;
+            }
+            for (int i = 0; i < tapOffset; ++i) {
+              column[i] = out[Wrap(i - tapOffset, width)];
+            }
+            for (int i = tapOffset + width; i < (int)column.size(); ++i) {
+              column[i] = out[Wrap(i - tapOffset, width)];
+            }
+
+            // Horizontal pass at full width, then every other texel is
+            // kept.
+            for (x = 0; x < width; x += 8) {
+              float8 sum = float8::Broadcast(weights[0]) *
+                           float8::Load(column.data() + x);
+              for (int k = 1; k < numTaps; ++k) {
+                sum = MulAdd(float8::Broadcast(weights[k]),
+                             float8::Load(column.data() + x + k), sum);
+              }
+              sum.Store(row.data() + x);
+            }
+            // Kaiser lobes can overshoot.
+            float *dstRow = dst[c].data() + (size_t)y * dstWidth;
+            for (x = 0; x < dstWidth; ++x) {
+              dstRow[x] = glm::clamp(row[2 * x], 0.0f, 1.0f);
+            }
+          }
+        }
+      });
+}
+
+namespace MipGenerator {
+
+const char *FilterName(const MipFilter filter) {
+  return filter == MipFilter::Kaiser ? "Kaiser" : "box";
+}
+
+void Generate(const cv::Mat &image, const MipFilter filter, const bool srgb,
+              std::vector<cv::Mat> &mips) {
+  PROFILE_SCOPE("Generate Mips");
+  mips.assign(1, image);
+  const int channels = image.channels();
+  if (image.empty() || image.depth() != CV_8U) {
+    std::cerr << "[ERROR] Mips need an 8-bit image" << std::endl;
+    return;
+  }
+  const SrgbTables &tables = GetSrgbTables();
+  std::vector<bool> isSrgb(channels, srgb);
+  if (channels == 4) {
+    isSrgb[3] = false;
+  }
+
+  int width = image.cols;
+  int height = image.rows;
+  std::vector<Plane> planes(channels, Plane((size_t)width * height));
+  ThreadPool::Get().ParallelFor(
+      height, 32, [&](const int begin, const int end) {
+        for (int y = begin; y < end; ++y) {
+          const unsigned char *p = image.ptr<unsigned char>(y);
+          for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) {
+              const unsigned char v = p[x * channels + c];
+              planes[c][(size_t)y * width + x] =
+                  isSrgb[c] ? tables.toLinear[v] : v / 255.0f;
+            }
+          }
+        }
+      });
+
+  std::vector<Plane> next;
+  while (width > 1 || height > 1) {
+    const int dstWidth = std::max(1, width / 2);
+    const int dstHeight = std::max(1, height / 2);
+    Downsample(planes, width, height, filter, next, dstWidth, dstHeight);
+    planes.swap(next);
+    width = dstWidth;
+    height = dstHeight;
+
+    cv::Mat level(height, width, image.type());
+    ThreadPool::Get().ParallelFor(
+        height, 32, [&](const int begin, const int end) {
+          for (int y = begin; y < end; ++y) {
+            unsigned char *p = level.ptr<unsigned char>(y);
+            for (int x = 0; x < width; ++x) {
+              for (int c = 0; c < channels; ++c) {
+                const float v = planes[c][(size_t)y * width + x];
+                p[x * channels + c] =
+                    isSrgb[c] ? EncodeSrgb(v, tables.bounds)
+                              : EncodeLinear(v);
+              }
+            }
+          }
+        });
+    mips.push_back(level);
+  }
+}
+
+bool ReadCache(const std::string &cachePath, const int width,
+               const int height, const int channels,
+               std::vector<cv::Mat> &mips) {
+  std::vector<char> data;
+  if (!FileCache::ReadFile(cachePath, data) ||
+      data.size() < sizeof(MipCacheHeader)) {
+    return false;
+  }
+  MipCacheHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (std::memcmp(header.magic, kCacheMagic, 4) != 0 ||
+      header.version != kCacheVersion || (int)header.width != width ||
+      (int)header.height != height || (int)header.channels != channels) {
+    return false;
+  }
+
+  const int type = channels == 1   ? CV_8UC1
+                   : channels == 3 ? CV_8UC3
+                                   : CV_8UC4;
+  size_t offset = sizeof(header);
+  mips.clear();
+  int w = width;
+  int h = height;
+  for (uint32_t level = 0; level < header.numLevels; ++level) {
+    const size_t bytes = (size_t)w * h * channels;
+    if (offset + bytes > data.size()) {
+      mips.clear();
+      return false;
+    }
+    cv::Mat mip(h, w, type);
+    std::memcpy(mip.ptr(), data.data() + offset, bytes);
+    offset += bytes;
+    mips.push_back(mip);
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+  return !mips.empty();
+}
+
+bool WriteCache(const std::string &cachePath,
+                const std::vector<cv::Mat> &mips) {
+  if (mips.empty()) {
+    return false;
+  }
+  MipCacheHeader header;
+  std::memcpy(header.magic, kCacheMagic, 4);
+  header.version = kCacheVersion;
+  header.width = (uint32_t)mips[0].cols;
+  header.height = (uint32_t)mips[0].rows;
+  header.channels = (uint32_t)mips[0].channels();
+  header.numLevels = (uint32_t)mips.size();
+
+  std::vector<char> data((const char *)&header,
+                         (const char *)&header + sizeof(header));
+  for (const cv::Mat &mip : mips) {
+    const size_t rowBytes = (size_t)mip.cols * mip.channels();
+    for (int y = 0; y < mip.rows; ++y) {
+      const char *row = (const char *)mip.ptr(y);
+      data.insert(data.end(), row, row + rowBytes);
+    }
+  }
+  return FileCache::WriteFile(cachePath, data.data(), data.size());
+}
+
+}  // namespace MipGenerator
@@ -0,0 +1,39 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include "headers.h"
+
+// Downsampling filters of the mip chain.
+enum class MipFilter {
+  // 2x2 average, like glGenerateMipmap.
+  Box,
+  // 8-tap Kaiser-windowed sinc, sharper with little ringing.
+  Kaiser,
+};
+
+// Mip chain generation on the CPU. Every level is filtered from the
+// previous one in linear space (sRGB channels are decoded first and encoded
+// again at the end), rows spread over the thread pool and columns over
+// float8 lanes. Texture addressing wraps around, matching GL_REPEAT.
+namespace MipGenerator {
+
+const char *FilterName(const MipFilter filter);
+
+// Fills mips with image (8-bit, 1, 3 or 4 channels) followed by its
+// downsampled levels down to 1x1. With srgb set, every channel except the
+// alpha of 4-channel images is treated as sRGB-encoded.
+void Generate(const cv::Mat &image, const MipFilter filter, const bool srgb,
+              std::vector<cv::Mat> &mips);
+
+// The chain as a cache file: a small header followed by the level texels.
+// ReadCache fails on any size mismatch with level 0's width, height and
+// channels.
+bool ReadCache(const std::string &cachePath, const int width,
+               const int height, const int channels,
+               std::vector<cv::Mat> &mips);
+bool WriteCache(const std::string &cachePath,
+                const std::vector<cv::Mat> &mips);
+
+}  // namespace MipGenerator
+
+#endif
@@ -0,0 +1,545 @@
+#include "path_tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "headless.h"
+#include "json_writer.h"
+#include "profiler.h"
+#include "sampling.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+namespace {
+
+using RenderClock = std::chrono::steady_clock;
+
+const float kPi = 3.14159265358979f;
+
+// Bounces after which paths may be terminated by Russian roulette.
+const int kMinBouncesBeforeRoulette = 2;
+
+float Luminance(const glm::vec3 &c) {
+  return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+}  // namespace
+
+PathTracer::PathTracer(const int width, const int height)
+    : width(width), height(height) {
+  tilesX = (width + kTileSize - 1) / kTileSize;
+  tilesY = (height + kTileSize - 1) / kTileSize;
+  Reset();
+}
+
+void PathTracer::Reset() {
+  accum.assign((size_t)width * height, glm::vec3(0.0f));
+  stats = PathTracerStats();
+}
+
+void PathTracer::RenderPass(const Scene *scene, const Camera *camera,
+                            const glm::mat4x4 &rootTransform) {
+  PROFILE_SCOPE("Path Trace Pass");
+  const RenderClock::time_point start = RenderClock::now();
+  PrepareLights(scene, rootTransform);
+  const glm::mat4x4 invViewProj =
+      glm::inverse(camera->GetProjMatrix() * camera->GetViewMatrix());
+
+  // Every worker starts with a contiguous block of tiles, which keeps
+  // neighbouring tiles (and their BVH nodes) on one thread until it runs
+  // dry and starts stealing.
+  const int numWorkers = ThreadPool::Get().GetConcurrency();
+  const int numTiles = tilesX * tilesY;
+  std::vector<TileQueue> queues(numWorkers);
+  for (int w = 0; w < numWorkers; w++) {
+    int begin = (int)((long long)numTiles * w / numWorkers);
+    int end = (int)((long long)numTiles * (w + 1) / numWorkers);
+    for (int tile = begin; tile < end; tile++) {
+      queues[w].tiles.push_back(tile);
+    }
+  }
+
+  std::atomic<long long> rays(0);
+  std::atomic<int> stolenTiles(0);
+  ThreadPool::Get().ParallelFor(numWorkers, 1, [&](const int begin,
+                                                   const int end) {
+    for (int w = begin; w < end; w++) {
+      long long localRays = 0;
+      int localStolen = 0;
+      int tile;
+      bool stolen;
+      while (NextTile(queues, w, tile, stolen)) {
+        RenderTile(tile, scene, invViewProj, localRays);
+        localStolen += stolen ? 1 : 0;
+      }
+      rays += localRays;
+      stolenTiles += localStolen;
+    }
+  });
+
+  stats.samples++;
+  stats.threads = numWorkers;
+  stats.lastPassMs = MsSince(start);
+  stats.lastPassRays = rays.load();
+  stats.raysPerSec =
+      stats.lastPassMs > 0.0 ? stats.lastPassRays / (stats.lastPassMs * 1e-3)
+                             : 0.0;
+  stats.tilesStolen = stolenTiles.load();
+  stats.totalMs += stats.lastPassMs;
+  stats.totalRays += stats.lastPassRays;
+}
+
+bool PathTracer::NextTile(std::vector<TileQueue> &queues, const int worker,
+                          int &tile, bool &stolen) const {
+  {
+    TileQueue &own = queues[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tiles.empty()) {
+      tile = own.tiles.front();
+      own.tiles.pop_front();
+      stolen = false;
+      return true;
+    }
+  }
+  // Take from the far end of another queue, away from where its owner works.
+  const int numWorkers = (int)queues.size();
+  for (int i = 1; i < numWorkers; i++) {
+    TileQueue &victim = queues[(worker + i) % numWorkers];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tiles.empty()) {
+      tile = victim.tiles.back();
+      victim.tiles.pop_back();
+      stolen = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PathTracer::PrepareLights(const Scene *scene,
+                               const glm::mat4x4 &rootTransform) {
+  // Light positions and directions are in model space, like in the shader.
+  lights = PassLights();
+  const glm::mat3x3 rootNormal =
+      glm::transpose(glm::inverse(glm::mat3x3(rootTransform)));
+  for (const DirectionalLight *light : scene->dirLights) {
+    lights.dirLightDirs.push_back(
+        glm::normalize(rootNormal * -light->GetDirection()));
+  }
+  for (const PointLight *light : scene->pointLights) {
+    lights.pointLightPositions.push_back(
+        glm::vec3(rootTransform * glm::vec4(light->GetPosition(), 1.0f)));
+  }
+  for (const SpotLight *light : scene->spotLights) {
+    lights.spotLightPositions.push_back(
+        glm::vec3(rootTransform * glm::vec4(light->GetPosition(), 1.0f)));
+    lights.spotLightDirs.push_back(
+        glm::normalize(glm::mat3x3(rootTransform) * light->GetDirection()));
+  }
+  for (const AreaLight *light : scene->areaLights) {
+    // Same rectangle the shader places its samples on. The shader's frame
+    // breaks down for lights facing straight up or down, so those use x as
+    // the reference axis instead.
+    glm::vec3 lightDir = glm::normalize(light->GetDirection());
+    glm::vec3 reference = std::abs(lightDir.y) > 0.999f
+                              ? glm::vec3(1.0f, 0.0f, 0.0f)
+                              : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::vec3 right = glm::normalize(glm::cross(lightDir, reference));
+    glm::vec3 up = glm::normalize(glm::cross(right, lightDir));
+    glm::vec3 edgeU =
+        glm::mat3x3(rootTransform) * (light->GetWidth() * right);
+    glm::vec3 edgeV = glm::mat3x3(rootTransform) * (light->GetHeight() * up);
+    glm::vec3 center =
+        glm::vec3(rootTransform * glm::vec4(light->GetPosition(), 1.0f));
+    glm::vec3 normal = glm::cross(edgeU, edgeV);
+    float area = glm::length(normal);
+    normal = area > 0.0f ? normal / area : glm::vec3(0.0f);
+    if (glm::dot(normal, rootNormal * lightDir) < 0.0f) {
+      normal = -normal;
+    }
+    lights.areaCorners.push_back(center - 0.5f * edgeU - 0.5f * edgeV);
+    lights.areaEdgesU.push_back(edgeU);
+    lights.areaEdgesV.push_back(edgeV);
+    lights.areaNormals.push_back(normal);
+    // A light of unit area at unit distance gives the same irradiance as a
+    // point light of the same intensity.
+    lights.areaRadiance.push_back(
+        area > 0.0f ? light->GetIntensity() * kPi / area : glm::vec3(0.0f));
+  }
+}
+
+void PathTracer::RenderTile(const int tile, const Scene *scene,
+                            const glm::mat4x4 &invViewProj,
+                            long long &rays) {
+  const int tileX = (tile % tilesX) * kTileSize;
+  const int tileY = (tile / tilesX) * kTileSize;
+  const int tileX1 = std::min(tileX + kTileSize, width);
+  const int tileY1 = std::min(tileY + kTileSize, height);
+  const uint32_t sampleSeed = PcgHash((uint32_t)stats.samples);
+  const SceneBVH &bvh = scene->GetBVH();
+
+  for (int y = tileY; y < tileY1; y++) {
+    for (int x0 = tileX; x0 < tileX1; x0 += 8) {
+      // Jittered camera rays of 8 neighbouring pixels; the tail of a row
+      // narrower than the tile stays inactive.
+      RayPacket8 packet;
+      Ray cameraRays[8];
+      uint32_t rng[8];
+      for (int lane = 0; lane < 8; lane++) {
+        const int x = x0 + lane;
+        if (x >= tileX1) {
+          packet.tMax[lane] = 0.0f;
+          continue;
+        }
+        rng[lane] = PcgHash((uint32_t)(y * width + x) ^ sampleSeed);
+        float jx = NextRandom(rng[lane]);
+        float jy = NextRandom(rng[lane]);
+        glm::vec2 ndc(2.0f * (x + jx) / width - 1.0f,
+                      1.0f - 2.0f * (y + jy) / height);
+        glm::vec4 nearPoint = invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+        glm::vec4 farPoint = invViewProj * glm::vec4(ndc, 1.0f, 1.0f);
+        glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+        cameraRays[lane] =
+            Ray(origin, glm::vec3(farPoint) / farPoint.w - origin, 1.0f);
+        packet.Set(lane, cameraRays[lane]);
+        rays++;
+      }
+      PacketHit8 packetHit;
+      bvh.IntersectPacket(packet, packetHit);
+
+      for (int lane = 0; lane < 8 && x0 + lane < tileX1; lane++) {
+        RayHit hit;
+        hit.object = packetHit.object[lane];
+        hit.subMesh = packetHit.subMesh[lane];
+        hit.triangle = packetHit.triangle[lane];
+        hit.t = packetHit.t[lane];
+        hit.barycentric = glm::vec2(packetHit.u[lane], packetHit.v[lane]);
+        glm::vec3 radiance =
+            TracePath(cameraRays[lane], hit, scene, rng[lane], rays);
+        // A rare NaN would poison the pixel for good.
+        if (!std::isfinite(radiance.r + radiance.g + radiance.b)) {
+          radiance = glm::vec3(0.0f);
+        }
+        accum[(size_t)y * width + x0 + lane] += radiance;
+      }
+    }
+  }
+}
+
+glm::vec3 PathTracer::TracePath(Ray ray, RayHit hit, const Scene *scene,
+                                uint32_t &rng, long long &rays) const {
+  glm::vec3 radiance(0.0f);
+  glm::vec3 throughput(1.0f);
+  for (int bounce = 0;; bounce++) {
+    const bool found = hit.IsValid();
+    // Emitters are only hit by camera rays; bounces reach them through the
+    // light samples instead.
+    if (bounce == 0) {
+      glm::vec3 emitted;
+      if (HitAreaLight(ray, found ? hit.t : ray.tMax, emitted)) {
+        radiance += emitted;
+        break;
+      }
+    }
+    if (!found) {
+      if (bounce == 0) {
+        radiance += settings.clearColor;
+      } else if (settings.ambientSky) {
+        radiance += throughput * scene->ambientLight;
+      }
+      break;
+    }
+
+    const SurfacePoint sp = scene->GetSurfacePoint(ray, hit);
+    const SurfaceSample surface = PhongMaterial::Sample(sp.material, sp.uv);
+    const glm::vec3 wo = -glm::normalize(ray.direction);
+    radiance += throughput * SampleLights(sp, surface, wo, scene, rng, rays);
+    if (bounce >= settings.maxBounces) {
+      break;
+    }
+
+    // Pick the diffuse or the specular lobe by their weight, then sample
+    // it; the estimate is divided by the pick probability.
+    const float diffuseWeight = Luminance(surface.Kd);
+    const float specularWeight = Luminance(surface.Ks);
+    if (diffuseWeight + specularWeight <= 0.0f) {
+      break;
+    }
+    const float pickSpecular =
+        specularWeight / (diffuseWeight + specularWeight);
+    const float exponent = glm::max(surface.Ns, 0.0f);
+    glm::vec3 wi;
+    glm::vec3 weight;
+    if (NextRandom(rng) < pickSpecular) {
+      if (settings.blinnPhong) {
+        glm::vec3 h = SamplePowerCosine(sp.normal, exponent, NextRandom(rng),
+                                        NextRandom(rng));
+        wi = glm::reflect(-wo, h);
+        float cosI = glm::dot(sp.normal, wi);
+        float woDotH = glm::dot(wo, h);
+        if (cosI <= 0.0f || woDotH <= 0.0f) {
+          break;
+        }
+        weight = surface.Ks * ((exponent + 8.0f) * cosI * woDotH /
+                               (exponent + 1.0f));
+      } else {
+        glm::vec3 r = glm::reflect(-wo, sp.normal);
+        wi = SamplePowerCosine(r, exponent, NextRandom(rng), NextRandom(rng));
+        float cosI = glm::dot(sp.normal, wi);
+        if (cosI <= 0.0f) {
+          break;
+        }
+        weight = surface.Ks * ((exponent + 2.0f) * cosI / (exponent + 1.0f));
+      }
+      weight /= pickSpecular;
+    } else {
+      wi = SamplePowerCosine(sp.normal, 1.0f, NextRandom(rng), NextRandom(rng));
+      weight = surface.Kd / (1.0f - pickSpecular);
+    }
+    throughput *= weight;
+
+    if (bounce + 1 >= kMinBouncesBeforeRoulette) {
+      float survive =
+          glm::min(glm::max(throughput.r, glm::max(throughput.g, throughput.b)),
+                   0.95f);
+      if (NextRandom(rng) >= survive) {
+        break;
+      }
+      throughput /= survive;
+    }
+
+    ray = Ray(OffsetRayOrigin(sp.position, sp.geometricNormal, wi), wi);
+    hit = RayHit();
+    scene->RayCast(ray, hit);
+    rays++;
+  }
+  return radiance;
+}
+
+glm::vec3 PathTracer::EvaluateBrdf(const SurfaceSample &surface,
+                                   const glm::vec3 &n, const glm::vec3 &wo,
+                                   const glm::vec3 &wi) const {
+  glm::vec3 f = surface.Kd / kPi;
+  const float exponent = glm::max(surface.Ns, 0.0f);
+  if (settings.blinnPhong) {
+    glm::vec3 h = glm::normalize(wi + wo);
+    f += surface.Ks * ((exponent + 8.0f) / (8.0f * kPi) *
+                       std::pow(glm::max(glm::dot(n, h), 0.0f), exponent));
+  } else {
+    glm::vec3 r = glm::reflect(-wi, n);
+    f += surface.Ks * ((exponent + 2.0f) / (2.0f * kPi) *
+                       std::pow(glm::max(glm::dot(wo, r), 0.0f), exponent));
+  }
+  return f;
+}
+
+glm::vec3 PathTracer::SampleLights(const SurfacePoint &sp,
+                                   const SurfaceSample &surface,
+                                   const glm::vec3 &wo, const Scene *scene,
+                                   uint32_t &rng, long long &rays) const {
+  glm::vec3 result(0.0f);
+  // Delta lights: the shader's I * cos becomes BRDF * (pi * I) * cos, which
+  // is the same for a white Lambertian surface.
+  auto addDeltaLight = [&](const glm::vec3 &wi, const float distance,
+                           const glm::vec3 &intensity) {
+    float cosI = glm::dot(sp.normal, wi);
+    if (cosI <= 0.0f || intensity == glm::vec3(0.0f)) {
+      return;
+    }
+    Ray shadowRay(OffsetRayOrigin(sp.position, sp.geometricNormal, wi), wi,
+                  distance);
+    rays++;
+    if (scene->IsOccluded(shadowRay)) {
+      return;
+    }
+    result += EvaluateBrdf(surface, sp.normal, wo, wi) * intensity *
+              (kPi * cosI);
+  };
+
+  for (size_t i = 0; i < scene->dirLights.size(); i++) {
+    addDeltaLight(lights.dirLightDirs[i],
+                  std::numeric_limits<float>::infinity(),
+                  scene->dirLights[i]->GetIntensity());
+  }
+  for (size_t i = 0; i < scene->pointLights.size(); i++) {
+    const PointLight *light = scene->pointLights[i];
+    glm::vec3 toLight = lights.pointLightPositions[i] - sp.position;
+    float distance = glm::length(toLight);
+    addDeltaLight(toLight / distance, distance,
+                  light->GetIntensity() * light->GetAttenuation(distance));
+  }
+  for (size_t i = 0; i < scene->spotLights.size(); i++) {
+    const SpotLight *light = scene->spotLights[i];
+    glm::vec3 toLight = lights.spotLightPositions[i] - sp.position;
+    float distance = glm::length(toLight);
+    glm::vec3 lightDir = toLight / distance;
+    // Same cone test as the shader.
+    float cosTheta = glm::dot(lightDir, lights.spotLightDirs[i]);
+    float cosEpsilon = light->GetCosCutoffStart() - light->GetCosCutoffEnd();
+    float factor = glm::clamp(
+        (cosTheta - light->GetCosCutoffEnd()) / cosEpsilon, 0.0f, 1.0f);
+    addDeltaLight(lightDir, distance,
+                  factor * light->GetIntensity() *
+                      light->GetAttenuation(distance));
+  }
+
+  // One uniform point on each area light.
+  for (size_t i = 0; i < lights.areaCorners.size(); i++) {
+    const glm::vec3 &edgeU = lights.areaEdgesU[i];
+    const glm::vec3 &edgeV = lights.areaEdgesV[i];
+    glm::vec3 lightPoint = lights.areaCorners[i] + NextRandom(rng) * edgeU +
+                           NextRandom(rng) * edgeV;
+    glm::vec3 toLight = lightPoint - sp.position;
+    float distanceSquared = glm::dot(toLight, toLight);
+    float distance = std::sqrt(distanceSquared);
+    glm::vec3 wi = toLight / distance;
+    float cosI = glm::dot(sp.normal, wi);
+    float cosL = -glm::dot(lights.areaNormals[i], wi);
+    if (cosI <= 0.0f || cosL <= 0.0f) {
+      continue;
+    }
+    Ray shadowRay(OffsetRayOrigin(sp.position, sp.geometricNormal, wi), wi,
+                  distance * (1.0f - 1e-4f));
+    rays++;
+    if (scene->IsOccluded(shadowRay)) {
+      continue;
+    }
+    float area = glm::length(glm::cross(edgeU, edgeV));
+    result += EvaluateBrdf(surface, sp.normal, wo, wi) *
+              lights.areaRadiance[i] *
+              (cosI * cosL * area / distanceSquared);
+  }
+  return result;
+}
+
+bool PathTracer::HitAreaLight(const Ray &ray, const float tMax,
+                              glm::vec3 &emitted) const {
+  float closest = tMax;
+  bool found = false;
+  for (size_t i = 0; i < lights.areaCorners.size(); i++) {
+    const glm::vec3 &normal = lights.areaNormals[i];
+    float denom = glm::dot(normal, ray.direction);
+    // One-sided: only the front face emits.
+    if (denom >= 0.0f) {
+      continue;
+    }
+    float t = glm::dot(lights.areaCorners[i] - ray.origin, normal) / denom;
+    if (t <= 0.0f || t >= closest) {
+      continue;
+    }
+    glm::vec3 d = ray.origin + t * ray.direction - lights.areaCorners[i];
+    const glm::vec3 &edgeU = lights.areaEdgesU[i];
+    const glm::vec3 &edgeV = lights.areaEdgesV[i];
+    float s = glm::dot(d, edgeU) / glm::dot(edgeU, edgeU);
+    float r = glm::dot(d, edgeV) / glm::dot(edgeV, edgeV);
+    if (s < 0.0f || s > 1.0f || r < 0.0f || r > 1.0f) {
+      continue;
+    }
+    closest = t;
+    emitted = lights.areaRadiance[i];
+    found = true;
+  }
+  return found;
+}
+
+bool PathTracer::SaveImage(const std::string &filePath) const {
+  const float invSamples = stats.samples > 0 ? 1.0f / stats.samples : 0.0f;
+  std::string extension = filePath.size() >= 4
+                              ? filePath.substr(filePath.size() - 4)
+                              : std::string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return (char)std::tolower(c); });
+
+  const bool isFloat = extension == ".exr";
+  cv::Mat image(height, width, isFloat ? CV_32FC3 : CV_8UC3);
+  if (isFloat) {
+    for (int y = 0; y < height; y++) {
+      float *row = image.ptr<float>(y);
+      for (int x = 0; x < width; x++) {
+        glm::vec3 c = accum[(size_t)y * width + x] * invSamples;
+        row[x * 3 + 0] = c.b;
+        row[x * 3 + 1] = c.g;
+        row[x * 3 + 2] = c.r;
+      }
+    }
+  } else {
+    for (int y = 0; y < height; y++) {
+      unsigned char *row = image.ptr<unsigned char>(y);
+      for (int x = 0; x < width; x++) {
+        glm::vec3 c = glm::clamp(accum[(size_t)y * width + x] * invSamples,
+                                 glm::vec3(0.0f), glm::vec3(1.0f));
+        row[x * 3 + 0] = (unsigned char)(c.b * 255.0f + 0.5f);
+        row[x * 3 + 1] = (unsigned char)(c.g * 255.0f + 0.5f);
+        row[x * 3 + 2] = (unsigned char)(c.r * 255.0f + 0.5f);
+      }
+    }
+  }
+  if (!cv::imwrite(filePath, image)) {
+    std::cerr << "[ERROR] Failed to write " << filePath << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void PathTracer::Resolve(std::vector<unsigned char> &rgba) const {
+  const float invSamples = stats.samples > 0 ? 1.0f / stats.samples : 0.0f;
+  rgba.resize((size_t)width * height * 4);
+  ThreadPool::Get().ParallelFor(height, 16, [&](const int begin,
+                                                const int end) {
+    for (int y = begin; y < end; y++) {
+      for (int x = 0; x < width; x++) {
+        const size_t i = (size_t)y * width + x;
+        glm::vec3 c = glm::clamp(accum[i] * invSamples, glm::vec3(0.0f),
+                                 glm::vec3(1.0f));
+        rgba[i * 4 + 0] = (unsigned char)(c.r * 255.0f + 0.5f);
+        rgba[i * 4 + 1] = (unsigned char)(c.g * 255.0f + 0.5f);
+        rgba[i * 4 + 2] = (unsigned char)(c.b * 255.0f + 0.5f);
+        rgba[i * 4 + 3] = 255;
+      }
+    }
+  });
+}
+
+int PathTracer::RunHeadless(const HeadlessOptions &options, Scene *scene,
+                            const glm::mat4x4 &rootTransform,
+                            const PathTracerSettings &settings) {
+  scene->UpdateBVH(rootTransform);
+  PathTracer tracer(options.width, options.height);
+  tracer.GetSettings() = settings;
+  for (int i = 0; i < options.jobs.pathTraceSamples; i++) {
+    tracer.RenderPass(scene, scene->camera, rootTransform);
+  }
+  if (!tracer.SaveImage(options.jobs.pathTraceImagePath)) {
+    return 1;
+  }
+
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  const PathTracerStats &stats = tracer.GetStats();
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("image", options.jobs.pathTraceImagePath);
+  json.Field("width", options.width);
+  json.Field("height", options.height);
+  json.Field("simd", float8::Name());
+  json.Field("threads", stats.threads);
+  json.Field("samples", stats.samples);
+  json.Field("maxBounces", settings.maxBounces);
+  json.Field("rays", stats.totalRays);
+  json.Field("totalMs", stats.totalMs);
+  json.Field("raysPerSec",
+             stats.totalMs > 0.0 ? stats.totalRays / (stats.totalMs * 1e-3)
+                                 : 0.0);
+  json.Field("lastPassTilesStolen", stats.tilesStolen);
+  json.EndObject();
+  file << std::endl;
+  return 0;
+}
@@ -0,0 +1,135 @@
+#ifndef PATH_TRACER_H
+#define PATH_TRACER_H
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#include "bvh.h"
+#include "camera.h"
+#include "headers.h"
+#include "material.h"
+#include "scene.h"
+
+struct HeadlessOptions;
+
+struct PathTracerSettings {
+  // Surface interactions after the camera hit; 0 is direct light only.
+  int maxBounces = 4;
+  bool blinnPhong = true;
+  // Bounce rays that leave the scene pick up Scene::ambientLight.
+  bool ambientSky = true;
+  // Seen by camera rays that miss everything.
+  glm::vec3 clearColor = glm::vec3(0.44f, 0.57f, 0.75f);
+};
+
+struct PathTracerStats {
+  // Passes accumulated since the last Reset (one sample per pixel each).
+  int samples = 0;
+  int threads = 0;
+  double lastPassMs = 0.0;
+  // Camera, bounce and shadow rays of the last pass.
+  long long lastPassRays = 0;
+  double raysPerSec = 0.0;
+  // Tiles a worker took from another worker's queue in the last pass.
+  int tilesStolen = 0;
+  double totalMs = 0.0;
+  long long totalRays = 0;
+};
+
+// PathTracer Declarations.
+// Progressive CPU path tracer over the scene BVH. Each RenderPass adds one
+// sample per pixel: 16x16 tiles are spread over per-thread queues and idle
+// threads steal from the back of the others. Camera rays are traced in
+// 8-ray packets, bounces and shadow rays one at a time.
+//
+// Surfaces use the Phong material inputs of phong_shading_demo.fs with a
+// Lambertian plus normalized (Blinn-)Phong BRDF. Point, spot and directional
+// lights keep the shader's intensity and falloff, so the direct diffuse term
+// matches the rasterizer. Area lights are one-sided emitting rectangles with
+// inverse-square falloff and are sampled explicitly at every bounce; their
+// surface is only visible to camera rays.
+class PathTracer {
+ public:
+  // PathTracer Public Methods.
+  PathTracer(const int width, const int height);
+
+  // Drops the accumulated samples, e.g. after the camera moved.
+  void Reset();
+  // Scene::UpdateBVH(rootTransform) must have been called.
+  void RenderPass(const Scene *scene, const Camera *camera,
+                  const glm::mat4x4 &rootTransform);
+
+  // Average of all passes. Writes linear float RGB for .exr files and
+  // clamped 8-bit RGB otherwise.
+  bool SaveImage(const std::string &filePath) const;
+
+  // Path traces the scene at the options' size and sample count to
+  // options.pathTraceImagePath and writes the rays per second to the report.
+  static int RunHeadless(const HeadlessOptions &options, Scene *scene,
+                         const glm::mat4x4 &rootTransform,
+                         const PathTracerSettings &settings);
+  // RGBA8, top row first, for display.
+  void Resolve(std::vector<unsigned char> &rgba) const;
+
+  PathTracerSettings &GetSettings() { return settings; }
+  const PathTracerStats &GetStats() const { return stats; }
+  int GetWidth() const { return width; }
+  int GetHeight() const { return height; }
+
+  static const int kTileSize = 16;
+
+ private:
+  // Lights moved into the space of the BVH (rootTransform applied).
+  struct PassLights {
+    std::vector<glm::vec3> dirLightDirs;
+    std::vector<glm::vec3> pointLightPositions;
+    std::vector<glm::vec3> spotLightPositions;
+    std::vector<glm::vec3> spotLightDirs;
+    // Area light rectangles: corner, the two edges, the unit normal, and
+    // the emitted radiance.
+    std::vector<glm::vec3> areaCorners;
+    std::vector<glm::vec3> areaEdgesU;
+    std::vector<glm::vec3> areaEdgesV;
+    std::vector<glm::vec3> areaNormals;
+    std::vector<glm::vec3> areaRadiance;
+  };
+
+  struct TileQueue {
+    std::mutex mutex;
+    std::deque<int> tiles;
+  };
+
+  // PathTracer Private Methods.
+  void PrepareLights(const Scene *scene, const glm::mat4x4 &rootTransform);
+  bool NextTile(std::vector<TileQueue> &queues, const int worker, int &tile,
+                bool &stolen) const;
+  void RenderTile(const int tile, const Scene *scene,
+                  const glm::mat4x4 &invViewProj, long long &rays);
+  glm::vec3 TracePath(Ray ray, RayHit hit, const Scene *scene,
+                      uint32_t &rng, long long &rays) const;
+  // Light arriving from all lights, times the BRDF and cosine.
+  glm::vec3 SampleLights(const SurfacePoint &sp, const SurfaceSample &surface,
+                         const glm::vec3 &wo, const Scene *scene,
+                         uint32_t &rng, long long &rays) const;
+  glm::vec3 EvaluateBrdf(const SurfaceSample &surface, const glm::vec3 &n,
+                         const glm::vec3 &wo, const glm::vec3 &wi) const;
+  // Emission of the closest area light in front of the hit (camera rays).
+  bool HitAreaLight(const Ray &ray, const float tMax,
+                    glm::vec3 &emitted) const;
+
+  // PathTracer Private Data.
+  int width;
+  int height;
+  int tilesX;
+  int tilesY;
+  PathTracerSettings settings;
+  PathTracerStats stats;
+
+  PassLights lights;
+
+  // Sum of all samples, top row first.
+  std::vector<glm::vec3> accum;
+};
+
+#endif
@@ -0,0 +1,358 @@
+#include "probe_grid.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "headless.h"
+#include "json_writer.h"
+#include "material.h"
+#include "profiler.h"
+#include "sampling.h"
+#include "thread_pool.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+namespace {
+
+using BakeClock = std::chrono::steady_clock;
+
+// Point i of n on a spherical Fibonacci spiral; evenly spread over the
+// sphere without clumping at the poles.
+glm::vec3 FibonacciDirection(const int i, const int n) {
+  const float goldenAngle = 2.39996323f;
+  float z = 1.0f - (2.0f * (float)i + 1.0f) / (float)n;
+  float r = std::sqrt(glm::max(0.0f, 1.0f - z * z));
+  float phi = goldenAngle * (float)i;
+  return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Grows the box [boxMin, boxMax] to the box around its corners moved by m.
+void TransformBox(const glm::mat4x4 &m, glm::vec3 &boxMin,
+                  glm::vec3 &boxMax) {
+  const glm::vec3 localMin = boxMin;
+  const glm::vec3 localMax = boxMax;
+  boxMin = glm::vec3(std::numeric_limits<float>::max());
+  boxMax = glm::vec3(-std::numeric_limits<float>::max());
+  for (int corner = 0; corner < 8; corner++) {
+    glm::vec3 p((corner & 1) ? localMax.x : localMin.x,
+                (corner & 2) ? localMax.y : localMin.y,
+                (corner & 4) ? localMax.z : localMin.z);
+    p = glm::vec3(m * glm::vec4(p, 1.0f));
+    boxMin = glm::min(boxMin, p);
+    boxMax = glm::max(boxMax, p);
+  }
+}
+
+}  // namespace
+
+ProbeGrid::ProbeGrid(const ProbeGridSettings &settings)
+    : settings(settings),
+      resolution(0),
+      boundsMin(0.0f),
+      boundsMax(0.0f),
+      textureObj(0),
+      uploadPending(false) {}
+
+ProbeGrid::~ProbeGrid() {
+  if (textureObj != 0) {
+    glDeleteTextures(1, &textureObj);
+  }
+}
+
+void ProbeGrid::Bake(Scene *scene) {
+  PROFILE_SCOPE("Probe Grid Bake");
+  scene->UpdateBVH(glm::mat4x4(1.0f));
+
+  // Fit the grid to all objects.
+  boundsMin = glm::vec3(std::numeric_limits<float>::max());
+  boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+  for (size_t o = 0; o < scene->objects.size(); o++) {
+    const MeshBVH *bvh = scene->objects[o].mesh->GetBVH();
+    glm::vec3 meshMin = bvh->GetBoundsMin();
+    glm::vec3 meshMax = bvh->GetBoundsMax();
+    TransformBox(scene->bvhWorldMatrices[o], meshMin, meshMax);
+    boundsMin = glm::min(boundsMin, meshMin);
+    boundsMax = glm::max(boundsMax, meshMax);
+  }
+  if (scene->objects.empty()) {
+    boundsMin = glm::vec3(-1.0f);
+    boundsMax = glm::vec3(1.0f);
+  }
+  // Keep flat scenes from collapsing an axis.
+  glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+  glm::vec3 halfExtent = glm::max(0.5f * (boundsMax - boundsMin),
+                                  glm::vec3(1e-3f));
+  boundsMin = center - halfExtent;
+  boundsMax = center + halfExtent;
+
+  resolution = glm::max(settings.resolution, glm::ivec3(1));
+  const int numProbes = resolution.x * resolution.y * resolution.z;
+  probes.assign(numProbes, SH9());
+  valid.assign(numProbes, 1);
+  dirty.assign(numProbes, 0);
+  std::vector<int> all(numProbes);
+  for (int i = 0; i < numProbes; i++) all[i] = i;
+  BakeProbes(scene, all);
+}
+
+void ProbeGrid::MarkDirty(const glm::vec3 &changedMin,
+                          const glm::vec3 &changedMax) {
+  if (probes.empty()) {
+    return;
+  }
+  glm::vec3 cell = (boundsMax - boundsMin) / glm::vec3(resolution);
+  glm::vec3 margin = settings.dirtyRadiusCells * cell;
+  glm::vec3 lo = changedMin - margin;
+  glm::vec3 hi = changedMax + margin;
+  for (int i = 0; i < (int)probes.size(); i++) {
+    glm::vec3 p = GetProbePosition(i);
+    if (glm::all(glm::greaterThanEqual(p, lo)) &&
+        glm::all(glm::lessThanEqual(p, hi))) {
+      dirty[i] = 1;
+    }
+  }
+}
+
+void ProbeGrid::MarkAllDirty() {
+  std::fill(dirty.begin(), dirty.end(), 1);
+}
+
+int ProbeGrid::GetNumDirty() const {
+  int count = 0;
+  for (const unsigned char d : dirty) count += d;
+  return count;
+}
+
+int ProbeGrid::BakeDirty(Scene *scene) {
+  std::vector<int> list;
+  for (int i = 0; i < (int)dirty.size(); i++) {
+    if (dirty[i]) list.push_back(i);
+  }
+  if (list.empty()) {
+    return 0;
+  }
+  PROFILE_SCOPE("Probe Grid Re-bake");
+  scene->UpdateBVH(glm::mat4x4(1.0f));
+  BakeProbes(scene, list);
+  return (int)list.size();
+}
+
+glm::vec3 ProbeGrid::GetProbePosition(const int probe) const {
+  glm::ivec3 cell(probe % resolution.x,
+                  (probe / resolution.x) % resolution.y,
+                  probe / (resolution.x * resolution.y));
+  // Probes sit at the cell centers, which are the texel centers.
+  return boundsMin + (glm::vec3(cell) + 0.5f) / glm::vec3(resolution) *
+                         (boundsMax - boundsMin);
+}
+
+void ProbeGrid::BakeProbes(Scene *scene, const std::vector<int> &list) {
+  BakeClock::time_point start = BakeClock::now();
+  lights.Prepare(scene);
+  std::atomic<long long> totalRays(0);
+  std::atomic<int> invalid(0);
+  ThreadPool::Get().ParallelFor(
+      (int)list.size(), 1, [&](const int begin, const int end) {
+        long long localRays = 0;
+        for (int i = begin; i < end; i++) {
+          const int probe = list[i];
+          bool probeValid = true;
+          probes[probe] = BakeProbe(scene, GetProbePosition(probe),
+                                    probeValid, localRays);
+          valid[probe] = probeValid;
+          dirty[probe] = 0;
+          if (!probeValid) invalid++;
+        }
+        totalRays += localRays;
+      });
+  FillInvalidProbes();
+  uploadPending = true;
+
+  stats.probes = (int)probes.size();
+  stats.probesBaked = (int)list.size();
+  stats.probesInvalid = invalid.load();
+  stats.rays = totalRays.load();
+  stats.bakeMs = MsSince(start);
+  stats.threads = ThreadPool::Get().GetConcurrency();
+}
+
+SH9 ProbeGrid::BakeProbe(const Scene *scene, const glm::vec3 &position,
+                         bool &probeValid, long long &rays) const {
+  const int numRays = glm::max(settings.raysPerProbe, 1);
+  // Uniform sphere samples: each carries 4 pi / n of solid angle.
+  const float weight = 4.0f * glm::pi<float>() / (float)numRays;
+  SH9 sh;
+  int backFaces = 0;
+  for (int r = 0; r < numRays; r++) {
+    glm::vec3 dir = FibonacciDirection(r, numRays);
+    Ray ray(position, dir);
+    RayHit hit;
+    rays++;
+    glm::vec3 radiance = scene->ambientLight;
+    if (scene->RayCast(ray, hit)) {
+      SurfacePoint sp = scene->GetSurfacePoint(ray, hit);
+      if (!sp.frontFace) {
+        backFaces++;
+        continue;
+      }
+      SurfaceSample surface = PhongMaterial::Sample(sp.material, sp.uv);
+      radiance = surface.Ka * scene->ambientLight +
+                 surface.Kd * lights.DirectLight(scene, hit.object,
+                                                 sp.position, sp.normal,
+                                                 sp.geometricNormal, rays);
+    }
+    AddSHSample(sh, dir, radiance, weight);
+  }
+  probeValid = backFaces <= settings.maxBackFaceRatio * numRays;
+  ConvolveSHCosine(sh);
+  return sh;
+}
+
+void ProbeGrid::FillInvalidProbes() {
+  std::vector<unsigned char> filled = valid;
+  const glm::ivec3 steps[6] = {glm::ivec3(1, 0, 0),  glm::ivec3(-1, 0, 0),
+                               glm::ivec3(0, 1, 0),  glm::ivec3(0, -1, 0),
+                               glm::ivec3(0, 0, 1),  glm::ivec3(0, 0, -1)};
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    std::vector<unsigned char> next = filled;
+    for (int i = 0; i < (int)probes.size(); i++) {
+      if (filled[i]) continue;
+      glm::ivec3 cell(i % resolution.x, (i / resolution.x) % resolution.y,
+                      i / (resolution.x * resolution.y));
+      SH9 sum;
+      int count = 0;
+      for (const glm::ivec3 &step : steps) {
+        glm::ivec3 n = cell + step;
+        if (glm::any(glm::lessThan(n, glm::ivec3(0))) ||
+            glm::any(glm::greaterThanEqual(n, resolution))) {
+          continue;
+        }
+        int j = (n.z * resolution.y + n.y) * resolution.x + n.x;
+        if (!filled[j]) continue;
+        for (int c = 0; c < 9; c++) sum.c[c] += probes[j].c[c];
+        count++;
+      }
+      if (count > 0) {
+        for (int c = 0; c < 9; c++) probes[i].c[c] = sum.c[c] / (float)count;
+        next[i] = 1;
+        changed = true;
+      }
+    }
+    filled.swap(next);
+  }
+}
+
+void ProbeGrid::Upload() {
+  if (probes.empty()) {
+    return;
+  }
+  // Coefficient c of probe (x, y, z) goes to texel (c * resX + x, y, z).
+  const int width = 9 * resolution.x;
+  std::vector<glm::vec3> texels((size_t)width * resolution.y * resolution.z);
+  for (int i = 0; i < (int)probes.size(); i++) {
+    int x = i % resolution.x;
+    int row = i / resolution.x;
+    for (int c = 0; c < 9; c++) {
+      texels[(size_t)row * width + c * resolution.x + x] = probes[i].c[c];
+    }
+  }
+  if (textureObj == 0) {
+    glGenTextures(1, &textureObj);
+  }
+  glBindTexture(GL_TEXTURE_3D, textureObj);
+  glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, width, resolution.y,
+               resolution.z, 0, GL_RGB, GL_FLOAT, texels.data());
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_3D, 0);
+  uploadPending = false;
+}
+
+void ProbeGrid::Bind(GLenum textureUnit) {
+  glActiveTexture(textureUnit);
+  glBindTexture(GL_TEXTURE_3D, textureObj);
+}
+
+glm::vec3 ProbeGrid::Evaluate(const glm::vec3 &position,
+                              const glm::vec3 &normal) const {
+  if (probes.empty()) {
+    return glm::vec3(0.0f);
+  }
+  glm::vec3 g = (position - boundsMin) / (boundsMax - boundsMin) *
+                    glm::vec3(resolution) -
+                0.5f;
+  g = glm::clamp(g, glm::vec3(0.0f), glm::vec3(resolution - 1));
+  glm::ivec3 c0 = glm::ivec3(glm::floor(g));
+  glm::ivec3 c1 = glm::min(c0 + 1, resolution - 1);
+  glm::vec3 f = g - glm::vec3(c0);
+  SH9 sh;
+  for (int corner = 0; corner < 8; corner++) {
+    glm::ivec3 c((corner & 1) ? c1.x : c0.x, (corner & 2) ? c1.y : c0.y,
+                 (corner & 4) ? c1.z : c0.z);
+    float w = ((corner & 1) ? f.x : 1.0f - f.x) *
+              ((corner & 2) ? f.y : 1.0f - f.y) *
+              ((corner & 4) ? f.z : 1.0f - f.z);
+    const SH9 &probe =
+        probes[(c.z * resolution.y + c.y) * resolution.x + c.x];
+    for (int i = 0; i < 9; i++) sh.c[i] += probe.c[i] * w;
+  }
+  return glm::max(EvaluateSH(sh, normal), glm::vec3(0.0f));
+}
+
+glm::mat4x4 ProbeGrid::GetGridMatrix() const {
+  glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+  return glm::scale(glm::mat4x4(1.0f), 1.0f / extent) *
+         glm::translate(glm::mat4x4(1.0f), -boundsMin);
+}
+
+int ProbeGrid::RunHeadless(const HeadlessOptions &options, Scene *scene,
+                           const ProbeGridSettings &settings) {
+  ProbeGrid grid(settings);
+  grid.Bake(scene);
+  const ProbeGridStats fullStats = grid.GetStats();
+
+  // A small edit: nudge the first object along x by a tenth of its size.
+  // The grid is baked in world space, so are the bounds and the offset.
+  SceneObject &edited = scene->objects[0];
+  const MeshBVH *bvh = edited.mesh->GetBVH();
+  glm::vec3 boundsMin = bvh->GetBoundsMin();
+  glm::vec3 boundsMax = bvh->GetBoundsMax();
+  TransformBox(edited.worldMatrix, boundsMin, boundsMax);
+  glm::vec3 offset(0.1f * (boundsMax.x - boundsMin.x), 0.0f, 0.0f);
+  grid.MarkDirty(boundsMin, boundsMax + offset);
+  edited.worldMatrix =
+      glm::translate(glm::mat4x4(1.0f), offset) * edited.worldMatrix;
+  scene->transforms.MarkDirty(0);
+  grid.BakeDirty(scene);
+  const ProbeGridStats &dirtyStats = grid.GetStats();
+
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  const glm::ivec3 res = grid.GetResolution();
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("resolution", std::to_string(res.x) + "x" +
+                               std::to_string(res.y) + "x" +
+                               std::to_string(res.z));
+  json.Field("raysPerProbe", settings.raysPerProbe);
+  json.Field("threads", fullStats.threads);
+  json.Field("probes", fullStats.probes);
+  json.Field("probesInvalid", fullStats.probesInvalid);
+  json.Field("rays", fullStats.rays);
+  json.Field("bakeMs", fullStats.bakeMs);
+  json.Field("rebakeProbes", dirtyStats.probesBaked);
+  json.Field("rebakeMs", dirtyStats.bakeMs);
+  json.EndObject();
+  file << std::endl;
+  return 0;
+}
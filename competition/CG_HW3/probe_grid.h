@@ -0,0 +1,107 @@
+#ifndef PROBE_GRID_H
+#define PROBE_GRID_H
+
+#include "headers.h"
+#include "scene.h"
+#include "spherical_harmonics.h"
+#include "static_lights.h"
+
+struct HeadlessOptions;
+
+struct ProbeGridSettings {
+  // Probes along each axis of the scene bounds.
+  glm::ivec3 resolution = glm::ivec3(8, 4, 8);
+  // Rays per probe, spread evenly over the sphere.
+  int raysPerProbe = 256;
+  // An edit dirties the probes within this many cells of its bounds.
+  float dirtyRadiusCells = 2.0f;
+  // Probes that see more back faces than this (inside walls) take the
+  // light of their valid neighbours instead.
+  float maxBackFaceRatio = 0.25f;
+};
+
+struct ProbeGridStats {
+  int probes = 0;
+  // Probes of the last Bake or BakeDirty, and how many were inside
+  // geometry.
+  int probesBaked = 0;
+  int probesInvalid = 0;
+  long long rays = 0;
+  double bakeMs = 0.0;
+  int threads = 0;
+};
+
+// ProbeGrid Declarations.
+// Irradiance probes on a regular grid over the scene, for objects without
+// a lightmap. Each probe casts rays against the scene BVH; a hit returns
+// the surface's ambient and diffuse response to the static lights (see
+// StaticLights), a miss returns Scene::ambientLight. The radiance is
+// projected to L2 spherical harmonics and convolved with the cosine lobe.
+//
+// The coefficients live in one RGB16F 3D texture whose x axis holds the 9
+// coefficients side by side; the shader clamps its lookups to one block so
+// trilinear filtering never mixes coefficients. Probes are baked in the
+// space of Scene::UpdateBVH(identity), like the lightmaps.
+class ProbeGrid {
+ public:
+  // ProbeGrid Public Methods.
+  explicit ProbeGrid(const ProbeGridSettings &settings);
+  ~ProbeGrid();
+
+  // Fits the grid to the scene bounds and bakes every probe.
+  void Bake(Scene *scene);
+  // Marks the probes near a changed box (in bake space) for BakeDirty.
+  void MarkDirty(const glm::vec3 &changedMin, const glm::vec3 &changedMax);
+  void MarkAllDirty();
+  int GetNumDirty() const;
+  // Re-bakes only the dirty probes, keeping the grid; returns how many.
+  int BakeDirty(Scene *scene);
+
+  // Creates or refreshes the 3D texture after a bake.
+  void Upload();
+  void Bind(GLenum textureUnit);
+  bool IsUploaded() const { return textureObj != 0 && !uploadPending; }
+
+  // Trilinear irradiance / pi at a point, like the shader's lookup.
+  glm::vec3 Evaluate(const glm::vec3 &position,
+                     const glm::vec3 &normal) const;
+
+  // Maps bake space to [0, 1]^3 over the grid.
+  glm::mat4x4 GetGridMatrix() const;
+  glm::ivec3 GetResolution() const { return resolution; }
+  const ProbeGridStats &GetStats() const { return stats; }
+  ProbeGridSettings &GetSettings() { return settings; }
+
+  // Bakes the grid of the scene, then moves the first object and re-bakes
+  // only the probes it dirtied, and writes the timings of both to the
+  // report.
+  static int RunHeadless(const HeadlessOptions &options, Scene *scene,
+                         const ProbeGridSettings &settings);
+
+ private:
+  // ProbeGrid Private Methods.
+  glm::vec3 GetProbePosition(const int probe) const;
+  // Bakes the listed probes on all pool threads.
+  void BakeProbes(Scene *scene, const std::vector<int> &probes);
+  SH9 BakeProbe(const Scene *scene, const glm::vec3 &position,
+                bool &valid, long long &rays) const;
+  // Replaces invalid probes with the average of their valid neighbours.
+  void FillInvalidProbes();
+
+  // ProbeGrid Private Data.
+  ProbeGridSettings settings;
+  ProbeGridStats stats;
+  StaticLights lights;
+  // Resolution and bounds of the last full Bake.
+  glm::ivec3 resolution;
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
+  std::vector<SH9> probes;
+  std::vector<unsigned char> valid;
+  std::vector<unsigned char> dirty;
+
+  GLuint textureObj;
+  bool uploadPending;
+};
+
+#endif
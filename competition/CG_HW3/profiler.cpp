@@ -0,0 +1,463 @@
+#include "profiler.h"
+
+#if PROFILER_ENABLED
+
+#include <chrono>
+#include <map>
+
+#include "json_writer.h"
+
+// Track index used for the GPU in zones and traces.
+static const int kGpuThread = -1;
+
+Profiler &Profiler::Get() {
+  static Profiler profiler;
+  return profiler;
+}
+
+Profiler::Profiler() {
+  frameIndex = 0;
+  frameBeginNs = NowNs();
+  gpuTimerChecked = false;
+  hasGpuTimer = false;
+  gpuToCpuOffsetNs = 0;
+  paused = false;
+  selectedFrame = -1;
+}
+
+int64_t Profiler::NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int &Profiler::ThreadDepth() {
+  thread_local int depth = 0;
+  return depth;
+}
+
+Profiler::ThreadBuffer *Profiler::GetThreadBuffer() {
+  thread_local ThreadBuffer *buffer = nullptr;
+  if (buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    threads.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+    buffer = threads.back().get();
+    buffer->index = (int)threads.size() - 1;
+    buffer->name = "Thread " + std::to_string(buffer->index);
+  }
+  return buffer;
+}
+
+void Profiler::SetThreadName(const std::string &name) {
+  ThreadBuffer *buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(threadsMutex);
+  buffer->name = name;
+}
+
+void Profiler::RecordCpuZone(const char *name, const int64_t beginNs,
+                             const int64_t endNs, const int depth) {
+  ThreadBuffer *buffer = GetThreadBuffer();
+  uint64_t count = buffer->writeCount.load(std::memory_order_relaxed);
+  ProfileZone &zone = buffer->events[count % kRingSize];
+  zone.name = name;
+  zone.beginNs = beginNs;
+  zone.endNs = endNs;
+  zone.depth = depth;
+  zone.thread = buffer->index;
+  buffer->writeCount.store(count + 1, std::memory_order_release);
+}
+
+int Profiler::BeginGpuZone(const char *name, const int depth) {
+  if (!gpuTimerChecked) {
+    GLint bits = 0;
+    glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+    hasGpuTimer = bits > 0;
+    gpuTimerChecked = true;
+  }
+  if (!hasGpuTimer) {
+    return -1;
+  }
+
+  GpuFrame &gpuFrame = gpuFrames[frameIndex % kGpuLatency];
+  GpuZone zone;
+  zone.name = name;
+  zone.depth = depth;
+  for (GLuint *query : {&zone.beginQuery, &zone.endQuery}) {
+    if (freeQueries.empty()) {
+      GLuint ids[16];
+      glGenQueries(16, ids);
+      freeQueries.insert(freeQueries.end(), ids, ids + 16);
+    }
+    *query = freeQueries.back();
+    freeQueries.pop_back();
+  }
+  glQueryCounter(zone.beginQuery, GL_TIMESTAMP);
+  gpuFrame.frameIndex = frameIndex;
+  gpuFrame.pending = true;
+  gpuFrame.zones.push_back(zone);
+  return (int)gpuFrame.zones.size() - 1;
+}
+
+void Profiler::EndGpuZone(const int handle) {
+  if (handle < 0) {
+    return;
+  }
+  GpuFrame &gpuFrame = gpuFrames[frameIndex % kGpuLatency];
+  glQueryCounter(gpuFrame.zones[handle].endQuery, GL_TIMESTAMP);
+}
+
+void Profiler::CollectCpuZones(ProfileFrame &frame) {
+  std::lock_guard<std::mutex> lock(threadsMutex);
+  for (auto &buffer : threads) {
+    uint64_t end = buffer->writeCount.load(std::memory_order_acquire);
+    uint64_t begin = buffer->readCount;
+    // Zones older than one ring are lost if a thread records faster than we
+    // collect.
+    if (end - begin > (uint64_t)kRingSize) {
+      begin = end - kRingSize;
+    }
+    for (uint64_t i = begin; i < end; ++i) {
+      frame.cpuZones.push_back(buffer->events[i % kRingSize]);
+    }
+    buffer->readCount = end;
+  }
+}
+
+void Profiler::ResolveGpuZones(const bool wait) {
+  for (int k = 1; k <= kGpuLatency; ++k) {
+    // Oldest first; the slot of the next frame must be free before it starts.
+    GpuFrame &gpuFrame = gpuFrames[(frameIndex + k) % kGpuLatency];
+    if (!gpuFrame.pending || gpuFrame.zones.empty()) {
+      continue;
+    }
+    bool mustResolve = wait && k == 1;
+    if (!mustResolve) {
+      GLint available = 0;
+      glGetQueryObjectiv(gpuFrame.zones.back().endQuery,
+                         GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available) {
+        break;
+      }
+    }
+
+    ProfileFrame *target = nullptr;
+    for (auto &frame : history) {
+      if (frame.index == gpuFrame.frameIndex) {
+        target = &frame;
+        break;
+      }
+    }
+    for (const auto &zone : gpuFrame.zones) {
+      GLuint64 beginNs = 0, endNs = 0;
+      glGetQueryObjectui64v(zone.beginQuery, GL_QUERY_RESULT, &beginNs);
+      glGetQueryObjectui64v(zone.endQuery, GL_QUERY_RESULT, &endNs);
+      if (target != nullptr) {
+        ProfileZone resolved;
+        resolved.name = zone.name;
+        resolved.beginNs = (int64_t)beginNs - gpuToCpuOffsetNs;
+        resolved.endNs = (int64_t)endNs - gpuToCpuOffsetNs;
+        resolved.depth = zone.depth;
+        resolved.thread = kGpuThread;
+        target->gpuZones.push_back(resolved);
+      }
+      freeQueries.push_back(zone.beginQuery);
+      freeQueries.push_back(zone.endQuery);
+    }
+    if (target != nullptr) {
+      target->gpuResolved = true;
+    }
+    gpuFrame.zones.clear();
+    gpuFrame.pending = false;
+  }
+}
+
+void Profiler::EndFrame() {
+  int64_t now = NowNs();
+
+  ProfileFrame frame;
+  frame.index = frameIndex;
+  frame.beginNs = frameBeginNs;
+  frame.endNs = now;
+  // Frames without GPU zones have nothing to wait for.
+  frame.gpuResolved =
+      !hasGpuTimer || gpuFrames[frameIndex % kGpuLatency].zones.empty() ||
+      gpuFrames[frameIndex % kGpuLatency].frameIndex != frameIndex;
+  CollectCpuZones(frame);
+  if (!paused) {
+    history.push_back(std::move(frame));
+    if ((int)history.size() > kHistorySize) {
+      history.pop_front();
+    }
+  }
+
+  if (hasGpuTimer) {
+    // Re-calibrate the GPU clock against the CPU clock; it does not stall.
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    gpuToCpuOffsetNs = (int64_t)gpuNow - NowNs();
+    ResolveGpuZones(true);
+  }
+
+  frameIndex++;
+  frameBeginNs = now;
+}
+
+void Profiler::ReleaseGpuResources() {
+  for (auto &gpuFrame : gpuFrames) {
+    for (const auto &zone : gpuFrame.zones) {
+      glDeleteQueries(1, &zone.beginQuery);
+      glDeleteQueries(1, &zone.endQuery);
+    }
+    gpuFrame.zones.clear();
+    gpuFrame.pending = false;
+  }
+  if (!freeQueries.empty()) {
+    glDeleteQueries((GLsizei)freeQueries.size(), freeQueries.data());
+    freeQueries.clear();
+  }
+}
+
+bool Profiler::ExportChromeTrace(const std::string &filePath) {
+  std::ofstream file(filePath);
+  if (!file) {
+    std::cerr << "[ERROR] Failed to write trace: " << filePath << std::endl;
+    return false;
+  }
+  int64_t originNs = history.empty() ? 0 : history.front().beginNs;
+  auto toUs = [originNs](const int64_t ns) {
+    return (double)(ns - originNs) / 1000.0;
+  };
+  // The GPU gets its own track after the CPU threads.
+  int gpuTid;
+  std::vector<std::string> threadNames;
+  {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for (const auto &buffer : threads) {
+      threadNames.push_back(buffer->name);
+    }
+  }
+  gpuTid = (int)threadNames.size();
+
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Key("traceEvents");
+  json.BeginArray();
+  for (int tid = 0; tid <= gpuTid; ++tid) {
+    json.BeginObject();
+    json.Field("name", "thread_name");
+    json.Field("ph", "M");
+    json.Field("pid", 0);
+    json.Field("tid", tid);
+    json.Key("args");
+    json.BeginObject();
+    json.Field("name", tid == gpuTid ? std::string("GPU") : threadNames[tid]);
+    json.EndObject();
+    json.EndObject();
+  }
+  for (const auto &frame : history) {
+    json.BeginObject();
+    json.Field("name", "Frame " + std::to_string(frame.index));
+    json.Field("ph", "X");
+    json.Field("pid", 0);
+    json.Field("tid", 0);
+    json.Field("ts", toUs(frame.beginNs));
+    json.Field("dur", (double)(frame.endNs - frame.beginNs) / 1000.0);
+    json.EndObject();
+    for (const auto *zones : {&frame.cpuZones, &frame.gpuZones}) {
+      for (const auto &zone : *zones) {
+        json.BeginObject();
+        json.Field("name", zone.name);
+        json.Field("ph", "X");
+        json.Field("pid", 0);
+        json.Field("tid", zone.thread == kGpuThread ? gpuTid : zone.thread);
+        json.Field("ts", toUs(zone.beginNs));
+        json.Field("dur", (double)(zone.endNs - zone.beginNs) / 1000.0);
+        json.EndObject();
+      }
+    }
+  }
+  json.EndArray();
+  json.Field("displayTimeUnit", "ms");
+  json.EndObject();
+  return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+static ImU32 ZoneColor(const char *name) {
+  // Stable color per zone name.
+  unsigned int hash = 2166136261u;
+  for (const char *c = name; *c; ++c) {
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
+  }
+  float hue = (float)(hash % 360) / 360.0f;
+  return ImColor::HSV(hue, 0.45f, 0.75f);
+}
+
+void Profiler::DrawTimeline(const ProfileFrame &frame) {
+  // One track per thread that recorded something, plus the GPU.
+  std::map<int, int> trackDepth;
+  for (const auto &zone : frame.cpuZones) {
+    trackDepth[zone.thread] = std::max(trackDepth[zone.thread], zone.depth + 1);
+  }
+  for (const auto &zone : frame.gpuZones) {
+    trackDepth[kGpuThread] =
+        std::max(trackDepth[kGpuThread], zone.depth + 1);
+  }
+  std::vector<std::string> threadNames;
+  {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for (const auto &buffer : threads) {
+      threadNames.push_back(buffer->name);
+    }
+  }
+
+  const float rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+  const float labelWidth = 90.0f;
+  const double frameNs = (double)std::max<int64_t>(frame.endNs - frame.beginNs, 1);
+  ImDrawList *drawList = ImGui::GetWindowDrawList();
+  ImVec2 mouse = ImGui::GetIO().MousePos;
+
+  for (const auto &track : trackDepth) {
+    const int thread = track.first;
+    const std::string name = thread == kGpuThread ? "GPU"
+                             : thread < (int)threadNames.size()
+                                 ? threadNames[thread]
+                                 : "?";
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = std::max(ImGui::GetContentRegionAvail().x - labelWidth, 1.0f);
+    float height = rowHeight * (float)track.second;
+    ImGui::InvisibleButton(name.c_str(), ImVec2(labelWidth + width, height));
+    drawList->AddText(origin, ImGui::GetColorU32(ImGuiCol_Text), name.c_str());
+
+    const std::vector<ProfileZone> &zones =
+        thread == kGpuThread ? frame.gpuZones : frame.cpuZones;
+    for (const auto &zone : zones) {
+      if (zone.thread != thread) {
+        continue;
+      }
+      float x0 = origin.x + labelWidth +
+                 width * (float)((double)(zone.beginNs - frame.beginNs) / frameNs);
+      float x1 = origin.x + labelWidth +
+                 width * (float)((double)(zone.endNs - frame.beginNs) / frameNs);
+      // GPU zones may run past the end of the CPU frame.
+      if (x0 >= origin.x + labelWidth + width) {
+        continue;
+      }
+      x0 = std::max(x0, origin.x + labelWidth);
+      x1 = std::min(std::max(x1, x0 + 1.0f), origin.x + labelWidth + width);
+      float y0 = origin.y + rowHeight * (float)zone.depth;
+      ImVec2 minCorner(x0, y0);
+      ImVec2 maxCorner(x1, y0 + rowHeight - 1.0f);
+      drawList->AddRectFilled(minCorner, maxCorner, ZoneColor(zone.name));
+
+      float textWidth = ImGui::CalcTextSize(zone.name).x;
+      if (textWidth + 4.0f < x1 - x0) {
+        drawList->AddText(ImVec2(x0 + 2.0f, y0 + 2.0f), IM_COL32_BLACK,
+                          zone.name);
+      }
+      if (mouse.x >= x0 && mouse.x < x1 && mouse.y >= y0 &&
+          mouse.y < y0 + rowHeight) {
+        ImGui::SetTooltip("%s\n%.3f ms", zone.name,
+                          (double)(zone.endNs - zone.beginNs) / 1.0e6);
+      }
+    }
+  }
+}
+
+void Profiler::DrawPanel(const ImVec2 &anchor) {
+  ImGui::SetNextWindowPos(anchor, ImGuiCond_FirstUseEver);
+  ImGui::SetNextWindowSize(ImVec2(560.0f, 360.0f), ImGuiCond_FirstUseEver);
+  ImGui::Begin("Profiler");
+
+  ImGui::Checkbox("Pause", &paused);
+  ImGui::SameLine();
+  if (ImGui::Button("Export Chrome trace")) {
+    const std::string path = "profile_trace.json";
+    lastExport = ExportChromeTrace(path) ? "Wrote " + path : "Export failed";
+  }
+  if (!lastExport.empty()) {
+    ImGui::SameLine();
+    ImGui::TextUnformatted(lastExport.c_str());
+  }
+
+  if (history.empty()) {
+    ImGui::End();
+    return;
+  }
+
+  std::vector<float> frameMs;
+  float maxMs = 0.0f;
+  for (const auto &frame : history) {
+    frameMs.push_back((float)((double)(frame.endNs - frame.beginNs) / 1.0e6));
+    maxMs = std::max(maxMs, frameMs.back());
+  }
+  ImGui::PlotHistogram("##frames", frameMs.data(), (int)frameMs.size(), 0,
+                       "Frame time (ms)", 0.0f, maxMs * 1.1f,
+                       ImVec2(-1.0f, 50.0f));
+
+  int last = (int)history.size() - 1;
+  bool follow = selectedFrame < 0;
+  if (ImGui::Checkbox("Latest", &follow)) {
+    selectedFrame = follow ? -1 : last;
+  }
+  int index = follow ? last : std::min(selectedFrame, last);
+  if (!follow) {
+    ImGui::SameLine();
+    if (ImGui::SliderInt("Frame", &index, 0, last)) {
+      selectedFrame = index;
+    }
+  }
+  // GPU results of the newest frames are not back yet.
+  if (follow) {
+    while (index > 0 && !history[index].gpuResolved) {
+      index--;
+    }
+  }
+  const ProfileFrame &frame = history[index];
+  ImGui::Text("Frame %llu: %.2f ms", (unsigned long long)frame.index,
+              (double)(frame.endNs - frame.beginNs) / 1.0e6);
+
+  DrawTimeline(frame);
+
+  // Totals per zone name, CPU of the main thread and GPU.
+  if (ImGui::BeginTable("zones", 4,
+                        ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY,
+                        ImVec2(0.0f, 160.0f))) {
+    ImGui::TableSetupColumn("Zone");
+    ImGui::TableSetupColumn("Calls");
+    ImGui::TableSetupColumn("CPU (ms)");
+    ImGui::TableSetupColumn("GPU (ms)");
+    ImGui::TableHeadersRow();
+    struct Total {
+      int calls = 0;
+      double cpuMs = 0.0;
+      double gpuMs = 0.0;
+    };
+    std::map<std::string, Total> totals;
+    for (const auto &zone : frame.cpuZones) {
+      Total &total = totals[zone.name];
+      total.calls++;
+      total.cpuMs += (double)(zone.endNs - zone.beginNs) / 1.0e6;
+    }
+    for (const auto &zone : frame.gpuZones) {
+      totals[zone.name].gpuMs += (double)(zone.endNs - zone.beginNs) / 1.0e6;
+    }
+    for (const auto &entry : totals) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(entry.first.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", entry.second.calls);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", entry.second.cpuMs);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", entry.second.gpuMs);
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+}
+
+#endif  // PROFILER_ENABLED
@@ -0,0 +1,186 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Zone profiler. Instrument code with
+//   PROFILE_SCOPE("name");      CPU time of the enclosing scope.
+//   PROFILE_GPU_SCOPE("name");  CPU and GPU time (GL thread only).
+//   PROFILE_FRAME();            once per frame, after SwapBuffers.
+// Names must be string literals. Build with PROFILER_ENABLED=0 (CMake
+// option ENABLE_PROFILER=OFF) and the macros expand to nothing.
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#if PROFILER_ENABLED
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "headers.h"
+
+// One finished zone.
+struct ProfileZone {
+  const char *name;
+  int64_t beginNs;
+  int64_t endNs;
+  int depth;
+  int thread;  // Index into Profiler thread names; -1 for the GPU.
+};
+
+// Everything recorded in one frame.
+struct ProfileFrame {
+  uint64_t index;
+  int64_t beginNs;
+  int64_t endNs;
+  std::vector<ProfileZone> cpuZones;
+  // GPU zones in CPU time (calibrated), filled a few frames late.
+  std::vector<ProfileZone> gpuZones;
+  bool gpuResolved;
+};
+
+// Profiler Declarations.
+// CPU zones go to a lock-free ring buffer owned by the recording thread and
+// are collected once per frame. GPU zones are GL_TIMESTAMP query pairs that
+// are read back kGpuLatency frames later, so the CPU never waits on the GPU.
+class Profiler {
+ public:
+  // Profiler Public Methods.
+  static Profiler &Get();
+
+  // Name shown for the calling thread in the panel and traces.
+  void SetThreadName(const std::string &name);
+
+  void RecordCpuZone(const char *name, const int64_t beginNs,
+                     const int64_t endNs, const int depth);
+  // Returns a handle for EndGpuZone, or -1 when GPU timing is off.
+  int BeginGpuZone(const char *name, const int depth);
+  void EndGpuZone(const int handle);
+
+  // Collects this frame's zones and resolves older GPU zones.
+  void EndFrame();
+
+  // Writes the frame history in the Chrome trace event format
+  // (chrome://tracing, Perfetto).
+  bool ExportChromeTrace(const std::string &filePath);
+
+  // anchor is where the window first opens, e.g. next to "Settings".
+  void DrawPanel(const ImVec2 &anchor);
+
+  void ReleaseGpuResources();
+
+  static int64_t NowNs();
+  // Per-thread nesting depth used by the scopes.
+  static int &ThreadDepth();
+
+ private:
+  // Profiler Private Methods.
+  Profiler();
+  struct ThreadBuffer;
+  ThreadBuffer *GetThreadBuffer();
+  void CollectCpuZones(ProfileFrame &frame);
+  void ResolveGpuZones(const bool wait);
+  void DrawTimeline(const ProfileFrame &frame);
+
+  // Profiler Private Data.
+  static const int kRingSize = 1 << 15;
+  static const int kHistorySize = 240;
+  static const int kGpuLatency = 4;
+
+  struct ThreadBuffer {
+    std::string name;
+    int index;
+    ProfileZone events[kRingSize];
+    // Written only by the owning thread.
+    std::atomic<uint64_t> writeCount{0};
+    // Read position of the collecting thread.
+    uint64_t readCount = 0;
+  };
+
+  struct GpuZone {
+    const char *name;
+    int depth;
+    GLuint beginQuery;
+    GLuint endQuery;
+  };
+  struct GpuFrame {
+    uint64_t frameIndex = 0;
+    std::vector<GpuZone> zones;
+    bool pending = false;
+  };
+
+  std::mutex threadsMutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+  std::deque<ProfileFrame> history;
+  uint64_t frameIndex;
+  int64_t frameBeginNs;
+
+  GpuFrame gpuFrames[kGpuLatency];
+  std::vector<GLuint> freeQueries;
+  bool gpuTimerChecked;
+  bool hasGpuTimer;
+  // GPU timestamp minus CPU time, measured every frame.
+  int64_t gpuToCpuOffsetNs;
+
+  bool paused;
+  int selectedFrame;  // -1 follows the latest frame.
+  std::string lastExport;
+};
+
+// ProfileScope Declarations.
+// Records the CPU time between construction and destruction.
+class ProfileScope {
+ public:
+  explicit ProfileScope(const char *name)
+      : name(name), beginNs(Profiler::NowNs()) {
+    depth = Profiler::ThreadDepth()++;
+  }
+  ~ProfileScope() {
+    Profiler::ThreadDepth()--;
+    Profiler::Get().RecordCpuZone(name, beginNs, Profiler::NowNs(), depth);
+  }
+
+ private:
+  const char *name;
+  int64_t beginNs;
+  int depth;
+};
+
+// GpuProfileScope Declarations.
+// Records CPU and GPU time of the enclosing scope. GL thread only.
+class GpuProfileScope {
+ public:
+  explicit GpuProfileScope(const char *name) : cpuScope(name) {
+    handle = Profiler::Get().BeginGpuZone(name, Profiler::ThreadDepth() - 1);
+  }
+  ~GpuProfileScope() { Profiler::Get().EndGpuZone(handle); }
+
+ private:
+  ProfileScope cpuScope;
+  int handle;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name) \
+  ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) \
+  GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#define PROFILE_FRAME() Profiler::Get().EndFrame()
+#define PROFILE_THREAD_NAME(name) Profiler::Get().SetThreadName(name)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_GPU_SCOPE(name) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+
+#endif  // PROFILER_ENABLED
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef PROGRAM_BINARY_CACHE_H
+#define PROGRAM_BINARY_CACHE_H
+
+// Where ShaderProg::LoadFromFiles gets its programs from.
+enum class ProgramBinaryCache {
+  // Always compile and link the sources.
+  Off,
+  // Reload the program binary stored by an earlier run, compiling (and
+  // storing) only when there is none or the driver rejects it.
+  On,
+  // Compile every program and store fresh binaries, i.e. a cold start.
+  Rebuild,
+};
+
+#endif
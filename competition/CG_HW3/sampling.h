@@ -0,0 +1,57 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "headers.h"
+
+// Random numbers and direction sampling shared by the CPU ray tracers.
+
+// PCG hash; also decorrelates seeds built from pixel or texel indices.
+inline uint32_t PcgHash(const uint32_t v) {
+  uint32_t state = v * 747796405u + 2891336453u;
+  uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Uniform in [0, 1); advances rng.
+inline float NextRandom(uint32_t &rng) {
+  rng = PcgHash(rng);
+  return (float)(rng >> 8) * (1.0f / 16777216.0f);
+}
+
+// Orthonormal basis around n.
+inline void BuildBasis(const glm::vec3 &n, glm::vec3 &t, glm::vec3 &b) {
+  t = std::abs(n.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f)
+                           : glm::vec3(1.0f, 0.0f, 0.0f);
+  t = glm::normalize(glm::cross(t, n));
+  b = glm::cross(n, t);
+}
+
+// Direction around axis with pdf (exponent + 1) / (2 pi) * cos^exponent.
+// exponent 1 gives a cosine-weighted hemisphere.
+inline glm::vec3 SamplePowerCosine(const glm::vec3 &axis, const float exponent,
+                                   const float u1, const float u2) {
+  float cosTheta = std::pow(u1, 1.0f / (exponent + 1.0f));
+  float sinTheta = std::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+  float phi = 2.0f * glm::pi<float>() * u2;
+  glm::vec3 t, b;
+  BuildBasis(axis, t, b);
+  return sinTheta * std::cos(phi) * t + sinTheta * std::sin(phi) * b +
+         cosTheta * axis;
+}
+
+// Ray start just off a surface, on the side dir leaves to.
+inline glm::vec3 OffsetRayOrigin(const glm::vec3 &p,
+                                 const glm::vec3 &geometricNormal,
+                                 const glm::vec3 &dir) {
+  float scale = glm::max(
+      1.0f, glm::max(std::abs(p.x), glm::max(std::abs(p.y), std::abs(p.z))));
+  float offset = 1e-4f * scale;
+  return glm::dot(dir, geometricNormal) >= 0.0f
+             ? p + offset * geometricNormal
+             : p - offset * geometricNormal;
+}
+
+#endif
@@ -0,0 +1,303 @@
+#include "scene.h"
+
+#include <atomic>
+#include <chrono>
+#include <unordered_set>
+
+#include "headless.h"
+#include "json_writer.h"
+#include "profiler.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+void Scene::UpdateBVH(const glm::mat4x4& rootTransform)
+{
+	std::vector<glm::mat4x4> worldMatrices;
+	for (const SceneObject& sceneObj : objects) {
+		worldMatrices.push_back(rootTransform * sceneObj.worldMatrix);
+	}
+	if (worldMatrices == bvhWorldMatrices) {
+		return;
+	}
+	bvh.Build(objects, rootTransform);
+	bvhWorldMatrices = worldMatrices;
+	bvhNormalMatrices.clear();
+	for (const glm::mat4x4& m : worldMatrices) {
+		bvhNormalMatrices.push_back(glm::transpose(glm::inverse(glm::mat3x3(m))));
+	}
+}
+
+void Scene::SpawnInstances(TriangleMesh* mesh,
+	const std::vector<glm::mat4x4>& worldMatrices, const bool isStatic)
+{
+	objects.reserve(objects.size() + worldMatrices.size());
+	SceneObject sceneObj;
+	sceneObj.mesh = mesh;
+	sceneObj.isStatic = isStatic;
+	for (const glm::mat4x4& worldMatrix : worldMatrices) {
+		sceneObj.worldMatrix = worldMatrix;
+		objects.push_back(sceneObj);
+	}
+	transforms.MarkAllDirty();
+}
+
+// Each mesh and material texture once.
+static void CollectUnique(const std::vector<SceneObject>& objects,
+	std::vector<TriangleMesh*>& meshes, std::vector<ImageTexture*>& textures)
+{
+	std::unordered_set<TriangleMesh*> seenMeshes;
+	std::unordered_set<ImageTexture*> seenTextures;
+	for (const SceneObject& sceneObj : objects) {
+		if (sceneObj.mesh == nullptr ||
+			!seenMeshes.insert(sceneObj.mesh).second) {
+			continue;
+		}
+		meshes.push_back(sceneObj.mesh);
+		for (const SubMesh& subMesh : sceneObj.mesh->getSubMeshes()) {
+			if (subMesh.material == nullptr) {
+				continue;
+			}
+			ImageTexture* maps[2] = { subMesh.material->GetMapKd(),
+				subMesh.material->GetMapKs() };
+			for (ImageTexture* map : maps) {
+				if (map != nullptr && seenTextures.insert(map).second) {
+					textures.push_back(map);
+				}
+			}
+		}
+	}
+}
+
+CpuReleaseStats Scene::ReleaseCpuData()
+{
+	PROFILE_SCOPE("Release CPU Data");
+	auto start = std::chrono::steady_clock::now();
+	std::vector<TriangleMesh*> meshes;
+	std::vector<ImageTexture*> textures;
+	CollectUnique(objects, meshes, textures);
+	CpuReleaseStats stats;
+	for (TriangleMesh* mesh : meshes) {
+		const size_t bytes = mesh->ReleaseCpuData();
+		if (bytes > 0) {
+			stats.meshes++;
+			stats.meshBytes += (long long)bytes;
+		}
+	}
+	for (ImageTexture* texture : textures) {
+		const size_t bytes = texture->ReleaseCpuData();
+		if (bytes > 0) {
+			stats.textures++;
+			stats.textureBytes += (long long)bytes;
+		}
+		if (texture->IsStreamable() && !texture->HasCpuData()) {
+			stats.streamedTextures++;
+			stats.streamedBytes += (long long)texture->GetCpuBytes();
+		}
+	}
+	stats.ms = MsSince(start);
+	return stats;
+}
+
+bool Scene::RestoreCpuData()
+{
+	PROFILE_SCOPE("Restore CPU Data");
+	std::vector<TriangleMesh*> meshes;
+	std::vector<ImageTexture*> textures;
+	CollectUnique(objects, meshes, textures);
+	bool ok = true;
+	for (TriangleMesh* mesh : meshes) {
+		ok &= mesh->HasCpuData() || mesh->RestoreCpuData();
+	}
+	for (ImageTexture* texture : textures) {
+		ok &= texture->RestoreCpuData();
+	}
+	return ok;
+}
+
+void Scene::GetBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const
+{
+	boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (const SceneObject& sceneObj : objects) {
+		glm::vec3 objMin, objMax;
+		GetWorldBounds(sceneObj, objMin, objMax);
+		boundsMin = glm::min(boundsMin, objMin);
+		boundsMax = glm::max(boundsMax, objMax);
+	}
+	if (objects.empty()) {
+		boundsMin = glm::vec3(-1.0f);
+		boundsMax = glm::vec3(1.0f);
+	}
+}
+
+void GetWorldBounds(const SceneObject& sceneObj, glm::vec3& boundsMin,
+	glm::vec3& boundsMax)
+{
+	const glm::mat4x4& world = sceneObj.worldMatrix;
+	glm::vec3 center =
+		glm::vec3(world * glm::vec4(sceneObj.mesh->GetObjCenter(), 1.0f));
+	// Half extent of the transformed box.
+	glm::mat3x3 absWorld(world);
+	for (int c = 0; c < 3; ++c) {
+		absWorld[c] = glm::abs(absWorld[c]);
+	}
+	glm::vec3 half = absWorld * (0.5f * sceneObj.mesh->GetObjExtent());
+	boundsMin = center - half;
+	boundsMax = center + half;
+}
+
+bool Scene::RayCast(const Ray& ray, RayHit& hit) const
+{
+	Ray query = ray;
+	return bvh.Intersect(query, hit);
+}
+
+bool Scene::IsOccluded(const Ray& ray) const
+{
+	return bvh.Occluded(ray);
+}
+
+SurfacePoint Scene::GetSurfacePoint(const Ray& ray, const RayHit& hit) const
+{
+	TriangleMesh* mesh = objects[hit.object].mesh;
+	const SubMesh& subMesh = mesh->getSubMeshes()[hit.subMesh];
+	const std::vector<VertexPTN>& vertices = mesh->GetVertices();
+	const VertexPTN& v0 = vertices[subMesh.vertexIndices[3 * hit.triangle]];
+	const VertexPTN& v1 = vertices[subMesh.vertexIndices[3 * hit.triangle + 1]];
+	const VertexPTN& v2 = vertices[subMesh.vertexIndices[3 * hit.triangle + 2]];
+	const float u = hit.barycentric.x;
+	const float v = hit.barycentric.y;
+	const float w = 1.0f - u - v;
+
+	const glm::mat4x4& m = bvhWorldMatrices[hit.object];
+	SurfacePoint sp;
+	sp.position = ray.origin + hit.t * ray.direction;
+	sp.uv = w * v0.texcoord + u * v1.texcoord + v * v2.texcoord;
+	sp.material = subMesh.material;
+	glm::vec3 p0 = glm::vec3(m * glm::vec4(v0.position, 1.0f));
+	glm::vec3 p1 = glm::vec3(m * glm::vec4(v1.position, 1.0f));
+	glm::vec3 p2 = glm::vec3(m * glm::vec4(v2.position, 1.0f));
+	sp.geometricNormal = glm::normalize(glm::cross(p1 - p0, p2 - p0));
+	glm::vec3 normal = bvhNormalMatrices[hit.object] *
+		(w * v0.normal + u * v1.normal + v * v2.normal);
+	float length = glm::length(normal);
+	sp.normal = length > 0.0f ? normal / length : sp.geometricNormal;
+
+	// Shade the side the ray arrived from.
+	sp.frontFace = glm::dot(sp.geometricNormal, ray.direction) <= 0.0f;
+	if (!sp.frontFace) {
+		sp.geometricNormal = -sp.geometricNormal;
+	}
+	if (glm::dot(sp.normal, sp.geometricNormal) < 0.0f) {
+		sp.normal = -sp.normal;
+	}
+	return sp;
+}
+
+RayCastBenchmark BenchmarkPrimaryRays(const Scene* scene, const Camera* camera,
+	const int width, const int height)
+{
+	PROFILE_SCOPE("Ray Benchmark");
+	RayCastBenchmark result;
+	result.numRays = width * height;
+
+	// Rays are generated up front so only the traversal is timed.
+	std::vector<Ray> rays(result.numRays);
+	const glm::mat4x4 invViewProj =
+		glm::inverse(camera->GetProjMatrix() * camera->GetViewMatrix());
+	ThreadPool::Get().ParallelFor(height, 8, [&](const int begin, const int end) {
+		for (int y = begin; y < end; y++) {
+			for (int x = 0; x < width; x++) {
+				glm::vec2 ndc(2.0f * (x + 0.5f) / width - 1.0f,
+					1.0f - 2.0f * (y + 0.5f) / height);
+				glm::vec4 nearPoint = invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+				glm::vec4 farPoint = invViewProj * glm::vec4(ndc, 1.0f, 1.0f);
+				glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+				rays[y * width + x] =
+					Ray(origin, glm::vec3(farPoint) / farPoint.w - origin, 1.0f);
+			}
+		}
+	});
+
+	using Clock = std::chrono::steady_clock;
+	std::atomic<int> hits(0);
+	Clock::time_point start = Clock::now();
+	ThreadPool::Get().ParallelFor(result.numRays, 4096, [&](const int begin, const int end) {
+		int localHits = 0;
+		for (int i = begin; i < end; i++) {
+			RayHit hit;
+			if (scene->RayCast(rays[i], hit)) {
+				localHits++;
+			}
+		}
+		hits += localHits;
+	});
+	result.singleMs = MsSince(start);
+	result.numHits = hits.load();
+
+	// Packets of 8 horizontally adjacent pixels; the tail is padded with
+	// inactive lanes.
+	start = Clock::now();
+	const int numPackets = (result.numRays + 7) / 8;
+	ThreadPool::Get().ParallelFor(numPackets, 512, [&](const int begin, const int end) {
+		for (int p = begin; p < end; p++) {
+			RayPacket8 packet;
+			for (int lane = 0; lane < 8; lane++) {
+				int i = p * 8 + lane;
+				packet.Set(lane, i < result.numRays ? rays[i] : Ray(glm::vec3(0.0f), glm::vec3(1.0f), -1.0f));
+			}
+			PacketHit8 hit;
+			scene->GetBVH().IntersectPacket(packet, hit);
+		}
+	});
+	result.packetMs = MsSince(start);
+
+	result.singleRaysPerSec = result.numRays / std::max(result.singleMs * 1e-3, 1e-9);
+	result.packetRaysPerSec = result.numRays / std::max(result.packetMs * 1e-3, 1e-9);
+	return result;
+}
+
+int RunRayBenchmark(const HeadlessOptions& options, Scene* scene,
+	const glm::mat4x4& rootTransform) {
+	scene->UpdateBVH(rootTransform);
+	RayCastBenchmark result = BenchmarkPrimaryRays(scene, scene->camera,
+		options.width, options.height);
+
+	std::ofstream file;
+	if (!OpenReport(options, file)) {
+		return 1;
+	}
+	JsonWriter json(file);
+	json.BeginObject();
+	json.Field("scene", options.scenePath);
+	json.Field("width", options.width);
+	json.Field("height", options.height);
+	json.Field("simd", float8::Name());
+	json.Field("threads", ThreadPool::Get().GetConcurrency());
+	json.Key("meshes");
+	json.BeginArray();
+	for (const SceneObject& sceneObj : scene->objects) {
+		const BVHBuildStats& stats = sceneObj.mesh->GetBVH()->GetStats();
+		json.BeginObject();
+		json.Field("triangles", stats.numPrimitives);
+		json.Field("nodes", stats.numNodes);
+		json.Field("leaves", stats.numLeaves);
+		json.Field("maxDepth", stats.maxDepth);
+		json.Field("memoryBytes", (long long)stats.memoryBytes);
+		json.Field("buildMs", stats.buildMs);
+		json.EndObject();
+	}
+	json.EndArray();
+	json.Field("topLevelBuildMs", scene->GetBVH().GetStats().buildMs);
+	json.Field("rays", result.numRays);
+	json.Field("hits", result.numHits);
+	json.Field("singleMs", result.singleMs);
+	json.Field("packetMs", result.packetMs);
+	json.Field("singleRaysPerSec", result.singleRaysPerSec);
+	json.Field("packetRaysPerSec", result.packetRaysPerSec);
+	json.EndObject();
+	file << std::endl;
+	return 0;
+}
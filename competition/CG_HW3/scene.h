@@ -1,9 +1,52 @@
 #pragma once
 #include "headers.h"
+#include "bvh.h"
 #include "light.h"
+#include "scene_graph.h"
 #include "scene_obj.h"
+#include "texture_streamer.h"
+#include "transform_store.h"
 #include "camera.h"
 
+class PhongMaterial;
+class TriangleMesh;
+struct HeadlessOptions;
+
+// Result of BenchmarkPrimaryRays.
+struct RayCastBenchmark {
+	int numRays = 0;
+	int numHits = 0;
+	double singleMs = 0.0;
+	double packetMs = 0.0;
+	double singleRaysPerSec = 0.0;
+	double packetRaysPerSec = 0.0;
+};
+
+// Result of Scene::ReleaseCpuData.
+struct CpuReleaseStats {
+	int meshes = 0;
+	int textures = 0;
+	long long meshBytes = 0;
+	long long textureBytes = 0;
+	// Streamed textures keep the levels they can stream in, level 0
+	// included, on the CPU.
+	int streamedTextures = 0;
+	long long streamedBytes = 0;
+	double ms = 0.0;
+};
+
+// Interpolated attributes at a ray hit, in the space of the BVH.
+struct SurfacePoint {
+	glm::vec3 position;
+	// Both normals face the side the ray came from.
+	glm::vec3 normal;
+	glm::vec3 geometricNormal;
+	glm::vec2 uv;
+	const PhongMaterial* material;
+	// False when the ray hit the back of the triangle.
+	bool frontFace;
+};
+
 struct Scene {
 	std::vector<SceneObject> objects;
 	std::vector<AreaLight*> areaLights;
@@ -14,4 +57,59 @@ struct Scene {
 	glm::vec3 ambientLight;
 
 	Camera* camera;
-};
\ No newline at end of file
+
+	// Hierarchy of the imported FBX scenes, which places their objects.
+	SceneGraph graph;
+	// World and normal matrices of the objects for the rasterizer. Mark
+	// objects dirty here after changing their worldMatrix.
+	TransformStore transforms;
+	// Mip residency of the streamed textures used by the objects.
+	TextureStreamer textureStreamer;
+
+	// Appends one object per world matrix, all sharing mesh. Meant for
+	// large crowds of copies, which InstanceBatcher draws in one call per
+	// submesh.
+	void SpawnInstances(TriangleMesh* mesh,
+		const std::vector<glm::mat4x4>& worldMatrices,
+		const bool isStatic = true);
+
+	// Rebuilds the ray-query BVH when objects were added or moved. Mesh BVHs
+	// are built once; only the top level follows the transforms.
+	void UpdateBVH(const glm::mat4x4& rootTransform);
+	// Closest hit along the ray, which is in the space rootTransform maps to.
+	bool RayCast(const Ray& ray, RayHit& hit) const;
+	bool IsOccluded(const Ray& ray) const;
+	// Attributes of a hit returned by RayCast or the BVH.
+	SurfacePoint GetSurfacePoint(const Ray& ray, const RayHit& hit) const;
+	const SceneBVH& GetBVH() const { return bvh; }
+
+	// GPU-resident mode: drops the CPU copies of the uploaded meshes and of
+	// their material textures. The CPU renderers and bakers need
+	// RestoreCpuData first; the rasterizer only needs the GPU copies.
+	CpuReleaseStats ReleaseCpuData();
+	// False if any copy could not be read back.
+	bool RestoreCpuData();
+
+	// Box around the objects before the root transform; a unit box around
+	// the origin if there are none.
+	void GetBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+
+	SceneBVH bvh;
+	// Object world matrices the BVH was built with, and their normal
+	// matrices.
+	std::vector<glm::mat4x4> bvhWorldMatrices;
+	std::vector<glm::mat3x3> bvhNormalMatrices;
+};
+
+// World-space box around an object's mesh bounds.
+void GetWorldBounds(const SceneObject& sceneObj, glm::vec3& boundsMin,
+	glm::vec3& boundsMax);
+
+// Traces one ray per pixel of the camera, first one at a time and then in
+// 8-ray packets, on all pool threads. UpdateBVH must have been called.
+RayCastBenchmark BenchmarkPrimaryRays(const Scene* scene, const Camera* camera,
+	const int width, const int height);
+// Builds the BVHs, traces the primary rays at the options' size and writes
+// the build times and rays per second to the report.
+int RunRayBenchmark(const HeadlessOptions& options, Scene* scene,
+	const glm::mat4x4& rootTransform);
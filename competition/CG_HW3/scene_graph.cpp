@@ -0,0 +1,109 @@
+#include "scene_graph.h"
+
+int SceneGraph::AddNode(const std::string &name, const int parent,
+                        const glm::mat4x4 &localTransform) {
+  SceneNode node;
+  node.name = name;
+  node.parent = parent;
+  node.localTransform = localTransform;
+  const int index = (int)nodes.size();
+  nodes.push_back(node);
+  if (parent >= 0) {
+    nodes[parent].children.push_back(index);
+  }
+  hasDirtyObjects = true;
+  return index;
+}
+
+void SceneGraph::AttachObject(const int node, const int object,
+                              const glm::mat4x4 &offset) {
+  nodes[node].objects.push_back(object);
+  nodes[node].objectOffsets.push_back(offset);
+  nodes[node].objectsDirty = true;
+  hasDirtyObjects = true;
+}
+
+void SceneGraph::SetLocalTransform(const int node,
+                                   const glm::mat4x4 &localTransform) {
+  nodes[node].localTransform = localTransform;
+  MarkSubtreeDirty(node);
+}
+
+void SceneGraph::MarkSubtreeDirty(const int node) {
+  // A dirty node's subtree is dirty already.
+  SceneNode &current = nodes[node];
+  if (current.globalDirty && current.objectsDirty) {
+    return;
+  }
+  current.globalDirty = true;
+  current.objectsDirty = true;
+  hasDirtyObjects = true;
+  for (int child : current.children) {
+    MarkSubtreeDirty(child);
+  }
+}
+
+const glm::mat4x4 &SceneGraph::GetGlobalTransform(const int node) {
+  SceneNode &current = nodes[node];
+  if (current.globalDirty) {
+    current.globalTransform =
+        current.parent >= 0
+            ? GetGlobalTransform(current.parent) * current.localTransform
+            : current.localTransform;
+    current.globalDirty = false;
+  }
+  return current.globalTransform;
+}
+
+int SceneGraph::Update(std::vector<SceneObject> &objects,
+                       std::vector<int> *moved,
+                       std::vector<glm::mat4x4> *previous) {
+  if (!hasDirtyObjects) {
+    return 0;
+  }
+  int numMoved = 0;
+  // Parents come first, so each GetGlobalTransform only looks one level up.
+  for (int i = 0; i < (int)nodes.size(); i++) {
+    SceneNode &node = nodes[i];
+    if (!node.objectsDirty) {
+      continue;
+    }
+    const glm::mat4x4 &global = GetGlobalTransform(i);
+    for (size_t k = 0; k < node.objects.size(); k++) {
+      if (previous != nullptr) {
+        previous->push_back(objects[node.objects[k]].worldMatrix);
+      }
+      objects[node.objects[k]].worldMatrix = global * node.objectOffsets[k];
+      if (moved != nullptr) {
+        moved->push_back(node.objects[k]);
+      }
+      numMoved++;
+    }
+    node.objectsDirty = false;
+  }
+  hasDirtyObjects = false;
+  return numMoved;
+}
+
+void SceneGraph::RemapObjects(const std::vector<int> &newIndex) {
+  for (SceneNode &node : nodes) {
+    size_t kept = 0;
+    for (size_t k = 0; k < node.objects.size(); k++) {
+      const int object = newIndex[node.objects[k]];
+      if (object < 0) {
+        continue;
+      }
+      node.objects[kept] = object;
+      node.objectOffsets[kept] = node.objectOffsets[k];
+      kept++;
+    }
+    node.objects.resize(kept);
+    node.objectOffsets.resize(kept);
+  }
+}
+
+void SceneGraph::Clear() {
+  nodes.clear();
+  hasDirtyObjects = false;
+  importStats = SceneImportStats();
+}
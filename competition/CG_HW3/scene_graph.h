@@ -0,0 +1,85 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include "headers.h"
+#include "scene_obj.h"
+
+// One node of an imported hierarchy.
+struct SceneNode {
+  std::string name;
+  // -1 for a root. Parents always have a lower index than their children.
+  int parent = -1;
+  std::vector<int> children;
+  glm::mat4x4 localTransform = glm::mat4x4(1.0f);
+  // Parent global * local, valid unless globalDirty.
+  glm::mat4x4 globalTransform = glm::mat4x4(1.0f);
+  bool globalDirty = true;
+  // The objects still have the world matrices of an older global.
+  bool objectsDirty = true;
+  // Scene objects drawn at this node, each placed by an offset from the
+  // node (FBX geometric transforms, which children do not inherit).
+  std::vector<int> objects;
+  std::vector<glm::mat4x4> objectOffsets;
+};
+
+// Memory of an import with shared meshes compared with baking every mesh
+// reference into one vertex stream.
+struct SceneImportStats {
+  int nodes = 0;
+  // Nodes referencing a mesh, and the distinct meshes among them.
+  int meshReferences = 0;
+  int uniqueMeshes = 0;
+  // Vertex and index bytes of the baked import, and of the shared meshes
+  // plus the nodes and objects that place them.
+  long long bakedBytes = 0;
+  long long sharedBytes = 0;
+  double loadMs = 0.0;
+};
+
+// SceneGraph Declarations.
+// Node hierarchy of the imported scenes. Nodes hold local transforms and
+// reference scene objects, which in turn share their TriangleMesh. Editing a
+// node only marks its subtree dirty; global transforms are recomputed on
+// demand, and Update writes the world matrices of the moved objects once
+// per frame, so an unchanged hierarchy costs nothing.
+class SceneGraph {
+ public:
+  // SceneGraph Public Methods.
+  // parent must already exist (or be -1); returns the new node's index.
+  int AddNode(const std::string &name, const int parent,
+              const glm::mat4x4 &localTransform);
+  void AttachObject(const int node, const int object,
+                    const glm::mat4x4 &offset);
+
+  void SetLocalTransform(const int node, const glm::mat4x4 &localTransform);
+  const glm::mat4x4 &GetGlobalTransform(const int node);
+
+  // Writes the world matrices of the objects under dirty nodes. Returns how
+  // many objects moved, and appends their indices to moved if given, and
+  // their world matrices from before the update to previous if given.
+  int Update(std::vector<SceneObject> &objects,
+             std::vector<int> *moved = nullptr,
+             std::vector<glm::mat4x4> *previous = nullptr);
+  // Follows the removal of scene objects: newIndex[i] is the new index of
+  // object i, or -1 if it was removed.
+  void RemapObjects(const std::vector<int> &newIndex);
+  void Clear();
+
+  int GetNumNodes() const { return (int)nodes.size(); }
+  const SceneNode &GetNode(const int node) const { return nodes[node]; }
+
+  void SetImportStats(const SceneImportStats &stats) { importStats = stats; }
+  // Stats of the last import.
+  const SceneImportStats &GetImportStats() const { return importStats; }
+
+ private:
+  // SceneGraph Private Methods.
+  void MarkSubtreeDirty(const int node);
+
+  // SceneGraph Private Data.
+  std::vector<SceneNode> nodes;
+  bool hasDirtyObjects = false;
+  SceneImportStats importStats;
+};
+
+#endif
@@ -1,13 +1,20 @@
 #pragma once
 #include "headers.h"
 
+class Lightmap;
 class TriangleMesh;
 // SceneObject.
 struct SceneObject {
   SceneObject() {
     mesh = nullptr;
     worldMatrix = glm::mat4x4(1.0f);
+    isStatic = true;
+    lightmap = nullptr;
   }
   TriangleMesh* mesh;
   glm::mat4x4 worldMatrix;
+  // Static objects may be cached, e.g. in the far shadow cascades.
+  bool isStatic;
+  // Baked static lighting in the mesh's lightmap UVs, if any.
+  Lightmap* lightmap;
 };
\ No newline at end of file
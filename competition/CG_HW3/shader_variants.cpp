@@ -0,0 +1,327 @@
+#include "shader_variants.h"
+
+#include "json_writer.h"
+#include "material.h"
+#include "timing.h"
+
+PhongVariantKey PhongVariantKey::WithMaterial(
+    const PhongMaterial *material) const {
+  PhongVariantKey key = *this;
+  if (material != nullptr) {
+    key.hasMapKd = material->GetMapKd() != nullptr;
+    key.hasMapKs = material->GetMapKs() != nullptr;
+  }
+  return key;
+}
+
+uint32_t PhongVariantKey::Pack() const {
+  uint32_t bits = (uint32_t)blinnPhong | (uint32_t)ambientLight << 1 |
+                  (uint32_t)diffuseLight << 2 |
+                  (uint32_t)specularLight << 3 | (uint32_t)hasMapKd << 4 |
+                  (uint32_t)hasMapKs << 5;
+  bits |= (uint32_t)numDirLights << 6 | (uint32_t)numPointLights << 10 |
+          (uint32_t)numSpotLights << 14 | (uint32_t)numAreaLights << 18;
+  return bits;
+}
+
+std::string PhongVariantKey::GetDefines() const {
+  auto flag = [](const bool on) { return on ? "true" : "false"; };
+  std::ostringstream text;
+  text << "#define BLINN_PHONG " << flag(blinnPhong) << "\n"
+       << "#define AMBIENT_LIGHT " << flag(ambientLight) << "\n"
+       << "#define DIFFUSE_LIGHT " << flag(diffuseLight) << "\n"
+       << "#define SPECULAR_LIGHT " << flag(specularLight) << "\n"
+       << "#define HAS_MAP_KD " << (int)hasMapKd << "\n"
+       << "#define HAS_MAP_KS " << (int)hasMapKs << "\n"
+       << "#define NUM_DIR_LIGHTS " << numDirLights << "\n"
+       << "#define NUM_POINT_LIGHTS " << numPointLights << "\n"
+       << "#define NUM_SPOT_LIGHTS " << numSpotLights << "\n"
+       << "#define NUM_AREA_LIGHTS " << numAreaLights << "\n";
+  return text.str();
+}
+
+std::string PhongVariantKey::GetName() const {
+  std::ostringstream name;
+  name << (blinnPhong ? "blinn " : "phong ") << (ambientLight ? "A" : "-")
+       << (diffuseLight ? "D" : "-") << (specularLight ? "S" : "-")
+       << (hasMapKd ? " kd" : " --") << (hasMapKs ? " ks" : " --")
+       << " lights " << numDirLights << "/" << numPointLights << "/"
+       << numSpotLights << "/" << numAreaLights;
+  return name.str();
+}
+
+PhongVariants::PhongVariants(PhongShadingDemoShaderProg *uber,
+                             const std::string &vsFilePath,
+                             const std::string &fsFilePath)
+    : uber(uber), vsFilePath(vsFilePath), fsFilePath(fsFilePath) {
+  // The uber shader is timed like the variants.
+  Variant variant = {};
+  variant.name = "uber";
+  variant.program = uber;
+  variant.state = State::Ready;
+  variants.push_back(variant);
+  programIndices[uber] = 0;
+}
+
+PhongVariants::~PhongVariants() {
+  Clear();
+  for (const GLuint query : freeQueries) {
+    glDeleteQueries(1, &query);
+  }
+}
+
+void PhongVariants::Clear() {
+  for (int slot = 0; slot < kFrames; ++slot) {
+    FrameTimes &times = frames[slot];
+    freeQueries.insert(freeQueries.end(), times.stamps.begin(),
+                       times.stamps.end());
+    times.stamps.clear();
+    times.owners.clear();
+  }
+  for (size_t i = 1; i < variants.size(); ++i) {
+    delete variants[i].program;
+  }
+  variants.resize(1);
+  variants[0].gpuMs = 0.0;
+  variants[0].gpuMsSum = 0.0;
+  variants[0].gpuFrames = 0;
+  keyIndices.clear();
+  programIndices.clear();
+  programIndices[uber] = 0;
+  queue.clear();
+  compiling.clear();
+  stats = PhongVariantStats();
+}
+
+void PhongVariants::BeginFrame() {
+  // The slot about to be reused was recorded kFrames frames ago, so its
+  // timestamps are almost always available.
+  ResolveTimes(frame);
+  for (Variant &variant : variants) {
+    variant.draws = 0;
+  }
+  stats.variantDraws = 0;
+  stats.fallbackDraws = 0;
+  stats.programSwitches = 0;
+
+  // Without parallel compiles IsLoadDone is always true and FinishLoad
+  // waits, a frame after the driver got the sources.
+  for (size_t i = 0; i < compiling.size();) {
+    const int index = compiling[i];
+    if (variants[index].program->IsLoadDone()) {
+      FinishCompile(index);
+      compiling.erase(compiling.begin() + i);
+    } else {
+      ++i;
+    }
+  }
+  const int starts = std::min((int)queue.size(), maxCompilesPerFrame);
+  for (int i = 0; i < starts; ++i) {
+    StartCompile(queue[i]);
+  }
+  queue.erase(queue.begin(), queue.begin() + starts);
+  stats.queued = (int)queue.size();
+  stats.compiling = (int)compiling.size();
+}
+
+PhongShadingDemoShaderProg *PhongVariants::Get(const PhongVariantKey &key) {
+  const uint32_t packed = key.Pack();
+  auto it = keyIndices.find(packed);
+  if (it == keyIndices.end()) {
+    Variant variant = {};
+    variant.name = key.GetName();
+    variant.defines = key.GetDefines();
+    variant.program = nullptr;
+    variant.state = State::Queued;
+    variant.requested = std::chrono::steady_clock::now();
+    it = keyIndices.emplace(packed, (int)variants.size()).first;
+    queue.push_back(it->second);
+    variants.push_back(variant);
+    stats.variants++;
+    stats.queued++;
+  }
+  Variant &variant = variants[it->second];
+  if (variant.state == State::Ready) {
+    variant.draws++;
+    stats.variantDraws++;
+    return variant.program;
+  }
+  variants[0].draws++;
+  stats.fallbackDraws++;
+  return uber;
+}
+
+void PhongVariants::SetTimedProgram(PhongShadingDemoShaderProg *program) {
+  int owner = -1;
+  if (program != nullptr) {
+    auto it = programIndices.find(program);
+    owner = it != programIndices.end() ? it->second : -1;
+  }
+  FrameTimes &times = frames[frame];
+  const int current = times.owners.empty() ? -1 : times.owners.back();
+  if (owner == current) {
+    return;
+  }
+  if (owner >= 0) {
+    stats.programSwitches++;
+  }
+  const GLuint query = AcquireQuery();
+  glQueryCounter(query, GL_TIMESTAMP);
+  times.stamps.push_back(query);
+  times.owners.push_back(owner);
+}
+
+void PhongVariants::EndFrame() {
+  SetTimedProgram(nullptr);
+  frame = (frame + 1) % kFrames;
+}
+
+void PhongVariants::StartCompile(const int index) {
+  Variant &variant = variants[index];
+  auto start = std::chrono::steady_clock::now();
+  variant.program = new PhongShadingDemoShaderProg();
+  variant.program->SetDefines(variant.defines);
+  if (variant.program->StartLoad(vsFilePath, fsFilePath)) {
+    variant.state = State::Compiling;
+    compiling.push_back(index);
+  } else {
+    variant.state = State::Failed;
+    stats.failed++;
+  }
+  variant.compileMs += MsSince(start);
+  stats.compileMs += MsSince(start);
+}
+
+void PhongVariants::FinishCompile(const int index) {
+  Variant &variant = variants[index];
+  auto start = std::chrono::steady_clock::now();
+  if (variant.program->FinishLoad()) {
+    variant.state = State::Ready;
+    variant.latencyMs = MsSince(variant.requested);
+    programIndices[variant.program] = index;
+    stats.ready++;
+  } else {
+    std::cerr << "[ERROR] Failed to build shader variant " << variant.name
+              << std::endl;
+    variant.state = State::Failed;
+    stats.failed++;
+  }
+  variant.compileMs += MsSince(start);
+  stats.compileMs += MsSince(start);
+}
+
+void PhongVariants::ResolveTimes(const int slot) {
+  FrameTimes &times = frames[slot];
+  if (times.stamps.empty()) {
+    return;
+  }
+  std::vector<double> ms(variants.size(), 0.0);
+  GLuint64 previous = 0;
+  for (size_t k = 0; k < times.stamps.size(); ++k) {
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(times.stamps[k], GL_QUERY_RESULT, &ns);
+    if (k > 0 && times.owners[k - 1] >= 0) {
+      ms[times.owners[k - 1]] += (double)(ns - previous) / 1.0e6;
+    }
+    previous = ns;
+  }
+  for (size_t i = 0; i < variants.size(); ++i) {
+    Variant &variant = variants[i];
+    variant.gpuMs = ms[i];
+    if (ms[i] > 0.0) {
+      variant.gpuMsSum += ms[i];
+      variant.gpuFrames++;
+    }
+  }
+  freeQueries.insert(freeQueries.end(), times.stamps.begin(),
+                     times.stamps.end());
+  times.stamps.clear();
+  times.owners.clear();
+}
+
+GLuint PhongVariants::AcquireQuery() {
+  if (freeQueries.empty()) {
+    GLuint query = 0;
+    glGenQueries(1, &query);
+    return query;
+  }
+  const GLuint query = freeQueries.back();
+  freeQueries.pop_back();
+  return query;
+}
+
+void PhongVariants::WriteJson(JsonWriter &json) const {
+  json.BeginObject();
+  json.Field("enabled", enabled);
+  json.Field("variants", stats.variants);
+  json.Field("ready", stats.ready);
+  json.Field("failed", stats.failed);
+  json.Field("compileMs", stats.compileMs);
+  json.Key("programs");
+  json.BeginArray();
+  for (const Variant &variant : variants) {
+    json.BeginObject();
+    json.Field("name", variant.name);
+    json.Field("ready", variant.state == State::Ready);
+    json.Field("latencyMs", variant.latencyMs);
+    json.Field("compileMs", variant.compileMs);
+    json.Field("draws", variant.draws);
+    json.Field("gpuMs", variant.gpuMs);
+    json.Field("meanGpuMs", variant.gpuFrames > 0
+                                ? variant.gpuMsSum / variant.gpuFrames
+                                : 0.0);
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+}
+
+void PhongVariants::DrawDebugPanel() {
+  ImGui::Begin("Shader Variants");
+  ImGui::Checkbox("Specialize phong shader", &enabled);
+  ImGui::SliderInt("Compiles per frame", &maxCompilesPerFrame, 1, 16);
+  ImGui::Text("%d variants: %d ready, %d compiling, %d queued, %d failed",
+              stats.variants, stats.ready, stats.compiling, stats.queued,
+              stats.failed);
+  ImGui::Text("Last frame: %d variant draws, %d on the uber shader, %d "
+              "program switches",
+              stats.variantDraws, stats.fallbackDraws,
+              stats.programSwitches);
+  ImGui::Text("Compile CPU time %.1f ms", stats.compileMs);
+  if (ImGui::Button("Recompile")) {
+    Clear();
+  }
+
+  if (ImGui::BeginTable("variants", 5)) {
+    ImGui::TableSetupColumn("Program");
+    ImGui::TableSetupColumn("Draws");
+    ImGui::TableSetupColumn("GPU (ms)");
+    ImGui::TableSetupColumn("Mean GPU (ms)");
+    ImGui::TableSetupColumn("Ready after (ms)");
+    ImGui::TableHeadersRow();
+    for (const Variant &variant : variants) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      if (variant.state == State::Ready) {
+        ImGui::Text("%s", variant.name.c_str());
+      } else {
+        const char *state = variant.state == State::Failed ? "failed"
+                            : variant.state == State::Queued ? "queued"
+                                                             : "compiling";
+        ImGui::TextDisabled("%s (%s)", variant.name.c_str(), state);
+      }
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", variant.draws);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", variant.gpuMs);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", variant.gpuFrames > 0
+                              ? variant.gpuMsSum / variant.gpuFrames
+                              : 0.0);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", variant.latencyMs);
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+}
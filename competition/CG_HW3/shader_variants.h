@@ -0,0 +1,147 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <chrono>
+
+#include "headers.h"
+#include "shaderprog.h"
+
+class JsonWriter;
+class PhongMaterial;
+
+// The features a variant of phong_shading_demo.fs is compiled for; see
+// the defines at the top of the shader.
+struct PhongVariantKey {
+  bool blinnPhong = true;
+  bool ambientLight = true;
+  bool diffuseLight = true;
+  bool specularLight = true;
+  bool hasMapKd = true;
+  bool hasMapKs = true;
+  int numDirLights = 0;
+  int numPointLights = 0;
+  int numSpotLights = 0;
+  int numAreaLights = 0;
+
+  // The key with the texture bits of material. Submeshes without a
+  // material keep both, as their draws bind nothing.
+  PhongVariantKey WithMaterial(const PhongMaterial *material) const;
+  // Unique per key, as the light counts stay below 16.
+  uint32_t Pack() const;
+  std::string GetDefines() const;
+  // Short label, e.g. "blinn ADS kd -- lights 1/1/1/0".
+  std::string GetName() const;
+};
+
+struct PhongVariantStats {
+  int variants = 0;
+  int ready = 0;
+  int compiling = 0;
+  int queued = 0;
+  // Compiles that failed; their draws stay on the uber shader.
+  int failed = 0;
+  // Submesh draws of the last frame on a variant, and on the uber shader
+  // while their variant was not ready.
+  int variantDraws = 0;
+  int fallbackDraws = 0;
+  // Program changes of the last frame.
+  int programSwitches = 0;
+  // CPU time of StartLoad and FinishLoad over all variants.
+  double compileMs = 0.0;
+};
+
+// PhongVariants Declarations.
+// Specialized programs of phong_shading_demo.fs. The lighting switches,
+// the presence of mapKd and mapKs and the light counts become constants,
+// so the driver drops the dead branches and texture fetches and unrolls
+// the light loops. A variant is compiled the first time a draw asks for
+// it, a few per frame and on the driver's own threads if it supports
+// parallel shader compiles; until then its draws use the uber shader.
+//
+// GPU time is charged per program with a timestamp at every program
+// switch, read back kFrames frames later like GpuTimer.
+class PhongVariants {
+ public:
+  // PhongVariants Public Methods.
+  // uber is the shader loaded without defines; it is not deleted here.
+  PhongVariants(PhongShadingDemoShaderProg *uber,
+                const std::string &vsFilePath, const std::string &fsFilePath);
+  ~PhongVariants();
+
+  // Call once per frame before the draws: reads back the GPU times of an
+  // earlier frame, finishes the compiles the driver is done with and
+  // starts queued ones.
+  void BeginFrame();
+  // The program for the key, the uber shader until the variant is ready.
+  // Queues the variant the first time and counts the draw.
+  PhongShadingDemoShaderProg *Get(const PhongVariantKey &key);
+  // Charges the GPU time of the following draws to program, a variant or
+  // the uber shader. Call whenever the bound program changes.
+  void SetTimedProgram(PhongShadingDemoShaderProg *program);
+  // Call after the last draw of the frame.
+  void EndFrame();
+  // Deletes every variant, e.g. before the uber shader is reloaded.
+  void Clear();
+
+  // Off, the renderer draws everything with the uber shader.
+  void SetEnabled(const bool on) { enabled = on; }
+  bool IsEnabled() const { return enabled; }
+  void SetMaxCompilesPerFrame(const int count) { maxCompilesPerFrame = count; }
+  const PhongVariantStats &GetStats() const { return stats; }
+  // Stats and every program with its draws and GPU time.
+  void WriteJson(JsonWriter &json) const;
+  void DrawDebugPanel();
+
+ private:
+  // PhongVariants Private Methods.
+  enum class State { Queued, Compiling, Ready, Failed };
+
+  void StartCompile(const int index);
+  void FinishCompile(const int index);
+  void ResolveTimes(const int slot);
+  GLuint AcquireQuery();
+
+  // PhongVariants Private Data.
+  struct Variant {
+    std::string name;
+    std::string defines;
+    // Owned, except for the uber shader at index 0; nullptr while queued.
+    PhongShadingDemoShaderProg *program;
+    State state;
+    std::chrono::steady_clock::time_point requested;
+    // From the first request to ready, and the CPU time it took.
+    double latencyMs;
+    double compileMs;
+    // Draws of the last frame; GPU time of the last frame read back and
+    // the average over the frames it drew in.
+    int draws;
+    double gpuMs;
+    double gpuMsSum;
+    int gpuFrames;
+  };
+  // Timestamps of one frame; the draws between stamps[k] and
+  // stamps[k + 1] belong to variants[owners[k]], none if it is -1.
+  struct FrameTimes {
+    std::vector<GLuint> stamps;
+    std::vector<int> owners;
+  };
+
+  static const int kFrames = 4;
+
+  PhongShadingDemoShaderProg *uber;
+  std::string vsFilePath;
+  std::string fsFilePath;
+  std::vector<Variant> variants;
+  std::unordered_map<uint32_t, int> keyIndices;
+  std::unordered_map<const PhongShadingDemoShaderProg *, int> programIndices;
+  std::vector<int> queue;
+  std::vector<int> compiling;
+  bool enabled = true;
+  int maxCompilesPerFrame = 2;
+  FrameTimes frames[kFrames];
+  int frame = 0;
+  std::vector<GLuint> freeQueries;
+  PhongVariantStats stats;
+};
+
+#endif
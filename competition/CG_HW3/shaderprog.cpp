@@ -1,7 +1,86 @@
 #include "shaderprog.h"
 
+#include <chrono>
+#include <cstring>
+
+#include "file_cache.h"
+#include "headless.h"
+#include "json_writer.h"
+#include "memory_tracker.h"
+#include "timing.h"
+
 #define MAX_BUFFER_SIZE 1024
 
+ProgramBinaryCache ShaderProg::binaryCache = ProgramBinaryCache::On;
+ShaderLoadStats ShaderProg::loadStats;
+
+// Bump when the file layout changes.
+static const uint32_t kBinaryVersion = 1;
+static const char kBinaryMagic[4] = {'P', 'B', 'I', 'N'};
+
+struct ProgramBinaryHeader {
+  char magic[4];
+  uint32_t version;
+  // The GLenum glGetProgramBinary returned, and the binary's size.
+  uint32_t format;
+  uint32_t size;
+};
+
+// Some drivers expose the entry points with no binary formats.
+static bool SupportsProgramBinaries() {
+  static const bool supported = [] {
+    if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+      return false;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+  }();
+  return supported;
+}
+
+// Lets the driver compile on its own threads. Checked (and set up) once.
+static bool SupportsParallelCompile() {
+  static const bool supported = [] {
+    if (GLEW_KHR_parallel_shader_compile) {
+      glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+      return true;
+    }
+    if (GLEW_ARB_parallel_shader_compile) {
+      glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+      return true;
+    }
+    return false;
+  }();
+  return supported;
+}
+
+// Puts text on the line after #version, which has to stay first.
+static void InsertDefines(std::string &source, const std::string &text) {
+  const size_t version = source.find("#version");
+  if (version == std::string::npos) {
+    source.insert(0, text);
+    return;
+  }
+  const size_t end = source.find('\n', version);
+  if (end == std::string::npos) {
+    source += "\n" + text;
+  } else {
+    source.insert(end + 1, text);
+  }
+}
+
+static std::string GetDriverString() {
+  std::string driver;
+  const GLenum names[3] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+  for (const GLenum name : names) {
+    const GLubyte *value = glGetString(name);
+    driver += value != nullptr ? (const char *)value : "";
+    driver += '\n';
+  }
+  return driver;
+}
+
 ShaderProg::ShaderProg() {
   // Create OpenGL shader program.
   shaderProgId = glCreateProgram();
@@ -17,10 +96,24 @@ ShaderProg::ShaderProg() {
   locNumAreaLights = -1;  // 初始化區域光數量
 }
 
-ShaderProg::~ShaderProg() { glDeleteProgram(shaderProgId); }
+ShaderProg::~ShaderProg() {
+  MemoryTracker::Get().Remove(this);
+  if (loading) {
+    // Deleting 0 (a binary load) is ignored.
+    glDeleteShader(pending.vsId);
+    glDeleteShader(pending.fsId);
+  }
+  glDeleteProgram(shaderProgId);
+}
 
 bool ShaderProg::LoadFromFiles(const std::string vsFilePath,
                                const std::string fsFilePath) {
+  return StartLoad(vsFilePath, fsFilePath) && FinishLoad();
+}
+
+bool ShaderProg::StartLoad(const std::string &vsFilePath,
+                           const std::string &fsFilePath) {
+  auto start = std::chrono::steady_clock::now();
   // Load the vertex shader from a source file and attach it to the shader
   // program.
   std::string vs, fs;
@@ -29,7 +122,6 @@ bool ShaderProg::LoadFromFiles(const std::string vsFilePath,
               << std::endl;
     return false;
   }
-  GLuint vsId = AddShader(vs, GL_VERTEX_SHADER);
 
   // Load the fragment shader from a source file and attach it to the shader
   // program.
@@ -38,13 +130,124 @@ bool ShaderProg::LoadFromFiles(const std::string vsFilePath,
               << std::endl;
     return false;
   };
-  GLuint fsId = AddShader(fs, GL_FRAGMENT_SHADER);
+  if (!defines.empty()) {
+    InsertDefines(vs, defines);
+    InsertDefines(fs, defines);
+  }
+  loadStats.programs++;
+  pending = PendingLoad();
+  pending.name = vsFilePath + " + " + fsFilePath;
+  pending.sourceBytes = vs.size() + fs.size();
+  loading = true;
+
+  // Binaries only load on the driver that wrote them, so its strings are
+  // part of the key.
+  if (binaryCache != ProgramBinaryCache::Off && SupportsProgramBinaries()) {
+    uint64_t key = FileCache::Hash(vs.data(), vs.size());
+    key = FileCache::Hash(fs.data(), fs.size(), key);
+    const std::string driver = GetDriverString();
+    key = FileCache::Hash(driver.data(), driver.size(), key);
+    key = FileCache::Hash(&kBinaryVersion, sizeof(kBinaryVersion), key);
+    pending.cachePath = FileCache::GetCachePath(vsFilePath, key, ".progbin");
+  }
+
+  if (binaryCache == ProgramBinaryCache::On && !pending.cachePath.empty() &&
+      std::filesystem::exists(pending.cachePath)) {
+    auto binaryStart = std::chrono::steady_clock::now();
+    pending.fromBinary = LoadBinary(pending.cachePath);
+    loadStats.binaryMs += MsSince(binaryStart);
+    if (pending.fromBinary) {
+      loadStats.binaryHits++;
+    } else {
+      loadStats.binaryRejected++;
+      std::cerr << "[WARNING] Stale program binary " << pending.cachePath
+                << ", compiling " << vsFilePath << std::endl;
+    }
+  }
+  if (!pending.fromBinary) {
+    auto compileStart = std::chrono::steady_clock::now();
+    CompileAndLink(vs, fs);
+    loadStats.compileMs += MsSince(compileStart);
+  }
+  loadStats.totalMs += MsSince(start);
+  return true;
+}
+
+bool ShaderProg::IsLoadDone() const {
+  if (!loading || pending.fromBinary || !SupportsParallelCompile()) {
+    return true;
+  }
+  GLint done = GL_TRUE;
+  glGetProgramiv(shaderProgId, GL_COMPLETION_STATUS_KHR, &done);
+  return done == GL_TRUE;
+}
+
+bool ShaderProg::FinishLoad() {
+  if (!loading) {
+    return false;
+  }
+  loading = false;
+  auto start = std::chrono::steady_clock::now();
+  if (!pending.fromBinary) {
+    if (!FinishLink()) {
+      return false;
+    }
+    loadStats.compileMs += MsSince(start);
+    if (!pending.cachePath.empty()) {
+      StoreBinary(pending.cachePath);
+    }
+  }
+
+  // Update the location of uniform variables.
+  GetUniformVariableLocation();
 
+  // Programs keep no CPU copy. On the GPU the driver's binary is the best
+  // estimate there is; without program binaries the source size stands in.
+  GLint binaryBytes = (GLint)pending.sourceBytes;
+  if (SupportsProgramBinaries()) {
+    glGetProgramiv(shaderProgId, GL_PROGRAM_BINARY_LENGTH, &binaryBytes);
+  }
+  MemoryTracker::Get().Update(this, MemoryTag::Shader, pending.name, 0,
+                              (long long)binaryBytes);
+
+  loadStats.totalMs += MsSince(start);
+  return true;
+}
+
+void ShaderProg::CompileAndLink(const std::string &vs, const std::string &fs) {
+  // Sets the compiler threads up before the first compile.
+  SupportsParallelCompile();
+  pending.vsId = AddShader(vs, GL_VERTEX_SHADER);
+  pending.fsId = AddShader(fs, GL_FRAGMENT_SHADER);
+  if (SupportsProgramBinaries()) {
+    glProgramParameteri(shaderProgId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+  }
   // Link and compile shader programs.
+  glLinkProgram(shaderProgId);
+}
+
+bool ShaderProg::FinishLink() {
+  // A failed link is explained by the compile logs, if one failed. The
+  // caller decides what a failure means; a lazily built variant falls back
+  // to the uber shader.
+  const bool compiled = CheckShader(pending.vsId, GL_VERTEX_SHADER) &&
+                        CheckShader(pending.fsId, GL_FRAGMENT_SHADER);
   GLint success = 0;
   GLchar errorLog[MAX_BUFFER_SIZE] = {0};
-  glLinkProgram(shaderProgId);
-  glGetProgramiv(shaderProgId, GL_LINK_STATUS, &success);
+  if (compiled) {
+    glGetProgramiv(shaderProgId, GL_LINK_STATUS, &success);
+  }
+
+  // The program keeps the stage information once linked, and a failed
+  // build has no use for the shaders either.
+  glDeleteShader(pending.vsId);
+  glDeleteShader(pending.fsId);
+  pending.vsId = 0;
+  pending.fsId = 0;
+  if (!compiled) {
+    return false;
+  }
   if (success == 0) {
     glGetProgramInfoLog(shaderProgId, sizeof(errorLog), NULL, errorLog);
     std::cerr << "[ERROR] Failed to link shader program: " << errorLog
@@ -52,11 +255,6 @@ bool ShaderProg::LoadFromFiles(const std::string vsFilePath,
     return false;
   }
 
-  // Now the program already has all stage information, we can delete the
-  // shaders now.
-  glDeleteShader(vsId);
-  glDeleteShader(fsId);
-
   // Validate program.
   glValidateProgram(shaderProgId);
   glGetProgramiv(shaderProgId, GL_VALIDATE_STATUS, &success);
@@ -65,11 +263,115 @@ bool ShaderProg::LoadFromFiles(const std::string vsFilePath,
     std::cerr << "[ERROR] Invalid shader program: " << errorLog << std::endl;
     return false;
   }
+  return true;
+}
 
-  // Update the location of uniform variables.
-  GetUniformVariableLocation();
+bool ShaderProg::LoadBinary(const std::string &cachePath) {
+  std::vector<char> data;
+  ProgramBinaryHeader header;
+  bool ok = FileCache::ReadFile(cachePath, data) &&
+            data.size() >= sizeof(header);
+  if (ok) {
+    std::memcpy(&header, data.data(), sizeof(header));
+    ok = std::memcmp(header.magic, kBinaryMagic, 4) == 0 &&
+         header.version == kBinaryVersion &&
+         data.size() == sizeof(header) + header.size;
+  }
+  if (ok) {
+    glProgramBinary(shaderProgId, (GLenum)header.format,
+                    data.data() + sizeof(header), (GLsizei)header.size);
+    GLint success = 0;
+    glGetProgramiv(shaderProgId, GL_LINK_STATUS, &success);
+    ok = success != 0;
+  }
+  if (!ok) {
+    // Start over with a program that has seen no binary.
+    glDeleteProgram(shaderProgId);
+    shaderProgId = glCreateProgram();
+  }
+  return ok;
+}
 
-  return true;
+void ShaderProg::StoreBinary(const std::string &cachePath) {
+  GLint length = 0;
+  glGetProgramiv(shaderProgId, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<char> data(sizeof(ProgramBinaryHeader) + length);
+  GLenum format = 0;
+  GLsizei written = 0;
+  glGetProgramBinary(shaderProgId, length, &written, &format,
+                     data.data() + sizeof(ProgramBinaryHeader));
+  if (written <= 0) {
+    return;
+  }
+  ProgramBinaryHeader header;
+  std::memcpy(header.magic, kBinaryMagic, 4);
+  header.version = kBinaryVersion;
+  header.format = (uint32_t)format;
+  header.size = (uint32_t)written;
+  std::memcpy(data.data(), &header, sizeof(header));
+  data.resize(sizeof(header) + written);
+  if (FileCache::WriteFile(cachePath, data.data(), data.size())) {
+    loadStats.binariesStored++;
+  } else {
+    std::cerr << "[WARNING] Failed to write " << cachePath << std::endl;
+  }
+}
+
+// One configuration of the shader benchmark.
+struct ShaderBenchmarkRun {
+  const char *name;
+  ProgramBinaryCache cache;
+};
+
+int ShaderProg::RunHeadlessBenchmark(
+    const HeadlessOptions &options, const std::string &contextApi,
+    const std::function<void()> &createLibrary,
+    const std::function<void()> &deleteLibrary) {
+  const ShaderBenchmarkRun runs[] = {
+      {"source", ProgramBinaryCache::Off},
+      {"cold", ProgramBinaryCache::Rebuild},
+      {"warm", ProgramBinaryCache::On},
+  };
+
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("contextApi", contextApi);
+  json.Field("renderer",
+             std::string((const char *)glGetString(GL_RENDERER)));
+  json.Field("version", std::string((const char *)glGetString(GL_VERSION)));
+  json.Key("runs");
+  json.BeginArray();
+  for (const ShaderBenchmarkRun &run : runs) {
+    deleteLibrary();
+    SetBinaryCache(run.cache);
+    ResetLoadStats();
+    auto start = std::chrono::steady_clock::now();
+    createLibrary();
+    glFinish();
+    const double startupMs = MsSince(start);
+    json.BeginObject();
+    json.Field("mode", run.name);
+    json.Field("startupMs", startupMs);
+    json.Field("programs", loadStats.programs);
+    json.Field("binaryHits", loadStats.binaryHits);
+    json.Field("binaryRejected", loadStats.binaryRejected);
+    json.Field("binariesStored", loadStats.binariesStored);
+    json.Field("compileMs", loadStats.compileMs);
+    json.Field("binaryMs", loadStats.binaryMs);
+    json.Field("loadMs", loadStats.totalMs);
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+  file << std::endl;
+  return 0;
 }
 
 void ShaderProg::GetUniformVariableLocation() {
@@ -84,6 +386,9 @@ void ShaderProg::GetUniformVariableLocation() {
     dirLightLocations[i].radiance = glGetUniformLocation(
         shaderProgId,
         ("dirLights[" + std::to_string(i) + "].radiance").c_str());
+    dirLightLocations[i].isStatic = glGetUniformLocation(
+        shaderProgId,
+        ("dirLights[" + std::to_string(i) + "].isStatic").c_str());
   }
 
   // 點光源
@@ -107,6 +412,9 @@ void ShaderProg::GetUniformVariableLocation() {
     pointLightLocations[i].decayStart = glGetUniformLocation(
         shaderProgId,
         ("pointLights[" + std::to_string(i) + "].decayStart").c_str());
+    pointLightLocations[i].isStatic = glGetUniformLocation(
+        shaderProgId,
+        ("pointLights[" + std::to_string(i) + "].isStatic").c_str());
   }
 
   // 聚光燈
@@ -138,6 +446,9 @@ void ShaderProg::GetUniformVariableLocation() {
     spotLightLocations[i].decayStart = glGetUniformLocation(
         shaderProgId,
         ("spotLights[" + std::to_string(i) + "].decayStart").c_str());
+    spotLightLocations[i].isStatic = glGetUniformLocation(
+        shaderProgId,
+        ("spotLights[" + std::to_string(i) + "].isStatic").c_str());
   }
 
   // 區域光
@@ -170,6 +481,9 @@ void ShaderProg::GetUniformVariableLocation() {
     areaLightLocations[i].decayStart = glGetUniformLocation(
         shaderProgId,
         ("areaLights[" + std::to_string(i) + "].decayStart").c_str());
+    areaLightLocations[i].isStatic = glGetUniformLocation(
+        shaderProgId,
+        ("areaLights[" + std::to_string(i) + "].isStatic").c_str());
   }
 }
 
@@ -187,7 +501,12 @@ GLuint ShaderProg::AddShader(const std::string &sourceText, GLenum shaderType) {
   lengths[0] = (GLint)(sourceText.length());
   glShaderSource(shaderObj, 1, p, lengths);
   glCompileShader(shaderObj);
+  glAttachShader(shaderProgId, shaderObj);
 
+  return shaderObj;
+}
+
+bool ShaderProg::CheckShader(const GLuint shaderObj, const GLenum shaderType) {
   GLint success;
   glGetShaderiv(shaderObj, GL_COMPILE_STATUS, &success);
   if (!success) {
@@ -195,12 +514,9 @@ GLuint ShaderProg::AddShader(const std::string &sourceText, GLenum shaderType) {
     glGetShaderInfoLog(shaderObj, MAX_BUFFER_SIZE, NULL, infoLog);
     std::cerr << "[ERROR] Failed to compile shader with type: " << shaderType
               << ". Info: " << infoLog << std::endl;
-    exit(1);
+    return false;
   }
-
-  glAttachShader(shaderProgId, shaderObj);
-
-  return shaderObj;
+  return true;
 }
 
 bool ShaderProg::LoadShaderTextFromFile(const std::string filePath,
@@ -234,6 +550,7 @@ void FillColorShaderProg::GetUniformVariableLocation() {
 PhongShadingDemoShaderProg::PhongShadingDemoShaderProg() {
   locM = -1;
   locV = -1;
+  locLightWorld = -1;
   locNM = -1;
   locCameraPos = -1;
   locKa = -1;
@@ -247,6 +564,26 @@ PhongShadingDemoShaderProg::PhongShadingDemoShaderProg() {
   locOnSpecularLight = -1;
   locMapKd = -1;
   locMapKs = -1;
+  locOnShadow = -1;
+  locShadowMap = -1;
+  locNumCascades = -1;
+  locCascadeSplits = -1;
+  locCascadeLightVP = -1;
+  locShadowAtlas = -1;
+  locPointShadowRects = -1;
+  locPointShadowPosRange = -1;
+  locSpotShadowVP = -1;
+  locSpotShadowRects = -1;
+  locSpotShadowPosRange = -1;
+  locUseLightmap = -1;
+  locLightmap = -1;
+  locUseProbes = -1;
+  locProbeSH = -1;
+  locProbeGridRes = -1;
+  locProbeGridMatrix = -1;
+  locProbeNormalMatrix = -1;
+  locUseInstancing = -1;
+  locViewProj = -1;
 }
 
 PhongShadingDemoShaderProg::~PhongShadingDemoShaderProg() {}
@@ -255,6 +592,7 @@ void PhongShadingDemoShaderProg::GetUniformVariableLocation() {
   ShaderProg::GetUniformVariableLocation();
   locM = glGetUniformLocation(shaderProgId, "worldMatrix");
   locV = glGetUniformLocation(shaderProgId, "viewMatrix");
+  locLightWorld = glGetUniformLocation(shaderProgId, "lightWorldMatrix");
   locNM = glGetUniformLocation(shaderProgId, "normalMatrix");
   locCameraPos = glGetUniformLocation(shaderProgId, "cameraPos");
   locKa = glGetUniformLocation(shaderProgId, "Ka");
@@ -268,6 +606,129 @@ void PhongShadingDemoShaderProg::GetUniformVariableLocation() {
   locOnSpecularLight = glGetUniformLocation(shaderProgId, "onSpecularLight");
   locMapKd = glGetUniformLocation(shaderProgId, "mapKd");
   locMapKs = glGetUniformLocation(shaderProgId, "mapKs");
+  locOnShadow = glGetUniformLocation(shaderProgId, "onShadow");
+  locShadowMap = glGetUniformLocation(shaderProgId, "shadowMap");
+  locNumCascades = glGetUniformLocation(shaderProgId, "numCascades");
+  locCascadeSplits = glGetUniformLocation(shaderProgId, "cascadeSplits");
+  locCascadeLightVP = glGetUniformLocation(shaderProgId, "cascadeLightVP");
+  locShadowAtlas = glGetUniformLocation(shaderProgId, "shadowAtlas");
+  locPointShadowRects = glGetUniformLocation(shaderProgId, "pointShadowRects");
+  locPointShadowPosRange =
+      glGetUniformLocation(shaderProgId, "pointShadowPosRange");
+  locSpotShadowVP = glGetUniformLocation(shaderProgId, "spotShadowVP");
+  locSpotShadowRects = glGetUniformLocation(shaderProgId, "spotShadowRects");
+  locSpotShadowPosRange =
+      glGetUniformLocation(shaderProgId, "spotShadowPosRange");
+  locUseLightmap = glGetUniformLocation(shaderProgId, "useLightmap");
+  locLightmap = glGetUniformLocation(shaderProgId, "lightmap");
+  locUseProbes = glGetUniformLocation(shaderProgId, "useProbes");
+  locProbeSH = glGetUniformLocation(shaderProgId, "probeSH");
+  locProbeGridRes = glGetUniformLocation(shaderProgId, "probeGridRes");
+  locProbeGridMatrix = glGetUniformLocation(shaderProgId, "probeGridMatrix");
+  locProbeNormalMatrix =
+      glGetUniformLocation(shaderProgId, "probeNormalMatrix");
+  locUseInstancing = glGetUniformLocation(shaderProgId, "useInstancing");
+  locViewProj = glGetUniformLocation(shaderProgId, "viewProjMatrix");
+  GLuint skyAmbientBlock = glGetUniformBlockIndex(shaderProgId, "SkyAmbient");
+  if (skyAmbientBlock != GL_INVALID_INDEX) {
+    glUniformBlockBinding(shaderProgId, skyAmbientBlock, SKY_AMBIENT_BINDING);
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+DeferredLightShaderProg::DeferredLightShaderProg() {
+  locGAlbedo = -1;
+  locGSpecular = -1;
+  locGNormal = -1;
+  locGIndirect = -1;
+  locGDepth = -1;
+  locInvProj = -1;
+  locInvView = -1;
+  locAddIndirect = -1;
+  locFirstPointLight = -1;
+  locFirstSpotLight = -1;
+}
+
+DeferredLightShaderProg::~DeferredLightShaderProg() {}
+
+void DeferredLightShaderProg::GetUniformVariableLocation() {
+  PhongShadingDemoShaderProg::GetUniformVariableLocation();
+  locGAlbedo = glGetUniformLocation(shaderProgId, "gAlbedo");
+  locGSpecular = glGetUniformLocation(shaderProgId, "gSpecular");
+  locGNormal = glGetUniformLocation(shaderProgId, "gNormal");
+  locGIndirect = glGetUniformLocation(shaderProgId, "gIndirect");
+  locGDepth = glGetUniformLocation(shaderProgId, "gDepth");
+  locInvProj = glGetUniformLocation(shaderProgId, "invProjMatrix");
+  locInvView = glGetUniformLocation(shaderProgId, "invViewMatrix");
+  locAddIndirect = glGetUniformLocation(shaderProgId, "addIndirect");
+  locFirstPointLight = glGetUniformLocation(shaderProgId, "firstPointLight");
+  locFirstSpotLight = glGetUniformLocation(shaderProgId, "firstSpotLight");
+}
+
+// ------------------------------------------------------------------------------------------------
+
+VisibilityShaderProg::VisibilityShaderProg() {
+  locViewProj = -1;
+  locDrawBase = -1;
+  locDraws = -1;
+  locObjects = -1;
+}
+
+VisibilityShaderProg::~VisibilityShaderProg() {}
+
+void VisibilityShaderProg::GetUniformVariableLocation() {
+  ShaderProg::GetUniformVariableLocation();
+  locViewProj = glGetUniformLocation(shaderProgId, "viewProjMatrix");
+  locDrawBase = glGetUniformLocation(shaderProgId, "drawBase");
+  locDraws = glGetUniformLocation(shaderProgId, "draws");
+  locObjects = glGetUniformLocation(shaderProgId, "objects");
+}
+
+// ------------------------------------------------------------------------------------------------
+
+VisibilityDepthShaderProg::VisibilityDepthShaderProg() {
+  locVisibility = -1;
+  locDraws = -1;
+  locSceneDepth = -1;
+  locWriteSceneDepth = -1;
+}
+
+VisibilityDepthShaderProg::~VisibilityDepthShaderProg() {}
+
+void VisibilityDepthShaderProg::GetUniformVariableLocation() {
+  ShaderProg::GetUniformVariableLocation();
+  locVisibility = glGetUniformLocation(shaderProgId, "visibility");
+  locDraws = glGetUniformLocation(shaderProgId, "draws");
+  locSceneDepth = glGetUniformLocation(shaderProgId, "sceneDepth");
+  locWriteSceneDepth = glGetUniformLocation(shaderProgId, "writeSceneDepth");
+}
+
+// ------------------------------------------------------------------------------------------------
+
+VisibilityResolveShaderProg::VisibilityResolveShaderProg() {
+  locResolveMaterial = -1;
+  locVisibility = -1;
+  locVertices = -1;
+  locIndices = -1;
+  locLightmapUVs = -1;
+  locDraws = -1;
+  locObjects = -1;
+  locInvProj = -1;
+}
+
+VisibilityResolveShaderProg::~VisibilityResolveShaderProg() {}
+
+void VisibilityResolveShaderProg::GetUniformVariableLocation() {
+  PhongShadingDemoShaderProg::GetUniformVariableLocation();
+  locResolveMaterial = glGetUniformLocation(shaderProgId, "resolveMaterial");
+  locVisibility = glGetUniformLocation(shaderProgId, "visibility");
+  locVertices = glGetUniformLocation(shaderProgId, "vertices");
+  locIndices = glGetUniformLocation(shaderProgId, "indices");
+  locLightmapUVs = glGetUniformLocation(shaderProgId, "lightmapUVs");
+  locDraws = glGetUniformLocation(shaderProgId, "draws");
+  locObjects = glGetUniformLocation(shaderProgId, "objects");
+  locInvProj = glGetUniformLocation(shaderProgId, "invProjMatrix");
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -279,4 +740,41 @@ SkyboxShaderProg::~SkyboxShaderProg() {}
 void SkyboxShaderProg::GetUniformVariableLocation() {
   ShaderProg::GetUniformVariableLocation();
   locMapKd = glGetUniformLocation(shaderProgId, "mapKd");
-}
\ No newline at end of file
+}
+// ------------------------------------------------------------------------------------------------
+
+SkyboxCubeShaderProg::SkyboxCubeShaderProg() {
+  locInvViewProj = -1;
+  locMapCube = -1;
+}
+
+SkyboxCubeShaderProg::~SkyboxCubeShaderProg() {}
+
+void SkyboxCubeShaderProg::GetUniformVariableLocation() {
+  ShaderProg::GetUniformVariableLocation();
+  locInvViewProj = glGetUniformLocation(shaderProgId, "invViewProj");
+  locMapCube = glGetUniformLocation(shaderProgId, "mapCube");
+}
+
+// ------------------------------------------------------------------------------------------------
+
+ShadowDepthShaderProg::ShadowDepthShaderProg() {}
+
+ShadowDepthShaderProg::~ShadowDepthShaderProg() {}
+
+// ------------------------------------------------------------------------------------------------
+
+ShadowAtlasDepthShaderProg::ShadowAtlasDepthShaderProg() {
+  locWorldMatrix = -1;
+  locLightPos = -1;
+  locLightRange = -1;
+}
+
+ShadowAtlasDepthShaderProg::~ShadowAtlasDepthShaderProg() {}
+
+void ShadowAtlasDepthShaderProg::GetUniformVariableLocation() {
+  ShaderProg::GetUniformVariableLocation();
+  locWorldMatrix = glGetUniformLocation(shaderProgId, "worldMatrix");
+  locLightPos = glGetUniformLocation(shaderProgId, "lightPos");
+  locLightRange = glGetUniformLocation(shaderProgId, "lightRange");
+}
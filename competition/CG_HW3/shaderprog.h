@@ -2,11 +2,15 @@
 #define SHADER_PROGRAM_H
 
 #include "headers.h"
+#include "program_binary_cache.h"
+
+struct HeadlessOptions;
 
 // 光源結構體
 struct DirectionalLightLocation {
   GLint direction;
   GLint radiance;
+  GLint isStatic;
 };
 
 struct PointLightLocation {
@@ -16,6 +20,7 @@ struct PointLightLocation {
   GLint linear;
   GLint quadratic;
   GLint decayStart;
+  GLint isStatic;
 };
 
 struct SpotLightLocation {
@@ -28,6 +33,7 @@ struct SpotLightLocation {
   GLint linear;
   GLint quadratic;
   GLint decayStart;
+  GLint isStatic;
 };
 
 // 最大光源數量
@@ -35,6 +41,10 @@ struct SpotLightLocation {
 #define MAX_POINT_LIGHTS 8
 #define MAX_SPOT_LIGHTS 8
 #define MAX_AREA_LIGHTS 4  // 新增最大區域光源數量
+// 方向光陰影的 cascade 數量
+#define MAX_CASCADES 4
+// Uniform buffer binding point of the SkyAmbient block.
+#define SKY_AMBIENT_BINDING 0
 
 // 新增 AreaLightLocation 結構體
 struct AreaLightLocation {
@@ -48,6 +58,21 @@ struct AreaLightLocation {
   GLint linear;
   GLint quadratic;
   GLint decayStart;
+  GLint isStatic;
+};
+
+// Totals over the programs loaded since the last ResetLoadStats.
+struct ShaderLoadStats {
+  int programs = 0;
+  int binaryHits = 0;
+  // Stored binaries the driver refused, e.g. after a driver update.
+  int binaryRejected = 0;
+  int binariesStored = 0;
+  // Compile, link and validate; reading and loading binaries (rejected
+  // ones included); and the whole LoadFromFiles calls.
+  double compileMs = 0.0;
+  double binaryMs = 0.0;
+  double totalMs = 0.0;
 };
 
 // ShaderProg 宣告
@@ -57,13 +82,46 @@ class ShaderProg {
   ShaderProg();
   virtual ~ShaderProg();
 
+  // Compiles and links the two stages, or reloads the program binary of
+  // the same sources on the same driver (see ProgramBinaryCache).
   bool LoadFromFiles(const std::string vsFilePath,
                      const std::string fsFilePath);
+  // LoadFromFiles in two halves, so that compiles can overlap with
+  // rendering: StartLoad hands the sources to the driver, FinishLoad checks
+  // the result and looks up the uniforms. With a parallel_shader_compile
+  // extension the driver compiles on its own threads and IsLoadDone tells
+  // when FinishLoad will not block; without one it is always true.
+  bool StartLoad(const std::string &vsFilePath, const std::string &fsFilePath);
+  bool IsLoadDone() const;
+  bool FinishLoad();
+  // Lines inserted after the #version line of both stages, e.g. the
+  // "#define"s of a shader variant. Set before loading.
+  void SetDefines(const std::string &text) { defines = text; }
   void Bind() { glUseProgram(shaderProgId); };
   void UnBind() { glUseProgram(0); };
 
   GLint GetLocMVP() const { return locMVP; }
 
+  // Applies to programs loaded afterwards. Needs GL 4.1 or
+  // ARB_get_program_binary with at least one binary format; otherwise
+  // every program is compiled.
+  static void SetBinaryCache(const ProgramBinaryCache mode) {
+    binaryCache = mode;
+  }
+  static ProgramBinaryCache GetBinaryCache() { return binaryCache; }
+  static const ShaderLoadStats &GetLoadStats() { return loadStats; }
+  static void ResetLoadStats() { loadStats = ShaderLoadStats(); }
+
+  // Calls createLibrary from source, then compiling and storing every
+  // binary (cold cache), then from the stored binaries (warm cache), with
+  // deleteLibrary before each, and writes the startup time of each to the
+  // report. The driver's own shader cache, if it has one, is not cleared,
+  // so the source runs can be warm too.
+  static int RunHeadlessBenchmark(const HeadlessOptions &options,
+                                  const std::string &contextApi,
+                                  const std::function<void()> &createLibrary,
+                                  const std::function<void()> &deleteLibrary);
+
   // ShaderProg Protected Methods.
   virtual void GetUniformVariableLocation();
 
@@ -86,12 +144,38 @@ class ShaderProg {
 
  private:
   // ShaderProg Private Methods.
+  // Returns the shader without waiting for the compile; see CheckShader.
   GLuint AddShader(const std::string &sourceText, GLenum shaderType);
+  static bool CheckShader(const GLuint shaderObj, const GLenum shaderType);
   static bool LoadShaderTextFromFile(const std::string filePath,
                                      std::string &sourceText);
+  // Starts the compiles and the link; FinishLink waits for them.
+  void CompileAndLink(const std::string &vs, const std::string &fs);
+  bool FinishLink();
+  // Links the program from a stored binary. On failure the program is
+  // recreated empty, ready for CompileAndLink.
+  bool LoadBinary(const std::string &cachePath);
+  void StoreBinary(const std::string &cachePath);
 
   // ShaderProg Private Data.
   GLint locMVP;
+  std::string defines;
+
+  // State of a load between StartLoad and FinishLoad.
+  struct PendingLoad {
+    std::string name;
+    std::string cachePath;
+    GLuint vsId = 0;
+    GLuint fsId = 0;
+    bool fromBinary = false;
+    // Source size, standing in for the program's memory.
+    size_t sourceBytes = 0;
+  };
+  PendingLoad pending;
+  bool loading = false;
+
+  static ProgramBinaryCache binaryCache;
+  static ShaderLoadStats loadStats;
 };
 
 // ------------------------------------------------------------------------------------------------
@@ -126,6 +210,7 @@ class PhongShadingDemoShaderProg : public ShaderProg {
   // Getter 方法
   GLint GetLocM() const { return locM; }
   GLint GetLocV() const { return locV; }
+  GLint GetLocLightWorld() const { return locLightWorld; }
   GLint GetLocNM() const { return locNM; }
   GLint GetLocCameraPos() const { return locCameraPos; }
   GLint GetLocKa() const { return locKa; }
@@ -139,6 +224,26 @@ class PhongShadingDemoShaderProg : public ShaderProg {
   GLint GetLocOnAmbientLight() const { return locOnAmbientLight; }
   GLint GetLocOnDiffuseLight() const { return locOnDiffuseLight; }
   GLint GetLocOnSpecularLight() const { return locOnSpecularLight; }
+  GLint GetLocOnShadow() const { return locOnShadow; }
+  GLint GetLocShadowMap() const { return locShadowMap; }
+  GLint GetLocNumCascades() const { return locNumCascades; }
+  GLint GetLocCascadeSplits() const { return locCascadeSplits; }
+  GLint GetLocCascadeLightVP() const { return locCascadeLightVP; }
+  GLint GetLocShadowAtlas() const { return locShadowAtlas; }
+  GLint GetLocPointShadowRects() const { return locPointShadowRects; }
+  GLint GetLocPointShadowPosRange() const { return locPointShadowPosRange; }
+  GLint GetLocSpotShadowVP() const { return locSpotShadowVP; }
+  GLint GetLocSpotShadowRects() const { return locSpotShadowRects; }
+  GLint GetLocSpotShadowPosRange() const { return locSpotShadowPosRange; }
+  GLint GetLocUseLightmap() const { return locUseLightmap; }
+  GLint GetLocLightmap() const { return locLightmap; }
+  GLint GetLocUseProbes() const { return locUseProbes; }
+  GLint GetLocProbeSH() const { return locProbeSH; }
+  GLint GetLocProbeGridRes() const { return locProbeGridRes; }
+  GLint GetLocProbeGridMatrix() const { return locProbeGridMatrix; }
+  GLint GetLocProbeNormalMatrix() const { return locProbeNormalMatrix; }
+  GLint GetLocUseInstancing() const { return locUseInstancing; }
+  GLint GetLocViewProj() const { return locViewProj; }
 
  protected:
   // PhongShadingDemoShaderProg Protected Methods.
@@ -149,6 +254,7 @@ class PhongShadingDemoShaderProg : public ShaderProg {
   // Transformation matrix.
   GLint locM;
   GLint locV;
+  GLint locLightWorld;
   GLint locNM;
   GLint locCameraPos;
   // Material properties.
@@ -165,6 +271,163 @@ class PhongShadingDemoShaderProg : public ShaderProg {
   // Texture data.
   GLint locMapKd;
   GLint locMapKs;
+  // Cascaded shadow map data.
+  GLint locOnShadow;
+  GLint locShadowMap;
+  GLint locNumCascades;
+  GLint locCascadeSplits;
+  GLint locCascadeLightVP;
+
+  GLint locShadowAtlas;
+  GLint locPointShadowRects;
+  GLint locPointShadowPosRange;
+  GLint locSpotShadowVP;
+  GLint locSpotShadowRects;
+  GLint locSpotShadowPosRange;
+
+  GLint locUseLightmap;
+  GLint locLightmap;
+
+  GLint locUseProbes;
+  GLint locProbeSH;
+  GLint locProbeGridRes;
+  GLint locProbeGridMatrix;
+  GLint locProbeNormalMatrix;
+
+  GLint locUseInstancing;
+  GLint locViewProj;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// DeferredLightShaderProg 宣告.
+// phong_shading_demo.fs built with DEFERRED_LIGHTING: shades the G-buffer of
+// DeferredRenderer with the light loops of the forward shader.
+class DeferredLightShaderProg : public PhongShadingDemoShaderProg {
+ public:
+  // DeferredLightShaderProg Public Methods.
+  DeferredLightShaderProg();
+  virtual ~DeferredLightShaderProg();
+
+  GLint GetLocGAlbedo() const { return locGAlbedo; }
+  GLint GetLocGSpecular() const { return locGSpecular; }
+  GLint GetLocGNormal() const { return locGNormal; }
+  GLint GetLocGIndirect() const { return locGIndirect; }
+  GLint GetLocGDepth() const { return locGDepth; }
+  GLint GetLocInvProj() const { return locInvProj; }
+  GLint GetLocInvView() const { return locInvView; }
+  GLint GetLocAddIndirect() const { return locAddIndirect; }
+  GLint GetLocFirstPointLight() const { return locFirstPointLight; }
+  GLint GetLocFirstSpotLight() const { return locFirstSpotLight; }
+
+ protected:
+  // DeferredLightShaderProg Protected Methods.
+  void GetUniformVariableLocation() override;
+
+ private:
+  // DeferredLightShaderProg Private Data.
+  GLint locGAlbedo;
+  GLint locGSpecular;
+  GLint locGNormal;
+  GLint locGIndirect;
+  GLint locGDepth;
+  GLint locInvProj;
+  GLint locInvView;
+  GLint locAddIndirect;
+  GLint locFirstPointLight;
+  GLint locFirstSpotLight;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// VisibilityShaderProg 宣告.
+// Geometry pass of VisibilityBuffer: writes the draw and triangle of every
+// pixel.
+class VisibilityShaderProg : public ShaderProg {
+ public:
+  // VisibilityShaderProg Public Methods.
+  VisibilityShaderProg();
+  virtual ~VisibilityShaderProg();
+
+  GLint GetLocViewProj() const { return locViewProj; }
+  GLint GetLocDrawBase() const { return locDrawBase; }
+  GLint GetLocDraws() const { return locDraws; }
+  GLint GetLocObjects() const { return locObjects; }
+
+ protected:
+  // VisibilityShaderProg Protected Methods.
+  void GetUniformVariableLocation() override;
+
+ private:
+  // VisibilityShaderProg Private Data.
+  GLint locViewProj;
+  GLint locDrawBase;
+  GLint locDraws;
+  GLint locObjects;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// VisibilityDepthShaderProg 宣告.
+// Fullscreen depth passes of VisibilityBuffer: the material of every pixel
+// before the resolve, the scene depth after it.
+class VisibilityDepthShaderProg : public ShaderProg {
+ public:
+  // VisibilityDepthShaderProg Public Methods.
+  VisibilityDepthShaderProg();
+  virtual ~VisibilityDepthShaderProg();
+
+  GLint GetLocVisibility() const { return locVisibility; }
+  GLint GetLocDraws() const { return locDraws; }
+  GLint GetLocSceneDepth() const { return locSceneDepth; }
+  GLint GetLocWriteSceneDepth() const { return locWriteSceneDepth; }
+
+ protected:
+  // VisibilityDepthShaderProg Protected Methods.
+  void GetUniformVariableLocation() override;
+
+ private:
+  // VisibilityDepthShaderProg Private Data.
+  GLint locVisibility;
+  GLint locDraws;
+  GLint locSceneDepth;
+  GLint locWriteSceneDepth;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// VisibilityResolveShaderProg 宣告.
+// phong_shading_demo.fs built with VISIBILITY_RESOLVE: shades the triangle
+// the visibility buffer holds at each pixel, one material per pass.
+class VisibilityResolveShaderProg : public PhongShadingDemoShaderProg {
+ public:
+  // VisibilityResolveShaderProg Public Methods.
+  VisibilityResolveShaderProg();
+  virtual ~VisibilityResolveShaderProg();
+
+  GLint GetLocResolveMaterial() const { return locResolveMaterial; }
+  GLint GetLocVisibility() const { return locVisibility; }
+  GLint GetLocVertices() const { return locVertices; }
+  GLint GetLocIndices() const { return locIndices; }
+  GLint GetLocLightmapUVs() const { return locLightmapUVs; }
+  GLint GetLocDraws() const { return locDraws; }
+  GLint GetLocObjects() const { return locObjects; }
+  GLint GetLocInvProj() const { return locInvProj; }
+
+ protected:
+  // VisibilityResolveShaderProg Protected Methods.
+  void GetUniformVariableLocation() override;
+
+ private:
+  // VisibilityResolveShaderProg Private Data.
+  GLint locResolveMaterial;
+  GLint locVisibility;
+  GLint locVertices;
+  GLint locIndices;
+  GLint locLightmapUVs;
+  GLint locDraws;
+  GLint locObjects;
+  GLint locInvProj;
 };
 
 // ------------------------------------------------------------------------------------------------
@@ -187,4 +450,63 @@ class SkyboxShaderProg : public ShaderProg {
   GLint locMapKd;
 };
 
+// ------------------------------------------------------------------------------------------------
+
+// SkyboxCubeShaderProg 宣告.
+// Fullscreen-triangle skybox sampling a cube map.
+class SkyboxCubeShaderProg : public ShaderProg {
+ public:
+  // SkyboxCubeShaderProg Public Methods.
+  SkyboxCubeShaderProg();
+  virtual ~SkyboxCubeShaderProg();
+
+  GLint GetLocInvViewProj() const { return locInvViewProj; }
+  GLint GetLocMapCube() const { return locMapCube; }
+
+ protected:
+  // SkyboxCubeShaderProg Protected Methods.
+  void GetUniformVariableLocation() override;
+
+ private:
+  // SkyboxCubeShaderProg Private Data.
+  GLint locInvViewProj;
+  GLint locMapCube;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// ShadowDepthShaderProg 宣告.
+// Position-only depth pass used by the shadow maps.
+class ShadowDepthShaderProg : public ShaderProg {
+ public:
+  // ShadowDepthShaderProg Public Methods.
+  ShadowDepthShaderProg();
+  virtual ~ShadowDepthShaderProg();
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// ShadowAtlasDepthShaderProg 宣告.
+// Writes the linear distance to a point or spot light, divided by its range.
+class ShadowAtlasDepthShaderProg : public ShaderProg {
+ public:
+  // ShadowAtlasDepthShaderProg Public Methods.
+  ShadowAtlasDepthShaderProg();
+  virtual ~ShadowAtlasDepthShaderProg();
+
+  GLint GetLocWorldMatrix() const { return locWorldMatrix; }
+  GLint GetLocLightPos() const { return locLightPos; }
+  GLint GetLocLightRange() const { return locLightRange; }
+
+ protected:
+  // ShadowAtlasDepthShaderProg Protected Methods.
+  void GetUniformVariableLocation() override;
+
+ private:
+  // ShadowAtlasDepthShaderProg Private Data.
+  GLint locWorldMatrix;
+  GLint locLightPos;
+  GLint locLightRange;
+};
+
 #endif
\ No newline at end of file
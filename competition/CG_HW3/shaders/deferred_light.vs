@@ -0,0 +1,12 @@
+#version 330 core
+
+// One triangle covering the whole screen; the scissor test limits a pass to
+// the pixels its lights can reach. The fragment shader is
+// phong_shading_demo.fs with DEFERRED_LIGHTING, which reads the G-buffer at
+// gl_FragCoord.
+const vec2 positions[3] = vec2[3](vec2(-1.0, -1.0), vec2(3.0, -1.0), vec2(-1.0, 3.0));
+
+void main()
+{
+    gl_Position = vec4(positions[gl_VertexID], 0.0, 1.0);
+}
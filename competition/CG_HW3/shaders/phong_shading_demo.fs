@@ -1,9 +1,27 @@
 #version 330 core
 
-// Data from vertex shader.
+// Data from vertex shader. The deferred lighting pass has no geometry: it
+// reconstructs FragPos and WorldPos from the G-buffer.
+#ifdef DEFERRED_LIGHTING
+vec3 FragPos;
+vec3 WorldPos;
+#elif defined(VISIBILITY_RESOLVE)
+// Rebuilt for the triangle at the pixel by ResolveVisibility.
+vec3 FragPos;
+vec3 NormalOut;
+vec2 TexCoordOut;
+vec3 WorldPos;
+vec2 LightmapCoordOut;
+// Screen-space derivatives of TexCoordOut.
+vec2 TexCoordDx;
+vec2 TexCoordDy;
+#else
 in vec3 FragPos;
 in vec3 NormalOut;
 in vec2 TexCoordOut;
+in vec3 WorldPos;
+in vec2 LightmapCoordOut;
+#endif
 
 // Maximum number of lights
 const int MAX_DIR_LIGHTS = 4;
@@ -11,10 +29,41 @@ const int MAX_POINT_LIGHTS = 8;
 const int MAX_SPOT_LIGHTS = 8;
 const int MAX_AREA_LIGHTS = 4; 
 
+// Permutations (see PhongVariantKey). A variant gets the defines below
+// after the #version line; without one, each falls back to its uniform and
+// this is the uber shader.
+// BLINN_PHONG, AMBIENT_LIGHT, DIFFUSE_LIGHT, SPECULAR_LIGHT: true or false.
+// HAS_MAP_KD, HAS_MAP_KS: 0 skips the texture fetch.
+// NUM_DIR_LIGHTS, NUM_POINT_LIGHTS, NUM_SPOT_LIGHTS, NUM_AREA_LIGHTS:
+// constant loop counts.
+// The deferred path (see DeferredRenderer) builds two more programs:
+// GBUFFER_PASS writes the material, normal and indirect light to the
+// G-buffer instead of a color; DEFERRED_LIGHTING shades the G-buffer with
+// the light loops, a range of point or spot lights per pass.
+// VISIBILITY_RESOLVE (see VisibilityBuffer) shades the triangle a
+// visibility buffer holds at the pixel, fetching its vertices from buffer
+// textures.
+#ifndef HAS_MAP_KD
+#define HAS_MAP_KD 1
+#endif
+#ifndef HAS_MAP_KS
+#define HAS_MAP_KS 1
+#endif
+#ifdef DEFERRED_LIGHTING
+uniform int firstPointLight;
+uniform int firstSpotLight;
+#define FIRST_POINT_LIGHT firstPointLight
+#define FIRST_SPOT_LIGHT firstSpotLight
+#else
+#define FIRST_POINT_LIGHT 0
+#define FIRST_SPOT_LIGHT 0
+#endif
+
 // Structures for different light types
 struct DirectionalLight {
     vec3 direction;
     vec3 radiance;
+    bool isStatic;
 };
 
 struct PointLight {
@@ -24,6 +73,7 @@ struct PointLight {
     float linear;
     float quadratic;
     float decayStart;
+    bool isStatic;
 };
 
 struct SpotLight {
@@ -36,6 +86,7 @@ struct SpotLight {
     float linear;
     float quadratic;
     float decayStart;
+    bool isStatic;
 };
 
 // AreaLight structure
@@ -50,25 +101,40 @@ struct AreaLight {
     float linear;
     float quadratic;
     float decayStart;
+    bool isStatic;
 };
 
 // Uniform arrays for lights
+#ifndef NUM_DIR_LIGHTS
 uniform int numDirLights;
+#define NUM_DIR_LIGHTS numDirLights
+#endif
 uniform DirectionalLight dirLights[MAX_DIR_LIGHTS];
 
+#ifndef NUM_POINT_LIGHTS
 uniform int numPointLights;
+#define NUM_POINT_LIGHTS numPointLights
+#endif
 uniform PointLight pointLights[MAX_POINT_LIGHTS];
 
+#ifndef NUM_SPOT_LIGHTS
 uniform int numSpotLights;
+#define NUM_SPOT_LIGHTS numSpotLights
+#endif
 uniform SpotLight spotLights[MAX_SPOT_LIGHTS];
 
 // AreaLight uniforms
+#ifndef NUM_AREA_LIGHTS
 uniform int numAreaLights;
+#define NUM_AREA_LIGHTS numAreaLights
+#endif
 uniform AreaLight areaLights[MAX_AREA_LIGHTS];
 
 // Uniform variables.
-uniform mat4 worldMatrix;
 uniform mat4 viewMatrix;
+// The lights are given in the space of the model; this is the root
+// transform, which also places them for the shadow map and atlas.
+uniform mat4 lightWorldMatrix;
 uniform vec3 cameraPos; // 在相機空間中，cameraPos 可設定為 vec3(0.0, 0.0, 0.0)
 uniform vec3 ambientLight;
 
@@ -81,15 +147,218 @@ uniform float Ns;
 // Texture
 uniform sampler2D mapKd;
 uniform sampler2D mapKs;
+// The resolve pass gives its own gradients: neighbouring pixels may belong
+// to other triangles, so implicit ones jump at every edge.
+#ifdef VISIBILITY_RESOLVE
+#define SAMPLE_MATERIAL(map) textureGrad(map, TexCoordOut, TexCoordDx, TexCoordDy)
+#else
+#define SAMPLE_MATERIAL(map) texture(map, TexCoordOut)
+#endif
+
+// Baked diffuse light of the static lights; they are skipped below. The
+// deferred lighting pass reads the flag from the G-buffer.
+#ifdef DEFERRED_LIGHTING
+bool useLightmap;
+#else
+uniform bool useLightmap;
+#endif
+uniform sampler2D lightmap;
+
+// Irradiance probe grid (L2 SH), used instead of the constant ambient light.
+// The x axis of probeSH holds the 9 coefficient blocks side by side.
+uniform bool useProbes;
+uniform sampler3D probeSH;
+uniform ivec3 probeGridRes;
+// World position to [0, 1]^3 over the grid, camera-space normal to the
+// space the probes were baked in.
+uniform mat4 probeGridMatrix;
+uniform mat3 probeNormalMatrix;
+
+// Directional ambient from the skybox panorama (L2 SH of irradiance / pi),
+// used instead of the constant ambient light when enabled.
+layout(std140) uniform SkyAmbient {
+    vec4 skySH[9];
+    // Camera-space normal to panorama space.
+    mat4 skyNormalMatrix;
+    // x: enabled, y: intensity.
+    vec4 skyParams;
+};
 
 // bool for shading and lighting
+#ifndef BLINN_PHONG
 uniform bool isBlingPhong;
+#define BLINN_PHONG isBlingPhong
+#endif
+#ifndef AMBIENT_LIGHT
 uniform bool onAmbientLight;
+#define AMBIENT_LIGHT onAmbientLight
+#endif
+#ifndef DIFFUSE_LIGHT
 uniform bool onDiffuseLight;
+#define DIFFUSE_LIGHT onDiffuseLight
+#endif
+#ifndef SPECULAR_LIGHT
 uniform bool onSpecularLight;
+#define SPECULAR_LIGHT onSpecularLight
+#endif
+
+// Cascaded shadow map of dirLights[0].
+const int MAX_CASCADES = 4;
+uniform bool onShadow;
+uniform int numCascades;
+uniform float cascadeSplits[MAX_CASCADES];
+uniform mat4 cascadeLightVP[MAX_CASCADES];
+uniform sampler2DArrayShadow shadowMap;
+
+// Shadow atlas of the point and spot lights. Rects are (x, y, w, h) in atlas
+// uv; a range of 0 means the light has no shadow.
+uniform sampler2DShadow shadowAtlas;
+uniform vec4 pointShadowRects[MAX_POINT_LIGHTS * 6];
+uniform vec4 pointShadowPosRange[MAX_POINT_LIGHTS];
+uniform mat4 spotShadowVP[MAX_SPOT_LIGHTS];
+uniform vec4 spotShadowRects[MAX_SPOT_LIGHTS];
+uniform vec4 spotShadowPosRange[MAX_SPOT_LIGHTS];
+
+// Cube face axes, in the same order as the atlas tiles.
+const vec3 FACE_FORWARD[6] = vec3[6](
+    vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0),
+    vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 FACE_UP[6] = vec3[6](
+    vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0),
+    vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0));
 
 // Output data.
+#ifdef GBUFFER_PASS
+// a: the fragment has a lightmap.
+layout(location = 0) out vec4 GAlbedo;
+// a: Ns, see EncodeShininess.
+layout(location = 1) out vec4 GSpecular;
+// Camera-space normal, see OctEncode.
+layout(location = 2) out vec2 GNormal;
+// Ambient and lightmap light, see IndirectLight.
+layout(location = 3) out vec4 GIndirect;
+#else
 out vec4 FragColor;
+#endif
+
+#ifdef DEFERRED_LIGHTING
+// The G-buffer, read at gl_FragCoord.
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gIndirect;
+uniform sampler2D gDepth;
+uniform mat4 invProjMatrix;
+uniform mat4 invViewMatrix;
+// Only the first pass of a frame adds the indirect light.
+uniform bool addIndirect;
+#endif
+
+#ifdef VISIBILITY_RESOLVE
+// (draw + 1, triangle) per pixel, 0 for the background.
+uniform usampler2D visibility;
+// The merged geometry of VisibilityBuffer: two texels per vertex,
+// (position, normal.x) and (normal.yz, uv); the indices of the submeshes;
+// the lightmap uvs, a texel per vertex.
+uniform samplerBuffer vertices;
+uniform usamplerBuffer indices;
+uniform samplerBuffer lightmapUVs;
+// Per draw (object, first index, base vertex, material), and per object
+// the world matrix and the world normal matrix in 7 texels.
+uniform isamplerBuffer draws;
+uniform samplerBuffer objects;
+uniform mat4 invProjMatrix;
+
+vec3 Weights(vec2 bary)
+{
+    return vec3(1.0 - bary.x - bary.y, bary);
+}
+
+// Barycentrics of b and c where the camera ray through ndc meets the
+// triangle (a, b, c), in camera space (Moller-Trumbore).
+vec2 RayBarycentrics(vec2 ndc, vec3 a, vec3 b, vec3 c)
+{
+    vec4 farPos = invProjMatrix * vec4(ndc, 1.0, 1.0);
+    vec3 dir = farPos.xyz / farPos.w;
+    vec3 e1 = b - a;
+    vec3 e2 = c - a;
+    vec3 p = cross(dir, e2);
+    vec3 t = -a;
+    vec3 q = cross(t, e1);
+    return vec2(dot(t, p), dot(dir, q)) / dot(e1, p);
+}
+
+// The outputs of phong_shading_demo.vs, interpolated at this pixel.
+void ResolveVisibility()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    uvec2 id = texelFetch(visibility, texel, 0).rg;
+    ivec4 draw = texelFetch(draws, max(int(id.x) - 1, 0));
+    int first = draw.y + 3 * int(id.y);
+    ivec3 index = draw.z + ivec3(texelFetch(indices, first).r, texelFetch(indices, first + 1).r, texelFetch(indices, first + 2).r);
+
+    int object = 7 * draw.x;
+    mat4 objectWorld = mat4(texelFetch(objects, object), texelFetch(objects, object + 1), texelFetch(objects, object + 2), texelFetch(objects, object + 3));
+    mat3 worldNormal = mat3(texelFetch(objects, object + 4).xyz, texelFetch(objects, object + 5).xyz, texelFetch(objects, object + 6).xyz);
+    mat4 worldView = viewMatrix * objectWorld;
+
+    vec4 a0 = texelFetch(vertices, 2 * index.x);
+    vec4 a1 = texelFetch(vertices, 2 * index.x + 1);
+    vec4 b0 = texelFetch(vertices, 2 * index.y);
+    vec4 b1 = texelFetch(vertices, 2 * index.y + 1);
+    vec4 c0 = texelFetch(vertices, 2 * index.z);
+    vec4 c1 = texelFetch(vertices, 2 * index.z + 1);
+    vec3 pa = (worldView * vec4(a0.xyz, 1.0)).xyz;
+    vec3 pb = (worldView * vec4(b0.xyz, 1.0)).xyz;
+    vec3 pc = (worldView * vec4(c0.xyz, 1.0)).xyz;
+
+    vec2 pixel = 2.0 / vec2(textureSize(visibility, 0));
+    vec2 ndc = gl_FragCoord.xy * pixel - 1.0;
+    vec3 w = Weights(RayBarycentrics(ndc, pa, pb, pc));
+    FragPos = mat3(pa, pb, pc) * w;
+    WorldPos = (objectWorld * vec4(mat3(a0.xyz, b0.xyz, c0.xyz) * w, 1.0)).xyz;
+    vec3 normal = mat3(vec3(a0.w, a1.xy), vec3(b0.w, b1.xy), vec3(c0.w, c1.xy)) * w;
+    NormalOut = mat3(viewMatrix) * (worldNormal * normal);
+
+    // The uv derivatives are the change to the rays through the next pixels.
+    mat3x2 uvs = mat3x2(a1.zw, b1.zw, c1.zw);
+    TexCoordOut = uvs * w;
+    TexCoordDx = uvs * Weights(RayBarycentrics(ndc + vec2(pixel.x, 0.0), pa, pb, pc)) - TexCoordOut;
+    TexCoordDy = uvs * Weights(RayBarycentrics(ndc + vec2(0.0, pixel.y), pa, pb, pc)) - TexCoordOut;
+    LightmapCoordOut = mat3x2(texelFetch(lightmapUVs, index.x).rg, texelFetch(lightmapUVs, index.y).rg, texelFetch(lightmapUVs, index.z).rg) * w;
+}
+#endif
+
+// Unit vector to [0, 1]^2 by an octahedral map, and back.
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * s;
+    return e * 0.5 + 0.5;
+}
+
+vec3 OctDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0) {
+        vec2 s = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * s;
+    }
+    return normalize(n);
+}
+
+// Ns up to 2047 in [0, 1], finer for the low exponents.
+float EncodeShininess(float Ns)
+{
+    return log2(max(Ns, 0.0) + 1.0) / 11.0;
+}
+
+float DecodeShininess(float e)
+{
+    return exp2(e * 11.0) - 1.0;
+}
 
 // Ambient light.
 vec3 Ambient(vec3 Ka)
@@ -97,6 +366,44 @@ vec3 Ambient(vec3 Ka)
     return ambientLight * Ka;
 }
 
+// L2 spherical harmonics at the unit direction n, clamped to zero.
+vec3 EvaluateSH(vec3 c[9], vec3 n)
+{
+    vec3 e = 0.282095 * c[0]
+           + 0.488603 * (c[1] * n.y + c[2] * n.z + c[3] * n.x)
+           + 1.092548 * (c[4] * n.x * n.y + c[5] * n.y * n.z + c[7] * n.x * n.z)
+           + 0.315392 * c[6] * (3.0 * n.z * n.z - 1.0)
+           + 0.546274 * c[8] * (n.x * n.x - n.y * n.y);
+    return max(e, vec3(0.0));
+}
+
+// Irradiance / pi from the probe grid, for a camera-space normal.
+vec3 ProbeIrradiance(vec3 normal)
+{
+    vec3 g = (probeGridMatrix * vec4(WorldPos, 1.0)).xyz;
+    vec3 n = normalize(probeNormalMatrix * normal);
+    // Clamp to the texel centers of one block so filtering never mixes
+    // coefficients.
+    float res = float(probeGridRes.x);
+    float x = clamp(g.x * res, 0.5, res - 0.5);
+    vec3 c[9];
+    for(int i = 0; i < 9; i++) {
+        c[i] = texture(probeSH, vec3((float(i) * res + x) / (9.0 * res), g.y, g.z)).rgb;
+    }
+    return EvaluateSH(c, n);
+}
+
+// Sky irradiance / pi for a camera-space normal.
+vec3 SkyIrradiance(vec3 normal)
+{
+    vec3 n = normalize(mat3(skyNormalMatrix) * normal);
+    vec3 c[9];
+    for(int i = 0; i < 9; i++) {
+        c[i] = skySH[i].rgb;
+    }
+    return EvaluateSH(c, n) * skyParams.y;
+}
+
 // Diffuse light.
 vec3 Diffuse(vec3 normal, vec3 lightDir, vec3 lightRadiance, vec3 Kd)
 {
@@ -108,7 +415,7 @@ vec3 Diffuse(vec3 normal, vec3 lightDir, vec3 lightRadiance, vec3 Kd)
 vec3 Specular(vec3 normal, vec3 lightDir, vec3 viewDir, vec3 lightRadiance, vec3 Ks, float Ns)
 {
     float spec;
-    if(isBlingPhong){
+    if(BLINN_PHONG){
         vec3 halfwayDir = normalize(lightDir + viewDir);
         spec = pow(max(dot(normal, halfwayDir), 0.0), Ns);
     } else {
@@ -118,42 +425,143 @@ vec3 Specular(vec3 normal, vec3 lightDir, vec3 viewDir, vec3 lightRadiance, vec3
     return spec * lightRadiance * Ks;
 }
 
-void main()
+// Fraction of light reaching the fragment from the shadowed directional light.
+float DirShadow(vec3 normal)
 {
-    // 採樣漫反射貼圖
-    vec3 texColor = texture(mapKd, TexCoordOut).rgb;
-    vec3 effectiveKd = (Kd == vec3(0.0)) ? texColor : Kd;
+    // Pick the cascade by view depth.
+    float viewDepth = -FragPos.z;
+    if(viewDepth > cascadeSplits[numCascades - 1]) return 1.0;
+    int cascade = numCascades - 1;
+    for(int c = 0; c < numCascades; c++) {
+        if(viewDepth <= cascadeSplits[c]) {
+            cascade = c;
+            break;
+        }
+    }
 
-    // 採樣鏡面反射貼圖
-    vec3 specMap = texture(mapKs, TexCoordOut).rgb;
-    // 計算有效的 Ks 值
-    vec3 effectiveKs = (Ks == vec3(0.0)) ? specMap : Ks * specMap;
-    
+    // Offset along the normal by about one shadow map texel to avoid acne.
+    vec2 texSize = vec2(textureSize(shadowMap, 0).xy);
+    mat4 lightVP = cascadeLightVP[cascade];
+    float invRadius = length(vec3(lightVP[0][0], lightVP[1][0], lightVP[2][0]));
+    float texelWorld = 2.0 / (invRadius * texSize.x);
+    vec3 worldNormal = transpose(mat3(viewMatrix)) * normal;
+    vec3 offsetPos = WorldPos + worldNormal * texelWorld * 1.5;
+
+    vec4 lightClip = lightVP * vec4(offsetPos, 1.0);
+    vec3 coord = lightClip.xyz / lightClip.w * 0.5 + 0.5;
+
+    // 3x3 PCF on top of the hardware 2x2 comparison.
+    float lit = 0.0;
+    for(int x = -1; x <= 1; x++) {
+        for(int y = -1; y <= 1; y++) {
+            vec2 uv = coord.xy + vec2(x, y) / texSize;
+            lit += texture(shadowMap, vec4(uv, float(cascade), coord.z));
+        }
+    }
+    return lit / 9.0;
+}
 
-    vec3 norm = normalize(NormalOut);
-    // 在相機空間中，相機位置為原點
-    vec3 viewDir = normalize(-FragPos);
+// 3x3 PCF inside one atlas tile. ndc is the position inside the tile.
+float AtlasPCF(vec4 rect, vec2 ndc, float ref)
+{
+    vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+    vec2 uv = rect.xy + (ndc * 0.5 + 0.5) * rect.zw;
+    // Keep the filter taps inside the tile.
+    vec2 lo = rect.xy + texel * 1.5;
+    vec2 hi = rect.xy + rect.zw - texel * 1.5;
+    float lit = 0.0;
+    for(int x = -1; x <= 1; x++) {
+        for(int y = -1; y <= 1; y++) {
+            vec2 tap = clamp(uv + vec2(x, y) * texel, lo, hi);
+            lit += texture(shadowAtlas, vec3(tap, ref));
+        }
+    }
+    return lit / 9.0;
+}
 
-    // Ambient light.
-    vec3 ambient = Ambient(Ka);
+// Face of a cube map tile that contains direction d.
+int CubeFace(vec3 d)
+{
+    vec3 a = abs(d);
+    if(a.x >= a.y && a.x >= a.z) return d.x > 0.0 ? 0 : 1;
+    if(a.y >= a.z) return d.y > 0.0 ? 2 : 3;
+    return d.z > 0.0 ? 4 : 5;
+}
 
+// Fraction of light reaching the fragment from pointLights[i].
+float PointShadow(int i, vec3 normal)
+{
+    vec4 posRange = pointShadowPosRange[i];
+    if(posRange.w <= 0.0) return 1.0;
+    vec3 d = WorldPos - posRange.xyz;
+    float dist = length(d);
+    if(dist >= posRange.w) return 1.0;
+
+    // A 90 degree face covers 2 * dist world units at this distance.
+    vec4 rect = pointShadowRects[i * 6 + CubeFace(d)];
+    float tileTexels = rect.z * float(textureSize(shadowAtlas, 0).x);
+    vec3 worldNormal = transpose(mat3(viewMatrix)) * normal;
+    d += worldNormal * (2.0 * dist / tileTexels) * 1.5;
+
+    int face = CubeFace(d);
+    rect = pointShadowRects[i * 6 + face];
+    vec3 fwd = FACE_FORWARD[face];
+    vec3 right = normalize(cross(fwd, FACE_UP[face]));
+    vec3 up = cross(right, fwd);
+    float z = dot(d, fwd);
+    vec2 ndc = vec2(dot(d, right), dot(d, up)) / z;
+    return AtlasPCF(rect, ndc, length(d) / posRange.w);
+}
+
+// Fraction of light reaching the fragment from spotLights[i].
+float SpotShadow(int i, vec3 normal)
+{
+    vec4 posRange = spotShadowPosRange[i];
+    if(posRange.w <= 0.0) return 1.0;
+    float dist = length(WorldPos - posRange.xyz);
+    if(dist >= posRange.w) return 1.0;
+
+    mat4 lightVP = spotShadowVP[i];
+    vec4 rect = spotShadowRects[i];
+    // Focal length of the spot projection, independent of the view rotation.
+    float focal = length(vec3(lightVP[0][1], lightVP[1][1], lightVP[2][1]));
+    float tileTexels = rect.z * float(textureSize(shadowAtlas, 0).x);
+    vec3 worldNormal = transpose(mat3(viewMatrix)) * normal;
+    vec3 offsetPos = WorldPos + worldNormal * (2.0 * dist / (focal * tileTexels)) * 1.5;
+
+    vec4 lightClip = lightVP * vec4(offsetPos, 1.0);
+    if(lightClip.w <= 0.0) return 1.0;
+    vec2 ndc = lightClip.xy / lightClip.w;
+    if(any(greaterThan(abs(ndc), vec2(1.0)))) return 1.0;
+    return AtlasPCF(rect, ndc, length(offsetPos - posRange.xyz) / posRange.w);
+}
+
+#ifndef GBUFFER_PASS
+// Light of the light loops, for a camera-space normal and view direction.
+vec3 DirectLight(vec3 norm, vec3 viewDir, vec3 effectiveKd, vec3 effectiveKs, float shininess)
+{
     // Directional lights
     vec3 dirLightResult = vec3(0.0);
-    for(int i = 0; i < numDirLights; i++) {
-        vec3 lightDir = normalize( -dirLights[i].direction); // 確保方向正確
-        vec3 diffuse = Diffuse(norm, lightDir, dirLights[i].radiance, effectiveKd);
-        vec3 specular = Specular(norm, lightDir, viewDir, dirLights[i].radiance, effectiveKs, Ns);
+    for(int i = 0; i < NUM_DIR_LIGHTS; i++) {
+        if(useLightmap && dirLights[i].isStatic) continue;
+        // 與點光源一致，方向在物體空間，轉到相機空間
+        vec3 lightDir = normalize((viewMatrix * lightWorldMatrix * vec4(-dirLights[i].direction, 0.0)).xyz);
+        float shadow = (i == 0 && onShadow) ? DirShadow(norm) : 1.0;
+        vec3 radiance = dirLights[i].radiance * shadow;
+        vec3 diffuse = Diffuse(norm, lightDir, radiance, effectiveKd);
+        vec3 specular = Specular(norm, lightDir, viewDir, radiance, effectiveKs, shininess);
         
-        if(!onDiffuseLight) diffuse = vec3(0.0);
-        if(!onSpecularLight) specular = vec3(0.0);
+        if(!DIFFUSE_LIGHT) diffuse = vec3(0.0);
+        if(!SPECULAR_LIGHT) specular = vec3(0.0);
         
         dirLightResult += diffuse + specular;
     }
 
     // Point lights
     vec3 pointLightResult = vec3(0.0);
-    for(int i = 0; i < numPointLights; i++) {
-        vec3 lightPosCamSpace = (viewMatrix * worldMatrix * vec4(pointLights[i].position, 1.0)).xyz;
+    for(int i = FIRST_POINT_LIGHT; i < NUM_POINT_LIGHTS; i++) {
+        if(useLightmap && pointLights[i].isStatic) continue;
+        vec3 lightPosCamSpace = (viewMatrix * lightWorldMatrix * vec4(pointLights[i].position, 1.0)).xyz;
         vec3 lightDir = normalize(lightPosCamSpace - FragPos);
         float distance = length(lightPosCamSpace - FragPos);
         float attenuation;
@@ -164,22 +572,24 @@ void main()
             attenuation = 1.0 / (pointLights[i].constant + pointLights[i].linear * adjustedDistance + pointLights[i].quadratic * (adjustedDistance * adjustedDistance));
         }
         vec3 radiance = pointLights[i].intensity * attenuation;
+        if(onShadow) radiance *= PointShadow(i, norm);
         
         vec3 diffuse = Diffuse(norm, lightDir, radiance, effectiveKd);
-        vec3 specular = Specular(norm, lightDir, viewDir, radiance, effectiveKs, Ns);
+        vec3 specular = Specular(norm, lightDir, viewDir, radiance, effectiveKs, shininess);
         
-        if(!onDiffuseLight) diffuse = vec3(0.0);
-        if(!onSpecularLight) specular = vec3(0.0);
+        if(!DIFFUSE_LIGHT) diffuse = vec3(0.0);
+        if(!SPECULAR_LIGHT) specular = vec3(0.0);
         
         pointLightResult += diffuse + specular;
     }
 
     // Spot lights
     vec3 spotLightResult = vec3(0.0);
-    for(int i = 0; i < numSpotLights; i++) {
-        vec3 lightPosCamSpace = (viewMatrix * worldMatrix * vec4(spotLights[i].position, 1.0)).xyz;
+    for(int i = FIRST_SPOT_LIGHT; i < NUM_SPOT_LIGHTS; i++) {
+        if(useLightmap && spotLights[i].isStatic) continue;
+        vec3 lightPosCamSpace = (viewMatrix * lightWorldMatrix * vec4(spotLights[i].position, 1.0)).xyz;
         vec3 lightDir = normalize(lightPosCamSpace - FragPos);
-        vec3 spotDirCamSpace = normalize(viewMatrix * worldMatrix * vec4(spotLights[i].direction, 0.0)).xyz;
+        vec3 spotDirCamSpace = normalize(viewMatrix * lightWorldMatrix * vec4(spotLights[i].direction, 0.0)).xyz;
 
         float cosTheta = dot(lightDir, spotDirCamSpace);
         float cosEpsilon = spotLights[i].cosCutoffStart - spotLights[i].cosCutoffEnd;
@@ -195,19 +605,21 @@ void main()
 
         float intensityFactor = clamp((cosTheta - spotLights[i].cosCutoffEnd) / cosEpsilon, 0.0, 1.0);
         vec3 radiance = intensityFactor * spotLights[i].intensity * attenuation;
+        if(onShadow && intensityFactor > 0.0) radiance *= SpotShadow(i, norm);
 
         vec3 diffuse = Diffuse(norm, lightDir, radiance, effectiveKd);
-        vec3 specular = Specular(norm, lightDir, viewDir, radiance, effectiveKs, Ns);
+        vec3 specular = Specular(norm, lightDir, viewDir, radiance, effectiveKs, shininess);
 
-        if(!onDiffuseLight) diffuse = vec3(0.0);
-        if(!onSpecularLight) specular = vec3(0.0);
+        if(!DIFFUSE_LIGHT) diffuse = vec3(0.0);
+        if(!SPECULAR_LIGHT) specular = vec3(0.0);
 
         spotLightResult += diffuse + specular;
     }
 
     // Area lights
     vec3 areaLightResult = vec3(0.0);
-    for(int i = 0; i < numAreaLights; i++) {
+    for(int i = 0; i < NUM_AREA_LIGHTS; i++) {
+        if(useLightmap && areaLights[i].isStatic) continue;
         // 定義區域光源的方向和正交向量
         vec3 lightDir = normalize(areaLights[i].direction);
         vec3 right = normalize(cross(lightDir, vec3(0.0, 1.0, 0.0)));
@@ -225,7 +637,7 @@ void main()
                             + (randV - 0.5) * areaLights[i].height * up;
 
             // 轉換到相機空間
-            vec3 lightPosCamSpace = (viewMatrix * worldMatrix * vec4(samplePos, 1.0)).xyz;
+            vec3 lightPosCamSpace = (viewMatrix * lightWorldMatrix * vec4(samplePos, 1.0)).xyz;
             vec3 lightDirection = normalize(lightPosCamSpace - FragPos);
             float distance = length(lightPosCamSpace - FragPos);
             float attenuation;
@@ -239,10 +651,10 @@ void main()
 
             // 計算漫反射和鏡面反射
             vec3 diffuse = Diffuse(norm, lightDirection, radiance, effectiveKd);
-            vec3 specular = Specular(norm, lightDirection, viewDir, radiance, effectiveKs, Ns);
+            vec3 specular = Specular(norm, lightDirection, viewDir, radiance, effectiveKs, shininess);
 
-            if(!onDiffuseLight) diffuse = vec3(0.0);
-            if(!onSpecularLight) specular = vec3(0.0);
+            if(!DIFFUSE_LIGHT) diffuse = vec3(0.0);
+            if(!SPECULAR_LIGHT) specular = vec3(0.0);
 
             areaLightResult += diffuse + specular;
     }
@@ -251,8 +663,83 @@ void main()
     areaLightResult /= float(areaLights[i].samples);
 }
 
-    // Final color.
-    vec3 result = ambient + dirLightResult + pointLightResult + spotLightResult + areaLightResult;
-    if(!onAmbientLight) result -= ambient;
+    return dirLightResult + pointLightResult + spotLightResult + areaLightResult;
+}
+#endif
+
+#ifndef DEFERRED_LIGHTING
+// Ambient light (constant, sky or probes) and the lightmap.
+vec3 IndirectLight(vec3 norm, vec3 effectiveKd)
+{
+    vec3 ambient = Ambient(Ka);
+    if(skyParams.x > 0.5) ambient = Ka * SkyIrradiance(norm);
+    if(useProbes) ambient = effectiveKd * ProbeIrradiance(norm);
+    vec3 result = AMBIENT_LIGHT ? ambient : vec3(0.0);
+    if(useLightmap && DIFFUSE_LIGHT) result += effectiveKd * texture(lightmap, LightmapCoordOut).rgb;
+    return result;
+}
+#endif
+
+#ifdef DEFERRED_LIGHTING
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, texel, 0).r;
+    // Background.
+    if(depth == 1.0) discard;
+    vec2 uv = (vec2(texel) + 0.5) / vec2(textureSize(gDepth, 0));
+    vec4 viewPos = invProjMatrix * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    FragPos = viewPos.xyz / viewPos.w;
+    WorldPos = (invViewMatrix * vec4(FragPos, 1.0)).xyz;
+
+    vec4 albedo = texelFetch(gAlbedo, texel, 0);
+    vec4 specular = texelFetch(gSpecular, texel, 0);
+    vec3 norm = OctDecode(texelFetch(gNormal, texel, 0).rg);
+    useLightmap = albedo.a > 0.5;
+    vec3 viewDir = normalize(-FragPos);
+    vec3 result = DirectLight(norm, viewDir, albedo.rgb, specular.rgb, DecodeShininess(specular.a));
+    if(addIndirect) result += texelFetch(gIndirect, texel, 0).rgb;
+    // The skybox is drawn after the opaque pass and needs the depth.
+    gl_FragDepth = depth;
+    FragColor = vec4(result, 1.0);
+}
+#else
+void main()
+{
+#ifdef VISIBILITY_RESOLVE
+    ResolveVisibility();
+#endif
+    // 採樣漫反射貼圖
+#if HAS_MAP_KD
+    vec3 texColor = SAMPLE_MATERIAL(mapKd).rgb;
+#else
+    // Kd is used as is.
+    vec3 texColor = vec3(0.0);
+#endif
+    vec3 effectiveKd = (Kd == vec3(0.0)) ? texColor : Kd;
+
+    // 採樣鏡面反射貼圖
+#if HAS_MAP_KS
+    vec3 specMap = SAMPLE_MATERIAL(mapKs).rgb;
+#else
+    // Without mapKs its sampler reads unit 0, i.e. mapKd.
+    vec3 specMap = texColor;
+#endif
+    // 計算有效的 Ks 值
+    vec3 effectiveKs = (Ks == vec3(0.0)) ? specMap : Ks * specMap;
+    
+
+    vec3 norm = normalize(NormalOut);
+#ifdef GBUFFER_PASS
+    GAlbedo = vec4(effectiveKd, useLightmap ? 1.0 : 0.0);
+    GSpecular = vec4(effectiveKs, EncodeShininess(Ns));
+    GNormal = OctEncode(norm);
+    GIndirect = vec4(IndirectLight(norm, effectiveKd), 1.0);
+#else
+    // 在相機空間中，相機位置為原點
+    vec3 viewDir = normalize(-FragPos);
+    vec3 result = IndirectLight(norm, effectiveKd) + DirectLight(norm, viewDir, effectiveKd, effectiveKs, Ns);
     FragColor = vec4(result, 1.0);
-}
\ No newline at end of file
+#endif
+}
+#endif
@@ -3,32 +3,47 @@
 layout (location = 0) in vec3 Position;
 layout (location = 1) in vec3 NormalIn;
 layout (location = 2) in vec2 TexCoord;
+layout (location = 3) in vec2 LightmapCoord;
+// Per-instance transforms (useInstancing); InstanceNormal is the normal
+// matrix in world space.
+layout (location = 4) in mat4 InstanceWorld;
+layout (location = 8) in mat3 InstanceNormal;
 
-// Transformation matrix.
+// Transformation matrices. normalMatrix is in world space.
 uniform mat4 worldMatrix;
+uniform mat3 normalMatrix;
 uniform mat4 viewMatrix;
-uniform mat4 normalMatrix;
-uniform mat4 MVP;
+uniform mat4 viewProjMatrix;
 uniform vec3 cameraPos;
+// Instanced draws read the world matrices from the instance attributes.
+uniform bool useInstancing;
 
 // data pass to fragment shader
 out vec3 FragPos;
 out vec3 NormalOut;
 out vec2 TexCoordOut;
+out vec3 WorldPos;
+out vec2 LightmapCoordOut;
 
 void main()
 {
-    // Calculate normal in world space.
-    vec3 normal = (normalMatrix * vec4(NormalIn, 0.0)).xyz;
+    mat4 world = useInstancing ? InstanceWorld : worldMatrix;
+    mat3 worldNormal = useInstancing ? InstanceNormal : normalMatrix;
+    // Calculate normal in camera space. The view matrix is rigid, so it is
+    // its own normal matrix.
+    vec3 normal = mat3(viewMatrix) * (worldNormal * NormalIn);
 
     // Calculate position in world space.
-    vec4 positionTmp = viewMatrix * worldMatrix * vec4(Position, 1.0);
+    vec4 worldPosTmp = world * vec4(Position, 1.0);
+    vec4 positionTmp = viewMatrix * worldPosTmp;
 
     // Calculate position in clip space.
-    gl_Position = MVP * vec4(Position, 1.0);
+    gl_Position = viewProjMatrix * worldPosTmp;
 
     // Pass data to fragment shader.
     FragPos = positionTmp.xyz / positionTmp.w;
     NormalOut = normal;
     TexCoordOut = TexCoord;
+    WorldPos = worldPosTmp.xyz / worldPosTmp.w;
+    LightmapCoordOut = LightmapCoord;
 }
@@ -0,0 +1,13 @@
+#version 330 core
+
+in vec3 WorldPos;
+
+uniform vec3 lightPos;
+uniform float lightRange;
+
+// Store the linear distance to the light, so every cube face and spot light
+// tile can be compared the same way in the Phong shader.
+void main()
+{
+    gl_FragDepth = clamp(length(WorldPos - lightPos) / lightRange, 0.0, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 330 core
+
+layout (location = 0) in vec3 Position;
+
+uniform mat4 MVP;
+uniform mat4 worldMatrix;
+
+out vec3 WorldPos;
+
+void main()
+{
+    WorldPos = (worldMatrix * vec4(Position, 1.0)).xyz;
+    gl_Position = MVP * vec4(Position, 1.0);
+}
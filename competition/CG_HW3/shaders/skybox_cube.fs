@@ -0,0 +1,13 @@
+#version 330 core
+
+in vec4 ViewDir;
+
+uniform samplerCube mapCube;
+
+out vec4 FragColor;
+
+
+void main()
+{
+    FragColor = texture(mapCube, ViewDir.xyz / ViewDir.w);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+
+// One triangle covering the whole screen, at the far plane.
+const vec2 positions[3] = vec2[3](vec2(-1.0, -1.0), vec2(3.0, -1.0), vec2(-1.0, 3.0));
+
+uniform mat4 invViewProj;
+
+out vec4 ViewDir;
+
+void main()
+{
+    vec2 p = positions[gl_VertexID];
+    gl_Position = vec4(p, 1.0, 1.0);
+    // Divided per fragment; the un-projected point is linear in screen space.
+    ViewDir = invViewProj * vec4(p, 1.0, 1.0);
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+// Draw + 1, as 0 is the background, and the triangle in the submesh;
+// gl_PrimitiveID starts over with every instance.
+flat in int DrawId;
+
+out uvec2 Visibility;
+
+void main()
+{
+    Visibility = uvec2(uint(DrawId) + 1u, uint(gl_PrimitiveID));
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+// Geometry pass of VisibilityBuffer. A draw call covers the instances of
+// one submesh; each instance is one draw of the draw table, which gives
+// its object, and the object gives the world matrix.
+layout (location = 0) in vec3 Position;
+
+uniform mat4 viewProjMatrix;
+// Draw of instance 0.
+uniform int drawBase;
+// Per draw (object, first index, base vertex, material); per object the
+// world matrix in texels 0-3 of 7.
+uniform isamplerBuffer draws;
+uniform samplerBuffer objects;
+
+flat out int DrawId;
+
+void main()
+{
+    DrawId = drawBase + gl_InstanceID;
+    int object = 7 * texelFetch(draws, DrawId).x;
+    mat4 world = mat4(texelFetch(objects, object), texelFetch(objects, object + 1), texelFetch(objects, object + 2), texelFetch(objects, object + 3));
+    gl_Position = viewProjMatrix * world * vec4(Position, 1.0);
+}
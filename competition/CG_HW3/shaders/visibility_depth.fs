@@ -0,0 +1,29 @@
+#version 330 core
+
+// Depth passes of VisibilityBuffer over the pixels the visibility buffer
+// covers. Before the resolve, the depth of each pixel's material, which
+// the resolve passes test against; after it, the depth of the scene for the
+// passes that follow. Color writes are off.
+uniform usampler2D visibility;
+// Per draw (object, first index, base vertex, material).
+uniform isamplerBuffer draws;
+uniform sampler2D sceneDepth;
+uniform bool writeSceneDepth;
+
+// Depth key of a material; see visibility_fullscreen.vs.
+float MaterialDepth(int material)
+{
+    return 0.625 + float(material + 1) * (1.0 / 32768.0);
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    uint id = texelFetch(visibility, texel, 0).r;
+    if(id == 0u) discard;
+    if(writeSceneDepth) {
+        gl_FragDepth = texelFetch(sceneDepth, texel, 0).r;
+    } else {
+        gl_FragDepth = MaterialDepth(texelFetch(draws, int(id) - 1).w);
+    }
+}
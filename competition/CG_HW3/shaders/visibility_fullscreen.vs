@@ -0,0 +1,25 @@
+#version 330 core
+
+// One triangle covering the whole screen at the depth of a material. With
+// the depth test on GL_EQUAL, a resolve pass only runs on the pixels the
+// material depth pass gave its material. The fragment shader is
+// visibility_depth.fs or phong_shading_demo.fs with VISIBILITY_RESOLVE.
+const vec2 positions[3] = vec2[3](vec2(-1.0, -1.0), vec2(3.0, -1.0), vec2(-1.0, 3.0));
+
+// Material of the resolve pass.
+uniform int resolveMaterial;
+
+// Depth key of a material; the same function as in visibility_depth.fs.
+// 0.625 + (material + 1) / 2^15 has few enough bits that it stays exact in
+// float, through z * 2 - 1 and through the viewport transform, and it lies
+// 0.25 to 0.375 of a step above a 24-bit depth value, so the depth buffer
+// stores the same value whether the driver rounds or truncates.
+float MaterialDepth(int material)
+{
+    return 0.625 + float(material + 1) * (1.0 / 32768.0);
+}
+
+void main()
+{
+    gl_Position = vec4(positions[gl_VertexID], MaterialDepth(resolveMaterial) * 2.0 - 1.0, 1.0);
+}
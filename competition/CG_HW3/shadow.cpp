@@ -0,0 +1,324 @@
+#include "shadow.h"
+
+#include <gtc/epsilon.hpp>
+
+#include "profiler.h"
+#include "trianglemesh.h"
+
+CascadedShadowMap::CascadedShadowMap(const int resolution,
+                                     const int numCascades,
+                                     const int numCachedCascades) {
+  this->resolution = resolution;
+  this->numCascades = glm::clamp(numCascades, 1, MAX_CASCADES);
+  this->numCachedCascades =
+      glm::clamp(numCachedCascades, 0, this->numCascades - 1);
+  maxDistance = 100.0f;
+  splitLambda = 0.75f;
+  lastLightDir = glm::vec3(0.0f);
+  staticGeometryVersion = 1;
+
+  for (int i = 0; i < MAX_CASCADES; ++i) {
+    splitFar[i] = 0.0f;
+    lightVP[i] = glm::mat4x4(1.0f);
+    fittedRadius[i] = 1.0f;
+    cachedCenter[i] = glm::vec3(0.0f);
+    cachedRadius[i] = 0.0f;
+    cachedVersion[i] = 0;
+    cacheValid[i] = false;
+  }
+  stats.resize(this->numCascades);
+  for (auto &s : stats) {
+    s = CascadeStats();
+  }
+
+  // Live depth array, sampled with hardware depth comparison.
+  glGenTextures(1, &depthArray);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, resolution,
+               resolution, this->numCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE,
+                  GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+  // Static cache for the far cascades.
+  staticArray = 0;
+  if (this->numCachedCascades > 0) {
+    glGenTextures(1, &staticArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, staticArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, resolution,
+                 resolution, this->numCachedCascades, 0, GL_DEPTH_COMPONENT,
+                 GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  glGenFramebuffers(1, &fboId);
+  glGenFramebuffers(1, &blitFboId);
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  glBindFramebuffer(GL_FRAMEBUFFER, blitFboId);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+CascadedShadowMap::~CascadedShadowMap() {
+  glDeleteFramebuffers(1, &fboId);
+  glDeleteFramebuffers(1, &blitFboId);
+  glDeleteTextures(1, &depthArray);
+  if (staticArray != 0) {
+    glDeleteTextures(1, &staticArray);
+  }
+}
+
+void CascadedShadowMap::ComputeSplits(const Camera *camera) {
+  // Practical split scheme: blend of logarithmic and uniform splits.
+  const float n = camera->GetNearPlane();
+  const float f = glm::min(camera->GetFarPlane(), maxDistance);
+  for (int i = 0; i < numCascades; ++i) {
+    float p = (float)(i + 1) / (float)numCascades;
+    float logSplit = n * std::pow(f / n, p);
+    float uniformSplit = n + (f - n) * p;
+    splitFar[i] = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+  }
+}
+
+void CascadedShadowMap::FitCascade(const int index, const glm::vec3 &center,
+                                   const float radius,
+                                   const glm::mat4x4 &lightView,
+                                   const float sceneMaxZ) {
+  // Snap the sphere center to whole texels in light space so the rasterized
+  // shadow map only ever moves by whole texels.
+  const float texelSize = 2.0f * radius / (float)resolution;
+  glm::vec3 c = glm::vec3(lightView * glm::vec4(center, 1.0f));
+  c.x = std::floor(c.x / texelSize) * texelSize;
+  c.y = std::floor(c.y / texelSize) * texelSize;
+
+  // The light looks down -z. Extend the near plane towards the light so that
+  // casters outside the slice still land in the map.
+  float maxZ = glm::max(c.z + radius, sceneMaxZ);
+  float minZ = c.z - radius;
+  glm::mat4x4 lightProj = glm::ortho(c.x - radius, c.x + radius, c.y - radius,
+                                     c.y + radius, -maxZ, -minZ);
+  lightVP[index] = lightProj * lightView;
+  fittedRadius[index] = radius;
+}
+
+void CascadedShadowMap::AttachLayer(GLuint texture, const int layer) {
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0,
+                            layer);
+}
+
+void CascadedShadowMap::BlitLayer(const int staticLayer, const int liveLayer) {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, blitFboId);
+  glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            staticArray, 0, staticLayer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboId);
+  glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            depthArray, 0, liveLayer);
+  glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+}
+
+void CascadedShadowMap::RenderObjects(const int index,
+                                      const std::vector<SceneObject> &objects,
+                                      const TransformStore &transforms,
+                                      ShaderProg *depthShader,
+                                      const bool staticPass) {
+  for (int i = 0; i < (int)objects.size(); ++i) {
+    const SceneObject &obj = objects[i];
+    if (obj.mesh == nullptr || obj.isStatic != staticPass) {
+      continue;
+    }
+    const glm::mat4x4 &world = transforms.GetWorld(i);
+
+    // Cull objects outside the cascade box (x/y only, depth is clamped).
+    const glm::vec4 &sphere = transforms.GetBoundingSphere(i);
+    glm::vec4 clip = lightVP[index] * glm::vec4(glm::vec3(sphere), 1.0f);
+    float clipRadius = sphere.w / fittedRadius[index];
+    if (clip.x + clipRadius < -1.0f || clip.x - clipRadius > 1.0f ||
+        clip.y + clipRadius < -1.0f || clip.y - clipRadius > 1.0f) {
+      continue;
+    }
+
+    glm::mat4x4 MVP = lightVP[index] * world;
+    glUniformMatrix4fv(depthShader->GetLocMVP(), 1, GL_FALSE,
+                       glm::value_ptr(MVP));
+    obj.mesh->drawDepth();
+  }
+}
+
+void CascadedShadowMap::Update(const Camera *camera, const glm::vec3 &lightDir,
+                               const std::vector<SceneObject> &objects,
+                               const TransformStore &transforms,
+                               ShaderProg *depthShader) {
+  PROFILE_GPU_SCOPE("Cascaded Shadows");
+  ComputeSplits(camera);
+
+  // Light view with a fixed origin; only the direction matters.
+  glm::vec3 dir = glm::normalize(lightDir);
+  glm::vec3 up = std::abs(dir.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                         : glm::vec3(0.0f, 1.0f, 0.0f);
+  glm::mat4x4 lightView = glm::lookAt(glm::vec3(0.0f), dir, up);
+
+  bool lightChanged = glm::any(glm::epsilonNotEqual(dir, lastLightDir, 1e-5f));
+  lastLightDir = dir;
+
+  // The highest light-space z of all casters, used to pull the near plane.
+  float sceneMaxZ = -FLT_MAX;
+  bool hasDynamic = false;
+  for (int i = 0; i < (int)objects.size(); ++i) {
+    if (objects[i].mesh == nullptr) {
+      continue;
+    }
+    const glm::vec4 &sphere = transforms.GetBoundingSphere(i);
+    float z = (lightView * glm::vec4(glm::vec3(sphere), 1.0f)).z + sphere.w;
+    sceneMaxZ = glm::max(sceneMaxZ, z);
+    hasDynamic = hasDynamic || !objects[i].isStatic;
+  }
+
+  // Save the state we are about to change.
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  GLint prevFbo = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFbo);
+
+  depthShader->Bind();
+  glViewport(0, 0, resolution, resolution);
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_DEPTH_CLAMP);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.0f, 4.0f);
+
+  const glm::mat4x4 invView = glm::inverse(camera->GetViewMatrix());
+  const float tanHalfFovy = std::tan(glm::radians(camera->GetFovy()) * 0.5f);
+  const float aspect = camera->GetAspectRatio();
+
+  for (int i = 0; i < numCascades; ++i) {
+    float sliceNear = (i == 0) ? camera->GetNearPlane() : splitFar[i - 1];
+    float sliceFar = splitFar[i];
+
+    // Bounding sphere of the frustum slice. Its radius depends only on the
+    // projection, so it does not change while the camera turns.
+    float hn = sliceNear * tanHalfFovy;
+    float hf = sliceFar * tanHalfFovy;
+    float nearDiag2 = hn * hn * (1.0f + aspect * aspect);
+    float farDiag2 = hf * hf * (1.0f + aspect * aspect);
+    float centerDist = glm::min(
+        sliceFar, 0.5f * (sliceNear + sliceFar) +
+                      0.5f * (farDiag2 - nearDiag2) / (sliceFar - sliceNear));
+    float radius = glm::sqrt((sliceFar - centerDist) * (sliceFar - centerDist) +
+                             farDiag2);
+    radius = std::ceil(radius * 16.0f) / 16.0f;
+    glm::vec3 center =
+        glm::vec3(invView * glm::vec4(0.0f, 0.0f, -centerDist, 1.0f));
+
+    CascadeStats &s = stats[i];
+    s.splitNear = sliceNear;
+    s.splitFar = sliceFar;
+    timers[i].Begin();
+
+    if (!IsCached(i)) {
+      FitCascade(i, center, radius, lightView, sceneMaxZ);
+      AttachLayer(depthArray, i);
+      glClear(GL_DEPTH_BUFFER_BIT);
+      RenderObjects(i, objects, transforms, depthShader, true);
+      RenderObjects(i, objects, transforms, depthShader, false);
+      s.radius = radius;
+      s.cached = false;
+    } else {
+      const int staticLayer = i - (numCascades - numCachedCascades);
+      bool contained = glm::distance(center, cachedCenter[i]) + radius <=
+                       cachedRadius[i];
+      bool valid = cacheValid[i] && !lightChanged && contained &&
+                   cachedVersion[i] == staticGeometryVersion;
+      if (!valid) {
+        // Pad the cached region so small camera moves keep reusing it.
+        cachedCenter[i] = center;
+        cachedRadius[i] = std::ceil(radius * 1.25f * 16.0f) / 16.0f;
+        cachedVersion[i] = staticGeometryVersion;
+        cacheValid[i] = true;
+        FitCascade(i, cachedCenter[i], cachedRadius[i], lightView, sceneMaxZ);
+
+        AttachLayer(staticArray, staticLayer);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        RenderObjects(i, objects, transforms, depthShader, true);
+        s.staticRenders++;
+      }
+
+      // Copy the static depth into the live map and add dynamic casters on
+      // top. Without dynamic casters the live map only changes with the cache.
+      if (!valid || hasDynamic) {
+        BlitLayer(staticLayer, i);
+        AttachLayer(depthArray, i);
+        RenderObjects(i, objects, transforms, depthShader, false);
+      }
+      s.radius = cachedRadius[i];
+      s.cached = valid;
+    }
+
+    timers[i].End();
+    s.gpuMs = timers[i].GetElapsedMs();
+    s.texelsPerUnit = (float)resolution / (2.0f * s.radius);
+  }
+
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDisable(GL_DEPTH_CLAMP);
+  depthShader->UnBind();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFbo);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void CascadedShadowMap::Bind(PhongShadingDemoShaderProg *shader,
+                             const int textureUnit) {
+  glActiveTexture(GL_TEXTURE0 + textureUnit);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+  glUniform1i(shader->GetLocShadowMap(), textureUnit);
+  glUniform1i(shader->GetLocNumCascades(), numCascades);
+  glUniform1fv(shader->GetLocCascadeSplits(), numCascades, splitFar);
+  glUniformMatrix4fv(shader->GetLocCascadeLightVP(), numCascades, GL_FALSE,
+                     glm::value_ptr(lightVP[0]));
+}
+
+void CascadedShadowMap::DrawDebugPanel() {
+  ImGui::Begin("Shadows");
+  ImGui::Text("Resolution: %d x %d, %d cascades (%d cached)", resolution,
+              resolution, numCascades, numCachedCascades);
+  if (ImGui::BeginTable("cascades", 6)) {
+    ImGui::TableSetupColumn("#");
+    ImGui::TableSetupColumn("Range");
+    ImGui::TableSetupColumn("Texels/unit");
+    ImGui::TableSetupColumn("GPU ms");
+    ImGui::TableSetupColumn("Cached");
+    ImGui::TableSetupColumn("Static renders");
+    ImGui::TableHeadersRow();
+    for (int i = 0; i < numCascades; ++i) {
+      const CascadeStats &s = stats[i];
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", i);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f - %.2f", s.splitNear, s.splitFar);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", s.texelsPerUnit);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", s.gpuMs);
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", IsCached(i) ? (s.cached ? "hit" : "miss") : "-");
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", s.staticRenders);
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+}
@@ -0,0 +1,105 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "camera.h"
+#include "gpu_timer.h"
+#include "headers.h"
+#include "scene_obj.h"
+#include "shaderprog.h"
+#include "transform_store.h"
+
+// Per-cascade information shown in the shadow debug panel.
+struct CascadeStats {
+  float splitNear;
+  float splitFar;
+  float radius;
+  // Shadow map texels per world unit; higher means sharper shadows.
+  float texelsPerUnit;
+  double gpuMs;
+  // Whether this cascade reuses its cached static depth this frame.
+  bool cached;
+  // How many times the static content of this cascade has been rendered.
+  int staticRenders;
+};
+
+// CascadedShadowMap Declarations.
+// Shadows from one DirectionalLight. The camera frustum is split into
+// MAX_CASCADES slices; every slice is fitted with a bounding sphere whose
+// projection is snapped to shadow map texels, so shadows do not shimmer when
+// the camera moves or turns.
+// The near cascades are re-rendered every frame. The far cascades keep a
+// cache of the static geometry that is re-rendered only when the light, the
+// static geometry, or the camera (beyond a padded region) changes.
+class CascadedShadowMap {
+ public:
+  // CascadedShadowMap Public Methods.
+  CascadedShadowMap(const int resolution = 2048,
+                    const int numCascades = MAX_CASCADES,
+                    const int numCachedCascades = 2);
+  ~CascadedShadowMap();
+
+  // Render the shadow maps. lightDir is the light direction in world space;
+  // transforms must be up to date with objects.
+  void Update(const Camera *camera, const glm::vec3 &lightDir,
+              const std::vector<SceneObject> &objects,
+              const TransformStore &transforms, ShaderProg *depthShader);
+
+  // Bind the shadow maps and upload cascade data to the Phong shader.
+  void Bind(PhongShadingDemoShaderProg *shader, const int textureUnit);
+
+  // Call whenever static geometry is added, removed or moved.
+  void MarkStaticGeometryDirty() { ++staticGeometryVersion; }
+
+  void SetMaxShadowDistance(const float distance) { maxDistance = distance; }
+  void SetSplitLambda(const float lambda) { splitLambda = lambda; }
+
+  int GetNumCascades() const { return numCascades; }
+  int GetResolution() const { return resolution; }
+  const std::vector<CascadeStats> &GetStats() const { return stats; }
+
+  void DrawDebugPanel();
+
+ private:
+  // CascadedShadowMap Private Methods.
+  void ComputeSplits(const Camera *camera);
+  void FitCascade(const int index, const glm::vec3 &center, const float radius,
+                  const glm::mat4x4 &lightView, const float sceneMaxZ);
+  void RenderObjects(const int index, const std::vector<SceneObject> &objects,
+                     const TransformStore &transforms,
+                     ShaderProg *depthShader, const bool staticPass);
+  void AttachLayer(GLuint texture, const int layer);
+  void BlitLayer(const int staticLayer, const int liveLayer);
+  bool IsCached(const int index) const {
+    return index >= numCascades - numCachedCascades;
+  }
+
+  // CascadedShadowMap Private Data.
+  int resolution;
+  int numCascades;
+  int numCachedCascades;
+  float maxDistance;
+  float splitLambda;
+
+  GLuint fboId;
+  GLuint blitFboId;
+  // Depth array sampled by the Phong shader.
+  GLuint depthArray;
+  // Static-only depth for the cached cascades.
+  GLuint staticArray;
+
+  float splitFar[MAX_CASCADES];
+  glm::mat4x4 lightVP[MAX_CASCADES];
+  float fittedRadius[MAX_CASCADES];
+  glm::vec3 cachedCenter[MAX_CASCADES];
+  float cachedRadius[MAX_CASCADES];
+  unsigned long long cachedVersion[MAX_CASCADES];
+  bool cacheValid[MAX_CASCADES];
+
+  glm::vec3 lastLightDir;
+  unsigned long long staticGeometryVersion;
+
+  GpuTimer timers[MAX_CASCADES];
+  std::vector<CascadeStats> stats;
+};
+
+#endif
@@ -0,0 +1,712 @@
+#include "shadow_atlas.h"
+
+#include "profiler.h"
+#include "trianglemesh.h"
+
+// Cube face directions, matching the GL cube map face order.
+static const glm::vec3 kFaceForward[6] = {
+    glm::vec3(1.0f, 0.0f, 0.0f),  glm::vec3(-1.0f, 0.0f, 0.0f),
+    glm::vec3(0.0f, 1.0f, 0.0f),  glm::vec3(0.0f, -1.0f, 0.0f),
+    glm::vec3(0.0f, 0.0f, 1.0f),  glm::vec3(0.0f, 0.0f, -1.0f)};
+static const glm::vec3 kFaceUp[6] = {
+    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+    glm::vec3(0.0f, 0.0f, 1.0f),  glm::vec3(0.0f, 0.0f, -1.0f),
+    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)};
+
+static const char *StateName(const AtlasLightState state) {
+  switch (state) {
+    case AtlasLightState::Clean:
+      return "clean";
+    case AtlasLightState::Rendered:
+      return "rendered";
+    case AtlasLightState::Deferred:
+      return "deferred";
+    case AtlasLightState::Offscreen:
+      return "offscreen";
+    case AtlasLightState::NoSpace:
+      return "no space";
+  }
+  return "";
+}
+
+// ------------------------------------------------------------------------------------------------
+
+ShadowAtlasAllocator::ShadowAtlasAllocator(const int atlasSize,
+                                           const int minTileSize) {
+  this->atlasSize = atlasSize;
+  numLevels = 1;
+  while ((atlasSize >> (numLevels - 1)) > minTileSize) {
+    numLevels++;
+  }
+  usedArea = 0;
+  freeTiles.resize(numLevels);
+  freeTiles[0].insert(Key(glm::ivec2(0, 0)));
+}
+
+int ShadowAtlasAllocator::LevelOf(const int tileSize) const {
+  int level = 0;
+  while (level < numLevels - 1 && (atlasSize >> level) > tileSize) {
+    level++;
+  }
+  return level;
+}
+
+bool ShadowAtlasAllocator::Allocate(const int tileSize, glm::ivec2 &offset) {
+  const int level = LevelOf(tileSize);
+
+  // Find the smallest free block that is large enough.
+  int from = level;
+  while (from >= 0 && freeTiles[from].empty()) {
+    from--;
+  }
+  if (from < 0) {
+    return false;
+  }
+
+  long long key = *freeTiles[from].begin();
+  freeTiles[from].erase(freeTiles[from].begin());
+  glm::ivec2 block((int)(key >> 32), (int)(key & 0xffffffff));
+
+  // Split it down to the requested level, keeping the first quadrant.
+  for (int l = from + 1; l <= level; ++l) {
+    int half = atlasSize >> l;
+    freeTiles[l].insert(Key(block + glm::ivec2(half, 0)));
+    freeTiles[l].insert(Key(block + glm::ivec2(0, half)));
+    freeTiles[l].insert(Key(block + glm::ivec2(half, half)));
+  }
+
+  int size = atlasSize >> level;
+  usedArea += (long long)size * size;
+  offset = block;
+  return true;
+}
+
+void ShadowAtlasAllocator::Free(const glm::ivec2 &offset, const int tileSize) {
+  int level = LevelOf(tileSize);
+  int size = atlasSize >> level;
+  usedArea -= (long long)size * size;
+
+  // Merge with the three buddies while they are all free.
+  glm::ivec2 block = offset;
+  while (level > 0) {
+    int parentSize = atlasSize >> (level - 1);
+    glm::ivec2 parent = (block / parentSize) * parentSize;
+    int half = parentSize / 2;
+    glm::ivec2 quads[4] = {parent, parent + glm::ivec2(half, 0),
+                           parent + glm::ivec2(0, half),
+                           parent + glm::ivec2(half, half)};
+    bool allFree = true;
+    for (const auto &q : quads) {
+      if (q != block && freeTiles[level].count(Key(q)) == 0) {
+        allFree = false;
+        break;
+      }
+    }
+    if (!allFree) {
+      break;
+    }
+    for (const auto &q : quads) {
+      freeTiles[level].erase(Key(q));
+    }
+    block = parent;
+    level--;
+  }
+  freeTiles[level].insert(Key(block));
+}
+
+float ShadowAtlasAllocator::GetOccupancy() const {
+  return (float)usedArea / ((float)atlasSize * (float)atlasSize);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+ShadowAtlas::ShadowAtlas(const int atlasSize, const int maxTileSize,
+                         const int minTileSize)
+    : allocator(atlasSize, minTileSize) {
+  this->atlasSize = atlasSize;
+  this->maxTileSize = maxTileSize;
+  this->minTileSize = minTileSize;
+  maxRange = 50.0f;
+  // Two 1024^2 faces per frame.
+  texelBudget = 2 * 1024 * 1024;
+  texelsThisFrame = 0;
+  lastTransformVersion = 0;
+
+  glGenTextures(1, &depthTexture);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, atlasSize, atlasSize,
+               0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,
+                  GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glGenFramebuffers(1, &fboId);
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         depthTexture, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowAtlas::~ShadowAtlas() {
+  glDeleteFramebuffers(1, &fboId);
+  glDeleteTextures(1, &depthTexture);
+}
+
+AtlasLightEntry &ShadowAtlas::GetEntry(const Light *light, const bool isPoint,
+                                       const int index) {
+  for (auto &entry : entries) {
+    if (entry.light == light) {
+      entry.index = index;
+      return entry;
+    }
+  }
+
+  AtlasLightEntry entry;
+  entry.light = light;
+  entry.isPoint = isPoint;
+  entry.index = index;
+  entry.tileSize = 0;
+  entry.hasTiles = false;
+  entry.retiredTileSize = 0;
+  entry.hasRetiredTiles = false;
+  entry.position = glm::vec3(0.0f);
+  entry.direction = glm::vec3(0.0f);
+  entry.range = 0.0f;
+  entry.fovy = 0.0f;
+  entry.viewProj = glm::mat4x4(1.0f);
+  entry.published.valid = false;
+  entry.dirty = true;
+  entry.everRendered = false;
+  entry.framesDirty = 0;
+  entry.desiredSize = 0;
+  entry.resizeFrames = 0;
+  entry.coverage = 0.0f;
+  entry.renderCount = 0;
+  entry.state = AtlasLightState::Deferred;
+  entries.push_back(entry);
+  return entries.back();
+}
+
+float ShadowAtlas::ComputeRange(const Light *light, const glm::vec3 &intensity,
+                                const float maxRange) {
+  // Distance at which the attenuated intensity drops below 1/256.
+  float I = glm::max(glm::max(intensity.r, intensity.g), intensity.b);
+  float c = light->GetConstant();
+  float l = light->GetLinear();
+  float q = light->GetQuadratic();
+  float target = 256.0f * I;
+  float x = maxRange;
+  if (q > 0.0f) {
+    float disc = l * l - 4.0f * q * (c - target);
+    if (disc >= 0.0f) {
+      x = (-l + std::sqrt(disc)) / (2.0f * q);
+    }
+  } else if (l > 0.0f) {
+    x = (target - c) / l;
+  }
+  float range = light->GetDecayStart() + x;
+  if (!std::isfinite(range) || range <= 0.0f) {
+    return maxRange;
+  }
+  return glm::clamp(range, 0.1f, maxRange);
+}
+
+float ShadowAtlas::ComputeCoverage(const Camera *camera,
+                                   const glm::vec3 &center,
+                                   const float radius) const {
+  glm::vec3 viewCenter =
+      glm::vec3(camera->GetViewMatrix() * glm::vec4(center, 1.0f));
+  float dist = glm::length(viewCenter);
+  if (dist <= radius) {
+    return 1.0f;
+  }
+
+  // Reject spheres completely outside the view frustum.
+  float tanHalfFovy = std::tan(glm::radians(camera->GetFovy()) * 0.5f);
+  float tanHalfFovx = tanHalfFovy * camera->GetAspectRatio();
+  float depth = -viewCenter.z;
+  float cosY = 1.0f / std::sqrt(1.0f + tanHalfFovy * tanHalfFovy);
+  float cosX = 1.0f / std::sqrt(1.0f + tanHalfFovx * tanHalfFovx);
+  if (depth + radius < camera->GetNearPlane() ||
+      (std::abs(viewCenter.y) - depth * tanHalfFovy) * cosY > radius ||
+      (std::abs(viewCenter.x) - depth * tanHalfFovx) * cosX > radius) {
+    return 0.0f;
+  }
+
+  // Projected disc area relative to the screen area.
+  float projected = radius / (glm::max(depth, radius) * tanHalfFovy);
+  float area = glm::pi<float>() * projected * projected /
+               (4.0f * camera->GetAspectRatio());
+  return glm::clamp(area, 0.0f, 1.0f);
+}
+
+int ShadowAtlas::SizeForCoverage(const float coverage,
+                                 const bool isPoint) const {
+  // Linear resolution follows the projected size of the light's range.
+  float ideal = (float)maxTileSize * std::sqrt(coverage);
+  if (isPoint) {
+    // Six faces share the coverage.
+    ideal *= 0.5f;
+  }
+  int size = minTileSize;
+  while (size < maxTileSize && (float)size < ideal) {
+    size *= 2;
+  }
+  return size;
+}
+
+bool ShadowAtlas::AllocateTileSet(const int numTiles, const int size,
+                                  glm::ivec2 *tiles) {
+  int allocated = 0;
+  for (; allocated < numTiles; ++allocated) {
+    if (!allocator.Allocate(size, tiles[allocated])) {
+      break;
+    }
+  }
+  if (allocated == numTiles) {
+    return true;
+  }
+  // Roll back.
+  FreeTileSet(allocated, size, tiles);
+  return false;
+}
+
+void ShadowAtlas::FreeTileSet(const int numTiles, const int size,
+                              const glm::ivec2 *tiles) {
+  for (int i = 0; i < numTiles; ++i) {
+    allocator.Free(tiles[i], size);
+  }
+}
+
+bool ShadowAtlas::AllocateTiles(AtlasLightEntry &entry, const int size) {
+  const int numTiles = entry.isPoint ? 6 : 1;
+  // Fall back to smaller tiles when the atlas is crowded.
+  for (int s = size; s >= minTileSize; s /= 2) {
+    if (AllocateTileSet(numTiles, s, entry.tiles)) {
+      entry.tileSize = s;
+      entry.hasTiles = true;
+      return true;
+    }
+  }
+  entry.hasTiles = false;
+  entry.tileSize = 0;
+  return false;
+}
+
+bool ShadowAtlas::ResizeTiles(AtlasLightEntry &entry, const int size) {
+  const int numTiles = entry.isPoint ? 6 : 1;
+  glm::ivec2 tiles[6];
+  if (!AllocateTileSet(numTiles, size, tiles)) {
+    return false;
+  }
+  if (entry.published.valid && !entry.hasRetiredTiles) {
+    // The current tiles hold the published shadow.
+    entry.retiredTileSize = entry.tileSize;
+    for (int i = 0; i < numTiles; ++i) {
+      entry.retiredTiles[i] = entry.tiles[i];
+    }
+    entry.hasRetiredTiles = true;
+  } else {
+    // Nothing was rendered into the current tiles yet.
+    FreeTileSet(numTiles, entry.tileSize, entry.tiles);
+  }
+  for (int i = 0; i < numTiles; ++i) {
+    entry.tiles[i] = tiles[i];
+  }
+  entry.tileSize = size;
+  entry.dirty = true;
+  return true;
+}
+
+void ShadowAtlas::FreeTiles(AtlasLightEntry &entry) {
+  FreeRetiredTiles(entry);
+  if (!entry.hasTiles) {
+    return;
+  }
+  FreeTileSet(entry.isPoint ? 6 : 1, entry.tileSize, entry.tiles);
+  entry.hasTiles = false;
+  entry.tileSize = 0;
+  entry.published.valid = false;
+  entry.everRendered = false;
+}
+
+void ShadowAtlas::FreeRetiredTiles(AtlasLightEntry &entry) {
+  if (!entry.hasRetiredTiles) {
+    return;
+  }
+  FreeTileSet(entry.isPoint ? 6 : 1, entry.retiredTileSize,
+              entry.retiredTiles);
+  entry.hasRetiredTiles = false;
+  entry.retiredTileSize = 0;
+}
+
+glm::vec4 ShadowAtlas::TileRect(const glm::ivec2 &offset,
+                                const int size) const {
+  return glm::vec4(glm::vec2(offset), glm::vec2((float)size)) /
+         (float)atlasSize;
+}
+
+void ShadowAtlas::MarkAllDirty() {
+  for (auto &entry : entries) {
+    entry.dirty = true;
+  }
+}
+
+void ShadowAtlas::RenderLight(AtlasLightEntry &entry, const Scene *scene,
+                              ShadowAtlasDepthShaderProg *depthShader) {
+  glUniform3fv(depthShader->GetLocLightPos(), 1,
+               glm::value_ptr(entry.position));
+  glUniform1f(depthShader->GetLocLightRange(), entry.range);
+
+  const int numTiles = entry.isPoint ? 6 : 1;
+  for (int face = 0; face < numTiles; ++face) {
+    glm::mat4x4 viewProj;
+    if (entry.isPoint) {
+      glm::mat4x4 proj =
+          glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, entry.range);
+      glm::mat4x4 view = glm::lookAt(
+          entry.position, entry.position + kFaceForward[face], kFaceUp[face]);
+      viewProj = proj * view;
+    } else {
+      viewProj = entry.viewProj;
+    }
+
+    const glm::ivec2 &tile = entry.tiles[face];
+    glViewport(tile.x, tile.y, entry.tileSize, entry.tileSize);
+    glScissor(tile.x, tile.y, entry.tileSize, entry.tileSize);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    for (int i = 0; i < (int)scene->objects.size(); ++i) {
+      const SceneObject &obj = scene->objects[i];
+      if (obj.mesh == nullptr) {
+        continue;
+      }
+      const glm::mat4x4 &world = scene->transforms.GetWorld(i);
+      glm::mat4x4 MVP = viewProj * world;
+      glUniformMatrix4fv(depthShader->GetLocMVP(), 1, GL_FALSE,
+                         glm::value_ptr(MVP));
+      glUniformMatrix4fv(depthShader->GetLocWorldMatrix(), 1, GL_FALSE,
+                         glm::value_ptr(world));
+      obj.mesh->drawDepth();
+    }
+  }
+  texelsThisFrame += (long long)numTiles * entry.tileSize * entry.tileSize;
+  entry.renderCount++;
+
+  AtlasShadow &published = entry.published;
+  published.valid = true;
+  published.tileSize = entry.tileSize;
+  for (int face = 0; face < numTiles; ++face) {
+    published.tiles[face] = entry.tiles[face];
+  }
+  published.position = entry.position;
+  published.range = entry.range;
+  published.viewProj = entry.viewProj;
+  FreeRetiredTiles(entry);
+}
+
+void ShadowAtlas::Update(const Camera *camera, const Scene *scene,
+                         const glm::mat4x4 &rootTransform,
+                         ShadowAtlasDepthShaderProg *depthShader) {
+  PROFILE_GPU_SCOPE("Shadow Atlas");
+  texelsThisFrame = 0;
+
+  // Find the objects that moved since the last frame. The spheres can only
+  // differ if the transform store changed.
+  const TransformStore &transforms = scene->transforms;
+  const int numObjects = transforms.GetNumObjects();
+  std::vector<glm::vec4> movedSpheres;
+  if (numObjects != (int)lastObjectSpheres.size()) {
+    MarkAllDirty();
+    lastObjectSpheres.resize(numObjects);
+    for (int i = 0; i < numObjects; ++i) {
+      lastObjectSpheres[i] = transforms.GetBoundingSphere(i);
+    }
+  } else if (transforms.GetVersion() != lastTransformVersion) {
+    for (int i = 0; i < numObjects; ++i) {
+      const glm::vec4 &sphere = transforms.GetBoundingSphere(i);
+      if (sphere != lastObjectSpheres[i]) {
+        movedSpheres.push_back(lastObjectSpheres[i]);
+        movedSpheres.push_back(sphere);
+        lastObjectSpheres[i] = sphere;
+      }
+    }
+  }
+  lastTransformVersion = transforms.GetVersion();
+
+  // Collect the lights and drop entries of lights that no longer exist.
+  std::vector<const Light *> lights;
+  for (int i = 0; i < (int)scene->pointLights.size() && i < MAX_POINT_LIGHTS;
+       ++i) {
+    GetEntry(scene->pointLights[i], true, i);
+    lights.push_back(scene->pointLights[i]);
+  }
+  for (int i = 0; i < (int)scene->spotLights.size() && i < MAX_SPOT_LIGHTS;
+       ++i) {
+    GetEntry(scene->spotLights[i], false, i);
+    lights.push_back(scene->spotLights[i]);
+  }
+  for (size_t i = 0; i < entries.size();) {
+    if (std::find(lights.begin(), lights.end(), entries[i].light) ==
+        lights.end()) {
+      FreeTiles(entries[i]);
+      entries.erase(entries.begin() + i);
+    } else {
+      ++i;
+    }
+  }
+
+  // Detect changes and pick the tile size of every light.
+  for (auto &entry : entries) {
+    glm::vec3 position, direction(0.0f), intensity;
+    float fovy = 90.0f;
+    if (entry.isPoint) {
+      const PointLight *light = scene->pointLights[entry.index];
+      position = light->GetPosition();
+      intensity = light->GetIntensity();
+    } else {
+      const SpotLight *light = scene->spotLights[entry.index];
+      position = light->GetPosition();
+      direction = glm::normalize(glm::mat3(rootTransform) *
+                                 light->GetDirection());
+      intensity = light->GetIntensity();
+      float halfAngle = std::acos(glm::clamp(light->GetCosCutoffEnd(), 0.0f,
+                                             1.0f));
+      fovy = glm::min(glm::degrees(halfAngle) * 2.0f * 1.1f, 170.0f);
+    }
+    // Light parameters live in model space, like in the Phong shader.
+    position = glm::vec3(rootTransform * glm::vec4(position, 1.0f));
+    float range = ComputeRange(entry.light, intensity, maxRange);
+
+    if (position != entry.position || direction != entry.direction ||
+        range != entry.range || fovy != entry.fovy) {
+      entry.position = position;
+      entry.direction = direction;
+      entry.range = range;
+      entry.fovy = fovy;
+      if (!entry.isPoint) {
+        glm::vec3 up = std::abs(direction.y) > 0.99f
+                           ? glm::vec3(1.0f, 0.0f, 0.0f)
+                           : glm::vec3(0.0f, 1.0f, 0.0f);
+        entry.viewProj =
+            glm::perspective(glm::radians(fovy), 1.0f, 0.05f, range) *
+            glm::lookAt(position, position + direction, up);
+      }
+      entry.dirty = true;
+    }
+
+    // An object moving inside the range invalidates the shadow.
+    for (const auto &s : movedSpheres) {
+      if (glm::distance(glm::vec3(s), position) < range + s.w) {
+        entry.dirty = true;
+        break;
+      }
+    }
+
+    entry.coverage = ComputeCoverage(camera, position, range);
+    int desired = SizeForCoverage(entry.coverage, entry.isPoint);
+    // Only resize after the new size has been wanted for a while, so lights
+    // near a threshold do not thrash the atlas. A light that fell back to
+    // smaller tiles retries at the same pace.
+    if (desired != entry.desiredSize) {
+      entry.desiredSize = desired;
+      entry.resizeFrames = 0;
+    } else {
+      entry.resizeFrames++;
+    }
+    if (entry.hasTiles && entry.tileSize != desired &&
+        entry.resizeFrames >= 15) {
+      entry.resizeFrames = 0;
+      ResizeTiles(entry, desired);
+    }
+  }
+
+  // Allocate the largest tiles first to keep the atlas tidy.
+  std::vector<AtlasLightEntry *> order;
+  for (auto &entry : entries) {
+    order.push_back(&entry);
+  }
+  std::sort(order.begin(), order.end(),
+            [](const AtlasLightEntry *a, const AtlasLightEntry *b) {
+              return a->desiredSize > b->desiredSize;
+            });
+  for (auto entry : order) {
+    if (!entry->hasTiles) {
+      entry->dirty = true;
+      if (!AllocateTiles(*entry, entry->desiredSize)) {
+        entry->state = AtlasLightState::NoSpace;
+      }
+    }
+  }
+
+  // Schedule the dirty lights: never-rendered first, then by screen coverage
+  // weighted with how long they have been waiting.
+  std::vector<AtlasLightEntry *> candidates;
+  for (auto &entry : entries) {
+    if (!entry.hasTiles) {
+      continue;
+    }
+    if (!entry.dirty) {
+      entry.state = AtlasLightState::Clean;
+      entry.framesDirty = 0;
+    } else if (entry.coverage <= 0.0f && entry.everRendered) {
+      entry.state = AtlasLightState::Offscreen;
+      entry.framesDirty++;
+    } else {
+      candidates.push_back(&entry);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const AtlasLightEntry *a, const AtlasLightEntry *b) {
+              if (a->everRendered != b->everRendered) {
+                return !a->everRendered;
+              }
+              return a->coverage * (1.0f + a->framesDirty) >
+                     b->coverage * (1.0f + b->framesDirty);
+            });
+
+  if (candidates.empty()) {
+    return;
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  GLint prevFbo = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFbo);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+  depthShader->Bind();
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_SCISSOR_TEST);
+
+  for (auto entry : candidates) {
+    long long cost = (long long)(entry->isPoint ? 6 : 1) * entry->tileSize *
+                     entry->tileSize;
+    // Always allow one light so a large light cannot starve forever.
+    if (texelsThisFrame > 0 && texelsThisFrame + cost > texelBudget) {
+      entry->state = AtlasLightState::Deferred;
+      entry->framesDirty++;
+      continue;
+    }
+    RenderLight(*entry, scene, depthShader);
+    entry->dirty = false;
+    entry->everRendered = true;
+    entry->framesDirty = 0;
+    entry->state = AtlasLightState::Rendered;
+  }
+
+  glDisable(GL_SCISSOR_TEST);
+  depthShader->UnBind();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFbo);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void ShadowAtlas::Bind(PhongShadingDemoShaderProg *shader,
+                       const int textureUnit) {
+  glActiveTexture(GL_TEXTURE0 + textureUnit);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glUniform1i(shader->GetLocShadowAtlas(), textureUnit);
+
+  // Lights without a rendered shadow get range 0, which the shader treats as
+  // unshadowed.
+  glm::vec4 pointPosRange[MAX_POINT_LIGHTS];
+  glm::vec4 pointRects[MAX_POINT_LIGHTS * 6];
+  glm::vec4 spotPosRange[MAX_SPOT_LIGHTS];
+  glm::vec4 spotRects[MAX_SPOT_LIGHTS];
+  glm::mat4x4 spotVP[MAX_SPOT_LIGHTS];
+  for (int i = 0; i < MAX_POINT_LIGHTS; ++i) {
+    pointPosRange[i] = glm::vec4(0.0f);
+    for (int f = 0; f < 6; ++f) {
+      pointRects[i * 6 + f] = glm::vec4(0.0f);
+    }
+  }
+  for (int i = 0; i < MAX_SPOT_LIGHTS; ++i) {
+    spotPosRange[i] = glm::vec4(0.0f);
+    spotRects[i] = glm::vec4(0.0f);
+    spotVP[i] = glm::mat4x4(1.0f);
+  }
+
+  // A light that changed but waits for the budget keeps its old shadow.
+  for (const auto &entry : entries) {
+    const AtlasShadow &shadow = entry.published;
+    if (!shadow.valid) {
+      continue;
+    }
+    if (entry.isPoint) {
+      pointPosRange[entry.index] = glm::vec4(shadow.position, shadow.range);
+      for (int f = 0; f < 6; ++f) {
+        pointRects[entry.index * 6 + f] =
+            TileRect(shadow.tiles[f], shadow.tileSize);
+      }
+    } else {
+      spotPosRange[entry.index] = glm::vec4(shadow.position, shadow.range);
+      spotRects[entry.index] = TileRect(shadow.tiles[0], shadow.tileSize);
+      spotVP[entry.index] = shadow.viewProj;
+    }
+  }
+
+  glUniform4fv(shader->GetLocPointShadowPosRange(), MAX_POINT_LIGHTS,
+               glm::value_ptr(pointPosRange[0]));
+  glUniform4fv(shader->GetLocPointShadowRects(), MAX_POINT_LIGHTS * 6,
+               glm::value_ptr(pointRects[0]));
+  glUniform4fv(shader->GetLocSpotShadowPosRange(), MAX_SPOT_LIGHTS,
+               glm::value_ptr(spotPosRange[0]));
+  glUniform4fv(shader->GetLocSpotShadowRects(), MAX_SPOT_LIGHTS,
+               glm::value_ptr(spotRects[0]));
+  glUniformMatrix4fv(shader->GetLocSpotShadowVP(), MAX_SPOT_LIGHTS, GL_FALSE,
+                     glm::value_ptr(spotVP[0]));
+}
+
+void ShadowAtlas::DrawDebugPanel() {
+  ImGui::Begin("Shadow Atlas");
+  ImGui::Text("Atlas: %d x %d, %.1f%% allocated", atlasSize, atlasSize,
+              allocator.GetOccupancy() * 100.0f);
+  int budgetK = (int)(texelBudget / 1024);
+  if (ImGui::SliderInt("Budget (K texels)", &budgetK, 64, 16384)) {
+    texelBudget = (long long)budgetK * 1024;
+  }
+  ImGui::ProgressBar(
+      glm::min(1.0f, (float)texelsThisFrame / (float)texelBudget),
+      ImVec2(-1.0f, 0.0f));
+  ImGui::Text("Rendered this frame: %lld K texels", texelsThisFrame / 1024);
+
+  if (ImGui::BeginTable("lights", 6)) {
+    ImGui::TableSetupColumn("Light");
+    ImGui::TableSetupColumn("Coverage");
+    ImGui::TableSetupColumn("Tile");
+    ImGui::TableSetupColumn("State");
+    ImGui::TableSetupColumn("Waiting");
+    ImGui::TableSetupColumn("Renders");
+    ImGui::TableHeadersRow();
+    for (const auto &entry : entries) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%s %d", entry.isPoint ? "Point" : "Spot", entry.index);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f%%", entry.coverage * 100.0f);
+      ImGui::TableNextColumn();
+      if (entry.hasTiles) {
+        ImGui::Text("%d x%d", entry.tileSize, entry.isPoint ? 6 : 1);
+      } else {
+        ImGui::Text("-");
+      }
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", StateName(entry.state));
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", entry.framesDirty);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", entry.renderCount);
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+}
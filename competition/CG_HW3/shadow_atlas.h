@@ -0,0 +1,163 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include "camera.h"
+#include "headers.h"
+#include "light.h"
+#include "scene.h"
+#include "shaderprog.h"
+
+// What the scheduler did with a light in the last frame.
+enum class AtlasLightState {
+  Clean,       // Shadow is up to date.
+  Rendered,    // Re-rendered this frame.
+  Deferred,    // Dirty, but over the frame budget.
+  Offscreen,   // Dirty, but cannot affect any visible pixel.
+  NoSpace,     // Atlas is full; the light is unshadowed.
+};
+
+// ShadowAtlasAllocator Declarations.
+// Buddy allocator for power-of-two square tiles in a square atlas.
+class ShadowAtlasAllocator {
+ public:
+  ShadowAtlasAllocator(const int atlasSize, const int minTileSize);
+
+  // Returns false when no tile of this size is free.
+  bool Allocate(const int tileSize, glm::ivec2 &offset);
+  void Free(const glm::ivec2 &offset, const int tileSize);
+
+  // Fraction of the atlas area in use.
+  float GetOccupancy() const;
+
+ private:
+  int LevelOf(const int tileSize) const;
+  static long long Key(const glm::ivec2 &offset) {
+    return ((long long)offset.x << 32) | (unsigned int)offset.y;
+  }
+
+  int atlasSize;
+  int numLevels;
+  long long usedArea;
+  // freeTiles[level] holds the offsets of free tiles of size atlasSize >> level.
+  std::vector<std::set<long long>> freeTiles;
+};
+
+// A shadow as it was last rendered; this is what Bind uploads. Update
+// changes the light's parameters and tiles before the budget lets the light
+// render again, so they are kept apart.
+struct AtlasShadow {
+  bool valid;
+  int tileSize;
+  glm::ivec2 tiles[6];
+  glm::vec3 position;
+  float range;
+  glm::mat4x4 viewProj;
+};
+
+// Shadow state of one point or spot light.
+struct AtlasLightEntry {
+  const Light *light;
+  bool isPoint;
+  int index;  // Index into scene->pointLights or scene->spotLights.
+
+  // Tiles: 6 cube faces for point lights, 1 for spot lights.
+  int tileSize;
+  glm::ivec2 tiles[6];
+  bool hasTiles;
+  // Tiles of the published shadow while a resize waits for its first
+  // render.
+  int retiredTileSize;
+  glm::ivec2 retiredTiles[6];
+  bool hasRetiredTiles;
+
+  // Parameters of the light this frame; the shadow is rendered with them.
+  glm::vec3 position;
+  glm::vec3 direction;
+  float range;
+  float fovy;
+  glm::mat4x4 viewProj;
+  AtlasShadow published;
+
+  bool dirty;
+  bool everRendered;
+  int framesDirty;
+  int desiredSize;
+  int resizeFrames;
+  float coverage;
+  int renderCount;
+  AtlasLightState state;
+};
+
+// ShadowAtlas Declarations.
+// One shared depth atlas for all point and spot light shadows. Point lights
+// use six tiles (one per cube face), spot lights one. Tile resolution follows
+// the screen coverage of the light's range. A light is re-rendered only when
+// its parameters change or an object inside its range moves, and the updates
+// of a frame are limited by a texel budget; the rest wait for later frames.
+class ShadowAtlas {
+ public:
+  // ShadowAtlas Public Methods.
+  ShadowAtlas(const int atlasSize = 4096, const int maxTileSize = 1024,
+              const int minTileSize = 64);
+  ~ShadowAtlas();
+
+  // scene->transforms must be up to date.
+  void Update(const Camera *camera, const Scene *scene,
+              const glm::mat4x4 &rootTransform,
+              ShadowAtlasDepthShaderProg *depthShader);
+
+  // Bind the atlas and upload per-light shadow data to the Phong shader.
+  void Bind(PhongShadingDemoShaderProg *shader, const int textureUnit);
+
+  // Call when objects are added or removed.
+  void MarkAllDirty();
+
+  void SetTexelBudget(const long long texels) { texelBudget = texels; }
+
+  void DrawDebugPanel();
+
+ private:
+  // ShadowAtlas Private Methods.
+  AtlasLightEntry &GetEntry(const Light *light, const bool isPoint,
+                            const int index);
+  static float ComputeRange(const Light *light, const glm::vec3 &intensity,
+                            const float maxRange);
+  float ComputeCoverage(const Camera *camera, const glm::vec3 &center,
+                        const float radius) const;
+  int SizeForCoverage(const float coverage, const bool isPoint) const;
+  // Allocates numTiles tiles of exactly size, or none.
+  bool AllocateTileSet(const int numTiles, const int size, glm::ivec2 *tiles);
+  void FreeTileSet(const int numTiles, const int size,
+                   const glm::ivec2 *tiles);
+  bool AllocateTiles(AtlasLightEntry &entry, const int size);
+  // Moves the light to tiles of size if they can be allocated. The
+  // published shadow keeps its tiles until the light renders into the new
+  // ones.
+  bool ResizeTiles(AtlasLightEntry &entry, const int size);
+  // The tiles may be handed to another light, so the published shadow is
+  // dropped with them.
+  void FreeTiles(AtlasLightEntry &entry);
+  void FreeRetiredTiles(AtlasLightEntry &entry);
+  void RenderLight(AtlasLightEntry &entry, const Scene *scene,
+                   ShadowAtlasDepthShaderProg *depthShader);
+  glm::vec4 TileRect(const glm::ivec2 &offset, const int size) const;
+
+  // ShadowAtlas Private Data.
+  int atlasSize;
+  int maxTileSize;
+  int minTileSize;
+  float maxRange;
+  long long texelBudget;
+  long long texelsThisFrame;
+
+  GLuint fboId;
+  GLuint depthTexture;
+  ShadowAtlasAllocator allocator;
+
+  std::vector<AtlasLightEntry> entries;
+  // World bounding spheres of the scene objects in the previous frame.
+  std::vector<glm::vec4> lastObjectSpheres;
+  unsigned long long lastTransformVersion;
+};
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// 8-wide float vector for the CPU renderers. One AVX2 register when the
+// compiler targets AVX2 (CMake option ENABLE_AVX2), two SSE or NEON
+// registers otherwise, and a plain array as the last resort. Comparisons
+// return lane masks (all bits set or clear) for Select, Any and MoveMask.
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+// float8 Declarations.
+struct float8 {
+#if SIMD_AVX2
+  __m256 v;
+#elif SIMD_SSE
+  __m128 lo, hi;
+#elif SIMD_NEON
+  float32x4_t lo, hi;
+#else
+  float f[8];
+#endif
+
+  static const char *Name() {
+#if SIMD_AVX2
+    return "avx2";
+#elif SIMD_SSE
+    return "sse2";
+#elif SIMD_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+  }
+
+  static float8 Broadcast(const float s) {
+    float8 r;
+#if SIMD_AVX2
+    r.v = _mm256_set1_ps(s);
+#elif SIMD_SSE
+    r.lo = r.hi = _mm_set1_ps(s);
+#elif SIMD_NEON
+    r.lo = r.hi = vdupq_n_f32(s);
+#else
+    for (int i = 0; i < 8; i++) r.f[i] = s;
+#endif
+    return r;
+  }
+
+  // Unaligned load and store of 8 floats.
+  static float8 Load(const float *p) {
+    float8 r;
+#if SIMD_AVX2
+    r.v = _mm256_loadu_ps(p);
+#elif SIMD_SSE
+    r.lo = _mm_loadu_ps(p);
+    r.hi = _mm_loadu_ps(p + 4);
+#elif SIMD_NEON
+    r.lo = vld1q_f32(p);
+    r.hi = vld1q_f32(p + 4);
+#else
+    for (int i = 0; i < 8; i++) r.f[i] = p[i];
+#endif
+    return r;
+  }
+  void Store(float *p) const {
+#if SIMD_AVX2
+    _mm256_storeu_ps(p, v);
+#elif SIMD_SSE
+    _mm_storeu_ps(p, lo);
+    _mm_storeu_ps(p + 4, hi);
+#elif SIMD_NEON
+    vst1q_f32(p, lo);
+    vst1q_f32(p + 4, hi);
+#else
+    for (int i = 0; i < 8; i++) p[i] = f[i];
+#endif
+  }
+
+  // (0, 1, ..., 7).
+  static float8 Ramp() {
+    static const float ramp[8] = {0.0f, 1.0f, 2.0f, 3.0f,
+                                  4.0f, 5.0f, 6.0f, 7.0f};
+    return Load(ramp);
+  }
+};
+
+#if SIMD_AVX2
+#define SIMD_BINARY(name, avx)                      \
+  inline float8 name(const float8 &a, const float8 &b) { \
+    float8 r;                                       \
+    r.v = avx(a.v, b.v);                            \
+    return r;                                       \
+  }
+#define SIMD_COMPARE(name, pred)                    \
+  inline float8 name(const float8 &a, const float8 &b) { \
+    float8 r;                                       \
+    r.v = _mm256_cmp_ps(a.v, b.v, pred);            \
+    return r;                                       \
+  }
+SIMD_BINARY(operator+, _mm256_add_ps)
+SIMD_BINARY(operator-, _mm256_sub_ps)
+SIMD_BINARY(operator*, _mm256_mul_ps)
+SIMD_BINARY(operator/, _mm256_div_ps)
+SIMD_BINARY(Min, _mm256_min_ps)
+SIMD_BINARY(Max, _mm256_max_ps)
+SIMD_BINARY(operator&, _mm256_and_ps)
+SIMD_BINARY(operator|, _mm256_or_ps)
+SIMD_COMPARE(operator<, _CMP_LT_OQ)
+SIMD_COMPARE(operator<=, _CMP_LE_OQ)
+SIMD_COMPARE(operator>, _CMP_GT_OQ)
+SIMD_COMPARE(operator>=, _CMP_GE_OQ)
+
+// mask ? a : b.
+inline float8 Select(const float8 &mask, const float8 &a, const float8 &b) {
+  float8 r;
+  r.v = _mm256_blendv_ps(b.v, a.v, mask.v);
+  return r;
+}
+// Bit i is set when lane i of the mask is set.
+inline int MoveMask(const float8 &mask) { return _mm256_movemask_ps(mask.v); }
+
+#elif SIMD_SSE
+#define SIMD_BINARY(name, sse)                      \
+  inline float8 name(const float8 &a, const float8 &b) { \
+    float8 r;                                       \
+    r.lo = sse(a.lo, b.lo);                         \
+    r.hi = sse(a.hi, b.hi);                         \
+    return r;                                       \
+  }
+#define SIMD_COMPARE(name, sse) SIMD_BINARY(name, sse)
+SIMD_BINARY(operator+, _mm_add_ps)
+SIMD_BINARY(operator-, _mm_sub_ps)
+SIMD_BINARY(operator*, _mm_mul_ps)
+SIMD_BINARY(operator/, _mm_div_ps)
+SIMD_BINARY(Min, _mm_min_ps)
+SIMD_BINARY(Max, _mm_max_ps)
+SIMD_BINARY(operator&, _mm_and_ps)
+SIMD_BINARY(operator|, _mm_or_ps)
+SIMD_COMPARE(operator<, _mm_cmplt_ps)
+SIMD_COMPARE(operator<=, _mm_cmple_ps)
+SIMD_COMPARE(operator>, _mm_cmpgt_ps)
+SIMD_COMPARE(operator>=, _mm_cmpge_ps)
+
+inline float8 Select(const float8 &mask, const float8 &a, const float8 &b) {
+  float8 r;
+  r.lo = _mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo));
+  r.hi = _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi));
+  return r;
+}
+inline int MoveMask(const float8 &mask) {
+  return _mm_movemask_ps(mask.lo) | (_mm_movemask_ps(mask.hi) << 4);
+}
+
+#elif SIMD_NEON
+#define SIMD_BINARY(name, neon)                     \
+  inline float8 name(const float8 &a, const float8 &b) { \
+    float8 r;                                       \
+    r.lo = neon(a.lo, b.lo);                        \
+    r.hi = neon(a.hi, b.hi);                        \
+    return r;                                       \
+  }
+#define SIMD_BITWISE(name, neon)                                       \
+  inline float8 name(const float8 &a, const float8 &b) {               \
+    float8 r;                                                          \
+    r.lo = vreinterpretq_f32_u32(                                      \
+        neon(vreinterpretq_u32_f32(a.lo), vreinterpretq_u32_f32(b.lo))); \
+    r.hi = vreinterpretq_f32_u32(                                      \
+        neon(vreinterpretq_u32_f32(a.hi), vreinterpretq_u32_f32(b.hi))); \
+    return r;                                                          \
+  }
+#define SIMD_COMPARE(name, neon)                                        \
+  inline float8 name(const float8 &a, const float8 &b) {                \
+    float8 r;                                                           \
+    r.lo = vreinterpretq_f32_u32(neon(a.lo, b.lo));                     \
+    r.hi = vreinterpretq_f32_u32(neon(a.hi, b.hi));                     \
+    return r;                                                           \
+  }
+SIMD_BINARY(operator+, vaddq_f32)
+SIMD_BINARY(operator-, vsubq_f32)
+SIMD_BINARY(operator*, vmulq_f32)
+#if defined(__aarch64__)
+SIMD_BINARY(operator/, vdivq_f32)
+#else
+inline float8 operator/(const float8 &a, const float8 &b) {
+  float x[8], y[8];
+  a.Store(x);
+  b.Store(y);
+  for (int i = 0; i < 8; i++) x[i] /= y[i];
+  return float8::Load(x);
+}
+#endif
+SIMD_BINARY(Min, vminq_f32)
+SIMD_BINARY(Max, vmaxq_f32)
+SIMD_BITWISE(operator&, vandq_u32)
+SIMD_BITWISE(operator|, vorrq_u32)
+SIMD_COMPARE(operator<, vcltq_f32)
+SIMD_COMPARE(operator<=, vcleq_f32)
+SIMD_COMPARE(operator>, vcgtq_f32)
+SIMD_COMPARE(operator>=, vcgeq_f32)
+#undef SIMD_BITWISE
+
+inline float8 Select(const float8 &mask, const float8 &a, const float8 &b) {
+  float8 r;
+  r.lo = vbslq_f32(vreinterpretq_u32_f32(mask.lo), a.lo, b.lo);
+  r.hi = vbslq_f32(vreinterpretq_u32_f32(mask.hi), a.hi, b.hi);
+  return r;
+}
+inline int MoveMask(const float8 &mask) {
+  unsigned int bits[8];
+  vst1q_u32(bits, vreinterpretq_u32_f32(mask.lo));
+  vst1q_u32(bits + 4, vreinterpretq_u32_f32(mask.hi));
+  int result = 0;
+  for (int i = 0; i < 8; i++) result |= (int)(bits[i] >> 31) << i;
+  return result;
+}
+
+#else
+#define SIMD_BINARY(name, op)                            \
+  inline float8 name(const float8 &a, const float8 &b) { \
+    float8 r;                                            \
+    for (int i = 0; i < 8; i++) r.f[i] = op;             \
+    return r;                                            \
+  }
+#define SIMD_COMPARE(name, cmp)                                  \
+  inline float8 name(const float8 &a, const float8 &b) {         \
+    float8 r;                                                    \
+    for (int i = 0; i < 8; i++) r.f[i] = SimdMaskBits(cmp);      \
+    return r;                                                    \
+  }
+inline float SimdMaskBits(const bool set) {
+  const unsigned int bits = set ? 0xffffffffu : 0u;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+inline unsigned int SimdBits(const float f) {
+  unsigned int bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+SIMD_BINARY(operator+, a.f[i] + b.f[i])
+SIMD_BINARY(operator-, a.f[i] - b.f[i])
+SIMD_BINARY(operator*, a.f[i] * b.f[i])
+SIMD_BINARY(operator/, a.f[i] / b.f[i])
+SIMD_BINARY(Min, std::min(a.f[i], b.f[i]))
+SIMD_BINARY(Max, std::max(a.f[i], b.f[i]))
+SIMD_COMPARE(operator<, a.f[i] < b.f[i])
+SIMD_COMPARE(operator<=, a.f[i] <= b.f[i])
+SIMD_COMPARE(operator>, a.f[i] > b.f[i])
+SIMD_COMPARE(operator>=, a.f[i] >= b.f[i])
+SIMD_COMPARE(operator&, (SimdBits(a.f[i]) & SimdBits(b.f[i])) != 0)
+SIMD_COMPARE(operator|, (SimdBits(a.f[i]) | SimdBits(b.f[i])) != 0)
+
+inline float8 Select(const float8 &mask, const float8 &a, const float8 &b) {
+  float8 r;
+  for (int i = 0; i < 8; i++) r.f[i] = SimdBits(mask.f[i]) ? a.f[i] : b.f[i];
+  return r;
+}
+inline int MoveMask(const float8 &mask) {
+  int result = 0;
+  for (int i = 0; i < 8; i++) result |= (SimdBits(mask.f[i]) ? 1 : 0) << i;
+  return result;
+}
+#endif
+
+#undef SIMD_BINARY
+#undef SIMD_COMPARE
+
+inline bool Any(const float8 &mask) { return MoveMask(mask) != 0; }
+
+// a * b + c.
+inline float8 MulAdd(const float8 &a, const float8 &b, const float8 &c) {
+#if SIMD_AVX2 && defined(__FMA__)
+  float8 r;
+  r.v = _mm256_fmadd_ps(a.v, b.v, c.v);
+  return r;
+#else
+  return a * b + c;
+#endif
+}
+
+#endif
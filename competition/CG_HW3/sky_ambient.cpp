@@ -0,0 +1,254 @@
+#include "sky_ambient.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "file_cache.h"
+#include "profiler.h"
+#include "shaderprog.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "timing.h"
+
+// Bump when the projection or the file layout changes.
+static const uint32_t kCacheVersion = 1;
+static const char kCacheMagic[4] = {'S', 'H', 'L', '2'};
+
+struct SkyCacheHeader {
+  char magic[4];
+  uint32_t version;
+};
+
+SkyAmbient::SkyAmbient()
+    : ready(false), enabled(true), intensity(1.0f), uboId(0) {}
+
+SkyAmbient::~SkyAmbient() {
+  // A load still running keeps its PendingLoad alive on its own.
+  if (uboId != 0) {
+    glDeleteBuffers(1, &uboId);
+  }
+}
+
+void SkyAmbient::Load(const std::string &panoramaPath) {
+  // A newer load replaces one still in flight; its result is dropped.
+  pending = std::make_shared<PendingLoad>();
+  pendingPath = panoramaPath;
+  std::shared_ptr<PendingLoad> task = pending;
+  ThreadPool::Get().Enqueue(
+      [panoramaPath, task]() { RunLoad(panoramaPath, task); });
+}
+
+void SkyAmbient::RunLoad(const std::string &panoramaPath,
+                         const std::shared_ptr<PendingLoad> &pending) {
+  PROFILE_SCOPE("Sky Ambient Load");
+  SkyAmbientLoadStats loadStats;
+  SH9 sh;
+  auto totalStart = std::chrono::steady_clock::now();
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t key;
+  bool ok = FileCache::HashFile(panoramaPath, key);
+  std::string cachePath;
+  if (ok) {
+    key = FileCache::Hash(&kCacheVersion, sizeof(kCacheVersion), key);
+    cachePath = FileCache::GetCachePath(panoramaPath, key, ".sh");
+  }
+  loadStats.hashMs = MsSince(start);
+
+  if (ok) {
+    std::vector<char> data;
+    SkyCacheHeader header;
+    if (FileCache::ReadFile(cachePath, data) &&
+        data.size() == sizeof(header) + sizeof(sh.c)) {
+      std::memcpy(&header, data.data(), sizeof(header));
+      if (std::memcmp(header.magic, kCacheMagic, 4) == 0 &&
+          header.version == kCacheVersion) {
+        std::memcpy(sh.c, data.data() + sizeof(header), sizeof(sh.c));
+        loadStats.cacheHit = true;
+      }
+    }
+  }
+
+  if (ok && !loadStats.cacheHit) {
+    start = std::chrono::steady_clock::now();
+    cv::Mat equirect = cv::imread(panoramaPath);
+    loadStats.decodeMs = MsSince(start);
+    ok = equirect.rows > 0 && equirect.cols > 0;
+    if (ok) {
+      start = std::chrono::steady_clock::now();
+      sh = ProjectEquirect(equirect);
+      loadStats.projectMs = MsSince(start);
+
+      SkyCacheHeader header;
+      std::memcpy(header.magic, kCacheMagic, 4);
+      header.version = kCacheVersion;
+      std::vector<char> data(sizeof(header) + sizeof(sh.c));
+      std::memcpy(data.data(), &header, sizeof(header));
+      std::memcpy(data.data() + sizeof(header), sh.c, sizeof(sh.c));
+      FileCache::WriteFile(cachePath, data.data(), data.size());
+    }
+  }
+  if (!ok) {
+    std::cerr << "[ERROR] Failed to load image texture: " << panoramaPath
+              << std::endl;
+  }
+  loadStats.totalMs = MsSince(totalStart);
+
+  std::lock_guard<std::mutex> lock(pending->mutex);
+  pending->coefficients = sh;
+  pending->stats = loadStats;
+  pending->ok = ok;
+  pending->done = true;
+}
+
+void SkyAmbient::Update(const glm::mat4x4 &viewMatrix,
+                        const float skyRotationY) {
+  if (pending != nullptr) {
+    std::lock_guard<std::mutex> lock(pending->mutex);
+    if (pending->done) {
+      if (pending->ok) {
+        coefficients = pending->coefficients;
+        stats = pending->stats;
+        texFilePath = pendingPath;
+        ready = true;
+      }
+      pending.reset();
+    }
+  }
+
+  // Same rotation as the skybox: panorama directions are rotated by
+  // skyRotationY into the world.
+  glm::mat4x4 skyToWorld = glm::rotate(
+      glm::mat4x4(1.0f), glm::radians(skyRotationY), glm::vec3(0, 1, 0));
+  SkyAmbientBlock block;
+  for (int i = 0; i < 9; i++) {
+    block.sh[i] = glm::vec4(coefficients.c[i], 0.0f);
+  }
+  block.normalMatrix = glm::mat4x4(glm::transpose(glm::mat3x3(skyToWorld)) *
+                                   glm::mat3x3(glm::inverse(viewMatrix)));
+  block.params = glm::vec4(enabled && ready ? 1.0f : 0.0f, intensity, 0.0f,
+                           0.0f);
+
+  if (uboId == 0) {
+    glGenBuffers(1, &uboId);
+    glBindBuffer(GL_UNIFORM_BUFFER, uboId);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(block), nullptr, GL_DYNAMIC_DRAW);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, uboId);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, SKY_AMBIENT_BINDING, uboId);
+}
+
+void SkyAmbient::DrawDebugPanel() {
+  ImGui::Begin("Sky Ambient");
+  ImGui::Checkbox("Directional ambient", &enabled);
+  ImGui::SliderFloat("Intensity", &intensity, 0.0f, 4.0f);
+  if (pending != nullptr) {
+    ImGui::Text("Loading %s...", pendingPath.c_str());
+  }
+  if (ready) {
+    ImGui::Text("%s", texFilePath.c_str());
+    ImGui::Text("Cache %s, %.2f ms total", stats.cacheHit ? "hit" : "miss",
+                stats.totalMs);
+    if (!stats.cacheHit) {
+      ImGui::Text("Decode %.2f ms, project %.2f ms (%s, %d threads)",
+                  stats.decodeMs, stats.projectMs, float8::Name(),
+                  ThreadPool::Get().GetConcurrency());
+    }
+    const glm::vec3 &dc = coefficients.c[0];
+    ImGui::Text("Average: %.3f %.3f %.3f", dc.r * 0.282095f,
+                dc.g * 0.282095f, dc.b * 0.282095f);
+  }
+  ImGui::End();
+}
+
+SH9 SkyAmbient::ProjectEquirect(const cv::Mat &equirect) {
+  PROFILE_SCOPE("Project Sky SH");
+  const int width = equirect.cols;
+  const int height = equirect.rows;
+  const float pi = glm::pi<float>();
+
+  // Longitude terms per column, padded to whole groups of 8. Padding
+  // columns read black, so they add nothing.
+  const int paddedWidth = (width + 7) / 8 * 8;
+  std::vector<float> cosPhi(paddedWidth, 0.0f);
+  std::vector<float> sinPhi(paddedWidth, 0.0f);
+  for (int x = 0; x < width; ++x) {
+    // Same mapping as the skybox: u follows atan2(z, x).
+    float phi = 2.0f * pi * ((float)x + 0.5f) / (float)width;
+    cosPhi[x] = std::cos(phi);
+    sinPhi[x] = std::sin(phi);
+  }
+
+  SH9 total;
+  std::mutex totalMutex;
+  ThreadPool::Get().ParallelFor(height, 16, [&](const int rowBegin,
+                                                const int rowEnd) {
+    // 9 coefficients x RGB.
+    float8 acc[27];
+    for (int i = 0; i < 27; ++i) acc[i] = float8::Broadcast(0.0f);
+    float r[8], g[8], b[8];
+    for (int y = rowBegin; y < rowEnd; ++y) {
+      // The top image row is straight up.
+      float theta = pi * (0.5f - ((float)y + 0.5f) / (float)height);
+      float cosTheta = std::cos(theta);
+      // Solid angle of a texel, with the 1/255 of the 8-bit colors.
+      float weight =
+          cosTheta * (2.0f * pi / width) * (pi / height) / 255.0f;
+      const float8 dirY = float8::Broadcast(std::sin(theta));
+      const float8 ringRadius = float8::Broadcast(cosTheta);
+      const float8 texelWeight = float8::Broadcast(weight);
+      const unsigned char *row = equirect.ptr<unsigned char>(y);
+      for (int x0 = 0; x0 < paddedWidth; x0 += 8) {
+        for (int i = 0; i < 8; ++i) {
+          int x = x0 + i;
+          if (x < width) {
+            b[i] = row[x * 3];
+            g[i] = row[x * 3 + 1];
+            r[i] = row[x * 3 + 2];
+          } else {
+            r[i] = g[i] = b[i] = 0.0f;
+          }
+        }
+        const float8 dirX = ringRadius * float8::Load(&cosPhi[x0]);
+        const float8 dirZ = ringRadius * float8::Load(&sinPhi[x0]);
+        float8 basis[9];
+        basis[0] = float8::Broadcast(0.282095f);
+        basis[1] = float8::Broadcast(0.488603f) * dirY;
+        basis[2] = float8::Broadcast(0.488603f) * dirZ;
+        basis[3] = float8::Broadcast(0.488603f) * dirX;
+        basis[4] = float8::Broadcast(1.092548f) * dirX * dirY;
+        basis[5] = float8::Broadcast(1.092548f) * dirY * dirZ;
+        basis[6] = float8::Broadcast(0.315392f) *
+                   (float8::Broadcast(3.0f) * dirZ * dirZ -
+                    float8::Broadcast(1.0f));
+        basis[7] = float8::Broadcast(1.092548f) * dirX * dirZ;
+        basis[8] = float8::Broadcast(0.546274f) *
+                   (dirX * dirX - dirY * dirY);
+        const float8 red = float8::Load(r) * texelWeight;
+        const float8 green = float8::Load(g) * texelWeight;
+        const float8 blue = float8::Load(b) * texelWeight;
+        for (int i = 0; i < 9; ++i) {
+          acc[3 * i] = MulAdd(basis[i], red, acc[3 * i]);
+          acc[3 * i + 1] = MulAdd(basis[i], green, acc[3 * i + 1]);
+          acc[3 * i + 2] = MulAdd(basis[i], blue, acc[3 * i + 2]);
+        }
+      }
+    }
+
+    SH9 local;
+    float lanes[8];
+    for (int i = 0; i < 27; ++i) {
+      acc[i].Store(lanes);
+      float sum = 0.0f;
+      for (int lane = 0; lane < 8; ++lane) sum += lanes[lane];
+      local.c[i / 3][i % 3] = sum;
+    }
+    std::lock_guard<std::mutex> lock(totalMutex);
+    for (int i = 0; i < 9; ++i) total.c[i] += local.c[i];
+  });
+
+  ConvolveSHCosine(total);
+  return total;
+}
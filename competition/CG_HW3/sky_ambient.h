@@ -0,0 +1,87 @@
+#ifndef SKY_AMBIENT_H
+#define SKY_AMBIENT_H
+
+#include <memory>
+#include <mutex>
+
+#include "headers.h"
+#include "spherical_harmonics.h"
+
+// Startup cost of a SkyAmbient load, split by stage.
+struct SkyAmbientLoadStats {
+  double hashMs = 0.0;
+  double decodeMs = 0.0;   // PNG/JPG decode (cache miss only).
+  double projectMs = 0.0;  // SH projection (cache miss only).
+  double totalMs = 0.0;
+  bool cacheHit = false;
+};
+
+// Layout of the SkyAmbient uniform block (std140).
+struct SkyAmbientBlock {
+  // Irradiance / pi of the sky, one RGB coefficient per vec4.
+  glm::vec4 sh[9];
+  // Camera-space normal to panorama space.
+  glm::mat4x4 normalMatrix;
+  // x: enabled, y: intensity.
+  glm::vec4 params;
+};
+
+// SkyAmbient Declarations.
+// Directional ambient light from a skybox panorama. The panorama is
+// projected into L2 spherical harmonics (8 pixels at a time with float8,
+// rows spread over the thread pool) and convolved with the cosine lobe.
+// The result is cached on disk, keyed by the hash of the panorama file.
+//
+// Loads run on a pool thread, and the previous sky stays in use until the
+// new one is ready, so switching skyboxes does not stall a frame. The
+// coefficients reach phong_shading_demo.fs through the SkyAmbient uniform
+// block at binding point SKY_AMBIENT_BINDING.
+class SkyAmbient {
+ public:
+  // SkyAmbient Public Methods.
+  SkyAmbient();
+  ~SkyAmbient();
+
+  // Starts loading the panorama in the background.
+  void Load(const std::string &panoramaPath);
+  // Takes a finished load and refreshes the uniform block; call once per
+  // frame on the GL thread. skyRotationY is the skybox rotation in degrees.
+  void Update(const glm::mat4x4 &viewMatrix, const float skyRotationY);
+
+  bool IsReady() const { return ready; }
+  const SH9 &GetCoefficients() const { return coefficients; }
+  const SkyAmbientLoadStats &GetLoadStats() const { return stats; }
+
+  // Toggle, intensity and the stats of the last load.
+  void DrawDebugPanel();
+
+  // Irradiance / pi of a 3-channel 8-bit panorama, in the skybox mapping.
+  static SH9 ProjectEquirect(const cv::Mat &equirect);
+
+ private:
+  // Result of a background load, shared with its task.
+  struct PendingLoad {
+    std::mutex mutex;
+    bool done = false;
+    bool ok = false;
+    SH9 coefficients;
+    SkyAmbientLoadStats stats;
+  };
+
+  // SkyAmbient Private Methods.
+  static void RunLoad(const std::string &panoramaPath,
+                      const std::shared_ptr<PendingLoad> &pending);
+
+  // SkyAmbient Private Data.
+  std::shared_ptr<PendingLoad> pending;
+  std::string pendingPath;
+  std::string texFilePath;
+  SH9 coefficients;
+  SkyAmbientLoadStats stats;
+  bool ready;
+  bool enabled;
+  float intensity;
+  GLuint uboId;
+};
+
+#endif
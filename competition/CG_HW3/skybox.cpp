@@ -1,11 +1,62 @@
 #include "skybox.h"
 
+#include <chrono>
+
+#include "memory_tracker.h"
+#include "profiler.h"
+#include "timing.h"
+
 Skybox::Skybox(const std::string& texImagePath, const int nSlices,
-               const int nStacks, const float radius) {
+               const int nStacks, const float radius)
+    : texFilePath(texImagePath) {
   rotationY = 0.0f;
+  this->nSlices = nSlices;
+  this->nStacks = nStacks;
+  this->radius = radius;
+  path = SkyboxPath::Cubemap;
+
+  vboId = 0;
+  iboId = 0;
+  material = nullptr;
+  panorama = nullptr;
+  sphereStartupMs = 0.0;
+
+  // Convert the panorama to a cube map (or load it from the cache).
+  cubeMap = new CubeMapTexture(texImagePath);
+  if (!cubeMap->IsValid()) {
+    path = SkyboxPath::Sphere;
+  }
+}
+
+Skybox::~Skybox() {
+  MemoryTracker::Get().Remove(this);
+  vertices.clear();
+  glDeleteBuffers(1, &vboId);
+  indices.clear();
+  glDeleteBuffers(1, &iboId);
+
+  if (panorama) {
+    delete panorama;
+    panorama = nullptr;
+  }
+  if (material) {
+    delete material;
+    material = nullptr;
+  }
+  if (cubeMap) {
+    delete cubeMap;
+    cubeMap = nullptr;
+  }
+}
+
+void Skybox::CreateSphere() {
+  auto start = std::chrono::steady_clock::now();
 
   // Load panorama.
-  panorama = new ImageTexture(texImagePath);
+  panorama = new ImageTexture(texFilePath);
+  // The sky fills the screen; keep all of it resident.
+  panorama->SetResidentLevel(0);
+  panorama->SetMemoryTag(MemoryTag::Skybox);
   // panorama->Preview();
 
   // Create material.
@@ -25,25 +76,59 @@ Skybox::Skybox(const std::string& texImagePath, const int nSlices,
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(),
                &(indices[0]), GL_STATIC_DRAW);
-}
+  // The sphere keeps its CPU copy.
+  const long long sphereBytes =
+      (long long)(sizeof(VertexPT) * vertices.size() +
+                  sizeof(unsigned int) * indices.size());
+  MemoryTracker::Get().Update(this, MemoryTag::Skybox, texFilePath + " sphere",
+                              sphereBytes, sphereBytes);
 
-Skybox::~Skybox() {
-  vertices.clear();
-  glDeleteBuffers(1, &vboId);
-  indices.clear();
-  glDeleteBuffers(1, &iboId);
+  sphereStartupMs = MsSince(start);
+}
 
-  if (panorama) {
-    delete panorama;
-    panorama = nullptr;
-  }
-  if (material) {
-    delete material;
-    material = nullptr;
+void Skybox::Render(Camera* camera, SkyboxShaderProg* sphereShader,
+                    SkyboxCubeShaderProg* cubeShader) {
+  PROFILE_GPU_SCOPE("Skybox");
+  if (path == SkyboxPath::Cubemap) {
+    cubemapTimer.Begin();
+    RenderCubemap(camera, cubeShader);
+    cubemapTimer.End();
+  } else {
+    if (panorama == nullptr) {
+      CreateSphere();
+    }
+    sphereTimer.Begin();
+    RenderSphere(camera, sphereShader);
+    sphereTimer.End();
   }
 }
 
-void Skybox::Render(Camera* camera, SkyboxShaderProg* shader) {
+void Skybox::RenderCubemap(Camera* camera, SkyboxCubeShaderProg* shader) {
+  shader->Bind();
+
+  // Rotation-only view, so the sky stays at infinity. The vertex shader
+  // un-projects the far plane corners into sample directions.
+  glm::mat4x4 R = glm::rotate(glm::mat4x4(1.0f), glm::radians(rotationY),
+                              glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4x4 view = glm::mat4x4(glm::mat3x3(camera->GetViewMatrix()));
+  glm::mat4x4 invViewProj = glm::inverse(camera->GetProjMatrix() * view * R);
+  glUniformMatrix4fv(shader->GetLocInvViewProj(), 1, GL_FALSE,
+                     glm::value_ptr(invViewProj));
+  cubeMap->Bind(GL_TEXTURE0);
+  glUniform1i(shader->GetLocMapCube(), 0);
+
+  // The triangle sits at depth 1.0: it passes only where the clear value is
+  // left, and never writes depth.
+  glDepthFunc(GL_LEQUAL);
+  glDepthMask(GL_FALSE);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glDepthMask(GL_TRUE);
+  glDepthFunc(GL_LESS);
+
+  shader->UnBind();
+}
+
+void Skybox::RenderSphere(Camera* camera, SkyboxShaderProg* shader) {
   glEnableVertexAttribArray(0);
   glEnableVertexAttribArray(1);
 
@@ -127,3 +212,50 @@ void Skybox::CreateSphere3D(const int nSlices, const int nStacks,
     }
   }
 }
+
+void Skybox::DrawDebugPanel() {
+  ImGui::Begin("Skybox Renderer");
+  int current = (int)path;
+  ImGui::RadioButton("Sphere", &current, (int)SkyboxPath::Sphere);
+  ImGui::SameLine();
+  ImGui::RadioButton("Fullscreen cubemap", &current, (int)SkyboxPath::Cubemap);
+  if (cubeMap->IsValid()) {
+    path = (SkyboxPath)current;
+  }
+
+  if (ImGui::BeginTable("skybox", 3)) {
+    ImGui::TableSetupColumn("");
+    ImGui::TableSetupColumn("Startup (ms)");
+    ImGui::TableSetupColumn("GPU (ms)");
+    ImGui::TableHeadersRow();
+
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::Text("Sphere");
+    ImGui::TableNextColumn();
+    if (panorama != nullptr) {
+      ImGui::Text("%.2f", sphereStartupMs);
+    } else {
+      ImGui::Text("-");
+    }
+    ImGui::TableNextColumn();
+    ImGui::Text("%.3f", sphereTimer.GetElapsedMs());
+
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::Text("Cubemap");
+    ImGui::TableNextColumn();
+    ImGui::Text("%.2f", cubeMap->GetLoadStats().totalMs);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.3f", cubemapTimer.GetElapsedMs());
+    ImGui::EndTable();
+  }
+
+  const CubeMapLoadStats& stats = cubeMap->GetLoadStats();
+  ImGui::Text("Cube face: %d, cache %s", cubeMap->GetFaceSize(),
+              stats.cacheHit ? "hit" : "miss");
+  ImGui::Text("hash %.2f  decode %.2f  convert %.2f  cache %.2f  upload %.2f",
+              stats.hashMs, stats.decodeMs, stats.convertMs, stats.cacheMs,
+              stats.uploadMs);
+  ImGui::End();
+}
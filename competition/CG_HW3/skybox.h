@@ -6,6 +6,8 @@
 #include "shaderprog.h"
 #include "material.h"
 #include "camera.h"
+#include "cubemap.h"
+#include "gpu_timer.h"
 
 
 // VertexPT Declarations.
@@ -24,6 +26,17 @@ struct VertexPT
 };
 
 
+// How the skybox is drawn.
+enum class SkyboxPath
+{
+	// Tessellated sphere textured with the equirect panorama.
+	Sphere,
+	// Cube map on one fullscreen triangle at max depth, drawn after the opaque
+	// pass so early-Z rejects every covered pixel.
+	Cubemap,
+};
+
+
 // Skybox Declarations.
 class Skybox
 {
@@ -32,26 +45,50 @@ public:
 	Skybox(const std::string& texImagePath, const int nSlices, 
 			const int nStacks, const float radius);
 	~Skybox();
-	void Render(Camera* camera, SkyboxShaderProg* shader);
+	void Render(Camera* camera, SkyboxShaderProg* sphereShader,
+				SkyboxCubeShaderProg* cubeShader);
 	
 	void SetRotation(const float newRotation) { rotationY = newRotation; }
+	void SetPath(const SkyboxPath newPath) { path = newPath; }
 	
+	// The panorama is only loaded once the sphere path has been used.
 	ImageTexture* GetTexture() { return panorama; };
+	CubeMapTexture* GetCubeMap() { return cubeMap; }
 	float GetRotation() const  { return rotationY; }
+	SkyboxPath GetPath() const { return path; }
+
+	// Startup cost and GPU time of both paths.
+	void DrawDebugPanel();
 
 private:
 	// Skybox Private Methods.
+	void CreateSphere();
+	void RenderSphere(Camera* camera, SkyboxShaderProg* shader);
+	void RenderCubemap(Camera* camera, SkyboxCubeShaderProg* shader);
 	static void CreateSphere3D(const int nSlices, const int nStacks, const float radius, 
 					std::vector<VertexPT>& vertices, std::vector<unsigned int>& indices);
 
 	// Skybox Private Data.
+	std::string texFilePath;
+	int nSlices;
+	int nStacks;
+	float radius;
+	SkyboxPath path;
+
+	// Sphere path, created on first use.
 	GLuint vboId;
 	GLuint iboId;
 	std::vector<VertexPT> vertices;
 	std::vector<unsigned int> indices;
-	
 	SkyboxMaterial* material;
 	ImageTexture* panorama;
+	double sphereStartupMs;
+
+	// Cubemap path.
+	CubeMapTexture* cubeMap;
+
+	GpuTimer sphereTimer;
+	GpuTimer cubemapTimer;
 
 	float rotationY;
 };
@@ -0,0 +1,581 @@
+#include "software_rasterizer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+#include "headless.h"
+#include "json_writer.h"
+#include "profiler.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+namespace {
+
+using RenderClock = std::chrono::steady_clock;
+
+long long NanosecondsSince(const RenderClock::time_point &start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             RenderClock::now() - start)
+      .count();
+}
+
+// Vertex positions are snapped to 1/16 pixel so that neighbouring triangles
+// see exactly the same shared edge.
+const float kSubpixelSteps = 16.0f;
+
+// Input triangles per setup chunk (at least).
+const int kMinChunkTriangles = 1024;
+
+float Fract(const float x) { return x - std::floor(x); }
+
+}  // namespace
+
+SoftwareRasterizer::SoftwareRasterizer(const int width, const int height)
+    : width(width), height(height), numChunks(0) {
+  tilesX = (width + kTileSize - 1) / kTileSize;
+  tilesY = (height + kTileSize - 1) / kTileSize;
+  color.assign((size_t)width * height, glm::vec3(0.0f));
+}
+
+void SoftwareRasterizer::Render(const Scene *scene, const Camera *camera,
+                                const glm::mat4x4 &rootTransform) {
+  PROFILE_SCOPE("Software Render");
+  const RenderClock::time_point start = RenderClock::now();
+  stats = SoftwareRenderStats();
+  stats.threads = ThreadPool::Get().GetConcurrency();
+
+  RenderClock::time_point stageStart = RenderClock::now();
+  TransformObjects(scene, camera, rootTransform);
+  stats.transformMs = MsSince(stageStart);
+
+  stageStart = RenderClock::now();
+  SetupAndBin(scene);
+  stats.binMs = MsSince(stageStart);
+
+  // One tile per task; tiles write disjoint parts of the color buffer.
+  stageStart = RenderClock::now();
+  std::atomic<long long> rasterNs(0);
+  std::atomic<long long> shadeNs(0);
+  std::atomic<long long> pixelsShaded(0);
+  ThreadPool::Get().ParallelFor(
+      tilesX * tilesY, 1, [&](const int begin, const int end) {
+        PROFILE_SCOPE("Raster Tiles");
+        long long raster = 0, shade = 0, pixels = 0;
+        for (int tile = begin; tile < end; tile++) {
+          RenderTile(tile, scene, raster, shade, pixels);
+        }
+        rasterNs += raster;
+        shadeNs += shade;
+        pixelsShaded += pixels;
+      });
+  stats.tileMs = MsSince(stageStart);
+  stats.rasterCpuMs = rasterNs.load() / 1e6;
+  stats.shadeCpuMs = shadeNs.load() / 1e6;
+  stats.pixelsShaded = pixelsShaded.load();
+
+  for (int chunk = 0; chunk < numChunks; chunk++) {
+    stats.trianglesBinned += (long long)chunkTriangles[chunk].size();
+  }
+  for (const auto &bin : chunkBins) {
+    stats.binEntries += (long long)bin.size();
+  }
+  stats.totalMs = MsSince(start);
+}
+
+void SoftwareRasterizer::TransformObjects(const Scene *scene,
+                                          const Camera *camera,
+                                          const glm::mat4x4 &rootTransform) {
+  PROFILE_SCOPE("Software Transform");
+  const glm::mat4x4 view = camera->GetViewMatrix();
+  const glm::mat4x4 proj = camera->GetProjMatrix();
+
+  transformed.resize(scene->objects.size());
+
+  for (size_t o = 0; o < scene->objects.size(); o++) {
+    const SceneObject &sceneObj = scene->objects[o];
+    // Same matrices as RenderOpaquePass.
+    const glm::mat4x4 worldView = view * rootTransform * sceneObj.worldMatrix;
+    const glm::mat4x4 mvp = proj * worldView;
+    const glm::mat4x4 normalMatrix = glm::transpose(glm::inverse(worldView));
+
+    const std::vector<VertexPTN> &vertices = sceneObj.mesh->GetVertices();
+    std::vector<TransformedVertex> &out = transformed[o];
+    out.resize(vertices.size());
+    ThreadPool::Get().ParallelFor(
+        (int)vertices.size(), 4096, [&](const int begin, const int end) {
+          for (int i = begin; i < end; i++) {
+            const VertexPTN &v = vertices[i];
+            glm::vec4 p(v.position, 1.0f);
+            glm::vec4 viewPos = worldView * p;
+            out[i].clip = mvp * p;
+            out[i].viewPos = glm::vec3(viewPos) / viewPos.w;
+            out[i].normal = glm::vec3(normalMatrix * glm::vec4(v.normal, 0.0f));
+            out[i].uv = v.texcoord;
+          }
+        });
+  }
+
+  // Light positions and directions are in model space and follow the root
+  // transform, like in the shader; they are the same for every object.
+  const glm::mat4x4 lightView = view * rootTransform;
+  ViewLights &lights = viewLights;
+  lights = ViewLights();
+  for (const DirectionalLight *light : scene->dirLights) {
+    lights.dirLightDirs.push_back(glm::normalize(
+        glm::vec3(lightView * glm::vec4(-light->GetDirection(), 0.0f))));
+  }
+  for (const PointLight *light : scene->pointLights) {
+    lights.pointLightPositions.push_back(
+        glm::vec3(lightView * glm::vec4(light->GetPosition(), 1.0f)));
+  }
+  for (const SpotLight *light : scene->spotLights) {
+    lights.spotLightPositions.push_back(
+        glm::vec3(lightView * glm::vec4(light->GetPosition(), 1.0f)));
+    lights.spotLightDirs.push_back(glm::normalize(
+        glm::vec3(lightView * glm::vec4(light->GetDirection(), 0.0f))));
+  }
+  for (const AreaLight *light : scene->areaLights) {
+    // Same sample pattern as the shader.
+    glm::vec3 lightDir = glm::normalize(light->GetDirection());
+    glm::vec3 right =
+        glm::normalize(glm::cross(lightDir, glm::vec3(0.0f, 1.0f, 0.0f)));
+    glm::vec3 up = glm::normalize(glm::cross(right, lightDir));
+    std::vector<glm::vec3> samples;
+    for (int s = 0; s < light->GetSamples(); s++) {
+      float randU = Fract(std::sin((float)s * 12.9898f) * 43758.5453f);
+      float randV = Fract(std::sin((float)s * 78.233f) * 43758.5453f);
+      glm::vec3 samplePos = light->GetPosition() +
+                            (randU - 0.5f) * light->GetWidth() * right +
+                            (randV - 0.5f) * light->GetHeight() * up;
+      samples.push_back(glm::vec3(lightView * glm::vec4(samplePos, 1.0f)));
+    }
+    lights.areaLightSamples.push_back(samples);
+  }
+}
+
+void SoftwareRasterizer::SetupAndBin(const Scene *scene) {
+  PROFILE_SCOPE("Software Bin");
+  // Flatten the submeshes so the triangles can be split evenly.
+  struct DrawRange {
+    int object;
+    const SubMesh *subMesh;
+    long long firstTriangle;
+  };
+  std::vector<DrawRange> draws;
+  long long numTriangles = 0;
+  for (size_t o = 0; o < scene->objects.size(); o++) {
+    for (const SubMesh &subMesh : scene->objects[o].mesh->getSubMeshes()) {
+      draws.push_back({(int)o, &subMesh, numTriangles});
+      numTriangles += (long long)subMesh.vertexIndices.size() / 3;
+    }
+  }
+  stats.trianglesIn = numTriangles;
+
+  const int concurrency = ThreadPool::Get().GetConcurrency();
+  const long long chunkSize = std::max<long long>(
+      kMinChunkTriangles, (numTriangles + concurrency * 4 - 1) /
+                              (concurrency * 4));
+  numChunks = (int)((numTriangles + chunkSize - 1) / chunkSize);
+
+  const int numTiles = tilesX * tilesY;
+  chunkTriangles.resize(numChunks);
+  chunkBins.resize((size_t)numChunks * numTiles);
+  for (auto &triangles : chunkTriangles) triangles.clear();
+  for (auto &bin : chunkBins) bin.clear();
+
+  ThreadPool::Get().ParallelFor(numChunks, 1, [&](const int begin,
+                                                  const int end) {
+    for (int chunk = begin; chunk < end; chunk++) {
+      const long long first = chunk * chunkSize;
+      const long long last = std::min(numTriangles, first + chunkSize);
+      // Last draw that starts at or before the first triangle.
+      size_t d = std::upper_bound(draws.begin(), draws.end(), first,
+                                  [](const long long t, const DrawRange &r) {
+                                    return t < r.firstTriangle;
+                                  }) -
+                 draws.begin() - 1;
+      for (long long t = first; t < last; t++) {
+        while (d + 1 < draws.size() && draws[d + 1].firstTriangle <= t) d++;
+        const DrawRange &draw = draws[d];
+        const std::vector<unsigned int> &indices = draw.subMesh->vertexIndices;
+        const std::vector<TransformedVertex> &verts = transformed[draw.object];
+        const size_t base = (size_t)(t - draw.firstTriangle) * 3;
+        const TransformedVertex *v[3] = {&verts[indices[base]],
+                                         &verts[indices[base + 1]],
+                                         &verts[indices[base + 2]]};
+        EmitTriangle(v, draw.subMesh->material, draw.object, chunk);
+      }
+    }
+  });
+}
+
+void SoftwareRasterizer::EmitTriangle(const TransformedVertex *v[3],
+                                      const PhongMaterial *material,
+                                      const int object, const int chunk) {
+  // Reject triangles entirely outside one of the side or far planes.
+  for (int axis = 0; axis < 3; axis++) {
+    bool allAbove = true, allBelow = axis < 2;
+    for (int i = 0; i < 3; i++) {
+      allAbove &= v[i]->clip[axis] > v[i]->clip.w;
+      allBelow &= v[i]->clip[axis] < -v[i]->clip.w;
+    }
+    if (allAbove || allBelow) return;
+  }
+
+  // Clip against the near plane (z >= -w); at most 4 vertices remain.
+  TransformedVertex polygon[4];
+  int count = 0;
+  for (int i = 0; i < 3; i++) {
+    const TransformedVertex &a = *v[i];
+    const TransformedVertex &b = *v[(i + 1) % 3];
+    float da = a.clip.z + a.clip.w;
+    float db = b.clip.z + b.clip.w;
+    if (da >= 0.0f) polygon[count++] = a;
+    if ((da >= 0.0f) != (db >= 0.0f)) {
+      float t = da / (da - db);
+      TransformedVertex &c = polygon[count++];
+      c.clip = glm::mix(a.clip, b.clip, t);
+      c.viewPos = glm::mix(a.viewPos, b.viewPos, t);
+      c.normal = glm::mix(a.normal, b.normal, t);
+      c.uv = glm::mix(a.uv, b.uv, t);
+    }
+  }
+
+  const int numTiles = tilesX * tilesY;
+  std::vector<SetupTriangle> &triangles = chunkTriangles[chunk];
+  for (int fan = 1; fan + 1 < count; fan++) {
+    const TransformedVertex *tv[3] = {&polygon[0], &polygon[fan],
+                                      &polygon[fan + 1]};
+    SetupTriangle tri;
+    for (int i = 0; i < 3; i++) {
+      const glm::vec4 &clip = tv[i]->clip;
+      float invW = 1.0f / clip.w;
+      glm::vec3 ndc = glm::vec3(clip) * invW;
+      float sx = (ndc.x * 0.5f + 0.5f) * (float)width;
+      // Row 0 is the top of the image.
+      float sy = (0.5f - ndc.y * 0.5f) * (float)height;
+      tri.screen[i] = glm::vec4(std::round(sx * kSubpixelSteps) / kSubpixelSteps,
+                                std::round(sy * kSubpixelSteps) / kSubpixelSteps,
+                                ndc.z * 0.5f + 0.5f, invW);
+      tri.viewPos[i] = tv[i]->viewPos;
+      tri.normal[i] = tv[i]->normal;
+      tri.uv[i] = tv[i]->uv;
+    }
+
+    // Both windings are drawn (no face culling); store counter-clockwise
+    // in screen space so the edge functions are positive inside.
+    const glm::vec4 *s = tri.screen;
+    float area = (s[1].x - s[0].x) * (s[2].y - s[0].y) -
+                 (s[2].x - s[0].x) * (s[1].y - s[0].y);
+    if (area == 0.0f || !std::isfinite(area)) continue;
+    if (area < 0.0f) {
+      std::swap(tri.screen[1], tri.screen[2]);
+      std::swap(tri.viewPos[1], tri.viewPos[2]);
+      std::swap(tri.normal[1], tri.normal[2]);
+      std::swap(tri.uv[1], tri.uv[2]);
+    }
+    tri.material = material;
+    tri.object = object;
+
+    // Pixels whose centers can be inside.
+    float minX = std::min(s[0].x, std::min(s[1].x, s[2].x));
+    float maxX = std::max(s[0].x, std::max(s[1].x, s[2].x));
+    float minY = std::min(s[0].y, std::min(s[1].y, s[2].y));
+    float maxY = std::max(s[0].y, std::max(s[1].y, s[2].y));
+    int x0 = std::max(0, (int)std::ceil(minX - 0.5f));
+    int x1 = std::min(width - 1, (int)std::floor(maxX - 0.5f));
+    int y0 = std::max(0, (int)std::ceil(minY - 0.5f));
+    int y1 = std::min(height - 1, (int)std::floor(maxY - 0.5f));
+    if (x0 > x1 || y0 > y1) continue;
+
+    const unsigned int index = (unsigned int)triangles.size();
+    triangles.push_back(tri);
+    for (int ty = y0 / kTileSize; ty <= y1 / kTileSize; ty++) {
+      for (int tx = x0 / kTileSize; tx <= x1 / kTileSize; tx++) {
+        chunkBins[(size_t)chunk * numTiles + ty * tilesX + tx].push_back(index);
+      }
+    }
+  }
+}
+
+void SoftwareRasterizer::RenderTile(const int tile, const Scene *scene,
+                                    long long &rasterNs, long long &shadeNs,
+                                    long long &pixelsShaded) {
+  const RenderClock::time_point rasterStart = RenderClock::now();
+  const int numTiles = tilesX * tilesY;
+  const int tileX = (tile % tilesX) * kTileSize;
+  const int tileY = (tile / tilesX) * kTileSize;
+  const int tileX1 = std::min(width, tileX + kTileSize) - 1;
+  const int tileY1 = std::min(height, tileY + kTileSize) - 1;
+
+  // Per-tile visibility: depth, triangle and screen-space barycentrics.
+  float depth[kTileSize * kTileSize];
+  float bary1[kTileSize * kTileSize];
+  float bary2[kTileSize * kTileSize];
+  const SetupTriangle *visible[kTileSize * kTileSize];
+  std::fill(depth, depth + kTileSize * kTileSize, 1.0f);
+  std::fill(visible, visible + kTileSize * kTileSize, nullptr);
+
+  const float8 zero = float8::Broadcast(0.0f);
+  const float8 ramp = float8::Ramp();
+
+  for (int chunk = 0; chunk < numChunks; chunk++) {
+    const std::vector<unsigned int> &bin =
+        chunkBins[(size_t)chunk * numTiles + tile];
+    const std::vector<SetupTriangle> &triangles = chunkTriangles[chunk];
+    for (const unsigned int index : bin) {
+      const SetupTriangle &tri = triangles[index];
+      const glm::vec4 *s = tri.screen;
+
+      // Edge i is opposite vertex i, so E_i / area is its barycentric.
+      float a[3], b[3], c[3];
+      bool topLeft[3];
+      for (int e = 0; e < 3; e++) {
+        const glm::vec4 &p = s[(e + 1) % 3];
+        const glm::vec4 &q = s[(e + 2) % 3];
+        float dx = q.x - p.x;
+        float dy = q.y - p.y;
+        a[e] = -dy;
+        b[e] = dx;
+        c[e] = dy * p.x - dx * p.y;
+        // Pixels exactly on a top or left edge belong to this triangle.
+        topLeft[e] = dy < 0.0f || (dy == 0.0f && dx > 0.0f);
+      }
+      const float area = c[0] + a[0] * s[0].x + b[0] * s[0].y;
+      const float invArea = 1.0f / area;
+
+      float minX = std::min(s[0].x, std::min(s[1].x, s[2].x));
+      float maxX = std::max(s[0].x, std::max(s[1].x, s[2].x));
+      float minY = std::min(s[0].y, std::min(s[1].y, s[2].y));
+      float maxY = std::max(s[0].y, std::max(s[1].y, s[2].y));
+      int x0 = std::max(tileX, (int)std::ceil(minX - 0.5f));
+      int x1 = std::min(tileX1, (int)std::floor(maxX - 0.5f));
+      int y0 = std::max(tileY, (int)std::ceil(minY - 0.5f));
+      int y1 = std::min(tileY1, (int)std::floor(maxY - 0.5f));
+      if (x0 > x1 || y0 > y1) continue;
+
+      const float8 a0 = float8::Broadcast(a[0]), a1 = float8::Broadcast(a[1]),
+                   a2 = float8::Broadcast(a[2]);
+      const float8 z0 = float8::Broadcast(s[0].z * invArea);
+      const float8 z1 = float8::Broadcast(s[1].z * invArea);
+      const float8 z2 = float8::Broadcast(s[2].z * invArea);
+      const float8 invArea8 = float8::Broadcast(invArea);
+      const float8 colMin = float8::Broadcast((float)x0);
+      const float8 colMax = float8::Broadcast((float)x1);
+
+      // Blocks of 8 pixels stay inside the tile since tiles are 8-aligned.
+      const int blockX0 = x0 & ~7;
+      for (int y = y0; y <= y1; y++) {
+        const float py = (float)y + 0.5f;
+        const float8 row0 = float8::Broadcast(b[0] * py + c[0]);
+        const float8 row1 = float8::Broadcast(b[1] * py + c[1]);
+        const float8 row2 = float8::Broadcast(b[2] * py + c[2]);
+        const int rowOffset = (y - tileY) * kTileSize - tileX;
+        for (int bx = blockX0; bx <= x1; bx += 8) {
+          const float8 column = float8::Broadcast((float)bx) + ramp;
+          const float8 px = column + float8::Broadcast(0.5f);
+          const float8 e0 = MulAdd(a0, px, row0);
+          const float8 e1 = MulAdd(a1, px, row1);
+          const float8 e2 = MulAdd(a2, px, row2);
+          float8 inside = (column >= colMin) & (column <= colMax);
+          inside = inside & (topLeft[0] ? e0 >= zero : e0 > zero);
+          inside = inside & (topLeft[1] ? e1 >= zero : e1 > zero);
+          inside = inside & (topLeft[2] ? e2 >= zero : e2 > zero);
+          if (!Any(inside)) continue;
+
+          // Depth is affine in screen space.
+          const float8 z = MulAdd(e0, z0, MulAdd(e1, z1, e2 * z2));
+          float *depthRow = depth + rowOffset + bx;
+          const float8 oldDepth = float8::Load(depthRow);
+          const float8 pass = inside & (z < oldDepth);
+          const int passBits = MoveMask(pass);
+          if (passBits == 0) continue;
+
+          Select(pass, z, oldDepth).Store(depthRow);
+          float *b1Row = bary1 + rowOffset + bx;
+          float *b2Row = bary2 + rowOffset + bx;
+          Select(pass, e1 * invArea8, float8::Load(b1Row)).Store(b1Row);
+          Select(pass, e2 * invArea8, float8::Load(b2Row)).Store(b2Row);
+          const SetupTriangle **visibleRow = visible + rowOffset + bx;
+          for (int lane = 0; lane < 8; lane++) {
+            if (passBits & (1 << lane)) visibleRow[lane] = &tri;
+          }
+        }
+      }
+    }
+  }
+  const RenderClock::time_point shadeStart = RenderClock::now();
+  rasterNs += NanosecondsSince(rasterStart);
+
+  // Shade every visible pixel once.
+  for (int y = tileY; y <= tileY1; y++) {
+    for (int x = tileX; x <= tileX1; x++) {
+      const int local = (y - tileY) * kTileSize + (x - tileX);
+      glm::vec3 &out = color[(size_t)y * width + x];
+      if (visible[local] == nullptr) {
+        out = settings.clearColor;
+        continue;
+      }
+      out = glm::clamp(
+          ShadePixel(*visible[local], bary1[local], bary2[local], scene),
+          glm::vec3(0.0f), glm::vec3(1.0f));
+      pixelsShaded++;
+    }
+  }
+  shadeNs += NanosecondsSince(shadeStart);
+}
+
+glm::vec3 SoftwareRasterizer::ShadePixel(const SetupTriangle &tri,
+                                         const float l1, const float l2,
+                                         const Scene *scene) const {
+  // Perspective-correct interpolation weights.
+  const float l0 = 1.0f - l1 - l2;
+  float w0 = l0 * tri.screen[0].w;
+  float w1 = l1 * tri.screen[1].w;
+  float w2 = l2 * tri.screen[2].w;
+  const float invSum = 1.0f / (w0 + w1 + w2);
+  w0 *= invSum;
+  w1 *= invSum;
+  w2 *= invSum;
+  const glm::vec3 fragPos =
+      w0 * tri.viewPos[0] + w1 * tri.viewPos[1] + w2 * tri.viewPos[2];
+  const glm::vec3 norm = glm::normalize(w0 * tri.normal[0] +
+                                        w1 * tri.normal[1] +
+                                        w2 * tri.normal[2]);
+  const glm::vec2 uv = w0 * tri.uv[0] + w1 * tri.uv[1] + w2 * tri.uv[2];
+  const glm::vec3 viewDir = glm::normalize(-fragPos);
+
+  const SurfaceSample surface = PhongMaterial::Sample(tri.material, uv);
+  const glm::vec3 &Ka = surface.Ka;
+  const glm::vec3 &effectiveKd = surface.Kd;
+  const glm::vec3 &effectiveKs = surface.Ks;
+  const float Ns = surface.Ns;
+
+  auto lighting = [&](const glm::vec3 &lightDir, const glm::vec3 &radiance) {
+    glm::vec3 result(0.0f);
+    if (settings.onDiffuseLight) {
+      result += effectiveKd * radiance *
+                glm::max(glm::dot(norm, lightDir), 0.0f);
+    }
+    if (settings.onSpecularLight) {
+      float spec;
+      if (settings.blinnPhong) {
+        glm::vec3 halfwayDir = glm::normalize(lightDir + viewDir);
+        spec = std::pow(glm::max(glm::dot(norm, halfwayDir), 0.0f), Ns);
+      } else {
+        glm::vec3 reflectDir = glm::reflect(-lightDir, norm);
+        spec = std::pow(glm::max(glm::dot(viewDir, reflectDir), 0.0f), Ns);
+      }
+      result += spec * radiance * effectiveKs;
+    }
+    return result;
+  };
+
+  const ViewLights &lights = viewLights;
+  glm::vec3 result(0.0f);
+  if (settings.onAmbientLight) {
+    result += scene->ambientLight * Ka;
+  }
+
+  for (size_t i = 0; i < scene->dirLights.size(); i++) {
+    result += lighting(lights.dirLightDirs[i],
+                       scene->dirLights[i]->GetIntensity());
+  }
+
+  for (size_t i = 0; i < scene->pointLights.size(); i++) {
+    const PointLight *light = scene->pointLights[i];
+    glm::vec3 toLight = lights.pointLightPositions[i] - fragPos;
+    float distance = glm::length(toLight);
+    result += lighting(toLight / distance, light->GetIntensity() *
+                                               light->GetAttenuation(distance));
+  }
+
+  for (size_t i = 0; i < scene->spotLights.size(); i++) {
+    const SpotLight *light = scene->spotLights[i];
+    glm::vec3 toLight = lights.spotLightPositions[i] - fragPos;
+    float distance = glm::length(toLight);
+    glm::vec3 lightDir = toLight / distance;
+    float cosTheta = glm::dot(lightDir, lights.spotLightDirs[i]);
+    float cosEpsilon = light->GetCosCutoffStart() - light->GetCosCutoffEnd();
+    float factor = glm::clamp(
+        (cosTheta - light->GetCosCutoffEnd()) / cosEpsilon, 0.0f, 1.0f);
+    result += lighting(lightDir, factor * light->GetIntensity() *
+                                     light->GetAttenuation(distance));
+  }
+
+  // The shader divides the running area light sum by each light's sample
+  // count; kept as is so both renderers agree.
+  glm::vec3 areaResult(0.0f);
+  for (size_t i = 0; i < scene->areaLights.size(); i++) {
+    const AreaLight *light = scene->areaLights[i];
+    for (const glm::vec3 &samplePos : lights.areaLightSamples[i]) {
+      glm::vec3 toLight = samplePos - fragPos;
+      float distance = glm::length(toLight);
+      areaResult += lighting(toLight / distance,
+                             light->GetIntensity() *
+                                 light->GetAttenuation(distance));
+    }
+    areaResult /= (float)light->GetSamples();
+  }
+  return result + areaResult;
+}
+
+bool SoftwareRasterizer::SavePng(const std::string &filePath) const {
+  cv::Mat image(height, width, CV_8UC3);
+  for (int y = 0; y < height; y++) {
+    unsigned char *row = image.ptr<unsigned char>(y);
+    for (int x = 0; x < width; x++) {
+      const glm::vec3 &c = color[(size_t)y * width + x];
+      row[x * 3 + 0] = (unsigned char)(c.b * 255.0f + 0.5f);
+      row[x * 3 + 1] = (unsigned char)(c.g * 255.0f + 0.5f);
+      row[x * 3 + 2] = (unsigned char)(c.r * 255.0f + 0.5f);
+    }
+  }
+  if (!cv::imwrite(filePath, image)) {
+    std::cerr << "[ERROR] Failed to write " << filePath << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int SoftwareRasterizer::RunHeadless(const HeadlessOptions &options,
+                                    const Scene *scene,
+                                    const glm::mat4x4 &rootTransform,
+                                    const SoftwareRenderSettings &settings) {
+  SoftwareRasterizer rasterizer(options.width, options.height);
+  rasterizer.GetSettings() = settings;
+  rasterizer.Render(scene, scene->camera, rootTransform);
+  if (!rasterizer.SavePng(options.jobs.softwareImagePath)) {
+    return 1;
+  }
+
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  const SoftwareRenderStats &stats = rasterizer.GetStats();
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("image", options.jobs.softwareImagePath);
+  json.Field("width", options.width);
+  json.Field("height", options.height);
+  json.Field("simd", float8::Name());
+  json.Field("threads", stats.threads);
+  json.Field("trianglesIn", stats.trianglesIn);
+  json.Field("trianglesBinned", stats.trianglesBinned);
+  json.Field("binEntries", stats.binEntries);
+  json.Field("pixelsShaded", stats.pixelsShaded);
+  json.Field("transformMs", stats.transformMs);
+  json.Field("binMs", stats.binMs);
+  json.Field("tileMs", stats.tileMs);
+  json.Field("rasterCpuMs", stats.rasterCpuMs);
+  json.Field("shadeCpuMs", stats.shadeCpuMs);
+  json.Field("totalMs", stats.totalMs);
+  json.EndObject();
+  file << std::endl;
+  return 0;
+}
@@ -0,0 +1,132 @@
+#ifndef SOFTWARE_RASTERIZER_H
+#define SOFTWARE_RASTERIZER_H
+
+#include "camera.h"
+#include "headers.h"
+#include "material.h"
+#include "scene.h"
+
+struct HeadlessOptions;
+
+// Shading switches, the same ones the GUI sets on the Phong shader.
+struct SoftwareRenderSettings {
+  bool blinnPhong = true;
+  bool onAmbientLight = true;
+  bool onDiffuseLight = true;
+  bool onSpecularLight = true;
+  glm::vec3 clearColor = glm::vec3(0.44f, 0.57f, 0.75f);
+};
+
+// Time spent in each stage of the last Render call. The stages run one
+// after the other; rasterCpuMs and shadeCpuMs split the tile stage and are
+// summed over all threads.
+struct SoftwareRenderStats {
+  double transformMs = 0.0;
+  double binMs = 0.0;
+  double tileMs = 0.0;
+  double rasterCpuMs = 0.0;
+  double shadeCpuMs = 0.0;
+  double totalMs = 0.0;
+  long long trianglesIn = 0;
+  // After culling and near-plane clipping.
+  long long trianglesBinned = 0;
+  long long binEntries = 0;
+  long long pixelsShaded = 0;
+  int threads = 0;
+};
+
+// SoftwareRasterizer Declarations.
+// GPU-free reference renderer for a Scene. Triangles are transformed and
+// binned into 64x64 screen tiles in parallel; each tile is then rasterized
+// by one thread with 8-wide edge functions against its own depth buffer,
+// and every visible pixel is shaded once with the Phong/Blinn-Phong model of
+// phong_shading_demo.fs. Shadows and the skybox are not rendered.
+class SoftwareRasterizer {
+ public:
+  // SoftwareRasterizer Public Methods.
+  SoftwareRasterizer(const int width, const int height);
+
+  void Render(const Scene *scene, const Camera *camera,
+              const glm::mat4x4 &rootTransform);
+
+  bool SavePng(const std::string &filePath) const;
+
+  // Renders one frame of the scene at the options' size to
+  // options.softwareImagePath and writes the stage timings to the report.
+  static int RunHeadless(const HeadlessOptions &options, const Scene *scene,
+                         const glm::mat4x4 &rootTransform,
+                         const SoftwareRenderSettings &settings);
+
+  SoftwareRenderSettings &GetSettings() { return settings; }
+  const SoftwareRenderStats &GetStats() const { return stats; }
+  int GetWidth() const { return width; }
+  int GetHeight() const { return height; }
+
+  static const int kTileSize = 64;
+
+ private:
+  // Lights of the scene in view space; like the shader, they are placed
+  // with the root transform.
+  struct ViewLights {
+    std::vector<glm::vec3> dirLightDirs;
+    std::vector<glm::vec3> pointLightPositions;
+    std::vector<glm::vec3> spotLightPositions;
+    std::vector<glm::vec3> spotLightDirs;
+    // Sample positions of each area light.
+    std::vector<std::vector<glm::vec3>> areaLightSamples;
+  };
+
+  // A triangle after transform and clipping.
+  struct SetupTriangle {
+    // Snapped pixel x and y, depth in [0, 1] and 1/w.
+    glm::vec4 screen[3];
+    glm::vec3 viewPos[3];
+    glm::vec3 normal[3];
+    glm::vec2 uv[3];
+    const PhongMaterial *material;
+    int object;
+  };
+
+  // Per-vertex results of the transform stage.
+  struct TransformedVertex {
+    glm::vec4 clip;
+    glm::vec3 viewPos;
+    glm::vec3 normal;
+    glm::vec2 uv;
+  };
+
+  // SoftwareRasterizer Private Methods.
+  void TransformObjects(const Scene *scene, const Camera *camera,
+                        const glm::mat4x4 &rootTransform);
+  void SetupAndBin(const Scene *scene);
+  void EmitTriangle(const TransformedVertex *v[3], const PhongMaterial *material,
+                    const int object, const int chunk);
+  // Adds the CPU time spent rasterizing and shading (in ns) to the counters.
+  void RenderTile(const int tile, const Scene *scene, long long &rasterNs,
+                  long long &shadeNs, long long &pixelsShaded);
+  glm::vec3 ShadePixel(const SetupTriangle &tri, const float l1, const float l2,
+                       const Scene *scene) const;
+
+  // SoftwareRasterizer Private Data.
+  int width;
+  int height;
+  int tilesX;
+  int tilesY;
+  SoftwareRenderSettings settings;
+  SoftwareRenderStats stats;
+
+  std::vector<std::vector<TransformedVertex>> transformed;
+  ViewLights viewLights;
+
+  // Triangles and tile bins of each setup chunk. Chunks cover consecutive
+  // input triangles, so walking them in order keeps the submission order.
+  int numChunks;
+  std::vector<std::vector<SetupTriangle>> chunkTriangles;
+  // chunkBins[chunk * numTiles + tile] lists triangles of that chunk.
+  std::vector<std::vector<unsigned int>> chunkBins;
+
+  // RGB, top row first.
+  std::vector<glm::vec3> color;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SPHERICAL_HARMONICS_H
+#define SPHERICAL_HARMONICS_H
+
+#include "headers.h"
+
+// Order-2 (9 coefficient) real spherical harmonics of RGB functions on the
+// sphere, for irradiance.
+struct SH9 {
+  glm::vec3 c[9];
+
+  SH9() {
+    for (int i = 0; i < 9; i++) c[i] = glm::vec3(0.0f);
+  }
+};
+
+// The 9 basis functions at the unit direction d.
+inline void EvaluateSHBasis(const glm::vec3 &d, float basis[9]) {
+  basis[0] = 0.282095f;
+  basis[1] = 0.488603f * d.y;
+  basis[2] = 0.488603f * d.z;
+  basis[3] = 0.488603f * d.x;
+  basis[4] = 1.092548f * d.x * d.y;
+  basis[5] = 1.092548f * d.y * d.z;
+  basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+  basis[7] = 1.092548f * d.x * d.z;
+  basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+// Adds value * weight in direction d.
+inline void AddSHSample(SH9 &sh, const glm::vec3 &d, const glm::vec3 &value,
+                        const float weight) {
+  float basis[9];
+  EvaluateSHBasis(d, basis);
+  for (int i = 0; i < 9; i++) sh.c[i] += value * (basis[i] * weight);
+}
+
+// Turns projected radiance into irradiance divided by pi: the convolution
+// with the clamped cosine, per band. Evaluating the result at a normal
+// gives the light the shader's Diffuse() would add for a white surface.
+inline void ConvolveSHCosine(SH9 &sh) {
+  const float band[3] = {1.0f, 2.0f / 3.0f, 0.25f};
+  for (int i = 0; i < 9; i++) {
+    sh.c[i] *= band[i == 0 ? 0 : (i < 4 ? 1 : 2)];
+  }
+}
+
+inline glm::vec3 EvaluateSH(const SH9 &sh, const glm::vec3 &d) {
+  float basis[9];
+  EvaluateSHBasis(d, basis);
+  glm::vec3 result(0.0f);
+  for (int i = 0; i < 9; i++) result += sh.c[i] * basis[i];
+  return result;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include "static_lights.h"
+
+#include <cmath>
+#include <limits>
+
+#include "sampling.h"
+
+void StaticLights::Prepare(const Scene *scene) {
+  objectLights.assign(scene->objects.size(), ObjectLights());
+  for (size_t o = 0; o < scene->objects.size(); o++) {
+    // Same placement as the shader: model space, moved by the object.
+    const glm::mat4x4 &m = scene->bvhWorldMatrices[o];
+    ObjectLights &lights = objectLights[o];
+    for (const DirectionalLight *light : scene->dirLights) {
+      lights.dirLightDirs.push_back(
+          glm::normalize(glm::mat3x3(m) * -light->GetDirection()));
+    }
+    for (const PointLight *light : scene->pointLights) {
+      lights.pointLightPositions.push_back(
+          glm::vec3(m * glm::vec4(light->GetPosition(), 1.0f)));
+    }
+    for (const SpotLight *light : scene->spotLights) {
+      lights.spotLightPositions.push_back(
+          glm::vec3(m * glm::vec4(light->GetPosition(), 1.0f)));
+      lights.spotLightDirs.push_back(
+          glm::normalize(glm::mat3x3(m) * light->GetDirection()));
+    }
+    for (const AreaLight *light : scene->areaLights) {
+      // Same frame as the path tracer, which keeps vertical lights valid.
+      glm::vec3 lightDir = glm::normalize(light->GetDirection());
+      glm::vec3 reference = std::abs(lightDir.y) > 0.999f
+                                ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                : glm::vec3(0.0f, 1.0f, 0.0f);
+      glm::vec3 right = glm::normalize(glm::cross(lightDir, reference));
+      glm::vec3 up = glm::normalize(glm::cross(right, lightDir));
+      std::vector<glm::vec3> samples;
+      for (int s = 0; s < light->GetSamples(); s++) {
+        float u = std::sin((float)s * 12.9898f) * 43758.5453f;
+        float v = std::sin((float)s * 78.233f) * 43758.5453f;
+        u -= std::floor(u);
+        v -= std::floor(v);
+        glm::vec3 samplePos = light->GetPosition() +
+                              (u - 0.5f) * light->GetWidth() * right +
+                              (v - 0.5f) * light->GetHeight() * up;
+        samples.push_back(glm::vec3(m * glm::vec4(samplePos, 1.0f)));
+      }
+      lights.areaLightSamples.push_back(samples);
+    }
+  }
+}
+
+glm::vec3 StaticLights::DirectLight(const Scene *scene, const int object,
+                                    const glm::vec3 &position,
+                                    const glm::vec3 &normal,
+                                    const glm::vec3 &geometricNormal,
+                                    long long &rays) const {
+  const ObjectLights &lights = objectLights[object];
+  glm::vec3 result(0.0f);
+  auto addLight = [&](const glm::vec3 &wi, const float distance,
+                      const glm::vec3 &radiance) {
+    float cosTheta = glm::dot(normal, wi);
+    if (cosTheta <= 0.0f || radiance == glm::vec3(0.0f)) {
+      return;
+    }
+    Ray shadowRay(OffsetRayOrigin(position, geometricNormal, wi), wi,
+                  distance);
+    rays++;
+    if (!scene->IsOccluded(shadowRay)) {
+      result += radiance * cosTheta;
+    }
+  };
+
+  for (size_t i = 0; i < scene->dirLights.size(); i++) {
+    if (scene->dirLights[i]->IsStatic()) {
+      addLight(lights.dirLightDirs[i], std::numeric_limits<float>::infinity(),
+               scene->dirLights[i]->GetIntensity());
+    }
+  }
+  for (size_t i = 0; i < scene->pointLights.size(); i++) {
+    const PointLight *light = scene->pointLights[i];
+    if (!light->IsStatic()) continue;
+    glm::vec3 toLight = lights.pointLightPositions[i] - position;
+    float distance = glm::length(toLight);
+    addLight(toLight / distance, distance,
+             light->GetIntensity() * light->GetAttenuation(distance));
+  }
+  for (size_t i = 0; i < scene->spotLights.size(); i++) {
+    const SpotLight *light = scene->spotLights[i];
+    if (!light->IsStatic()) continue;
+    glm::vec3 toLight = lights.spotLightPositions[i] - position;
+    float distance = glm::length(toLight);
+    glm::vec3 lightDir = toLight / distance;
+    // Same cone test as the shader.
+    float cosTheta = glm::dot(lightDir, lights.spotLightDirs[i]);
+    float cosEpsilon = light->GetCosCutoffStart() - light->GetCosCutoffEnd();
+    float factor = glm::clamp(
+        (cosTheta - light->GetCosCutoffEnd()) / cosEpsilon, 0.0f, 1.0f);
+    addLight(lightDir, distance,
+             factor * light->GetIntensity() * light->GetAttenuation(distance));
+  }
+  for (size_t i = 0; i < scene->areaLights.size(); i++) {
+    const AreaLight *light = scene->areaLights[i];
+    if (!light->IsStatic()) continue;
+    const std::vector<glm::vec3> &samples = lights.areaLightSamples[i];
+    for (const glm::vec3 &samplePos : samples) {
+      glm::vec3 toLight = samplePos - position;
+      float distance = glm::length(toLight);
+      addLight(toLight / distance, distance,
+               light->GetIntensity() * light->GetAttenuation(distance) /
+                   (float)samples.size());
+    }
+  }
+  return result;
+}
@@ -0,0 +1,41 @@
+#ifndef STATIC_LIGHTS_H
+#define STATIC_LIGHTS_H
+
+#include "headers.h"
+#include "scene.h"
+
+// StaticLights Declarations.
+// Diffuse light of the scene's static lights at a surface point, with ray
+// traced shadows, for the offline bakes. It follows the shader: lights sit
+// in the model space of the object being shaded and use the shader's
+// falloff, spot cone and area light sample points. The result leaves out
+// the surface albedo.
+class StaticLights {
+ public:
+  // StaticLights Public Methods.
+  // Places the lights for every object. Scene::UpdateBVH must have been
+  // called; the result is in the space of the BVH.
+  void Prepare(const Scene *scene);
+  // Light arriving at a point of the given object. Adds the shadow rays it
+  // traces to rays.
+  glm::vec3 DirectLight(const Scene *scene, const int object,
+                        const glm::vec3 &position, const glm::vec3 &normal,
+                        const glm::vec3 &geometricNormal,
+                        long long &rays) const;
+
+ private:
+  // Lights in the space one object's shader invocation sees them in.
+  struct ObjectLights {
+    std::vector<glm::vec3> dirLightDirs;
+    std::vector<glm::vec3> pointLightPositions;
+    std::vector<glm::vec3> spotLightPositions;
+    std::vector<glm::vec3> spotLightDirs;
+    // Sample positions of each area light, like the shader's.
+    std::vector<std::vector<glm::vec3>> areaLightSamples;
+  };
+
+  // StaticLights Private Data.
+  std::vector<ObjectLights> objectLights;
+};
+
+#endif
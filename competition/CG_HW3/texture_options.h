@@ -0,0 +1,26 @@
+#ifndef TEXTURE_OPTIONS_H
+#define TEXTURE_OPTIONS_H
+
+// How ImageTexture loads PNG/JPG sources. DDS and KTX2 files are always
+// uploaded in their block format.
+enum class TextureCompression {
+	// RGB8, with mips as set by MipGeneration.
+	Off,
+	// BC1 (BC3 with alpha) from the <source>.dds sidecar, which is encoded
+	// first if it is missing or was encoded from different source bytes.
+	Cached,
+	// Like Cached, but always re-encodes the sidecar.
+	Rebuild,
+};
+
+// Where the mips of uncompressed textures come from.
+enum class MipGeneration {
+	// glGenerateMipmap, filtered in gamma space.
+	Driver,
+	// Linear-space box or Kaiser filtering on the thread pool, cached on disk
+	// by source hash and uploaded level by level.
+	Box,
+	Kaiser,
+};
+
+#endif
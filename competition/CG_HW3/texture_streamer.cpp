@@ -0,0 +1,338 @@
+#include "texture_streamer.h"
+
+#include <chrono>
+#include <climits>
+
+#include "camera.h"
+#include "imagetexture.h"
+#include "material.h"
+#include "memory_tracker.h"
+#include "profiler.h"
+#include "scene.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+// The six planes of the view frustum, normals pointing inside.
+static void ExtractFrustumPlanes(const glm::mat4x4 &viewProj,
+                                 glm::vec4 planes[6]) {
+  glm::vec4 rows[4];
+  for (int r = 0; r < 4; ++r) {
+    rows[r] = glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r],
+                        viewProj[3][r]);
+  }
+  for (int i = 0; i < 3; ++i) {
+    planes[2 * i] = rows[3] + rows[i];
+    planes[2 * i + 1] = rows[3] - rows[i];
+  }
+  for (int i = 0; i < 6; ++i) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+static bool IsSphereVisible(const glm::vec4 planes[6],
+                            const glm::vec4 &sphere) {
+  for (int i = 0; i < 6; ++i) {
+    if (glm::dot(glm::vec3(planes[i]), glm::vec3(sphere)) + planes[i].w <
+        -sphere.w) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int TextureStreamer::FindTexture(ImageTexture *texture) {
+  if (texture == nullptr || !texture->IsStreamable()) {
+    return -1;
+  }
+  auto found = textureIndices.find(texture);
+  if (found != textureIndices.end()) {
+    return found->second;
+  }
+  StreamedTexture streamed;
+  streamed.texture = texture;
+  streamed.visibleLevel = INT_MAX;
+  streamed.wantedLevel = texture->GetStartLevel();
+  streamed.lastVisibleFrame = LLONG_MIN / 2;
+  const int index = (int)textures.size();
+  textures.push_back(streamed);
+  textureIndices[texture] = index;
+  return index;
+}
+
+const std::vector<TextureStreamer::SubMeshTextures> &
+TextureStreamer::GetSubMeshTextures(TriangleMesh *mesh) {
+  auto found = meshTextures.find(mesh);
+  if (found != meshTextures.end()) {
+    return found->second;
+  }
+  std::vector<SubMeshTextures> &uses = meshTextures[mesh];
+  for (const SubMesh &subMesh : mesh->getSubMeshes()) {
+    SubMeshTextures use;
+    use.mapKd = -1;
+    use.mapKs = -1;
+    // Without a usable mapping the submesh requests nothing.
+    use.areaPerUv = subMesh.areaPerUv;
+    if (subMesh.material != nullptr) {
+      use.mapKd = FindTexture(subMesh.material->GetMapKd());
+      use.mapKs = FindTexture(subMesh.material->GetMapKs());
+    }
+    uses.push_back(use);
+  }
+  return uses;
+}
+
+void TextureStreamer::SetResidentLevel(const int index, const int level) {
+  ImageTexture *texture = textures[index].texture;
+  const int before = texture->GetResidentLevel();
+  const long long bytesBefore = texture->GetGpuBytes();
+  texture->SetResidentLevel(level);
+  const long long bytesAfter = texture->GetGpuBytes();
+  stats.residentBytes += bytesAfter - bytesBefore;
+  if (texture->GetResidentLevel() < before) {
+    stats.uploadedBytes += bytesAfter - bytesBefore;
+    stats.uploads++;
+  } else if (texture->GetResidentLevel() > before) {
+    stats.evictedBytes += bytesBefore - bytesAfter;
+    stats.evictions++;
+  }
+}
+
+bool TextureStreamer::EvictOneLevel(const int keep,
+                                    const bool overResidentOnly) {
+  int best = -1;
+  for (int i = 0; i < (int)textures.size(); ++i) {
+    const StreamedTexture &t = textures[i];
+    const int resident = t.texture->GetResidentLevel();
+    if (i == keep || resident >= t.texture->GetStartLevel() ||
+        (overResidentOnly && resident >= t.wantedLevel)) {
+      continue;
+    }
+    // Least recently visible first, then the finest level.
+    if (best < 0 || t.lastVisibleFrame < textures[best].lastVisibleFrame ||
+        (t.lastVisibleFrame == textures[best].lastVisibleFrame &&
+         resident < textures[best].texture->GetResidentLevel())) {
+      best = i;
+    }
+  }
+  if (best < 0) {
+    return false;
+  }
+  SetResidentLevel(best, textures[best].texture->GetResidentLevel() + 1);
+  return true;
+}
+
+void TextureStreamer::Update(const Scene *scene, const Camera *camera,
+                             const int viewportHeight) {
+  // Nothing was loaded for streaming.
+  if (textures.empty() && !ImageTexture::IsStreaming()) {
+    return;
+  }
+  PROFILE_SCOPE("Texture Streaming");
+  auto start = std::chrono::steady_clock::now();
+  frame++;
+  for (StreamedTexture &t : textures) {
+    t.visibleLevel = INT_MAX;
+  }
+
+  // Screen pixels per world unit at distance 1.
+  const float pixelsPerUnit =
+      (float)viewportHeight /
+      (2.0f * std::tan(glm::radians(camera->GetFovy()) * 0.5f));
+  const glm::vec3 cameraPos = camera->GetCameraPos();
+  glm::vec4 planes[6];
+  ExtractFrustumPlanes(camera->GetProjMatrix() * camera->GetViewMatrix(),
+                       planes);
+  const TransformStore &transforms = scene->transforms;
+  const int numObjects =
+      std::min((int)scene->objects.size(), transforms.GetNumObjects());
+  for (int i = 0; i < numObjects; ++i) {
+    TriangleMesh *mesh = scene->objects[i].mesh;
+    if (mesh == nullptr) {
+      continue;
+    }
+    const std::vector<SubMeshTextures> &uses = GetSubMeshTextures(mesh);
+    const glm::vec4 &sphere = transforms.GetBoundingSphere(i);
+    if (!IsSphereVisible(planes, sphere)) {
+      continue;
+    }
+    // The nearest point of the bounds, so the estimate errs on the sharp
+    // side.
+    const float distance =
+        std::max(glm::length(glm::vec3(sphere) - cameraPos) - sphere.w,
+                 camera->GetNearPlane());
+    const float halfDiagonal = 0.5f * glm::length(mesh->GetObjExtent());
+    const float scale = halfDiagonal > 0.0f ? sphere.w / halfDiagonal : 1.0f;
+    for (const SubMeshTextures &use : uses) {
+      if (use.areaPerUv <= 0.0f) {
+        continue;
+      }
+      const float pixelsPerUv =
+          std::sqrt(use.areaPerUv) * scale * pixelsPerUnit / distance;
+      for (const int index : {use.mapKd, use.mapKs}) {
+        if (index < 0) {
+          continue;
+        }
+        StreamedTexture &t = textures[index];
+        const float texelsPerPixel =
+            (float)std::max(t.texture->GetWidth(), t.texture->GetHeight()) /
+            pixelsPerUv;
+        const float level =
+            std::log2(std::max(1.0f, texelsPerPixel)) + settings.mipBias;
+        t.visibleLevel = std::min(
+            t.visibleLevel, glm::clamp((int)std::floor(level), 0,
+                                       t.texture->GetStartLevel()));
+      }
+    }
+  }
+
+  stats.residentBytes = 0;
+  stats.wantedBytes = 0;
+  stats.uploadedBytes = 0;
+  stats.evictedBytes = 0;
+  std::vector<int> pending;
+  for (int i = 0; i < (int)textures.size(); ++i) {
+    StreamedTexture &t = textures[i];
+    if (t.visibleLevel != INT_MAX) {
+      t.wantedLevel = t.visibleLevel;
+      t.lastVisibleFrame = frame;
+    } else if (frame - t.lastVisibleFrame > settings.keepFrames) {
+      t.wantedLevel = t.texture->GetStartLevel();
+    }
+    stats.residentBytes += t.texture->GetGpuBytes();
+    for (int level = t.wantedLevel; level < t.texture->GetNumLevels();
+         ++level) {
+      stats.wantedBytes += t.texture->GetLevelBytes(level);
+    }
+    if (t.texture->GetResidentLevel() > t.wantedLevel) {
+      pending.push_back(i);
+    }
+  }
+
+  // A texture budget on the MemoryTracker also covers the textures that
+  // are not streamed.
+  long long budget = settings.budgetBytes;
+  const MemoryTracker &tracker = MemoryTracker::Get();
+  const long long trackerBudget =
+      tracker.GetBudget(MemoryTag::Texture).gpuBytes;
+  if (trackerBudget > 0) {
+    const long long others =
+        tracker.GetUsage(MemoryTag::Texture).gpuBytes - stats.residentBytes;
+    budget = std::min(budget, trackerBudget - others);
+  }
+
+  // A lowered budget applies right away.
+  while (stats.residentBytes > budget &&
+         EvictOneLevel(-1, false)) {
+  }
+
+  // Largest deficit first, then the finest request.
+  std::sort(pending.begin(), pending.end(), [&](const int a, const int b) {
+    const int deficitA =
+        textures[a].texture->GetResidentLevel() - textures[a].wantedLevel;
+    const int deficitB =
+        textures[b].texture->GetResidentLevel() - textures[b].wantedLevel;
+    if (deficitA != deficitB) {
+      return deficitA > deficitB;
+    }
+    return textures[a].wantedLevel < textures[b].wantedLevel;
+  });
+  stats.blocked = 0;
+  for (const int index : pending) {
+    StreamedTexture &t = textures[index];
+    while (t.texture->GetResidentLevel() > t.wantedLevel) {
+      const int level = t.texture->GetResidentLevel() - 1;
+      const long long cost = t.texture->GetLevelBytes(level);
+      // One upload always goes through, however big.
+      if (stats.uploadedBytes > 0 &&
+          stats.uploadedBytes + cost > settings.uploadBytesPerFrame) {
+        break;
+      }
+      // Only textures holding more than they need give way.
+      while (stats.residentBytes + cost > budget &&
+             EvictOneLevel(index, true)) {
+      }
+      if (stats.residentBytes + cost > budget) {
+        stats.blocked++;
+        break;
+      }
+      SetResidentLevel(index, level);
+    }
+  }
+
+  stats.textures = (int)textures.size();
+  stats.pending = 0;
+  for (const StreamedTexture &t : textures) {
+    if (t.texture->GetResidentLevel() > t.wantedLevel) {
+      stats.pending++;
+    }
+  }
+  stats.satisfied = stats.textures - stats.pending;
+  stats.updateMs = MsSince(start);
+}
+
+long long TextureStreamer::Evict(const long long bytes) {
+  const long long before = stats.residentBytes;
+  while (before - stats.residentBytes < bytes && EvictOneLevel(-1, false)) {
+  }
+  return before - stats.residentBytes;
+}
+
+void TextureStreamer::Clear() {
+  textures.clear();
+  textureIndices.clear();
+  meshTextures.clear();
+  stats = TextureStreamerStats();
+}
+
+void TextureStreamer::DrawDebugPanel() {
+  ImGui::Begin("Texture Streaming");
+  bool enabled = ImageTexture::IsStreaming();
+  if (ImGui::Checkbox("Stream textures (next load)", &enabled)) {
+    ImageTexture::SetStreaming(enabled);
+  }
+  const double mb = 1024.0 * 1024.0;
+  int budgetMb = (int)(settings.budgetBytes / (long long)mb);
+  if (ImGui::SliderInt("Budget (MB)", &budgetMb, 16, 4096)) {
+    settings.budgetBytes = (long long)budgetMb * (long long)mb;
+  }
+  int uploadMb = (int)(settings.uploadBytesPerFrame / (long long)mb);
+  if (ImGui::SliderInt("Uploads per frame (MB)", &uploadMb, 1, 256)) {
+    settings.uploadBytesPerFrame = (long long)uploadMb * (long long)mb;
+  }
+  ImGui::SliderInt("Keep frames", &settings.keepFrames, 0, 1000);
+  ImGui::SliderFloat("Mip bias", &settings.mipBias, -1.0f, 4.0f, "%.1f");
+
+  char overlay[64];
+  std::snprintf(overlay, sizeof(overlay), "%.1f / %.1f MB",
+                stats.residentBytes / mb, settings.budgetBytes / mb);
+  ImGui::ProgressBar(
+      settings.budgetBytes > 0
+          ? (float)((double)stats.residentBytes / settings.budgetBytes)
+          : 0.0f,
+      ImVec2(-1.0f, 0.0f), overlay);
+  ImGui::Text("%d textures: %d at their wanted level, %d pending (%d over "
+              "budget)",
+              stats.textures, stats.satisfied, stats.pending, stats.blocked);
+  ImGui::Text("Wanted %.1f MB", stats.wantedBytes / mb);
+  ImGui::Text("Last frame: uploaded %.2f MB, evicted %.2f MB in %.3f ms",
+              stats.uploadedBytes / mb, stats.evictedBytes / mb,
+              stats.updateMs);
+  ImGui::Text("%lld uploads, %lld evictions", stats.uploads,
+              stats.evictions);
+  if (ImGui::TreeNode("Residency")) {
+    for (const StreamedTexture &t : textures) {
+      const ImageTexture *texture = t.texture;
+      const int resident = texture->GetResidentLevel();
+      ImGui::Text("%s: %dx%d (level %d, wanted %d) %.2f MB",
+                  std::filesystem::path(texture->GetPath())
+                      .filename()
+                      .string()
+                      .c_str(),
+                  std::max(1, texture->GetWidth() >> resident),
+                  std::max(1, texture->GetHeight() >> resident), resident,
+                  t.wantedLevel, texture->GetGpuBytes() / mb);
+    }
+    ImGui::TreePop();
+  }
+  ImGui::End();
+}
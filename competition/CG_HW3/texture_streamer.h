@@ -0,0 +1,104 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include "headers.h"
+
+class Camera;
+class ImageTexture;
+class TriangleMesh;
+struct Scene;
+
+struct TextureStreamerSettings {
+  // VRAM for the streamed textures, their start levels included.
+  long long budgetBytes = 256LL * 1024 * 1024;
+  // Uploads per frame, to keep camera cuts from stalling a single frame.
+  long long uploadBytesPerFrame = 16LL * 1024 * 1024;
+  // Frames a texture keeps its finer levels after it was last visible.
+  int keepFrames = 120;
+  // Added to every requested level; positive values save VRAM.
+  float mipBias = 0.0f;
+};
+
+struct TextureStreamerStats {
+  int textures = 0;
+  // Textures at their wanted level, and those waiting for finer levels.
+  int satisfied = 0;
+  int pending = 0;
+  // Pending textures the budget had no room for.
+  int blocked = 0;
+  long long residentBytes = 0;
+  // VRAM the wanted levels of all textures would take.
+  long long wantedBytes = 0;
+  long long uploadedBytes = 0;
+  long long evictedBytes = 0;
+  // Totals since the start.
+  long long uploads = 0;
+  long long evictions = 0;
+  double updateMs = 0.0;
+};
+
+// TextureStreamer Declarations.
+// Keeps the finer mips of the scene's streamed textures (see
+// ImageTexture::SetStreaming) resident only while something on screen
+// needs them. Every frame the visible submeshes request the level at
+// which one texel covers about one pixel, from the submesh's world area per
+// UV area and its distance to the camera. Requests are served largest
+// deficit first within a per-frame upload limit, evicting the finer levels
+// of textures that no longer need them, least recently used first, to stay
+// within the VRAM budget.
+class TextureStreamer {
+ public:
+  // TextureStreamer Public Methods.
+  // Call after scene->transforms is up to date for the frame.
+  void Update(const Scene *scene, const Camera *camera,
+              const int viewportHeight);
+  // Forgets all textures and meshes, e.g. before they are deleted.
+  void Clear();
+  // Drops resident levels, least recently used first, until bytes are
+  // freed or only the start levels are left. Returns the bytes freed. Used
+  // as the MemoryTracker budget callback of the textures.
+  long long Evict(const long long bytes);
+
+  TextureStreamerSettings &GetSettings() { return settings; }
+  const TextureStreamerStats &GetStats() const { return stats; }
+  void DrawDebugPanel();
+
+ private:
+  // TextureStreamer Private Methods.
+  struct SubMeshTextures {
+    // Indices into textures, -1 for none.
+    int mapKd;
+    int mapKs;
+    // Object-space surface area per unit of UV area.
+    float areaPerUv;
+  };
+
+  int FindTexture(ImageTexture *texture);
+  const std::vector<SubMeshTextures> &GetSubMeshTextures(TriangleMesh *mesh);
+  // Drops the finest resident level of the best eviction candidate other
+  // than keep. Returns false if there is none.
+  bool EvictOneLevel(const int keep, const bool overResidentOnly);
+  void SetResidentLevel(const int index, const int level);
+
+  struct StreamedTexture {
+    ImageTexture *texture;
+    // Finest level needed by the visible submeshes this frame, INT_MAX if
+    // none is visible.
+    int visibleLevel;
+    // The level requested: visibleLevel while visible, kept for keepFrames
+    // afterwards, then the start level.
+    int wantedLevel;
+    long long lastVisibleFrame;
+  };
+
+  // TextureStreamer Private Data.
+  std::vector<StreamedTexture> textures;
+  std::unordered_map<ImageTexture *, int> textureIndices;
+  std::unordered_map<const TriangleMesh *, std::vector<SubMeshTextures>>
+      meshTextures;
+  long long frame = 0;
+  TextureStreamerSettings settings;
+  TextureStreamerStats stats;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "profiler.h"
+
+ThreadPool::ThreadPool(const int numThreads) {
+  stopping = false;
+  int n = numThreads;
+  if (n <= 0) {
+    n = (int)std::thread::hardware_concurrency() - 1;
+  }
+  n = std::max(n, 1);
+  for (int i = 0; i < n; ++i) {
+    workers.emplace_back([this, i]() {
+      PROFILE_THREAD_NAME("Worker " + std::to_string(i));
+      WorkerLoop();
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeUp.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+ThreadPool &ThreadPool::Get() {
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::Enqueue(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  wakeUp.notify_one();
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeUp.wait(lock, [this]() { return stopping || !tasks.empty(); });
+      if (stopping && tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::ParallelFor(const int count, const int grainSize,
+                             const std::function<void(int, int)> &func) {
+  if (count <= 0) {
+    return;
+  }
+  const int grain = std::max(grainSize, 1);
+  const int numChunks = (count + grain - 1) / grain;
+  if (numChunks == 1) {
+    func(0, count);
+    return;
+  }
+
+  // Shared with the helper tasks, which may start after we have returned.
+  struct Job {
+    std::atomic<int> nextChunk{0};
+    std::atomic<int> doneChunks{0};
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+  auto job = std::make_shared<Job>();
+  const std::function<void(int, int)> *body = &func;
+
+  auto runChunks = [job, body, count, grain, numChunks]() {
+    PROFILE_SCOPE("ParallelFor");
+    int chunk;
+    while ((chunk = job->nextChunk.fetch_add(1)) < numChunks) {
+      int begin = chunk * grain;
+      (*body)(begin, std::min(begin + grain, count));
+      if (job->doneChunks.fetch_add(1) + 1 == numChunks) {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->done.notify_all();
+      }
+    }
+  };
+
+  const int numHelpers = std::min((int)workers.size(), numChunks - 1);
+  for (int i = 0; i < numHelpers; ++i) {
+    Enqueue(runChunks);
+  }
+  runChunks();
+
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->done.wait(lock,
+                 [&job, numChunks]() { return job->doneChunks == numChunks; });
+}
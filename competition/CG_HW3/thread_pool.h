@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool Declarations.
+// A fixed set of worker threads shared by the CPU-side tools (texture
+// conversion, baking, ...). The calling thread always takes part in
+// ParallelFor, so nested calls from a worker cannot deadlock.
+class ThreadPool {
+ public:
+  // ThreadPool Public Methods.
+  // numThreads == 0 uses one worker per hardware thread minus the caller.
+  explicit ThreadPool(const int numThreads = 0);
+  ~ThreadPool();
+
+  // The pool shared by the whole program.
+  static ThreadPool &Get();
+
+  // Number of threads that run ParallelFor work, including the caller.
+  int GetConcurrency() const { return (int)workers.size() + 1; }
+
+  // Calls func(begin, end) on chunks of at most grainSize items covering
+  // [0, count), and returns when all chunks are done.
+  void ParallelFor(const int count, const int grainSize,
+                   const std::function<void(int, int)> &func);
+
+  // Runs task on a worker thread some time later.
+  void Enqueue(std::function<void()> task);
+
+ private:
+  // ThreadPool Private Methods.
+  void WorkerLoop();
+
+  // ThreadPool Private Data.
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wakeUp;
+  bool stopping;
+};
+
+#endif
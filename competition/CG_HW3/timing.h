@@ -0,0 +1,18 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <chrono>
+
+// Wall-clock milliseconds from start to end, for the CPU timings of the
+// stats and benchmarks. GPU times come from GpuTimer.
+inline double MsBetween(const std::chrono::steady_clock::time_point &start,
+                        const std::chrono::steady_clock::time_point &end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Milliseconds since start.
+inline double MsSince(const std::chrono::steady_clock::time_point &start) {
+  return MsBetween(start, std::chrono::steady_clock::now());
+}
+
+#endif
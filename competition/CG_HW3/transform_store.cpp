@@ -0,0 +1,259 @@
+#include "transform_store.h"
+
+#include <atomic>
+#include <chrono>
+#include <numeric>
+
+#include "profiler.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+// No projective part: the bottom row is (0, 0, 0, 1).
+static bool IsAffine(const glm::mat4x4 &m) {
+  return m[0][3] == 0.0f && m[1][3] == 0.0f && m[2][3] == 0.0f &&
+         m[3][3] == 1.0f;
+}
+
+static glm::vec4 WorldSphere(const TriangleMesh *mesh,
+                             const glm::mat4x4 &world) {
+  if (mesh == nullptr) {
+    return glm::vec4(0.0f);
+  }
+  glm::vec3 center = glm::vec3(world * glm::vec4(mesh->GetObjCenter(), 1.0f));
+  float maxScale = glm::max(glm::max(glm::length(glm::vec3(world[0])),
+                                     glm::length(glm::vec3(world[1]))),
+                            glm::length(glm::vec3(world[2])));
+  return glm::vec4(center,
+                   0.5f * glm::length(mesh->GetObjExtent()) * maxScale);
+}
+
+void TransformStore::MarkDirty(const int object) {
+  if (object >= (int)dirtyFlags.size()) {
+    allDirty = true;
+    return;
+  }
+  if (!dirtyFlags[object]) {
+    dirtyFlags[object] = 1;
+    dirtyList.push_back(object);
+  }
+}
+
+int TransformStore::Update(const std::vector<SceneObject> &objects,
+                           const glm::mat4x4 &rootTransform) {
+  const int numObjects = (int)objects.size();
+  if (numObjects != (int)world.size() ||
+      rootTransform != this->rootTransform) {
+    allDirty = true;
+  }
+  if (!allDirty && dirtyList.empty()) {
+    stats.skipped++;
+    return 0;
+  }
+  PROFILE_SCOPE("Transform Update");
+  auto start = std::chrono::steady_clock::now();
+
+  if (allDirty) {
+    local.resize(numObjects);
+    world.resize(numObjects);
+    normal.resize(numObjects);
+    spheres.resize(numObjects);
+    dirtyFlags.assign(numObjects, 0);
+    dirtyList.resize(numObjects);
+    std::iota(dirtyList.begin(), dirtyList.end(), 0);
+    this->rootTransform = rootTransform;
+    rootAffine = IsAffine(rootTransform);
+    allDirty = false;
+  } else {
+    for (int object : dirtyList) {
+      dirtyFlags[object] = 0;
+    }
+  }
+
+  // 8 objects per group, 512 groups per task.
+  const int count = (int)dirtyList.size();
+  const int numGroups = (count + 7) / 8;
+  std::atomic<int> numGeneral(0);
+  ThreadPool::Get().ParallelFor(
+      numGroups, 512, [&](const int begin, const int end) {
+        const int first = begin * 8;
+        const int last = std::min(end * 8, count);
+        numGeneral += UpdateRange(objects, dirtyList.data() + first,
+                                  last - first);
+      });
+  dirtyList.clear();
+  version++;
+
+  stats.objects = numObjects;
+  stats.lastUpdated = count;
+  stats.general = numGeneral;
+  stats.affine = count - stats.general;
+  stats.updateMs = MsSince(start);
+  stats.updates++;
+  return count;
+}
+
+void TransformStore::UpdateGeneral(const SceneObject &obj, const int object) {
+  world[object] = rootTransform * local[object];
+  normal[object] =
+      glm::transpose(glm::inverse(glm::mat3x3(world[object])));
+  spheres[object] = WorldSphere(obj.mesh, world[object]);
+}
+
+int TransformStore::UpdateRange(const std::vector<SceneObject> &objects,
+                                const int *indices, const int count) {
+  // The upper 3x4 of the root, one broadcast per element.
+  float8 root[4][3];
+  for (int c = 0; c < 4; ++c) {
+    for (int r = 0; r < 3; ++r) {
+      root[c][r] = float8::Broadcast(rootTransform[c][r]);
+    }
+  }
+
+  int numGeneral = 0;
+  // Lane-major copies of 8 objects: l[c][r][lane] is element (c, r) of the
+  // local matrix.
+  float l[4][3][8];
+  float meshCenter[3][8];
+  float halfDiagonal[8];
+  float w[4][3][8];
+  float n[3][3][8];
+  float center[3][8];
+  float scale2[8];
+  for (int group = 0; group < count; group += 8) {
+    const int lanes = std::min(8, count - group);
+    int generalMask = 0;
+    for (int lane = 0; lane < 8; ++lane) {
+      const bool used = lane < lanes;
+      const glm::mat4x4 m =
+          used ? objects[indices[group + lane]].worldMatrix
+               : glm::mat4x4(1.0f);
+      if (used) {
+        local[indices[group + lane]] = m;
+        if (!rootAffine || !IsAffine(m)) {
+          generalMask |= 1 << lane;
+        }
+      }
+      for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 3; ++r) {
+          l[c][r][lane] = m[c][r];
+        }
+      }
+      const TriangleMesh *mesh =
+          used ? objects[indices[group + lane]].mesh : nullptr;
+      const glm::vec3 meshC =
+          mesh != nullptr ? mesh->GetObjCenter() : glm::vec3(0.0f);
+      for (int r = 0; r < 3; ++r) {
+        meshCenter[r][lane] = meshC[r];
+      }
+      halfDiagonal[lane] =
+          mesh != nullptr ? 0.5f * glm::length(mesh->GetObjExtent()) : 0.0f;
+    }
+
+    // world = root * local on the 3x4 parts; the bottom row stays
+    // (0, 0, 0, 1).
+    float8 wc[4][3];
+    for (int c = 0; c < 4; ++c) {
+      const float8 l0 = float8::Load(l[c][0]);
+      const float8 l1 = float8::Load(l[c][1]);
+      const float8 l2 = float8::Load(l[c][2]);
+      for (int r = 0; r < 3; ++r) {
+        float8 v = root[0][r] * l0;
+        v = MulAdd(root[1][r], l1, v);
+        v = MulAdd(root[2][r], l2, v);
+        if (c == 3) {
+          v = v + root[3][r];
+        }
+        wc[c][r] = v;
+        v.Store(w[c][r]);
+      }
+    }
+
+    // The inverse transpose of the columns [x y z] is
+    // [cross(y, z) cross(z, x) cross(x, y)] / dot(x, cross(y, z)).
+    const float8 *x = wc[0];
+    const float8 *y = wc[1];
+    const float8 *z = wc[2];
+    float8 nc[3][3];
+    nc[0][0] = y[1] * z[2] - y[2] * z[1];
+    nc[0][1] = y[2] * z[0] - y[0] * z[2];
+    nc[0][2] = y[0] * z[1] - y[1] * z[0];
+    nc[1][0] = z[1] * x[2] - z[2] * x[1];
+    nc[1][1] = z[2] * x[0] - z[0] * x[2];
+    nc[1][2] = z[0] * x[1] - z[1] * x[0];
+    nc[2][0] = x[1] * y[2] - x[2] * y[1];
+    nc[2][1] = x[2] * y[0] - x[0] * y[2];
+    nc[2][2] = x[0] * y[1] - x[1] * y[0];
+    const float8 det =
+        x[0] * nc[0][0] + x[1] * nc[0][1] + x[2] * nc[0][2];
+    // Degenerate matrices keep the cofactors, which still give the normal
+    // direction once the shader normalizes it.
+    const float8 zero = float8::Broadcast(0.0f);
+    const float8 invDet =
+        Select((det < zero) | (det > zero), float8::Broadcast(1.0f) / det,
+               float8::Broadcast(1.0f));
+    for (int c = 0; c < 3; ++c) {
+      for (int r = 0; r < 3; ++r) {
+        (nc[c][r] * invDet).Store(n[c][r]);
+      }
+    }
+
+    // Bounding sphere: the transformed mesh center, and the half diagonal
+    // scaled by the longest axis.
+    const float8 cx = float8::Load(meshCenter[0]);
+    const float8 cy = float8::Load(meshCenter[1]);
+    const float8 cz = float8::Load(meshCenter[2]);
+    for (int r = 0; r < 3; ++r) {
+      MulAdd(wc[2][r], cz, MulAdd(wc[1][r], cy, MulAdd(wc[0][r], cx,
+                                                       wc[3][r])))
+          .Store(center[r]);
+    }
+    float8 maxScale2 = zero;
+    for (int c = 0; c < 3; ++c) {
+      maxScale2 = Max(maxScale2, wc[c][0] * wc[c][0] + wc[c][1] * wc[c][1] +
+                                     wc[c][2] * wc[c][2]);
+    }
+    maxScale2.Store(scale2);
+
+    for (int lane = 0; lane < lanes; ++lane) {
+      const int object = indices[group + lane];
+      if (generalMask & (1 << lane)) {
+        UpdateGeneral(objects[object], object);
+        numGeneral++;
+        continue;
+      }
+      glm::mat4x4 &out = world[object];
+      glm::mat3x3 &outNormal = normal[object];
+      for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 3; ++r) {
+          out[c][r] = w[c][r][lane];
+        }
+        out[c][3] = c == 3 ? 1.0f : 0.0f;
+      }
+      for (int c = 0; c < 3; ++c) {
+        for (int r = 0; r < 3; ++r) {
+          outNormal[c][r] = n[c][r][lane];
+        }
+      }
+      spheres[object] =
+          objects[object].mesh != nullptr
+              ? glm::vec4(center[0][lane], center[1][lane], center[2][lane],
+                          halfDiagonal[lane] * std::sqrt(scale2[lane]))
+              : glm::vec4(0.0f);
+    }
+  }
+  return numGeneral;
+}
+
+void TransformStore::DrawDebugPanel() {
+  ImGui::Begin("Transforms");
+  ImGui::Text("%d objects", stats.objects);
+  ImGui::Text("Last update: %d objects in %.3f ms (%s, %d threads)",
+              stats.lastUpdated, stats.updateMs, float8::Name(),
+              ThreadPool::Get().GetConcurrency());
+  ImGui::Text("Affine %d, general %d", stats.affine, stats.general);
+  ImGui::Text("%d updates, %lld frames without any matrix math",
+              stats.updates, stats.skipped);
+  ImGui::End();
+}
@@ -0,0 +1,90 @@
+#ifndef TRANSFORM_STORE_H
+#define TRANSFORM_STORE_H
+
+#include "headers.h"
+#include "scene_obj.h"
+
+struct TransformStoreStats {
+  int objects = 0;
+  // Objects recomputed by the last Update that had any work, split by path.
+  int lastUpdated = 0;
+  int affine = 0;
+  int general = 0;
+  double updateMs = 0.0;
+  // Updates that recomputed something, and those that found nothing dirty.
+  int updates = 0;
+  long long skipped = 0;
+};
+
+// TransformStore Declarations.
+// Per-object matrices of the renderer, kept in separate arrays (local,
+// world and world-space normal matrices, plus world bounding spheres)
+// instead of being recomputed from the SceneObjects by every pass. Only
+// objects marked dirty are recomputed, all of them when the root transform
+// or the object count changes, so a frame where nothing moved does no
+// matrix math at all.
+//
+// Dirty objects are processed 8 at a time with float8: affine matrices (the
+// usual case) take a 3x4 product and a cofactor normal matrix, which needs
+// no general inverse; the rest fall back to glm. Large batches are split
+// over the thread pool.
+class TransformStore {
+ public:
+  // TransformStore Public Methods.
+  // Re-reads the world matrices of the dirty objects from objects and
+  // recomputes their derived data. Returns how many objects changed.
+  int Update(const std::vector<SceneObject> &objects,
+             const glm::mat4x4 &rootTransform);
+  // Call after changing the worldMatrix of an object in place.
+  void MarkDirty(const int object);
+  // Call after adding or removing objects.
+  void MarkAllDirty() { allDirty = true; }
+
+  int GetNumObjects() const { return (int)world.size(); }
+  const glm::mat4x4 &GetLocal(const int object) const {
+    return local[object];
+  }
+  // rootTransform * local.
+  const glm::mat4x4 &GetWorld(const int object) const {
+    return world[object];
+  }
+  // Inverse transpose of the world matrix's upper 3x3.
+  const glm::mat3x3 &GetNormal(const int object) const {
+    return normal[object];
+  }
+  // World-space center and radius of the mesh bounds, zero without a mesh.
+  const glm::vec4 &GetBoundingSphere(const int object) const {
+    return spheres[object];
+  }
+  // Increases whenever an Update changes anything, so consumers can cache
+  // what they derive from the store.
+  unsigned long long GetVersion() const { return version; }
+
+  const TransformStoreStats &GetStats() const { return stats; }
+  void DrawDebugPanel();
+
+ private:
+  // TransformStore Private Methods.
+  // Recomputes the count objects listed in indices. Returns how many took
+  // the general path.
+  int UpdateRange(const std::vector<SceneObject> &objects, const int *indices,
+                  const int count);
+  void UpdateGeneral(const SceneObject &obj, const int object);
+
+  // TransformStore Private Data.
+  std::vector<glm::mat4x4> local;
+  std::vector<glm::mat4x4> world;
+  std::vector<glm::mat3x3> normal;
+  std::vector<glm::vec4> spheres;
+
+  std::vector<unsigned char> dirtyFlags;
+  std::vector<int> dirtyList;
+  bool allDirty = true;
+
+  glm::mat4x4 rootTransform = glm::mat4x4(1.0f);
+  bool rootAffine = true;
+  unsigned long long version = 0;
+  TransformStoreStats stats;
+};
+
+#endif
@@ -1,6 +1,61 @@
 #include "trianglemesh.h"
 
+#include <chrono>
+
+#include <cstring>
+
 #include "fbx_loader.h"
+#include "file_cache.h"
+#include "memory_tracker.h"
+#include "profiler.h"
+#include "timing.h"
+
+namespace
+{
+  using LoadClock = std::chrono::steady_clock;
+
+  // Bump when the dump layout changes.
+  const uint32_t kDumpVersion = 1;
+  const char kDumpMagic[4] = {'M', 'E', 'S', 'H'};
+
+  struct MeshDumpHeader
+  {
+    char magic[4];
+    uint32_t version;
+    uint32_t numVertices;
+    uint32_t numSubMeshes;
+    uint32_t numLightmapUVs;
+    uint32_t numSourceVertices;
+  };
+
+  template <typename T>
+  void AppendBytes(std::vector<char> &data, const std::vector<T> &values)
+  {
+    const char *bytes = (const char *)values.data();
+    data.insert(data.end(), bytes, bytes + values.size() * sizeof(T));
+  }
+
+  template <typename T>
+  bool ReadBytes(const std::vector<char> &data, size_t &offset,
+                 const size_t count, std::vector<T> &values)
+  {
+    if (offset + count * sizeof(T) > data.size())
+    {
+      return false;
+    }
+    values.resize(count);
+    std::memcpy(values.data(), data.data() + offset, count * sizeof(T));
+    offset += count * sizeof(T);
+    return true;
+  }
+
+  // Frees the storage, which clear() keeps.
+  template <typename T>
+  void FreeVector(std::vector<T> &values)
+  {
+    std::vector<T>().swap(values);
+  }
+} // namespace
 
 std::vector<std::string> Utils::getFilesInDirectory(
     const std::string &directoryPath, const std::string &fileNameExtension)
@@ -89,6 +144,10 @@ VertexPTN TriangleMesh::parseVertex(const std::string &vertexData,
 void TriangleMesh::findAndAddVertexIndices(const VertexPTN vertex,
                                            SubMesh &subMesh)
 {
+  LoadClock::time_point start;
+  if (detailedLoadTiming)
+    start = LoadClock::now();
+
   if (uniqueVertices.find(vertex) == uniqueVertices.end())
   {
     uniqueVertices[vertex] = vertices.size();
@@ -99,6 +158,9 @@ void TriangleMesh::findAndAddVertexIndices(const VertexPTN vertex,
   {
     subMesh.vertexIndices.push_back(uniqueVertices[vertex]);
   }
+
+  if (detailedLoadTiming)
+    loadStats.dedupMs += MsSince(start);
 }
 
 void TriangleMesh::polygonSubdivision(const std::vector<glm::vec3> &points,
@@ -165,11 +227,19 @@ TriangleMesh::TriangleMesh()
   // -------------------------------------------------------
   // Add your initialization code here.
   // -------------------------------------------------------
+  vboId = 0;
+  posVboId = 0;
+  numVertices = 0;
+  numTriangles = 0;
+  detailedLoadTiming = false;
+  bvh = nullptr;
+  lightmapVboId = 0;
 }
 
 // Destructor of a triangle mesh.
 TriangleMesh::~TriangleMesh()
 {
+  MemoryTracker::Get().Remove(this);
   subMeshes.clear();
   // Destructor of a triangle mesh.
 
@@ -190,7 +260,81 @@ TriangleMesh::~TriangleMesh()
   vertices.clear();
   uniqueVertices.clear();
 
-  glDeleteBuffers(1, &vboId);
+  // Meshes loaded without a GL context never created buffers.
+  if (vboId != 0)
+    glDeleteBuffers(1, &vboId);
+  if (posVboId != 0)
+    glDeleteBuffers(1, &posVboId);
+  if (lightmapVboId != 0)
+    glDeleteBuffers(1, &lightmapVboId);
+  delete bvh;
+}
+
+const MeshBVH *TriangleMesh::GetBVH()
+{
+  if (bvh == nullptr)
+  {
+    // The BVH keeps its own triangles, so released data can go again.
+    // An unreadable dump leaves an empty BVH.
+    const bool released = !HasCpuData();
+    if (released)
+    {
+      RestoreCpuData();
+    }
+    bvh = new MeshBVH();
+    bvh->Build(this);
+    if (released)
+    {
+      ReleaseCpuData();
+    }
+    const BVHBuildStats &stats = bvh->GetStats();
+    std::cout << "BVH: " << stats.numPrimitives << " triangles, "
+              << stats.numNodes << " nodes, depth " << stats.maxDepth
+              << ", built in " << stats.buildMs << " ms" << std::endl;
+  }
+  return bvh;
+}
+
+void TriangleMesh::SetLightmapLayout(
+    const std::vector<unsigned int> &sourceVertices,
+    const std::vector<glm::vec2> &lightmapUVs,
+    const std::vector<std::vector<unsigned int>> &subMeshIndices)
+{
+  std::vector<VertexPTN> splitVertices(sourceVertices.size());
+  std::vector<unsigned int> sources(sourceVertices.size());
+  for (size_t i = 0; i < sourceVertices.size(); i++)
+  {
+    splitVertices[i] = vertices[sourceVertices[i]];
+    // Keep pointing at the loaded vertices across repeated layouts.
+    sources[i] = lightmapSourceVertices.empty()
+                     ? sourceVertices[i]
+                     : lightmapSourceVertices[sourceVertices[i]];
+  }
+  vertices.swap(splitVertices);
+  lightmapSourceVertices.swap(sources);
+  this->lightmapUVs = lightmapUVs;
+  for (size_t i = 0; i < subMeshes.size(); i++)
+  {
+    subMeshes[i].vertexIndices = subMeshIndices[i];
+  }
+  numVertices = (int)vertices.size();
+  // Only used while loading.
+  uniqueVertices.clear();
+
+  if (vboId != 0)
+  {
+    glDeleteBuffers(1, &vboId);
+    glDeleteBuffers(1, &posVboId);
+    if (lightmapVboId != 0)
+      glDeleteBuffers(1, &lightmapVboId);
+    for (auto &subMesh : subMeshes)
+    {
+      glDeleteBuffers(1, &subMesh.iboId);
+    }
+    lightmapVboId = 0;
+    createBuffer();
+  }
+  reportMemory();
 }
 void TriangleMesh::processMaterialLib(const std::string &mtlFile)
 {
@@ -320,6 +464,9 @@ void TriangleMesh::processFace(const std::vector<std::string> &parts,
 bool TriangleMesh::LoadFromFile(const std::string &filePath,
                                 const bool normalized, Scene *scene)
 {
+  PROFILE_SCOPE("LoadFromFile");
+  const LoadClock::time_point loadStart = LoadClock::now();
+  loadStats = MeshLoadStats();
   objFilePath = filePath;
   // temp vertex data
   std::vector<glm::vec3> points;
@@ -345,18 +492,35 @@ bool TriangleMesh::LoadFromFile(const std::string &filePath,
       return false;
     }
 
+    const LoadClock::time_point parseStart = LoadClock::now();
     std::string line;
-    while (std::getline(file, line))
+    std::vector<std::string> parts;
+    while (true)
     {
+      LoadClock::time_point splitStart;
+      if (detailedLoadTiming)
+        splitStart = LoadClock::now();
+
+      if (!std::getline(file, line))
+        break;
       if (line.empty())
         continue;
+      parts = Utils::splitString(line, ' ');
+
+      if (detailedLoadTiming)
+        loadStats.splitMs += MsSince(splitStart);
 
-      std::vector<std::string> parts = Utils::splitString(line, ' ');
       parseLine(points, texs, normals, parts);
     }
     file.close();
+
+    // Whatever was not attributed to split or dedup is parsing.
+    loadStats.parseMs = MsSince(parseStart) - loadStats.splitMs -
+                        loadStats.dedupMs;
   }
 
+  const LoadClock::time_point normalizeStart = LoadClock::now();
+
   // Clear temp data.
   points.clear();
   texs.clear();
@@ -410,28 +574,59 @@ bool TriangleMesh::LoadFromFile(const std::string &filePath,
   }
   else
   {
-    // Calculate the center and extent of the object.
-    glm::vec3 minPoint(FLT_MAX, FLT_MAX, FLT_MAX);
-    glm::vec3 maxPoint(FLT_MIN, FLT_MIN, FLT_MIN);
-
-    for (const auto &vertex : vertices)
-    {
-      minPoint = glm::min(minPoint, vertex.position);
-      maxPoint = glm::max(maxPoint, vertex.position);
-    }
-
-    objCenter = (minPoint + maxPoint) * 0.5f;
-    objExtent = maxPoint - minPoint;
+    computeBounds();
   }
 
   // Calculate the number of vertices and triangles.
   numVertices = vertices.size();
 
+  loadStats.normalizeMs = MsSince(normalizeStart);
+  loadStats.totalMs = MsSince(loadStart);
+  reportMemory();
   return true;
 }
 
+void TriangleMesh::computeBounds()
+{
+  // Calculate the center and extent of the object.
+  glm::vec3 minPoint(FLT_MAX, FLT_MAX, FLT_MAX);
+  glm::vec3 maxPoint(FLT_MIN, FLT_MIN, FLT_MIN);
+
+  for (const auto &vertex : vertices)
+  {
+    minPoint = glm::min(minPoint, vertex.position);
+    maxPoint = glm::max(maxPoint, vertex.position);
+  }
+
+  objCenter = (minPoint + maxPoint) * 0.5f;
+  objExtent = maxPoint - minPoint;
+  numVertices = (int)vertices.size();
+}
+
+size_t TriangleMesh::GetGeometryBytes() const
+{
+  size_t bytes = vertices.size() * sizeof(VertexPTN);
+  for (const SubMesh &subMesh : subMeshes)
+  {
+    bytes += subMesh.vertexIndices.size() * sizeof(unsigned int);
+  }
+  return bytes;
+}
+
+std::vector<glm::vec3> TriangleMesh::BuildPositionStream() const
+{
+  std::vector<glm::vec3> positions(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++)
+  {
+    positions[i] = vertices[i].position;
+  }
+  return positions;
+}
+
 void TriangleMesh::createBuffer()
 {
+  PROFILE_SCOPE("CreateBuffer");
+  const LoadClock::time_point bufferStart = LoadClock::now();
   glGenBuffers(1, &vboId);
 
   for (auto &subMesh : subMeshes)
@@ -442,63 +637,285 @@ void TriangleMesh::createBuffer()
   glBindBuffer(GL_ARRAY_BUFFER, vboId);
   glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexPTN),
                vertices.data(), GL_STATIC_DRAW);
+
+  // Depth passes only read positions, so keep them in their own stream to
+  // fetch 12 instead of 32 bytes per vertex.
+  std::vector<glm::vec3> positions = BuildPositionStream();
+  glGenBuffers(1, &posVboId);
+  glBindBuffer(GL_ARRAY_BUFFER, posVboId);
+  glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3),
+               positions.data(), GL_STATIC_DRAW);
+
+  if (!lightmapUVs.empty())
+  {
+    glGenBuffers(1, &lightmapVboId);
+    glBindBuffer(GL_ARRAY_BUFFER, lightmapVboId);
+    glBufferData(GL_ARRAY_BUFFER, lightmapUVs.size() * sizeof(glm::vec2),
+                 lightmapUVs.data(), GL_STATIC_DRAW);
+  }
+
+  computeAreaPerUv();
+  loadStats.bufferMs = MsSince(bufferStart);
+  reportMemory();
+}
+
+void TriangleMesh::computeAreaPerUv()
+{
+  for (SubMesh &subMesh : subMeshes)
+  {
+    double area = 0.0;
+    double uvArea = 0.0;
+    const std::vector<unsigned int> &indices = subMesh.vertexIndices;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+      const VertexPTN &v0 = vertices[indices[i]];
+      const VertexPTN &v1 = vertices[indices[i + 1]];
+      const VertexPTN &v2 = vertices[indices[i + 2]];
+      area += 0.5 * glm::length(glm::cross(v1.position - v0.position,
+                                           v2.position - v0.position));
+      const glm::vec2 e1 = v1.texcoord - v0.texcoord;
+      const glm::vec2 e2 = v2.texcoord - v0.texcoord;
+      uvArea += 0.5 * std::abs(e1.x * e2.y - e1.y * e2.x);
+    }
+    subMesh.areaPerUv = uvArea > 1e-12 ? (float)(area / uvArea) : 0.0f;
+  }
+}
+
+size_t TriangleMesh::ReleaseCpuData()
+{
+  if (!HasCpuData() || vboId == 0)
+  {
+    return 0;
+  }
+  PROFILE_SCOPE("Release Mesh CPU Data");
+  MeshDumpHeader header;
+  std::memcpy(header.magic, kDumpMagic, 4);
+  header.version = kDumpVersion;
+  header.numVertices = (uint32_t)vertices.size();
+  header.numSubMeshes = (uint32_t)subMeshes.size();
+  header.numLightmapUVs = (uint32_t)lightmapUVs.size();
+  header.numSourceVertices = (uint32_t)lightmapSourceVertices.size();
+
+  std::vector<char> data((const char *)&header,
+                         (const char *)&header + sizeof(header));
+  AppendBytes(data, vertices);
+  for (const SubMesh &subMesh : subMeshes)
+  {
+    const uint32_t count = (uint32_t)subMesh.vertexIndices.size();
+    const char *bytes = (const char *)&count;
+    data.insert(data.end(), bytes, bytes + sizeof(count));
+    AppendBytes(data, subMesh.vertexIndices);
+  }
+  AppendBytes(data, lightmapUVs);
+  AppendBytes(data, lightmapSourceVertices);
+
+  // Keyed by content: a dump left by an earlier run is reused as is.
+  const uint64_t key = FileCache::Hash(data.data(), data.size());
+  const std::string path = FileCache::GetCachePath(
+      objFilePath.empty() ? "mesh" : objFilePath, key, ".meshdump");
+  std::error_code error;
+  if (std::filesystem::file_size(path, error) != data.size() &&
+      !FileCache::WriteFile(path, data.data(), data.size()))
+  {
+    return 0;
+  }
+
+  const size_t freed = data.size() - sizeof(header) -
+                       subMeshes.size() * sizeof(uint32_t);
+  FreeVector(vertices);
+  for (SubMesh &subMesh : subMeshes)
+  {
+    FreeVector(subMesh.vertexIndices);
+  }
+  FreeVector(lightmapUVs);
+  FreeVector(lightmapSourceVertices);
+  cpuDataPath = path;
+  reportMemory();
+  return freed;
+}
+
+bool TriangleMesh::RestoreCpuData()
+{
+  if (HasCpuData())
+  {
+    return true;
+  }
+  PROFILE_SCOPE("Restore Mesh CPU Data");
+  std::vector<char> data;
+  MeshDumpHeader header;
+  bool ok = FileCache::ReadFile(cpuDataPath, data) &&
+            data.size() >= sizeof(header);
+  if (ok)
+  {
+    std::memcpy(&header, data.data(), sizeof(header));
+    ok = std::memcmp(header.magic, kDumpMagic, 4) == 0 &&
+         header.version == kDumpVersion &&
+         header.numSubMeshes == subMeshes.size();
+  }
+  size_t offset = sizeof(header);
+  ok = ok && ReadBytes(data, offset, header.numVertices, vertices);
+  for (size_t s = 0; ok && s < subMeshes.size(); s++)
+  {
+    std::vector<uint32_t> count;
+    ok = ReadBytes(data, offset, 1, count) &&
+         ReadBytes(data, offset, count[0], subMeshes[s].vertexIndices);
+  }
+  ok = ok && ReadBytes(data, offset, header.numLightmapUVs, lightmapUVs) &&
+       ReadBytes(data, offset, header.numSourceVertices,
+                 lightmapSourceVertices);
+  if (!ok)
+  {
+    std::cerr << "[ERROR] Failed to restore mesh data from " << cpuDataPath
+              << std::endl;
+    return false;
+  }
+  cpuDataPath.clear();
+  reportMemory();
+  return true;
+}
+
+void TriangleMesh::reportMemory()
+{
+  const long long cpuBytes =
+      (long long)(GetGeometryBytes() + lightmapUVs.size() * sizeof(glm::vec2) +
+                  lightmapSourceVertices.size() * sizeof(unsigned int));
+  // The GL buffers keep their sizes after the CPU copies are released.
+  long long gpuBytes = 0;
+  if (vboId != 0)
+  {
+    gpuBytes = (long long)numVertices * (sizeof(VertexPTN) + sizeof(glm::vec3));
+    if (lightmapVboId != 0)
+    {
+      gpuBytes += (long long)numVertices * sizeof(glm::vec2);
+    }
+    for (const SubMesh &subMesh : subMeshes)
+    {
+      gpuBytes += (long long)subMesh.indexCount * sizeof(unsigned int);
+    }
+  }
+  MemoryTracker::Get().Update(this, MemoryTag::Mesh,
+                              objFilePath.empty() ? "mesh" : objFilePath,
+                              cpuBytes, gpuBytes);
 }
 
 void TriangleMesh::bindBuffer() { glBindBuffer(GL_ARRAY_BUFFER, vboId); }
 
-void TriangleMesh::draw(PhongShadingDemoShaderProg *shader)
+void TriangleMesh::bindDrawBuffers()
 {
+  if (lightmapVboId != 0)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, lightmapVboId);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), 0);
+  }
   bindBuffer();
-  // 遍歷所有子網格並繪製
-  for (auto &subMesh : subMeshes)
+}
+
+void TriangleMesh::unbindDrawBuffers()
+{
+  if (lightmapVboId != 0)
   {
-    if (subMesh.material)
-    {
-      // 設定材質屬性
-      glUniform3fv(shader->GetLocKa(), 1,
-                   glm::value_ptr(subMesh.material->GetKa()));
-      glUniform3fv(shader->GetLocKd(), 1,
-                   glm::value_ptr(subMesh.material->GetKd()));
-      glUniform3fv(shader->GetLocKs(), 1,
-                   glm::value_ptr(subMesh.material->GetKs()));
-      glUniform1f(shader->GetLocNs(), subMesh.material->GetNs());
-
-      // 綁定貼圖（如果有的話）
-      if (subMesh.material->GetMapKd())
-      {
-        glActiveTexture(GL_TEXTURE0);
-        subMesh.material->GetMapKd()->Bind(GL_TEXTURE0);
-        glUniform1i(shader->GetLocMapKd(), 0);
-        glUniform3fv(shader->GetLocKd(), 1, glm::value_ptr(glm::vec3(0.0f)));
-      }
-      else
-      {
-        // 如果沒有貼圖，設定為0
-        glUniform1i(shader->GetLocMapKd(), 0);
+    glDisableVertexAttribArray(3);
+  }
+}
 
-        // 如果沒有貼圖，使用 Kd 作為顏色
-        glUniform3fv(shader->GetLocKd(), 1,
-                     glm::value_ptr(subMesh.material->GetKd()));
-      }
+void TriangleMesh::bindMaterial(PhongShadingDemoShaderProg *shader,
+                                const SubMesh &subMesh)
+{
+  if (!subMesh.material)
+  {
+    return;
+  }
+  // 設定材質屬性
+  glUniform3fv(shader->GetLocKa(), 1,
+               glm::value_ptr(subMesh.material->GetKa()));
+  glUniform3fv(shader->GetLocKd(), 1,
+               glm::value_ptr(subMesh.material->GetKd()));
+  glUniform3fv(shader->GetLocKs(), 1,
+               glm::value_ptr(subMesh.material->GetKs()));
+  glUniform1f(shader->GetLocNs(), subMesh.material->GetNs());
+
+  // 綁定貼圖（如果有的話）
+  if (subMesh.material->GetMapKd())
+  {
+    glActiveTexture(GL_TEXTURE0);
+    subMesh.material->GetMapKd()->Bind(GL_TEXTURE0);
+    glUniform1i(shader->GetLocMapKd(), 0);
+    glUniform3fv(shader->GetLocKd(), 1, glm::value_ptr(glm::vec3(0.0f)));
+  }
+  else
+  {
+    // 如果沒有貼圖，設定為0
+    glUniform1i(shader->GetLocMapKd(), 0);
 
-      if (subMesh.material->GetMapKs())
-      {
-        glActiveTexture(GL_TEXTURE1);
-        subMesh.material->GetMapKs()->Bind(GL_TEXTURE1);
-        glUniform1i(shader->GetLocMapKs(), 1);
-        glUniform3fv(shader->GetLocKs(), 1, glm::value_ptr(glm::vec3(1.0f)));
-      }
-      else
-      {
-        glUniform1i(shader->GetLocMapKs(), 0);
-        glUniform3fv(shader->GetLocKs(), 1,
-                     glm::value_ptr(subMesh.material->GetKs()));
-      }
-    }
+    // 如果沒有貼圖，使用 Kd 作為顏色
+    glUniform3fv(shader->GetLocKd(), 1,
+                 glm::value_ptr(subMesh.material->GetKd()));
+  }
 
+  if (subMesh.material->GetMapKs())
+  {
+    glActiveTexture(GL_TEXTURE1);
+    subMesh.material->GetMapKs()->Bind(GL_TEXTURE1);
+    glUniform1i(shader->GetLocMapKs(), 1);
+    glUniform3fv(shader->GetLocKs(), 1, glm::value_ptr(glm::vec3(1.0f)));
+  }
+  else
+  {
+    glUniform1i(shader->GetLocMapKs(), 0);
+    glUniform3fv(shader->GetLocKs(), 1,
+                 glm::value_ptr(subMesh.material->GetKs()));
+  }
+}
+
+void TriangleMesh::draw(PhongShadingDemoShaderProg *shader)
+{
+  draw([shader](const SubMesh &) { return shader; });
+}
+
+void TriangleMesh::draw(const ShaderSelector &select)
+{
+  bindDrawBuffers();
+  // 遍歷所有子網格並繪製
+  for (auto &subMesh : subMeshes)
+  {
+    bindMaterial(select(subMesh), subMesh);
     // 繪製子網格
     subMesh.draw();
   }
+  unbindDrawBuffers();
+}
+
+void TriangleMesh::drawInstanced(PhongShadingDemoShaderProg *shader,
+                                 const GLsizei instanceCount)
+{
+  drawInstanced([shader](const SubMesh &) { return shader; },
+                instanceCount);
+}
+
+void TriangleMesh::drawInstanced(const ShaderSelector &select,
+                                 const GLsizei instanceCount)
+{
+  bindDrawBuffers();
+  for (auto &subMesh : subMeshes)
+  {
+    bindMaterial(select(subMesh), subMesh);
+    subMesh.drawInstanced(instanceCount);
+  }
+  unbindDrawBuffers();
+}
+
+void TriangleMesh::drawDepth()
+{
+  glBindBuffer(GL_ARRAY_BUFFER, posVboId);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+  for (auto &subMesh : subMeshes)
+  {
+    subMesh.drawDepth();
+  }
+  glDisableVertexAttribArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 // Show model information.
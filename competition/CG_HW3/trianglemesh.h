@@ -74,11 +74,57 @@ struct SubMesh
   {
     material = nullptr;
     iboId = 0;
+    indexCount = 0;
+    areaPerUv = 0.0f;
   }
 
   ~SubMesh() { vertexIndices.clear(); }
 
   void draw()
+  {
+    enableAttributes();
+    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    disableAttributes();
+  }
+
+  // Draw instanceCount copies; the caller sets up the per-instance
+  // attributes.
+  void drawInstanced(const GLsizei instanceCount)
+  {
+    enableAttributes();
+    glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0,
+                            instanceCount);
+    disableAttributes();
+  }
+
+  // Draw with whatever position-only attribute setup the caller made.
+  void drawDepth()
+  {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+  }
+
+  void createBuffer()
+  {
+    glGenBuffers(1, &iboId);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 vertexIndices.size() * sizeof(unsigned int),
+                 vertexIndices.data(), GL_STATIC_DRAW);
+    indexCount = (GLsizei)vertexIndices.size();
+  }
+  PhongMaterial *material;
+  GLuint iboId;
+  // Size of the index buffer, which outlives vertexIndices in GPU-resident
+  // mode.
+  GLsizei indexCount;
+  // Object-space surface area per unit of UV area, 0 without a usable
+  // mapping. Set by TriangleMesh::createBuffer.
+  float areaPerUv;
+  std::vector<unsigned int> vertexIndices;
+
+private:
+  void enableAttributes()
   {
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
@@ -91,27 +137,38 @@ struct SubMesh
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertexPTN),
                           (void *)offsetof(VertexPTN, texcoord));
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
+  }
 
-    glDrawElements(GL_TRIANGLES, (GLsizei)vertexIndices.size(), GL_UNSIGNED_INT,
-                   0);
-
+  void disableAttributes()
+  {
     glDisableVertexAttribArray(0);
     glDisableVertexAttribArray(1);
     glDisableVertexAttribArray(2);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   }
+};
 
-  void createBuffer()
+// Wall-clock time of each phase of the last LoadFromFile (OBJ only) and
+// createBuffer call, in milliseconds.
+struct MeshLoadStats
+{
+  MeshLoadStats()
   {
-    glGenBuffers(1, &iboId);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboId);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 vertexIndices.size() * sizeof(unsigned int),
-                 vertexIndices.data(), GL_STATIC_DRAW);
+    splitMs = parseMs = dedupMs = normalizeMs = bufferMs = totalMs = 0.0;
   }
-  PhongMaterial *material;
-  GLuint iboId;
-  std::vector<unsigned int> vertexIndices;
+  // Reading lines and splitting them into tokens.
+  double splitMs;
+  // Number conversion and face assembly. Includes split and dedup unless
+  // detailed timing is on.
+  double parseMs;
+  // Vertex deduplication through the hash map.
+  double dedupMs;
+  // Bounding box, normalization and centering.
+  double normalizeMs;
+  // Packing the vertex streams and uploading them.
+  double bufferMs;
+  // The whole LoadFromFile call.
+  double totalMs;
 };
 
 // TriangleMesh Declarations.
@@ -135,15 +192,78 @@ public:
   void createBuffer();
   void bindBuffer();
 
+  // Picks the program of each submesh, e.g. a shader variant (see
+  // PhongVariants). It binds the program if it changed and returns it.
+  typedef std::function<PhongShadingDemoShaderProg *(const SubMesh &)>
+      ShaderSelector;
+
   void draw(PhongShadingDemoShaderProg *shader);
+  void draw(const ShaderSelector &select);
+  // Draw instanceCount copies of every submesh, one call each. The caller
+  // sets up the per-instance attributes (see InstanceBatcher).
+  void drawInstanced(PhongShadingDemoShaderProg *shader,
+                     const GLsizei instanceCount);
+  void drawInstanced(const ShaderSelector &select,
+                     const GLsizei instanceCount);
+  // Draw positions only, e.g. for shadow maps. No material is bound.
+  void drawDepth();
+  // Material uniforms and textures of one submesh.
+  void bindMaterial(PhongShadingDemoShaderProg *shader,
+                    const SubMesh &subMesh);
+
+  // GL buffers of the vertex streams, 0 before createBuffer: the VertexPTN
+  // stream, the packed positions and the lightmap UVs (0 without a
+  // lightmap layout). They are recreated when the layout changes.
+  GLuint GetVertexBuffer() const { return vboId; }
+  GLuint GetPositionBuffer() const { return posVboId; }
+  GLuint GetLightmapBuffer() const { return lightmapVboId; }
 
   int GetNumVertices() const { return numVertices; }
   int GetNumTriangles() const { return numTriangles; }
   int GetNumSubMeshes() const { return (int)subMeshes.size(); }
 
+  // CPU bytes of the vertex stream and the index lists.
+  size_t GetGeometryBytes() const;
+
   glm::vec3 GetObjCenter() const { return objCenter; }
   glm::vec3 GetObjExtent() const { return objExtent; }
 
+  // Per-line split and per-vertex dedup timing needs two clock reads per
+  // item, which is noticeable on big files, so it is off by default.
+  void SetDetailedLoadTiming(const bool enabled) { detailedLoadTiming = enabled; }
+  const MeshLoadStats &GetLoadStats() const { return loadStats; }
+
+  // Position-only copy of the vertex stream used by the depth passes.
+  std::vector<glm::vec3> BuildPositionStream() const;
+  const std::vector<VertexPTN> &GetVertices() const { return vertices; }
+
+  // Object-space BVH over all submeshes, built on first use.
+  const MeshBVH *GetBVH();
+
+  // Replaces the vertex stream with one split along lightmap charts: vertex
+  // i copies vertex sourceVertices[i] and gets lightmapUVs[i]. The submesh
+  // index lists must keep their triangle order, so the BVH stays valid. GL
+  // buffers are recreated if they exist.
+  void SetLightmapLayout(
+      const std::vector<unsigned int> &sourceVertices,
+      const std::vector<glm::vec2> &lightmapUVs,
+      const std::vector<std::vector<unsigned int>> &subMeshIndices);
+  // GPU-resident mode: once the buffers exist, the vertex stream, the index
+  // lists and the lightmap layout can leave RAM. They are dumped to a cache
+  // file first, which RestoreCpuData reads back; GetBVH does so on its own
+  // when it needs them. Returns the bytes freed.
+  size_t ReleaseCpuData();
+  bool RestoreCpuData();
+  bool HasCpuData() const { return cpuDataPath.empty(); }
+
+  bool HasLightmapUVs() const { return !lightmapUVs.empty(); }
+  const std::vector<glm::vec2> &GetLightmapUVs() const { return lightmapUVs; }
+  // Vertex of the loaded file each vertex was copied from.
+  const std::vector<unsigned int> &GetLightmapSourceVertices() const
+  {
+    return lightmapSourceVertices;
+  }
+
 private:
   VertexPTN parseVertex(const std::string &vertexData,
                         const std::vector<glm::vec3> &points,
@@ -160,6 +280,14 @@ private:
                  std::vector<glm::vec3> &normals,
                  std::vector<std::string> parts);
   void processMaterialLib(const std::string &mtlFile);
+  // Center, extent and vertex count of the vertices as they are.
+  void computeBounds();
+  void computeAreaPerUv();
+  // Current sizes to the MemoryTracker.
+  void reportMemory();
+  // Vertex streams shared by draw and drawInstanced.
+  void bindDrawBuffers();
+  void unbindDrawBuffers();
 
   // 處理材質屬性
   void processMateriakProperty(const std::string &cmd,
@@ -187,6 +315,8 @@ private:
 
   // TriangleMesh Private Data.
   GLuint vboId;
+  // Tightly packed positions for depth-only passes.
+  GLuint posVboId;
 
   std::vector<VertexPTN> vertices;
   // For supporting multiple materials per object, move to SubMesh.
@@ -206,6 +336,19 @@ private:
   glm::vec3 objCenter;
   glm::vec3 objExtent;
 
+  bool detailedLoadTiming;
+  MeshLoadStats loadStats;
+
+  MeshBVH *bvh;
+
+  // Second UV set (attribute 3), empty until a lightmap layout is set.
+  GLuint lightmapVboId;
+  std::vector<glm::vec2> lightmapUVs;
+  std::vector<unsigned int> lightmapSourceVertices;
+
+  // Dump of the released CPU data, empty while it is in RAM.
+  std::string cpuDataPath;
+
   friend class FbxSdkLoader;
   friend class AssimpLoader;
 };
@@ -0,0 +1,612 @@
+#include "visibility_buffer.h"
+
+#include <map>
+
+#include "camera.h"
+#include "deferred_renderer.h"
+#include "json_writer.h"
+#include "lightmap.h"
+#include "memory_tracker.h"
+#include "profiler.h"
+#include "scene.h"
+#include "shaderprog.h"
+#include "shadow_atlas.h"
+#include "trianglemesh.h"
+
+// Texels of one object in the object table: the world matrix, then the
+// normal matrix, a column each.
+static const int kObjectTexels = 7;
+
+VisibilityBuffer::VisibilityBuffer() {}
+
+VisibilityBuffer::~VisibilityBuffer() {
+  ReleaseTargets();
+  ReleaseGeometry();
+  if (bufferTextures[0] != 0) {
+    glDeleteTextures(kNumBuffers, bufferTextures);
+    glDeleteBuffers(kNumBuffers, buffers);
+  }
+  MemoryTracker::Get().Remove(this);
+}
+
+void VisibilityBuffer::ReleaseTargets() {
+  if (fboId != 0) {
+    glDeleteFramebuffers(1, &fboId);
+    glDeleteTextures(1, &visibilityTexture);
+    glDeleteTextures(1, &depthTexture);
+    fboId = 0;
+  }
+  stats.width = 0;
+  stats.height = 0;
+  stats.targetBytes = 0;
+}
+
+void VisibilityBuffer::ReleaseGeometry() {
+  meshes.clear();
+  meshBuffers.clear();
+  ranges.clear();
+  mergedBytes = 0;
+  stats.meshes = 0;
+}
+
+void VisibilityBuffer::ReportMemory() {
+  stats.geometryBytes = mergedBytes;
+  for (const Buffer buffer : {Draws, Objects}) {
+    GLint bytes = 0;
+    if (buffers[buffer] != 0) {
+      glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+      glGetBufferParameteriv(GL_TEXTURE_BUFFER, GL_BUFFER_SIZE, &bytes);
+    }
+    stats.geometryBytes += bytes;
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  MemoryTracker::Get().Update(this, MemoryTag::Mesh, "visibility buffer", 0,
+                              stats.geometryBytes + stats.targetBytes);
+}
+
+void VisibilityBuffer::Resize(const int width, const int height) {
+  ReleaseTargets();
+  glGenTextures(1, &visibilityTexture);
+  glGenTextures(1, &depthTexture);
+  glGenFramebuffers(1, &fboId);
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+  glBindTexture(GL_TEXTURE_2D, visibilityTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, width, height, 0,
+               GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         visibilityTexture, 0);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0,
+               GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         depthTexture, 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "[ERROR] Visibility framebuffer is incomplete" << std::endl;
+  }
+
+  stats.width = width;
+  stats.height = height;
+  // RG32UI and 24-bit depth padded to 32.
+  stats.targetBytes = (long long)width * height * (8 + 4);
+  ReportMemory();
+}
+
+void VisibilityBuffer::Allocate(const Buffer buffer, const GLsizeiptr bytes,
+                                const void *data) {
+  if (bufferTextures[0] == 0) {
+    glGenBuffers(kNumBuffers, buffers);
+    glGenTextures(kNumBuffers, bufferTextures);
+  }
+  const GLenum formats[kNumBuffers] = {GL_RGBA32F, GL_R32UI, GL_RG32F,
+                                       GL_RGBA32I, GL_RGBA32F};
+  glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+  // A zero-sized store cannot back a texture.
+  glBufferData(GL_TEXTURE_BUFFER, std::max<GLsizeiptr>(bytes, 16), nullptr,
+               buffer >= Draws ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+  if (data != nullptr && bytes > 0) {
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+  }
+  glBindTexture(GL_TEXTURE_BUFFER, bufferTextures[buffer]);
+  glTexBuffer(GL_TEXTURE_BUFFER, formats[buffer], buffers[buffer]);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+bool VisibilityBuffer::MeshesChanged() const {
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    const glm::uvec2 current(meshes[m]->GetVertexBuffer(),
+                             meshes[m]->GetLightmapBuffer());
+    if (current != meshBuffers[m]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool VisibilityBuffer::BuildGeometry() {
+  PROFILE_SCOPE("Visibility Geometry");
+  // Sizes come from the GL buffers, as GPU-resident meshes have no CPU
+  // copy.
+  std::vector<GLint> vertexBytes(meshes.size(), 0);
+  long long numVertices = 0;
+  long long numIndices = 0;
+  ranges.clear();
+  meshBuffers.clear();
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    TriangleMesh *mesh = meshes[m];
+    glBindBuffer(GL_COPY_READ_BUFFER, mesh->GetVertexBuffer());
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE,
+                           &vertexBytes[m]);
+    MeshRange &range = ranges[mesh];
+    range.baseVertex = (int)numVertices;
+    for (const SubMesh &subMesh : mesh->getSubMeshes()) {
+      range.firstIndices.push_back((int)numIndices);
+      numIndices += subMesh.indexCount;
+    }
+    numVertices += vertexBytes[m] / (GLint)sizeof(VertexPTN);
+    meshBuffers.push_back(
+        glm::uvec2(mesh->GetVertexBuffer(), mesh->GetLightmapBuffer()));
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  if (2 * numVertices > maxTexels || numIndices > maxTexels) {
+    std::cerr << "[ERROR] Visibility buffer: " << numVertices
+              << " vertices and " << numIndices
+              << " indices exceed the buffer texture limit of " << maxTexels
+              << " texels" << std::endl;
+    return false;
+  }
+
+  // Meshes without a lightmap layout keep zero uvs.
+  Allocate(Vertices, numVertices * sizeof(VertexPTN), nullptr);
+  Allocate(Indices, numIndices * sizeof(GLuint), nullptr);
+  const std::vector<glm::vec2> zeros(numVertices, glm::vec2(0.0f));
+  Allocate(LightmapUVs, numVertices * sizeof(glm::vec2), zeros.data());
+  auto copy = [](const GLuint source, const GLuint target,
+                 const long long offset, const GLint bytes) {
+    GLint size = 0;
+    glBindBuffer(GL_COPY_READ_BUFFER, source);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                        (GLintptr)offset, std::min(size, bytes));
+  };
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    TriangleMesh *mesh = meshes[m];
+    const MeshRange &range = ranges[mesh];
+    copy(mesh->GetVertexBuffer(), buffers[Vertices],
+         (long long)range.baseVertex * sizeof(VertexPTN), vertexBytes[m]);
+    const GLint uvBytes = vertexBytes[m] / (GLint)sizeof(VertexPTN) *
+                          (GLint)sizeof(glm::vec2);
+    if (mesh->GetLightmapBuffer() != 0) {
+      copy(mesh->GetLightmapBuffer(), buffers[LightmapUVs],
+           (long long)range.baseVertex * sizeof(glm::vec2), uvBytes);
+    }
+    std::vector<SubMesh> &subMeshes = mesh->getSubMeshes();
+    for (size_t s = 0; s < subMeshes.size(); ++s) {
+      copy(subMeshes[s].iboId, buffers[Indices],
+           (long long)range.firstIndices[s] * sizeof(GLuint),
+           subMeshes[s].indexCount * (GLint)sizeof(GLuint));
+    }
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  mergedBytes = numVertices * (sizeof(VertexPTN) + sizeof(glm::vec2)) +
+                numIndices * sizeof(GLuint);
+  stats.meshes = (int)meshes.size();
+  return true;
+}
+
+void VisibilityBuffer::Regroup(Scene *scene, const bool useLightmaps) {
+  PROFILE_SCOPE("Visibility Regroup");
+  const std::vector<SceneObject> &objects = scene->objects;
+  // Objects of each mesh, in the order the meshes first appear.
+  std::unordered_map<const TriangleMesh *, int> meshIndices;
+  std::vector<TriangleMesh *> sceneMeshes;
+  std::vector<std::vector<int>> meshObjects;
+  for (int i = 0; i < (int)objects.size(); ++i) {
+    TriangleMesh *mesh = objects[i].mesh;
+    auto it = meshIndices.find(mesh);
+    if (it == meshIndices.end()) {
+      it = meshIndices.emplace(mesh, (int)sceneMeshes.size()).first;
+      sceneMeshes.push_back(mesh);
+      meshObjects.emplace_back();
+    }
+    meshObjects[it->second].push_back(i);
+  }
+  if (sceneMeshes != meshes || MeshesChanged()) {
+    meshes = sceneMeshes;
+    ready = BuildGeometry();
+    if (!ready) {
+      ReleaseGeometry();
+      return;
+    }
+  }
+
+  std::map<std::pair<const PhongMaterial *, const Lightmap *>, int> keys;
+  std::vector<glm::ivec4> draws;
+  groups.clear();
+  materials.clear();
+  for (size_t m = 0; m < meshes.size(); ++m) {
+    TriangleMesh *mesh = meshes[m];
+    const MeshRange &range = ranges[mesh];
+    std::vector<SubMesh> &subMeshes = mesh->getSubMeshes();
+    for (int s = 0; s < (int)subMeshes.size(); ++s) {
+      const std::vector<int> &groupObjects = meshObjects[m];
+      groups.push_back(
+          {mesh, s, (int)draws.size(), (int)groupObjects.size()});
+      for (const int object : groupObjects) {
+        Lightmap *lightmap =
+            useLightmaps ? objects[object].lightmap : nullptr;
+        auto key = keys.emplace(
+            std::make_pair(subMeshes[s].material, lightmap),
+            (int)materials.size());
+        if (key.second) {
+          materials.push_back({mesh, s, lightmap});
+        }
+        draws.push_back(glm::ivec4(object, range.firstIndices[s],
+                                   range.baseVertex, key.first->second));
+      }
+    }
+  }
+  Allocate(Draws, draws.size() * sizeof(glm::ivec4), draws.data());
+
+  stats.draws = (int)draws.size();
+  stats.materials = std::min((int)materials.size(), kMaxMaterials);
+  stats.droppedMaterials = (int)materials.size() - stats.materials;
+  if (stats.droppedMaterials > 0) {
+    std::cerr << "[ERROR] Visibility buffer: " << materials.size()
+              << " materials, only " << kMaxMaterials << " are shaded"
+              << std::endl;
+  }
+  ready = draws.size() <= (size_t)maxTexels;
+}
+
+void VisibilityBuffer::UploadObjects(const Scene *scene) {
+  const TransformStore &transforms = scene->transforms;
+  const int numObjects = (int)scene->objects.size();
+  std::vector<glm::vec4> texels((size_t)numObjects * kObjectTexels);
+  for (int i = 0; i < numObjects; ++i) {
+    glm::vec4 *object = &texels[(size_t)i * kObjectTexels];
+    const glm::mat4x4 &world = transforms.GetWorld(i);
+    const glm::mat3x3 &normal = transforms.GetNormal(i);
+    for (int c = 0; c < 4; ++c) {
+      object[c] = world[c];
+    }
+    for (int c = 0; c < 3; ++c) {
+      object[4 + c] = glm::vec4(normal[c], 0.0f);
+    }
+  }
+  Allocate(Objects, texels.size() * sizeof(glm::vec4), texels.data());
+}
+
+bool VisibilityBuffer::Update(Scene *scene, const bool useLightmaps) {
+  if (maxTexels == 0) {
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+  }
+  const size_t numObjects = scene->objects.size();
+  const bool regroup = dirty || numObjects != lastNumObjects ||
+                       useLightmaps != lastUseLightmaps || MeshesChanged();
+  const bool moved =
+      regroup || scene->transforms.GetVersion() != lastTransformVersion;
+  if (regroup) {
+    Regroup(scene, useLightmaps);
+  }
+  if (moved && ready) {
+    if ((long long)numObjects * kObjectTexels > maxTexels) {
+      std::cerr << "[ERROR] Visibility buffer: " << numObjects
+                << " objects exceed the buffer texture limit" << std::endl;
+      ready = false;
+    } else {
+      UploadObjects(scene);
+    }
+  }
+  dirty = false;
+  lastNumObjects = numObjects;
+  lastTransformVersion = scene->transforms.GetVersion();
+  lastUseLightmaps = useLightmaps;
+  if (moved) {
+    ReportMemory();
+  }
+  return ready;
+}
+
+void VisibilityBuffer::DrawVisibility(VisibilityShaderProg *shader,
+                                      const Camera *camera) {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFbo);
+  if (fboId == 0 || viewport[2] != stats.width ||
+      viewport[3] != stats.height) {
+    Resize(viewport[2], viewport[3]);
+  }
+  visibilityTimer.Begin();
+  glBindFramebuffer(GL_FRAMEBUFFER, fboId);
+  const GLuint background[4] = {0, 0, 0, 0};
+  glClearBufferuiv(GL_COLOR, 0, background);
+  glClear(GL_DEPTH_BUFFER_BIT);
+
+  shader->Bind();
+  glUniformMatrix4fv(
+      shader->GetLocViewProj(), 1, GL_FALSE,
+      glm::value_ptr(camera->GetProjMatrix() * camera->GetViewMatrix()));
+  glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit + Draws);
+  glBindTexture(GL_TEXTURE_BUFFER, bufferTextures[Draws]);
+  glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit + Objects);
+  glBindTexture(GL_TEXTURE_BUFFER, bufferTextures[Objects]);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(shader->GetLocDraws(), kFirstTextureUnit + Draws);
+  glUniform1i(shader->GetLocObjects(), kFirstTextureUnit + Objects);
+
+  // The groups of a mesh are consecutive, so its positions are bound once.
+  glEnableVertexAttribArray(0);
+  const TriangleMesh *boundMesh = nullptr;
+  stats.drawCalls = 0;
+  for (const Group &group : groups) {
+    if (group.mesh != boundMesh) {
+      glBindBuffer(GL_ARRAY_BUFFER, group.mesh->GetPositionBuffer());
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+      boundMesh = group.mesh;
+    }
+    const SubMesh &subMesh = group.mesh->getSubMeshes()[group.subMesh];
+    glUniform1i(shader->GetLocDrawBase(), group.firstDraw);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subMesh.iboId);
+    glDrawElementsInstanced(GL_TRIANGLES, subMesh.indexCount,
+                            GL_UNSIGNED_INT, 0, group.count);
+    stats.drawCalls++;
+  }
+  glDisableVertexAttribArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  shader->UnBind();
+
+  visibilityTimer.End();
+  glBindFramebuffer(GL_FRAMEBUFFER, prevFbo);
+}
+
+void VisibilityBuffer::Resolve(VisibilityResolveShaderProg *shader,
+                               VisibilityDepthShaderProg *depthShader,
+                               const Camera *camera, const bool probesReady,
+                               const int lightmapTextureUnit) {
+  resolveTimer.Begin();
+  glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit);
+  glBindTexture(GL_TEXTURE_2D, visibilityTexture);
+  glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit + 1);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  for (int buffer = Vertices; buffer < kNumBuffers; ++buffer) {
+    glActiveTexture(GL_TEXTURE0 + kFirstTextureUnit + 2 + buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, bufferTextures[buffer]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  auto unitOf = [](const Buffer buffer) {
+    return kFirstTextureUnit + 2 + buffer;
+  };
+
+  // The material of every covered pixel, as depth.
+  depthShader->Bind();
+  glUniform1i(depthShader->GetLocVisibility(), kFirstTextureUnit);
+  glUniform1i(depthShader->GetLocSceneDepth(), kFirstTextureUnit + 1);
+  glUniform1i(depthShader->GetLocDraws(), unitOf(Draws));
+  glUniform1i(depthShader->GetLocWriteSceneDepth(), 0);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthFunc(GL_ALWAYS);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+  // One pass per material; the depth test keeps it to its own pixels.
+  shader->Bind();
+  glUniform1i(shader->GetLocVisibility(), kFirstTextureUnit);
+  glUniform1i(shader->GetLocVertices(), unitOf(Vertices));
+  glUniform1i(shader->GetLocIndices(), unitOf(Indices));
+  glUniform1i(shader->GetLocLightmapUVs(), unitOf(LightmapUVs));
+  glUniform1i(shader->GetLocDraws(), unitOf(Draws));
+  glUniform1i(shader->GetLocObjects(), unitOf(Objects));
+  glUniformMatrix4fv(shader->GetLocInvProj(), 1, GL_FALSE,
+                     glm::value_ptr(glm::inverse(camera->GetProjMatrix())));
+  glDepthFunc(GL_EQUAL);
+  glDepthMask(GL_FALSE);
+  for (int k = 0; k < stats.materials; ++k) {
+    const Material &material = materials[k];
+    glUniform1i(shader->GetLocResolveMaterial(), k);
+    material.mesh->bindMaterial(
+        shader, material.mesh->getSubMeshes()[material.subMesh]);
+    // Static lights come from the lightmap, like on the forward path.
+    glUniform1i(shader->GetLocUseLightmap(), material.lightmap != nullptr);
+    glUniform1i(shader->GetLocUseProbes(),
+                probesReady && material.lightmap == nullptr);
+    if (material.lightmap != nullptr) {
+      if (!material.lightmap->IsUploaded()) {
+        material.lightmap->Upload();
+      }
+      material.lightmap->Bind(GL_TEXTURE0 + lightmapTextureUnit);
+    }
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+  }
+  glDepthMask(GL_TRUE);
+
+  // The scene depth, for the skybox and the transparent objects.
+  depthShader->Bind();
+  glUniform1i(depthShader->GetLocWriteSceneDepth(), 1);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthFunc(GL_ALWAYS);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthFunc(GL_LESS);
+  depthShader->UnBind();
+  resolveTimer.End();
+
+  stats.visibilityGpuMs = visibilityTimer.GetElapsedMs();
+  stats.resolveGpuMs = resolveTimer.GetElapsedMs();
+}
+
+void VisibilityBuffer::WriteJson(JsonWriter &json) const {
+  json.BeginObject();
+  json.Field("enabled", enabled);
+  json.Field("width", stats.width);
+  json.Field("height", stats.height);
+  json.Field("targetBytes", stats.targetBytes);
+  json.Field("geometryBytes", stats.geometryBytes);
+  json.Field("meshes", stats.meshes);
+  json.Field("draws", stats.draws);
+  json.Field("drawCalls", stats.drawCalls);
+  json.Field("materials", stats.materials);
+  json.Field("droppedMaterials", stats.droppedMaterials);
+  json.Field("visibilityGpuMs", stats.visibilityGpuMs);
+  json.Field("resolveGpuMs", stats.resolveGpuMs);
+  json.EndObject();
+}
+
+void VisibilityBuffer::DrawDebugPanel() {
+  ImGui::Begin("Visibility Buffer");
+  ImGui::Checkbox("Visibility buffer opaque pass", &enabled);
+  ImGui::TextDisabled("One sample per pixel: no MSAA on opaque objects");
+  if (enabled && !ready) {
+    ImGui::TextDisabled("Scene does not fit; drawn forward");
+  }
+  if (enabled && stats.width > 0) {
+    ImGui::Text("Target %dx%d, %.2f MB; geometry copy %.2f MB", stats.width,
+                stats.height, stats.targetBytes / (1024.0 * 1024.0),
+                stats.geometryBytes / (1024.0 * 1024.0));
+    ImGui::Text("%d meshes, %d draws in %d calls", stats.meshes, stats.draws,
+                stats.drawCalls);
+    ImGui::Text("%d material passes", stats.materials);
+    if (stats.droppedMaterials > 0) {
+      ImGui::Text("%d materials over the limit are not shaded",
+                  stats.droppedMaterials);
+    }
+    ImGui::Text("GPU: visibility %.3f ms, resolve %.3f ms",
+                stats.visibilityGpuMs, stats.resolveGpuMs);
+  }
+  ImGui::End();
+}
+
+// Spawns a slab of layers solid layers of cubes above the scene, the lowest
+// first, and returns a still camera looking down into it, empty if the
+// cubes could not be spawned. With the draws in spawn order, every layer
+// passes the depth test over the one below, so a forward frame shades each
+// pixel about layers times.
+static CameraPath SpawnOverdrawLayers(
+    const int layers, const Scene *scene, const glm::mat4x4 &rootTransform,
+    const VisibilityBuffer::CubeSpawner &spawnCubes) {
+  const int side = 32;
+  const float cubeSize = 0.5f;
+  glm::vec3 bmin, bmax;
+  scene->GetBounds(bmin, bmax);
+  const float halfSize = 0.5f * (float)side * cubeSize;
+  const glm::vec3 base(0.5f * (bmin.x + bmax.x), bmax.y + cubeSize,
+                       0.5f * (bmin.z + bmax.z));
+  std::vector<glm::mat4x4> worldMatrices;
+  worldMatrices.reserve((size_t)layers * side * side);
+  for (int layer = 0; layer < layers; ++layer) {
+    for (int i = 0; i < side * side; ++i) {
+      const glm::vec3 position =
+          base + glm::vec3(((float)(i % side) + 0.5f) * cubeSize - halfSize,
+                           (float)layer * cubeSize,
+                           ((float)(i / side) + 0.5f) * cubeSize - halfSize);
+      worldMatrices.push_back(
+          glm::scale(glm::translate(glm::mat4x4(1.0f), position),
+                     glm::vec3(cubeSize)));
+    }
+  }
+  CameraPath path;
+  const glm::vec3 top = base + glm::vec3(0.0f, layers * cubeSize, 0.0f);
+  if (!spawnCubes(worldMatrices,
+                  base - glm::vec3(halfSize, cubeSize, halfSize),
+                  top + glm::vec3(halfSize, cubeSize, halfSize))) {
+    return path;
+  }
+
+  // Obliquely from above, close enough that the top layer fills the view.
+  const float rootScale = glm::length(glm::vec3(rootTransform[0]));
+  const float halfFovy = glm::radians(0.5f * scene->camera->GetFovy());
+  const float distance = 0.25f * halfSize / std::tan(halfFovy) * rootScale;
+  const glm::vec3 target =
+      glm::vec3(rootTransform * glm::vec4(top, 1.0f));
+  const glm::vec3 position =
+      target + distance * glm::normalize(glm::vec3(0.0f, 0.8f, 0.6f));
+  path.AddKey(0.0f, position, target);
+  path.AddKey(1.0f, position, target);
+  return path;
+}
+
+int VisibilityBuffer::RunHeadlessBenchmark(
+    const HeadlessOptions &options, const std::string &contextApi,
+    Scene *scene, const glm::mat4x4 &rootTransform,
+    DeferredRenderer *deferredRenderer, ShadowAtlas *shadowAtlas,
+    const GpuFrameTimer &measure, const CubeSpawner &spawnCubes,
+    const std::function<void()> &removeCubes) {
+  const int layerCounts[] = {1, 2, 4, 8, 16};
+  const glm::ivec2 sizes[] = {{1280, 720}, {1920, 1080}};
+  std::ofstream file;
+  if (!OpenReport(options, file)) {
+    return 1;
+  }
+  const std::vector<PointLight *> scenePointLights = scene->pointLights;
+  const std::vector<SpotLight *> sceneSpotLights = scene->spotLights;
+
+  JsonWriter json(file);
+  json.BeginObject();
+  json.Field("scene", options.scenePath);
+  json.Field("contextApi", contextApi);
+  json.Field("renderer",
+             std::string((const char *)glGetString(GL_RENDERER)));
+  json.Field("frames", options.frames);
+  json.Field("warmupFrames", options.warmupFrames);
+  json.Field("shaderVariants", !options.render.noShaderVariants);
+  json.Key("runs");
+  json.BeginArray();
+  for (const int layers : layerCounts) {
+    const CameraPath path =
+        SpawnOverdrawLayers(layers, scene, rootTransform, spawnCubes);
+    if (path.IsEmpty()) {
+      break;
+    }
+    scene->pointLights.clear();
+    scene->spotLights.clear();
+    SetBenchmarkLights(scene, 4, 4);
+    shadowAtlas->MarkAllDirty();
+    for (const glm::ivec2 &size : sizes) {
+      deferredRenderer->SetEnabled(false);
+      SetEnabled(false);
+      double samplesPerPixel = 0.0;
+      const double forwardMs =
+          measure(path, size.x, size.y, &samplesPerPixel);
+      deferredRenderer->SetEnabled(true);
+      const double deferredMs = measure(path, size.x, size.y, nullptr);
+      deferredRenderer->SetEnabled(false);
+      SetEnabled(true);
+      const double visibilityMs = measure(path, size.x, size.y, nullptr);
+      json.BeginObject();
+      json.Field("layers", layers);
+      json.Field("width", size.x);
+      json.Field("height", size.y);
+      json.Field("objects", (int)scene->objects.size());
+      json.Field("forwardSamplesPerPixel", samplesPerPixel);
+      json.Field("forwardGpuMs", forwardMs);
+      json.Field("deferredGpuMs", deferredMs);
+      json.Field("visibilityGpuMs", visibilityMs);
+      json.Field("visibilityPassGpuMs", stats.visibilityGpuMs);
+      json.Field("resolveGpuMs", stats.resolveGpuMs);
+      json.Field("materials", stats.materials);
+      json.Field("drawCalls", stats.drawCalls);
+      json.EndObject();
+    }
+    DeleteBenchmarkLights(scene);
+    removeCubes();
+  }
+  json.EndArray();
+  json.EndObject();
+  file << std::endl;
+
+  scene->pointLights = scenePointLights;
+  scene->spotLights = sceneSpotLights;
+  shadowAtlas->MarkAllDirty();
+  deferredRenderer->SetEnabled(options.render.deferred);
+  SetEnabled(options.render.visibility);
+  return 0;
+}
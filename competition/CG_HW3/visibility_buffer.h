@@ -0,0 +1,190 @@
+#ifndef VISIBILITY_BUFFER_H
+#define VISIBILITY_BUFFER_H
+
+#include "gpu_timer.h"
+#include "headers.h"
+#include "headless.h"
+
+class Camera;
+class DeferredRenderer;
+class JsonWriter;
+class Lightmap;
+class PhongMaterial;
+class ShadowAtlas;
+class TriangleMesh;
+class VisibilityDepthShaderProg;
+class VisibilityResolveShaderProg;
+class VisibilityShaderProg;
+struct Scene;
+
+struct VisibilityStats {
+  int width = 0;
+  int height = 0;
+  // Visibility target and its depth.
+  long long targetBytes = 0;
+  // Merged vertices, indices and lightmap uvs, plus the draw and object
+  // tables.
+  long long geometryBytes = 0;
+  int meshes = 0;
+  // Submesh draws in the draw table, one per object and submesh.
+  int draws = 0;
+  // Instanced calls of the visibility pass.
+  int drawCalls = 0;
+  // Materials, one resolve pass each.
+  int materials = 0;
+  // Materials past kMaxMaterials, which are not shaded.
+  int droppedMaterials = 0;
+  double visibilityGpuMs = 0.0;
+  double resolveGpuMs = 0.0;
+};
+
+// VisibilityBuffer Declarations.
+// Visibility-buffer path of the opaque pass. The geometry pass only writes
+// the draw and the triangle of every pixel (RG32UI); nothing about the
+// material is touched while fragments are overdrawn. The resolve then
+// shades each pixel once: phong_shading_demo.fs built with
+// VISIBILITY_RESOLVE fetches the triangle's vertices from buffer textures,
+// intersects the camera ray with it for the barycentrics (and the rays of
+// the next pixels for the uv gradients) and runs the usual material and
+// light code.
+//
+// The meshes' vertex and index buffers are copied on the GPU into one
+// merged set, rebuilt when a mesh's buffers change. The draw table holds
+// (object, first index, base vertex, material) per object and submesh, in
+// groups of one submesh so the visibility pass draws a group with one
+// instanced call; the object table holds the world and normal matrices.
+//
+// Textures cannot be picked per pixel in GL 3.3, so the resolve runs one
+// fullscreen pass per material (PhongMaterial and lightmap). A pass writes
+// each pixel's material as depth first, and every material pass tests
+// GL_EQUAL against its own depth, so the depth test rejects the other
+// pixels before shading. The scene depth is written back at the end.
+//
+// The visibility target has one sample per pixel, so the opaque pass
+// loses MSAA.
+class VisibilityBuffer {
+ public:
+  // Adds one unit cube per world matrix, all inside the box; false if it
+  // cannot.
+  typedef std::function<bool(const std::vector<glm::mat4x4> &worldMatrices,
+                             const glm::vec3 &boundsMin,
+                             const glm::vec3 &boundsMax)>
+      CubeSpawner;
+
+  // VisibilityBuffer Public Methods.
+  VisibilityBuffer();
+  ~VisibilityBuffer();
+
+  // Regroups the draws if objects were added or removed, rebuilds the
+  // merged geometry if a mesh's buffers changed and uploads the object
+  // matrices if they moved. scene->transforms must be up to date. False if
+  // the scene does not fit the buffer textures; draw it forward then.
+  bool Update(Scene *scene, const bool useLightmaps);
+  // Forces a regroup, e.g. after lightmaps were assigned.
+  void MarkDirty() { dirty = true; }
+  // Fills the visibility target, sized to the current viewport, and
+  // rebinds the framebuffer it found bound.
+  void DrawVisibility(VisibilityShaderProg *shader, const Camera *camera);
+  // Shades the visibility target into the bound framebuffer and writes its
+  // depth. shader is bound with the uniforms of the forward shader
+  // uploaded (the lights, switches and shadows); the material, lightmap
+  // and useProbes are set per pass.
+  void Resolve(VisibilityResolveShaderProg *shader,
+               VisibilityDepthShaderProg *depthShader, const Camera *camera,
+               const bool probesReady, const int lightmapTextureUnit);
+
+  // Off, the opaque pass stays forward.
+  void SetEnabled(const bool on) { enabled = on; }
+  bool IsEnabled() const { return enabled; }
+  const VisibilityStats &GetStats() const { return stats; }
+  void WriteJson(JsonWriter &json) const;
+  void DrawDebugPanel();
+
+  // Renders slabs of 1 to 16 layers of cubes forward, deferred and from
+  // the visibility buffer with measure, at two resolutions, and writes the
+  // mean GPU time of each with the measured overdraw of the forward frame.
+  // removeCubes takes away what spawnCubes added. The slab is lit by
+  // benchmark lights in place of the scene's point and spot lights; turn
+  // the shadows off first, as their passes still draw object by object.
+  int RunHeadlessBenchmark(const HeadlessOptions &options,
+                           const std::string &contextApi, Scene *scene,
+                           const glm::mat4x4 &rootTransform,
+                           DeferredRenderer *deferredRenderer,
+                           ShadowAtlas *shadowAtlas,
+                           const GpuFrameTimer &measure,
+                           const CubeSpawner &spawnCubes,
+                           const std::function<void()> &removeCubes);
+
+ private:
+  // Objects of one submesh, draws [firstDraw, firstDraw + count).
+  struct Group {
+    TriangleMesh *mesh;
+    int subMesh;
+    int firstDraw;
+    int count;
+  };
+  // What a resolve pass binds; subMesh of mesh has the PhongMaterial.
+  struct Material {
+    TriangleMesh *mesh;
+    int subMesh;
+    Lightmap *lightmap;
+  };
+  // Where a mesh starts in the merged buffers.
+  struct MeshRange {
+    int baseVertex;
+    std::vector<int> firstIndices;
+  };
+  enum Buffer { Vertices, Indices, LightmapUVs, Draws, Objects, kNumBuffers };
+
+  // VisibilityBuffer Private Methods.
+  void Regroup(Scene *scene, const bool useLightmaps);
+  bool BuildGeometry();
+  void UploadObjects(const Scene *scene);
+  // Points the buffer texture at a new store of bytes, orphaning the old.
+  void Allocate(const Buffer buffer, const GLsizeiptr bytes,
+                const void *data);
+  bool MeshesChanged() const;
+  void Resize(const int width, const int height);
+  void ReleaseTargets();
+  void ReleaseGeometry();
+  void ReportMemory();
+
+  // VisibilityBuffer Private Data.
+  // Material k is drawn at depth 0.625 + (k + 1) / 2^15 (see
+  // visibility_fullscreen.vs), which stays below 0.75.
+  static const int kMaxMaterials = 4095;
+  // Units of the visibility target, its depth and the buffer textures;
+  // after the forward shader's units.
+  static const int kFirstTextureUnit = 6;
+
+  bool enabled = false;
+  bool dirty = true;
+  bool ready = false;
+  GLuint fboId = 0;
+  GLuint visibilityTexture = 0;
+  GLuint depthTexture = 0;
+  GLint prevFbo = 0;
+  GLuint buffers[kNumBuffers] = {};
+  GLuint bufferTextures[kNumBuffers] = {};
+  GLint maxTexels = 0;
+
+  // The meshes in the merged buffers and the (vertex, lightmap) buffers
+  // they were copied from.
+  std::vector<TriangleMesh *> meshes;
+  std::vector<glm::uvec2> meshBuffers;
+  std::unordered_map<const TriangleMesh *, MeshRange> ranges;
+  std::vector<Group> groups;
+  std::vector<Material> materials;
+  long long mergedBytes = 0;
+
+  // Inputs of the last Update.
+  size_t lastNumObjects = 0;
+  unsigned long long lastTransformVersion = 0;
+  bool lastUseLightmaps = false;
+
+  GpuTimer visibilityTimer;
+  GpuTimer resolveTimer;
+  VisibilityStats stats;
+};
+
+#endif
@@ -0,0 +1,330 @@
+// Loader benchmark: times each phase of TriangleMesh::LoadFromFile on the
+// homework 1 test models and on generated OBJ files, and writes the results
+// as JSON. The buffer phase times TriangleMesh::createBuffer on a hidden
+// offscreen context (EGL or OSMesa, no display server needed); without one
+// it is left out of the report.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "headless.h"
+#include "json_writer.h"
+#include "obj_generator.h"
+#include "timing.h"
+#include "trianglemesh.h"
+
+#ifndef LOADER_BENCH_FIXTURE_DIR
+#define LOADER_BENCH_FIXTURE_DIR "../homework1/TestModels_HW1"
+#endif
+
+namespace {
+
+using BenchClock = std::chrono::steady_clock;
+
+struct BenchOptions {
+  std::string outputPath = "loader_bench.json";
+  std::string fixtureDir = LOADER_BENCH_FIXTURE_DIR;
+  std::string workDir = "loader_bench_tmp";
+  long long maxTriangles = 1000000;
+  int repeat = 3;
+  bool keepFiles = false;
+  bool fixtures = true;
+  bool synthetic = true;
+};
+
+struct CaseResult {
+  std::string name;
+  std::string source;
+  std::string filePath;
+  long long fileBytes = 0;
+  double generateMs = 0.0;
+  bool loaded = false;
+
+  int vertices = 0;
+  int triangles = 0;
+  int subMeshes = 0;
+
+  // Best plain LoadFromFile time over the repeats.
+  double totalMs = 0.0;
+  // Phase breakdown from one extra run with detailed timing on.
+  MeshLoadStats phases;
+};
+
+void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  --output PATH         JSON report, '-' for stdout "
+               "(default loader_bench.json)\n"
+            << "  --fixtures DIR        Test models to load "
+               "(default homework1/TestModels_HW1)\n"
+            << "  --work-dir DIR        Where generated files go "
+               "(default loader_bench_tmp)\n"
+            << "  --max-triangles N     Largest generated size "
+               "(default 1000000, up to 50000000)\n"
+            << "  --repeat N            Timed loads per case (default 3)\n"
+            << "  --no-fixtures         Skip the test models\n"
+            << "  --no-synthetic        Skip the generated meshes\n"
+            << "  --keep-files          Do not delete generated files\n";
+}
+
+bool ParseCommandLine(int argc, char **argv, BenchOptions &options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--output" && hasValue) {
+      options.outputPath = argv[++i];
+    } else if (arg == "--fixtures" && hasValue) {
+      options.fixtureDir = argv[++i];
+    } else if (arg == "--work-dir" && hasValue) {
+      options.workDir = argv[++i];
+    } else if (arg == "--max-triangles" && hasValue) {
+      options.maxTriangles = std::atoll(argv[++i]);
+    } else if (arg == "--repeat" && hasValue) {
+      options.repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--no-fixtures") {
+      options.fixtures = false;
+    } else if (arg == "--no-synthetic") {
+      options.synthetic = false;
+    } else if (arg == "--keep-files") {
+      options.keepFiles = true;
+    } else {
+      PrintUsage(argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+// A hidden window with a GL 3.3 context on GLFW's null platform. Returns
+// the context API that worked, empty if there is none.
+std::string CreateBenchContext() {
+  glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+  if (!glfwInit()) {
+    std::cerr << "[WARNING] GLFW initialization failed" << std::endl;
+    return "";
+  }
+  std::string contextApi;
+  GLFWwindow *window = CreateOffscreenWindow(64, 64, contextApi);
+  if (window == nullptr) {
+    glfwTerminate();
+    return "";
+  }
+  glfwMakeContextCurrent(window);
+  glewExperimental = GL_TRUE;
+  GLenum res = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  // A GLX build of GLEW still loads the GL entry points under EGL/OSMesa.
+  if (res == GLEW_ERROR_NO_GLX_DISPLAY) {
+    res = GLEW_OK;
+  }
+#endif
+  if (res != GLEW_OK) {
+    std::cerr << "[WARNING] GLEW initialization error: "
+              << glewGetErrorString(res) << std::endl;
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return "";
+  }
+  // Core profile keeps the index buffer binding in a vertex array.
+  GLuint vao = 0;
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  return contextApi;
+}
+
+// createBuffer as the viewer calls it. glFinish on both sides, so the
+// driver's copies and uploads are inside the clock.
+double TimeBufferPhase(TriangleMesh &mesh) {
+  glFinish();
+  const BenchClock::time_point start = BenchClock::now();
+  mesh.createBuffer();
+  glFinish();
+  const double ms = MsSince(start);
+
+  // ~TriangleMesh clears the submeshes before it gets to their index
+  // buffers, which would pile up over the cases.
+  for (SubMesh &subMesh : mesh.getSubMeshes()) {
+    glDeleteBuffers(1, &subMesh.iboId);
+    subMesh.iboId = 0;
+  }
+  return ms;
+}
+
+void RunCase(const BenchOptions &options, const bool hasContext,
+             CaseResult &result) {
+  std::error_code error;
+  if (result.fileBytes == 0) {
+    result.fileBytes =
+        (long long)std::filesystem::file_size(result.filePath, error);
+  }
+
+  for (int r = 0; r < options.repeat; r++) {
+    TriangleMesh mesh;
+    if (!mesh.LoadFromFile(result.filePath, true)) return;
+    const double ms = mesh.GetLoadStats().totalMs;
+    if (r == 0 || ms < result.totalMs) result.totalMs = ms;
+  }
+
+  TriangleMesh mesh;
+  mesh.SetDetailedLoadTiming(true);
+  if (!mesh.LoadFromFile(result.filePath, true)) return;
+  result.phases = mesh.GetLoadStats();
+  if (hasContext) {
+    result.phases.bufferMs = TimeBufferPhase(mesh);
+  }
+
+  result.vertices = mesh.GetNumVertices();
+  result.triangles = mesh.GetNumTriangles();
+  result.subMeshes = mesh.GetNumSubMeshes();
+  result.loaded = true;
+
+  std::cerr << "[loader_bench] " << result.name << ": " << result.triangles
+            << " triangles, " << result.totalMs << " ms" << std::endl;
+}
+
+void WriteCase(JsonWriter &json, const bool hasContext,
+               const CaseResult &result) {
+  json.BeginObject();
+  json.Field("name", result.name);
+  json.Field("source", result.source);
+  json.Field("file", result.filePath);
+  json.Field("fileBytes", result.fileBytes);
+  json.Field("loaded", result.loaded);
+  if (result.source != "fixture") json.Field("generateMs", result.generateMs);
+  if (result.loaded) {
+    json.Field("vertices", result.vertices);
+    json.Field("triangles", result.triangles);
+    json.Field("subMeshes", result.subMeshes);
+    json.Field("totalMs", result.totalMs);
+    json.Field("trianglesPerSec",
+               result.totalMs > 0.0
+                   ? result.triangles / (result.totalMs / 1000.0)
+                   : 0.0);
+    json.Field("megabytesPerSec",
+               result.totalMs > 0.0 ? (result.fileBytes / 1048576.0) /
+                                          (result.totalMs / 1000.0)
+                                    : 0.0);
+    json.Key("phasesMs");
+    json.BeginObject();
+    json.Field("split", result.phases.splitMs);
+    json.Field("parse", result.phases.parseMs);
+    json.Field("dedup", result.phases.dedupMs);
+    json.Field("normalize", result.phases.normalizeMs);
+    if (hasContext) {
+      json.Field("buffer", result.phases.bufferMs);
+    }
+    // Includes the clock overhead of the detailed run.
+    json.Field("detailedTotal", result.phases.totalMs);
+    json.EndObject();
+  }
+  json.EndObject();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  if (!ParseCommandLine(argc, argv, options)) return 1;
+
+  const std::string contextApi = CreateBenchContext();
+  const bool hasContext = !contextApi.empty();
+  if (!hasContext) {
+    std::cerr << "[WARNING] No GL context, skipping the buffer phase"
+              << std::endl;
+  }
+
+  std::vector<CaseResult> results;
+
+  if (options.fixtures) {
+    std::error_code error;
+    if (!std::filesystem::is_directory(options.fixtureDir, error)) {
+      std::cerr << "[ERROR] Fixture directory " << options.fixtureDir
+                << " not found" << std::endl;
+    } else {
+      std::vector<std::string> files =
+          Utils::getFilesInDirectory(options.fixtureDir, ".obj");
+      std::sort(files.begin(), files.end());
+      for (const std::string &file : files) {
+        CaseResult result;
+        result.name = std::filesystem::path(file).stem().string();
+        result.source = "fixture";
+        result.filePath = file;
+        RunCase(options, hasContext, result);
+        results.push_back(result);
+      }
+    }
+  }
+
+  if (options.synthetic) {
+    const long long sizes[] = {10000LL, 100000LL, 1000000LL, 10000000LL,
+                               50000000LL};
+    const ObjGeneratorKind kinds[] = {ObjGeneratorKind::Grid,
+                                      ObjGeneratorKind::Soup,
+                                      ObjGeneratorKind::NGon};
+    std::filesystem::create_directories(options.workDir);
+    for (const long long size : sizes) {
+      if (size > options.maxTriangles) break;
+      for (const ObjGeneratorKind kind : kinds) {
+        CaseResult result;
+        result.source = ObjGeneratorName(kind);
+        result.name = result.source + "_" + std::to_string(size);
+        result.filePath =
+            (std::filesystem::path(options.workDir) / (result.name + ".obj"))
+                .generic_string();
+
+        ObjGeneratorResult generated;
+        const BenchClock::time_point start = BenchClock::now();
+        if (!GenerateObj(kind, size, result.filePath, generated)) {
+          results.push_back(result);
+          continue;
+        }
+        result.generateMs = MsSince(start);
+        result.fileBytes = generated.fileBytes;
+
+        RunCase(options, hasContext, result);
+        results.push_back(result);
+
+        if (!options.keepFiles) {
+          std::error_code error;
+          std::filesystem::remove(result.filePath, error);
+          std::filesystem::path mtl(result.filePath);
+          std::filesystem::remove(mtl.replace_extension(".mtl"), error);
+        }
+      }
+    }
+  }
+
+  std::ofstream file;
+  if (options.outputPath != "-") {
+    file.open(options.outputPath);
+    if (!file.is_open()) {
+      std::cerr << "[ERROR] Cannot write " << options.outputPath << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &out = options.outputPath == "-" ? std::cout : file;
+
+  JsonWriter json(out);
+  json.BeginObject();
+  json.Field("repeat", options.repeat);
+  json.Field("maxTriangles", options.maxTriangles);
+  json.Field("context", hasContext ? contextApi : std::string("none"));
+  json.Key("cases");
+  json.BeginArray();
+  for (const CaseResult &result : results) {
+    WriteCase(json, hasContext, result);
+  }
+  json.EndArray();
+  json.EndObject();
+  out << std::endl;
+
+  if (hasContext) {
+    glfwTerminate();
+  }
+  return 0;
+}
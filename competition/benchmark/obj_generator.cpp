@@ -0,0 +1,229 @@
+#include "obj_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+const float kPi = 3.14159265358979f;
+const int kMaterialCount = 64;
+const int kFacesPerMaterial = 16;
+
+// Buffered formatted output; the multi-gigabyte files are dominated by
+// formatting, so avoid iostreams.
+class ObjWriter {
+ public:
+  explicit ObjWriter(const std::string &filePath)
+      : file(std::fopen(filePath.c_str(), "wb")), used(0), written(0) {
+    buffer.resize(1 << 20);
+  }
+  ~ObjWriter() { Close(); }
+
+  bool IsOpen() const { return file != nullptr; }
+
+  template <typename... Args>
+  void Print(const char *format, Args... args) {
+    if (buffer.size() - used < 256) Flush();
+    const int n = std::snprintf(buffer.data() + used, buffer.size() - used,
+                                format, args...);
+    if (n > 0) used += (size_t)n;
+  }
+
+  long long Close() {
+    if (file) {
+      Flush();
+      std::fclose(file);
+      file = nullptr;
+    }
+    return written;
+  }
+
+ private:
+  void Flush() {
+    std::fwrite(buffer.data(), 1, used, file);
+    written += (long long)used;
+    used = 0;
+  }
+
+  std::FILE *file;
+  std::vector<char> buffer;
+  size_t used;
+  long long written;
+};
+
+void WriteGrid(ObjWriter &out, const long long targetTriangles,
+               ObjGeneratorResult &result) {
+  const long long quads = std::max(1LL, targetTriangles / 2);
+  const int cells = (int)std::ceil(std::sqrt((double)quads));
+  const int side = cells + 1;
+
+  out.Print("# Synthetic grid, %d x %d cells\n", cells, cells);
+  for (int j = 0; j < side; j++) {
+    for (int i = 0; i < side; i++) {
+      const float u = (float)i / (float)cells;
+      const float v = (float)j / (float)cells;
+      const float h =
+          0.05f * std::sin(u * 8.0f * kPi) * std::cos(v * 8.0f * kPi);
+      out.Print("v %.6f %.6f %.6f\n", u, h, v);
+    }
+  }
+  for (int j = 0; j < side; j++) {
+    for (int i = 0; i < side; i++) {
+      out.Print("vt %.6f %.6f\n", (float)i / (float)cells,
+                (float)j / (float)cells);
+    }
+  }
+  out.Print("vn 0.0 1.0 0.0\n");
+
+  long long emitted = 0;
+  for (int j = 0; j < cells && emitted < targetTriangles; j++) {
+    for (int i = 0; i < cells && emitted < targetTriangles; i++) {
+      const long long a = (long long)j * side + i + 1;
+      const long long b = a + 1;
+      const long long c = a + side;
+      const long long d = c + 1;
+      out.Print("f %lld/%lld/1 %lld/%lld/1 %lld/%lld/1\n", a, a, c, c, b, b);
+      out.Print("f %lld/%lld/1 %lld/%lld/1 %lld/%lld/1\n", b, b, c, c, d, d);
+      emitted += 2;
+      result.faces += 2;
+    }
+  }
+  result.triangles = emitted;
+  result.positions = (long long)side * side;
+}
+
+void WriteSoup(ObjWriter &out, const long long targetTriangles,
+               ObjGeneratorResult &result) {
+  std::mt19937 rng(1234u);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::uniform_real_distribution<float> offset(-0.01f, 0.01f);
+
+  out.Print("# Synthetic triangle soup, %lld triangles\n", targetTriangles);
+  for (long long t = 0; t < targetTriangles; t++) {
+    const float cx = unit(rng), cy = unit(rng), cz = unit(rng);
+    for (int k = 0; k < 3; k++) {
+      out.Print("v %.6f %.6f %.6f\n", cx + offset(rng), cy + offset(rng),
+                cz + offset(rng));
+    }
+    float nx = offset(rng), ny = offset(rng), nz = offset(rng) + 0.02f;
+    const float len = std::sqrt(nx * nx + ny * ny + nz * nz);
+    nx /= len;
+    ny /= len;
+    nz /= len;
+    out.Print("vn %.6f %.6f %.6f\n", nx, ny, nz);
+    const long long v = t * 3 + 1;
+    const long long n = t + 1;
+    out.Print("f %lld//%lld %lld//%lld %lld//%lld\n", v, n, v + 1, n, v + 2,
+              n);
+  }
+  result.triangles = targetTriangles;
+  result.faces = targetTriangles;
+  result.positions = targetTriangles * 3;
+}
+
+bool WriteNGonMaterials(const std::string &mtlPath) {
+  ObjWriter out(mtlPath);
+  if (!out.IsOpen()) return false;
+  for (int m = 0; m < kMaterialCount; m++) {
+    const float r = (float)(m % 4) / 3.0f;
+    const float g = (float)((m / 4) % 4) / 3.0f;
+    const float b = (float)(m / 16) / 3.0f;
+    out.Print("newmtl mat_%d\n", m);
+    out.Print("Ka 0.1 0.1 0.1\n");
+    out.Print("Kd %.3f %.3f %.3f\n", r, g, b);
+    out.Print("Ks 0.5 0.5 0.5\n");
+    out.Print("Ns %d\n\n", 8 + m);
+  }
+  return true;
+}
+
+void WriteNGons(ObjWriter &out, const std::string &mtlName,
+                const long long targetTriangles, ObjGeneratorResult &result) {
+  // Sides cycle 5..8, i.e. 4.5 triangles per face on average.
+  const long long faces = std::max(1LL, (targetTriangles * 2 + 8) / 9);
+  const int columns = (int)std::ceil(std::sqrt((double)faces));
+
+  out.Print("# Synthetic n-gons, %lld faces\n", faces);
+  out.Print("mtllib %s\n", mtlName.c_str());
+  out.Print("vn 0.0 0.0 1.0\n");
+
+  long long nextVertex = 1;
+  for (long long f = 0; f < faces; f++) {
+    if (f % kFacesPerMaterial == 0) {
+      out.Print("usemtl mat_%d\n",
+                (int)((f / kFacesPerMaterial) % kMaterialCount));
+      result.materialSwitches++;
+    }
+    const int sides = 5 + (int)(f % 4);
+    const float cx = (float)(f % columns);
+    const float cy = (float)(f / columns);
+    for (int k = 0; k < sides; k++) {
+      const float a = 2.0f * kPi * (float)k / (float)sides;
+      out.Print("v %.6f %.6f 0.0\n", cx + 0.4f * std::cos(a),
+                cy + 0.4f * std::sin(a));
+      out.Print("vt %.6f %.6f\n", 0.5f + 0.5f * std::cos(a),
+                0.5f + 0.5f * std::sin(a));
+    }
+    out.Print("f");
+    for (int k = 0; k < sides; k++) {
+      out.Print(" %lld/%lld/1", nextVertex + k, nextVertex + k);
+    }
+    out.Print("\n");
+    nextVertex += sides;
+    result.triangles += sides - 2;
+  }
+  result.faces = faces;
+  result.positions = nextVertex - 1;
+}
+
+}  // namespace
+
+const char *ObjGeneratorName(const ObjGeneratorKind kind) {
+  switch (kind) {
+    case ObjGeneratorKind::Grid:
+      return "grid";
+    case ObjGeneratorKind::Soup:
+      return "soup";
+    case ObjGeneratorKind::NGon:
+      return "ngon";
+  }
+  return "unknown";
+}
+
+bool GenerateObj(const ObjGeneratorKind kind, const long long targetTriangles,
+                 const std::string &filePath, ObjGeneratorResult &result) {
+  result = ObjGeneratorResult();
+  ObjWriter out(filePath);
+  if (!out.IsOpen()) {
+    std::cerr << "[ERROR] Cannot write " << filePath << std::endl;
+    return false;
+  }
+
+  switch (kind) {
+    case ObjGeneratorKind::Grid:
+      WriteGrid(out, targetTriangles, result);
+      break;
+    case ObjGeneratorKind::Soup:
+      WriteSoup(out, targetTriangles, result);
+      break;
+    case ObjGeneratorKind::NGon: {
+      const std::filesystem::path path(filePath);
+      const std::string mtlName = path.stem().string() + ".mtl";
+      const std::string mtlPath =
+          (path.parent_path() / mtlName).generic_string();
+      if (!WriteNGonMaterials(mtlPath)) {
+        std::cerr << "[ERROR] Cannot write " << mtlPath << std::endl;
+        return false;
+      }
+      WriteNGons(out, mtlName, targetTriangles, result);
+      break;
+    }
+  }
+  result.fileBytes = out.Close();
+  return true;
+}
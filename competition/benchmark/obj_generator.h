@@ -0,0 +1,35 @@
+#ifndef OBJ_GENERATOR_H
+#define OBJ_GENERATOR_H
+
+#include <string>
+
+// Shapes of synthetic meshes. Each one stresses a different part of the
+// OBJ loader.
+enum class ObjGeneratorKind {
+  // Regular height field; every vertex is shared by six triangles, so the
+  // dedup map mostly hits.
+  Grid,
+  // Independent random triangles; every face vertex is new, so the dedup
+  // map only inserts.
+  Soup,
+  // 5- to 8-sided polygons with a usemtl switch every few faces. Exercises
+  // polygon subdivision and submesh creation.
+  NGon,
+};
+
+struct ObjGeneratorResult {
+  long long triangles = 0;
+  long long positions = 0;
+  long long faces = 0;
+  int materialSwitches = 0;
+  long long fileBytes = 0;
+};
+
+const char *ObjGeneratorName(const ObjGeneratorKind kind);
+
+// Writes an OBJ file with roughly targetTriangles triangles (plus an .mtl
+// next to it for NGon). The output depends only on the arguments.
+bool GenerateObj(const ObjGeneratorKind kind, const long long targetTriangles,
+                 const std::string &filePath, ObjGeneratorResult &result);
+
+#endif
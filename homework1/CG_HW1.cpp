@@ -17,6 +17,7 @@
 
 // C++ STL headers.
 #include <algorithm>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
 #include <vector>
@@ -43,6 +44,7 @@ void ProcessKeysCB(unsigned char, int, int);
 void ProcessMenuEvents(int);
 void CreateGLUTMenus();
 void mouse(int, int, int, int);
+int RunTransformBenchmarks(const int);
 
 // Callback function for glutDisplayFunc.
 void RenderSceneCB() {
@@ -181,7 +183,39 @@ void SetupScene(const std::string &modelPath) {
   glutPostRedisplay();
 }
 
+// Check the CPU transform kernels against the scalar path and time them on
+// every test model, using the same MVP as SetupScene.
+int RunTransformBenchmarks(const int numVertices) {
+  glm::mat4x4 V = glm::lookAt(glm::vec3(0.0f, 0.5f, 2.0f),
+                              glm::vec3(0.0f, 0.0f, 0.0f),
+                              glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4x4 P = glm::perspective(
+      glm::radians(40.0f), (float)screenWidth / (float)screenHeight, 0.1f,
+      100.0f);
+  glm::mat4x4 MVP = P * V;
+
+  bool passed = true;
+  std::vector<std::string> files = getFilesInDirectory("TestModels_HW1");
+  std::sort(files.begin(), files.end());
+  for (const std::string &file : files) {
+    TriangleMesh model;
+    if (!model.LoadFromFile(file)) {
+      passed = false;
+      continue;
+    }
+    passed &= RunTransformBenchmark(model.GetPositionStream(), MVP,
+                                    numVertices);
+  }
+  return passed ? 0 : 1;
+}
+
 int main(int argc, char **argv) {
+  // --transform-bench [numVertices]: test and time the CPU transform, then
+  // exit without opening a window.
+  if (argc > 1 && std::string(argv[1]) == "--transform-bench") {
+    return RunTransformBenchmarks(argc > 2 ? std::atoi(argv[2]) : 4000000);
+  }
+
   // Setting window properties.
   glutInit(&argc, argv);
   glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
@@ -149,8 +149,9 @@ TriangleMesh::TriangleMesh() {
 TriangleMesh::~TriangleMesh() {
   vertices.clear();
   vertexIndices.clear();
-  glDeleteBuffers(1, &vboId);
-  glDeleteBuffers(1, &iboId);
+  // Meshes loaded for --transform-bench have no GL context or buffers.
+  if (vboId != 0) glDeleteBuffers(1, &vboId);
+  if (iboId != 0) glDeleteBuffers(1, &iboId);
 }
 
 // Desc: Load the geometry data of the model from file and normalize it.
@@ -229,6 +230,11 @@ bool TriangleMesh::LoadFromFile(const std::string& filePath,
   numVertices = vertices.size();
   numTriangles = vertexIndices.size() / 3;
 
+  positionStream.Resize(numVertices);
+  for (int i = 0; i < numVertices; ++i) {
+    positionStream.Set(i, vertices[i].position);
+  }
+
   PrintMeshInfo();
   return true;
 }
@@ -249,16 +255,12 @@ void TriangleMesh::CreateBuffers() {
                vertexIndices.data(), GL_STATIC_DRAW);
 }
 
-// Desc: Apply transformation to all vertices (DON'T NEED TO TOUCH)
+// Desc: Apply transformation to all vertices. Runs the SIMD kernels on the
+// SoA position stream and copies the result back into the vertices.
 void TriangleMesh::ApplyTransformCPU(const glm::mat4x4& mvpMatrix) {
+  TransformPositions(mvpMatrix, positionStream, positionStream);
   for (int i = 0; i < numVertices; ++i) {
-    glm::vec4 p = mvpMatrix * glm::vec4(vertices[i].position, 1.0f);
-    if (p.w != 0.0f) {
-      float inv = 1.0f / p.w;
-      vertices[i].position.x = p.x * inv;
-      vertices[i].position.y = p.y * inv;
-      vertices[i].position.z = p.z * inv;
-    }
+    vertices[i].position = positionStream.Get(i);
   }
 }
 
@@ -32,6 +32,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "VertexTransform.h"
+
 // VertexPTN Declarations.
 struct VertexPTN {
   VertexPTN() {
@@ -91,6 +93,9 @@ class TriangleMesh {
   // Apply transform on CPU.
   void ApplyTransformCPU(const glm::mat4x4& mvpMatrix);
 
+  // Vertex positions in SoA layout, kept in sync with the vertices.
+  const PositionStream& GetPositionStream() const { return positionStream; }
+
   int GetNumVertices() const { return numVertices; }
   int GetNumTriangles() const { return numTriangles; }
   int GetNumIndices() const { return (int)vertexIndices.size(); }
@@ -106,6 +111,7 @@ class TriangleMesh {
   GLuint iboId;
   std::vector<VertexPTN> vertices;
   std::vector<unsigned int> vertexIndices;
+  PositionStream positionStream;
 
   std::unordered_map<VertexPTN, unsigned int> uniqueVertices;
 
@@ -0,0 +1,292 @@
+#include "VertexTransform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define VERTEXTRANSFORM_AVX2 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define VERTEXTRANSFORM_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Vertices per thread below which splitting costs more than it saves.
+const int kChunkSize = 1 << 16;
+
+#if VERTEXTRANSFORM_AVX2
+// Compiled for AVX2 regardless of the build flags; only called after the
+// CPU check in HasAvx2.
+__attribute__((target("avx2,fma"))) void TransformAvx2(
+    const glm::mat4x4& m, const PositionStream& in, PositionStream& out,
+    const int begin, const int end) {
+  // glm is column-major: m[column][row].
+  const __m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]),
+               m02 = _mm256_set1_ps(m[0][2]), m03 = _mm256_set1_ps(m[0][3]);
+  const __m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]),
+               m12 = _mm256_set1_ps(m[1][2]), m13 = _mm256_set1_ps(m[1][3]);
+  const __m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]),
+               m22 = _mm256_set1_ps(m[2][2]), m23 = _mm256_set1_ps(m[2][3]);
+  const __m256 m30 = _mm256_set1_ps(m[3][0]), m31 = _mm256_set1_ps(m[3][1]),
+               m32 = _mm256_set1_ps(m[3][2]), m33 = _mm256_set1_ps(m[3][3]);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+
+  for (int i = begin; i < end; i += PositionStream::kLanes) {
+    const __m256 px = _mm256_loadu_ps(&in.x[i]);
+    const __m256 py = _mm256_loadu_ps(&in.y[i]);
+    const __m256 pz = _mm256_loadu_ps(&in.z[i]);
+
+    const __m256 cx = _mm256_fmadd_ps(
+        m00, px, _mm256_fmadd_ps(m10, py, _mm256_fmadd_ps(m20, pz, m30)));
+    const __m256 cy = _mm256_fmadd_ps(
+        m01, px, _mm256_fmadd_ps(m11, py, _mm256_fmadd_ps(m21, pz, m31)));
+    const __m256 cz = _mm256_fmadd_ps(
+        m02, px, _mm256_fmadd_ps(m12, py, _mm256_fmadd_ps(m22, pz, m32)));
+    const __m256 cw = _mm256_fmadd_ps(
+        m03, px, _mm256_fmadd_ps(m13, py, _mm256_fmadd_ps(m23, pz, m33)));
+
+    // Unordered compare so NaN w divides, as in the scalar path.
+    const __m256 divide = _mm256_cmp_ps(cw, zero, _CMP_NEQ_UQ);
+    const __m256 inv = _mm256_div_ps(one, cw);
+
+    _mm256_storeu_ps(&out.x[i],
+                     _mm256_blendv_ps(px, _mm256_mul_ps(cx, inv), divide));
+    _mm256_storeu_ps(&out.y[i],
+                     _mm256_blendv_ps(py, _mm256_mul_ps(cy, inv), divide));
+    _mm256_storeu_ps(&out.z[i],
+                     _mm256_blendv_ps(pz, _mm256_mul_ps(cz, inv), divide));
+  }
+}
+
+bool HasAvx2() {
+  static const bool hasAvx2 =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return hasAvx2;
+}
+#endif
+
+#if VERTEXTRANSFORM_NEON
+// One 8-vertex block is two 4-wide halves.
+void TransformNeon(const glm::mat4x4& m, const PositionStream& in,
+                   PositionStream& out, const int begin, const int end) {
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+
+  for (int i = begin; i < end; i += 4) {
+    const float32x4_t px = vld1q_f32(&in.x[i]);
+    const float32x4_t py = vld1q_f32(&in.y[i]);
+    const float32x4_t pz = vld1q_f32(&in.z[i]);
+
+    float32x4_t c[4];
+    for (int r = 0; r < 4; ++r) {
+      float32x4_t v = vdupq_n_f32(m[3][r]);
+      v = vfmaq_n_f32(v, pz, m[2][r]);
+      v = vfmaq_n_f32(v, py, m[1][r]);
+      c[r] = vfmaq_n_f32(v, px, m[0][r]);
+    }
+
+    // w == 0 keeps the input; NaN compares unequal and divides.
+    const uint32x4_t keep = vceqq_f32(c[3], zero);
+    const float32x4_t inv = vdivq_f32(one, c[3]);
+
+    vst1q_f32(&out.x[i], vbslq_f32(keep, px, vmulq_f32(c[0], inv)));
+    vst1q_f32(&out.y[i], vbslq_f32(keep, py, vmulq_f32(c[1], inv)));
+    vst1q_f32(&out.z[i], vbslq_f32(keep, pz, vmulq_f32(c[2], inv)));
+  }
+}
+#endif
+
+double SecondsSince(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Best of a few runs, in vertices per second.
+template <typename Func>
+double MeasureThroughput(const int numVertices, Func func) {
+  double best = 1e30;
+  for (int run = 0; run < 5; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    best = std::min(best, SecondsSince(start));
+  }
+  return best > 0.0 ? numVertices / best : 0.0;
+}
+
+// Largest difference between two streams, relative to the magnitude of the
+// reference value (absolute below 1).
+float MaxRelativeError(const PositionStream& reference,
+                       const PositionStream& other) {
+  float maxError = 0.0f;
+  for (int i = 0; i < reference.GetCount(); ++i) {
+    const glm::vec3 a = reference.Get(i);
+    const glm::vec3 b = other.Get(i);
+    for (int k = 0; k < 3; ++k) {
+      if (std::isnan(a[k]) && std::isnan(b[k])) continue;
+      const float scale = std::max(1.0f, std::fabs(a[k]));
+      maxError = std::max(maxError, std::fabs(a[k] - b[k]) / scale);
+    }
+  }
+  return maxError;
+}
+
+}  // namespace
+
+void PositionStream::Resize(const int newCount) {
+  count = newCount;
+  const int padded = (newCount + kLanes - 1) / kLanes * kLanes;
+  x.assign(padded, 0.0f);
+  y.assign(padded, 0.0f);
+  z.assign(padded, 0.0f);
+}
+
+void TransformPositionsScalar(const glm::mat4x4& matrix,
+                              const PositionStream& in, PositionStream& out,
+                              const int begin, const int end) {
+  for (int i = begin; i < end; ++i) {
+    const glm::vec3 position = in.Get(i);
+    glm::vec4 p = matrix * glm::vec4(position, 1.0f);
+    if (p.w != 0.0f) {
+      float inv = 1.0f / p.w;
+      out.Set(i, glm::vec3(p.x * inv, p.y * inv, p.z * inv));
+    } else {
+      out.Set(i, position);
+    }
+  }
+}
+
+void TransformPositionsSimd(const glm::mat4x4& matrix,
+                            const PositionStream& in, PositionStream& out,
+                            const int begin, const int end) {
+#if VERTEXTRANSFORM_AVX2
+  if (HasAvx2()) {
+    TransformAvx2(matrix, in, out, begin, end);
+    return;
+  }
+#elif VERTEXTRANSFORM_NEON
+  TransformNeon(matrix, in, out, begin, end);
+  return;
+#endif
+  TransformPositionsScalar(matrix, in, out, begin, end);
+}
+
+void TransformPositions(const glm::mat4x4& matrix, const PositionStream& in,
+                        PositionStream& out, const bool parallel) {
+  if (out.GetPaddedCount() != in.GetPaddedCount()) out.Resize(in.GetCount());
+
+  const int total = in.GetPaddedCount();
+  const int hardwareThreads = (int)std::thread::hardware_concurrency();
+  const int numThreads =
+      parallel ? std::max(1, std::min(hardwareThreads, total / kChunkSize))
+               : 1;
+  if (numThreads <= 1) {
+    TransformPositionsSimd(matrix, in, out, 0, total);
+    return;
+  }
+
+  // Chunks stay 8-aligned; the last one takes the remainder.
+  const int blocks = total / PositionStream::kLanes;
+  const int blocksPerThread = (blocks + numThreads - 1) / numThreads;
+  const int chunk = blocksPerThread * PositionStream::kLanes;
+  std::vector<std::thread> workers;
+  for (int t = 1; t < numThreads; ++t) {
+    const int begin = std::min(total, t * chunk);
+    const int end = std::min(total, (t + 1) * chunk);
+    if (begin >= end) break;
+    workers.emplace_back([&matrix, &in, &out, begin, end]() {
+      TransformPositionsSimd(matrix, in, out, begin, end);
+    });
+  }
+  TransformPositionsSimd(matrix, in, out, 0, std::min(total, chunk));
+  for (auto& worker : workers) worker.join();
+}
+
+const char* GetTransformKernelName() {
+#if VERTEXTRANSFORM_AVX2
+  return HasAvx2() ? "avx2" : "scalar";
+#elif VERTEXTRANSFORM_NEON
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+bool RunTransformBenchmark(const PositionStream& source,
+                           const glm::mat4x4& matrix, const int numVertices) {
+  if (source.GetCount() == 0 || numVertices <= 0) return false;
+
+  // Tile the model up to the requested size.
+  PositionStream in;
+  in.Resize(numVertices);
+  std::vector<glm::vec3> aos(numVertices);
+  for (int i = 0; i < numVertices; ++i) {
+    const glm::vec3 p = source.Get(i % source.GetCount());
+    in.Set(i, p);
+    aos[i] = p;
+  }
+  const int padded = in.GetPaddedCount();
+
+  // Correctness: every path against the scalar SoA loop.
+  PositionStream reference, simd, threaded;
+  reference.Resize(numVertices);
+  simd.Resize(numVertices);
+  threaded.Resize(numVertices);
+  TransformPositionsScalar(matrix, in, reference, 0, numVertices);
+  TransformPositionsSimd(matrix, in, simd, 0, padded);
+  TransformPositions(matrix, in, threaded, true);
+
+  // FMA and the order of the adds differ, so allow a few ulps.
+  const float tolerance = 1e-5f;
+  const float simdError = MaxRelativeError(reference, simd);
+  const float threadedError = MaxRelativeError(reference, threaded);
+  const bool passed = simdError <= tolerance && threadedError <= tolerance;
+
+  // Throughput. The AoS loop is what ApplyTransformCPU used to do.
+  std::vector<glm::vec3> aosOut(numVertices);
+  const double aosRate = MeasureThroughput(numVertices, [&]() {
+    for (int i = 0; i < numVertices; ++i) {
+      glm::vec4 p = matrix * glm::vec4(aos[i], 1.0f);
+      if (p.w != 0.0f) {
+        float inv = 1.0f / p.w;
+        aosOut[i] = glm::vec3(p.x * inv, p.y * inv, p.z * inv);
+      } else {
+        aosOut[i] = aos[i];
+      }
+    }
+  });
+  const double scalarRate = MeasureThroughput(numVertices, [&]() {
+    TransformPositionsScalar(matrix, in, reference, 0, numVertices);
+  });
+  const double simdRate = MeasureThroughput(numVertices, [&]() {
+    TransformPositionsSimd(matrix, in, simd, 0, padded);
+  });
+  const double threadedRate = MeasureThroughput(
+      numVertices, [&]() { TransformPositions(matrix, in, threaded, true); });
+
+  std::cout << "[*] Transform Benchmark: " << numVertices << " vertices, kernel "
+            << GetTransformKernelName() << ", "
+            << std::thread::hardware_concurrency() << " threads" << std::endl;
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "AoS scalar:        " << aosRate / 1e6 << " M vertices/s"
+            << std::endl;
+  std::cout << "SoA scalar:        " << scalarRate / 1e6 << " M vertices/s"
+            << std::endl;
+  std::cout << "SoA SIMD:          " << simdRate / 1e6 << " M vertices/s"
+            << std::endl;
+  std::cout << "SoA SIMD threaded: " << threadedRate / 1e6 << " M vertices/s"
+            << std::endl;
+  std::cout << std::defaultfloat;
+  std::cout << "Max relative error: SIMD " << simdError << ", threaded "
+            << threadedError << (passed ? " (OK)" : " (FAILED)") << std::endl;
+
+  return passed;
+}
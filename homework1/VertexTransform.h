@@ -0,0 +1,62 @@
+#ifndef VERTEXTRANSFORM_H
+#define VERTEXTRANSFORM_H
+
+#ifdef __APPLE__  // MacOS
+#include <glm/glm.hpp>
+#else
+#include <glm.hpp>
+#endif
+
+#include <vector>
+
+// PositionStream Declarations.
+// Positions in SoA layout (all x, then all y, then all z) so 8 vertices can
+// be loaded into one AVX2 register or two NEON registers. The arrays are
+// padded to a multiple of 8 so the kernels never need a scalar tail.
+struct PositionStream {
+  static const int kLanes = 8;
+
+  void Resize(const int count);
+  int GetCount() const { return count; }
+  int GetPaddedCount() const { return (int)x.size(); }
+
+  glm::vec3 Get(const int i) const { return glm::vec3(x[i], y[i], z[i]); }
+  void Set(const int i, const glm::vec3& p) {
+    x[i] = p.x;
+    y[i] = p.y;
+    z[i] = p.z;
+  }
+
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  int count = 0;
+};
+
+// Transforms in[begin, end) by the matrix and divides by w, writing to
+// out[begin, end). Positions whose w is 0 are copied unchanged, like
+// ApplyTransformCPU always did. in and out may be the same stream.
+void TransformPositionsScalar(const glm::mat4x4& matrix,
+                              const PositionStream& in, PositionStream& out,
+                              const int begin, const int end);
+// 8-wide version of the above; begin and end must be multiples of 8. Uses
+// AVX2+FMA when the CPU has it, NEON on AArch64, and the scalar loop
+// otherwise.
+void TransformPositionsSimd(const glm::mat4x4& matrix,
+                            const PositionStream& in, PositionStream& out,
+                            const int begin, const int end);
+// Whole stream, split into chunks over the hardware threads. Small streams
+// run on the calling thread.
+void TransformPositions(const glm::mat4x4& matrix, const PositionStream& in,
+                        PositionStream& out, const bool parallel = true);
+
+// "avx2", "neon" or "scalar".
+const char* GetTransformKernelName();
+
+// Checks the SIMD and multi-threaded paths against the scalar path on the
+// given positions (tiled up to numVertices) and prints vertices/sec for
+// each path. Returns false when the results differ.
+bool RunTransformBenchmark(const PositionStream& source,
+                           const glm::mat4x4& matrix, const int numVertices);
+
+#endif